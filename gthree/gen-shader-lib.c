@@ -0,0 +1,224 @@
+/* Expands the #includes of the library shaders in shader_lib/ with the
+ * chunks in shader_chunks/, strips comments, indentation and blank
+ * lines, and writes the results out as C strings, with the hash
+ * gthree_shader_hash() would compute for them.
+ *
+ * Usage: gen-shader-lib SRCDIR NAME... > gthreeshaderlib.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+} Buffer;
+
+static void
+buffer_append (Buffer *buffer, const char *s, size_t len)
+{
+  if (buffer->len + len + 1 > buffer->size)
+    {
+      buffer->size = (buffer->len + len + 1) * 2;
+      buffer->data = realloc (buffer->data, buffer->size);
+      if (buffer->data == NULL)
+        {
+          fprintf (stderr, "gen-shader-lib: out of memory\n");
+          exit (1);
+        }
+    }
+
+  memcpy (buffer->data + buffer->len, s, len);
+  buffer->len += len;
+  buffer->data[buffer->len] = 0;
+}
+
+static char *
+read_file (const char *srcdir, const char *subdir, const char *name)
+{
+  Buffer buffer = { NULL, 0, 0 };
+  char path[4096];
+  char chunk[4096];
+  size_t n;
+  FILE *f;
+
+  snprintf (path, sizeof (path), "%s/%s/%s", srcdir, subdir, name);
+  f = fopen (path, "r");
+  if (f == NULL)
+    {
+      fprintf (stderr, "gen-shader-lib: can't open %s\n", path);
+      exit (1);
+    }
+
+  buffer_append (&buffer, "", 0);
+  while ((n = fread (chunk, 1, sizeof (chunk), f)) > 0)
+    buffer_append (&buffer, chunk, n);
+
+  fclose (f);
+
+  return buffer.data;
+}
+
+/* Removes comments in place, in_comment carries over between lines */
+static void
+strip_comments (char *line, int *in_comment)
+{
+  char *in = line, *out = line;
+
+  while (*in)
+    {
+      if (*in_comment)
+        {
+          if (in[0] == '*' && in[1] == '/')
+            {
+              *in_comment = 0;
+              in += 2;
+            }
+          else
+            in++;
+        }
+      else if (in[0] == '/' && in[1] == '/')
+        break;
+      else if (in[0] == '/' && in[1] == '*')
+        {
+          *in_comment = 1;
+          in += 2;
+        }
+      else
+        *out++ = *in++;
+    }
+
+  *out = 0;
+}
+
+static void
+append_source (Buffer *out, const char *srcdir, const char *subdir, const char *name)
+{
+  char *text = read_file (srcdir, subdir, name);
+  char *line, *next, *start, *end;
+  int in_comment = 0;
+
+  for (line = text; line != NULL; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next)
+        *next++ = 0;
+
+      strip_comments (line, &in_comment);
+
+      start = line;
+      while (*start == ' ' || *start == '\t' || *start == '\r')
+        start++;
+      end = start + strlen (start);
+      while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        end--;
+      *end = 0;
+
+      if (*start == 0)
+        continue;
+
+      if (strncmp (start, "#include", strlen ("#include")) == 0)
+        {
+          char *file = strchr (start, '"');
+          char *file_end = file ? strchr (file + 1, '"') : NULL;
+
+          if (file_end == NULL)
+            {
+              fprintf (stderr, "gen-shader-lib: bad include in %s: %s\n", name, start);
+              exit (1);
+            }
+
+          *file_end = 0;
+          append_source (out, srcdir, "shader_chunks", file + 1);
+          continue;
+        }
+
+      buffer_append (out, start, end - start);
+      buffer_append (out, "\n", 1);
+    }
+
+  free (text);
+}
+
+/* Must match g_str_hash() */
+static unsigned int
+str_hash (const char *s)
+{
+  const signed char *p;
+  unsigned int h = 5381;
+
+  for (p = (const signed char *) s; *p != 0; p++)
+    h = (h << 5) + h + *p;
+
+  return h;
+}
+
+static void
+write_string (const char *name, const char *kind, const char *text)
+{
+  const char *p;
+
+  printf ("static const char %s_%s_shader[] =\n  \"", name, kind);
+
+  for (p = text; *p; p++)
+    {
+      switch (*p)
+        {
+        case '\n':
+          printf (p[1] ? "\\n\"\n  \"" : "\\n");
+          break;
+        case '\t':
+          printf ("\\t");
+          break;
+        case '"':
+        case '\\':
+          printf ("\\%c", *p);
+          break;
+        default:
+          putchar (*p);
+        }
+    }
+
+  printf ("\";\n\n");
+}
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  if (argc < 3)
+    {
+      fprintf (stderr, "Usage: gen-shader-lib SRCDIR NAME...\n");
+      return 1;
+    }
+
+  printf ("/* Generated by gen-shader-lib from shader_lib/ and shader_chunks/, do not edit */\n\n");
+
+  for (i = 2; i < argc; i++)
+    {
+      Buffer vertex = { NULL, 0, 0 };
+      Buffer fragment = { NULL, 0, 0 };
+      char file[1024];
+
+      buffer_append (&vertex, "", 0);
+      buffer_append (&fragment, "", 0);
+
+      snprintf (file, sizeof (file), "%s_vertex.glsl", argv[i]);
+      append_source (&vertex, argv[1], "shader_lib", file);
+      snprintf (file, sizeof (file), "%s_fragment.glsl", argv[i]);
+      append_source (&fragment, argv[1], "shader_lib", file);
+
+      write_string (argv[i], "vertex", vertex.data);
+      write_string (argv[i], "fragment", fragment.data);
+      printf ("#define %s_shader_hash 0x%08xu\n\n", argv[i],
+              str_hash (vertex.data) ^ str_hash (fragment.data));
+
+      free (vertex.data);
+      free (fragment.data);
+    }
+
+  return 0;
+}
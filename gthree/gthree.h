@@ -15,9 +15,14 @@
 #include <gthree/gthreegeometry.h>
 #include <gthree/gthreematerial.h>
 #include <gthree/gthreemesh.h>
+#include <gthree/gthreeinstancedmesh.h>
+#include <gthree/gthreestaticbatch.h>
+#include <gthree/gthreelod.h>
 #include <gthree/gthreemultimaterial.h>
 #include <gthree/gthreeobject.h>
 #include <gthree/gthreerenderer.h>
+#include <gthree/gthreerendertarget.h>
+#include <gthree/gthreeheadlesscontext.h>
 #include <gthree/gthreescene.h>
 #include <gthree/gthreetexture.h>
 #include <gthree/gthreecubetexture.h>
@@ -3,11 +3,19 @@
 #include "gthreearea.h"
 #include "gthreerenderer.h"
 #include "gthreemarshalers.h"
+#include "gthreeprivate.h"
+
+/* How often the stats text is redrawn, in microseconds */
+#define STATS_UPDATE_INTERVAL 500000
 
 typedef struct {
   GthreeRenderer *renderer;
   GthreeScene *scene;
   GthreeCamera *camera;
+
+  gboolean show_stats;
+  gint64 stats_update_time;
+  float gpu_total; /* Or negative if not known */
 } GthreeAreaPrivate;
 
 enum {
@@ -16,6 +24,7 @@ enum {
   PROP_SCENE,
   PROP_CAMERA,
   PROP_RENDERER,
+  PROP_SHOW_STATS,
 
   N_PROPS
 };
@@ -59,6 +68,10 @@ gthree_area_set_property (GObject *obj,
       gthree_area_set_camera (area, g_value_get_object (value));
       break;
 
+    case PROP_SHOW_STATS:
+      gthree_area_set_show_stats (area, g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
     }
@@ -87,6 +100,10 @@ gthree_area_get_property (GObject *obj,
       g_value_set_object (value, priv->renderer);
       break;
 
+    case PROP_SHOW_STATS:
+      g_value_set_boolean (value, priv->show_stats);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
     }
@@ -160,12 +177,95 @@ gthree_area_class_init (GthreeAreaClass *klass)
                          GTHREE_TYPE_RENDERER,
                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  obj_props[PROP_SHOW_STATS] =
+    g_param_spec_boolean ("show-stats", "Show stats", "Show render stats",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
   g_object_class_install_properties (gobject_class, N_PROPS, obj_props);
 }
 
 static void
 gthree_area_init (GthreeArea *area)
 {
+  GthreeAreaPrivate *priv = gthree_area_get_instance_private (area);
+
+  priv->gpu_total = -1;
+}
+
+static void
+frame_stats_cb (GthreeRenderer          *renderer,
+                const GthreeRenderStats *stats,
+                GthreeArea              *area)
+{
+  GthreeAreaPrivate *priv = gthree_area_get_instance_private (area);
+
+  if (stats->has_gpu_time)
+    priv->gpu_total = stats->gpu_total;
+}
+
+static void
+update_stats_overlay (GthreeArea *area)
+{
+  GthreeAreaPrivate *priv = gthree_area_get_instance_private (area);
+  const GthreeRenderStats *stats = gthree_renderer_get_render_stats (priv->renderer);
+  char *uniform_size = g_format_size (stats->uniform_upload_bytes);
+  char *buffer_size = g_format_size (stats->buffer_upload_bytes);
+  char *texture_size = g_format_size (stats->texture_upload_bytes);
+  GString *text = g_string_new ("");
+  PangoLayout *layout;
+  PangoFontDescription *font;
+  PangoRectangle extents;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  g_string_append_printf (text, "Draw calls: %d\n", stats->n_draw_calls);
+  g_string_append_printf (text, "Triangles: %d  Lines: %d\n", stats->n_triangles, stats->n_lines);
+  g_string_append_printf (text, "Objects: %d drawn, %d culled\n", stats->n_objects_drawn, stats->n_objects_culled);
+  g_string_append_printf (text, "Programs: %d  Materials: %d\n", stats->n_program_switches, stats->n_material_switches);
+  g_string_append_printf (text, "Binds: %d buffers, %d textures\n", stats->n_buffer_binds, stats->n_texture_binds);
+  g_string_append_printf (text, "Uniforms: %d, %s\n", stats->n_uniform_uploads, uniform_size);
+  g_string_append_printf (text, "Uploads: %s buffers, %s textures\n", buffer_size, texture_size);
+  if (stats->n_depth_prepass_objects > 0 && stats->depth_prepass_samples > 0)
+    g_string_append_printf (text, "Pre-pass: %d objects, %.0f%% shading saved\n",
+                            stats->n_depth_prepass_objects,
+                            100.0 * (1.0 - (double) stats->depth_prepass_shaded_samples / stats->depth_prepass_samples));
+  if (stats->n_pending_programs > 0)
+    g_string_append_printf (text, "Compiling: %d objects\n", stats->n_pending_programs);
+  g_string_append_printf (text, "CPU: %.2f ms", stats->cpu_total);
+  if (priv->gpu_total >= 0)
+    g_string_append_printf (text, "  GPU: %.2f ms", priv->gpu_total);
+
+  /* Measure first, on a scratch surface */
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 1, 1);
+  cr = cairo_create (surface);
+  layout = pango_cairo_create_layout (cr);
+  font = pango_font_description_from_string ("Monospace 9");
+  pango_layout_set_font_description (layout, font);
+  pango_font_description_free (font);
+  pango_layout_set_text (layout, text->str, -1);
+  pango_layout_get_pixel_extents (layout, NULL, &extents);
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, extents.width + 8, extents.height + 8);
+  cr = cairo_create (surface);
+  cairo_set_source_rgba (cr, 0, 0, 0, 0.6);
+  cairo_paint (cr);
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_move_to (cr, 4 - extents.x, 4 - extents.y);
+  pango_cairo_update_layout (cr, layout);
+  pango_cairo_show_layout (cr, layout);
+  cairo_destroy (cr);
+
+  gthree_renderer_update_overlay (priv->renderer, surface);
+
+  cairo_surface_destroy (surface);
+  g_object_unref (layout);
+  g_string_free (text, TRUE);
+  g_free (uniform_size);
+  g_free (buffer_size);
+  g_free (texture_size);
 }
 
 static gboolean
@@ -181,6 +281,23 @@ gthree_area_render (GtkGLArea    *gl_area,
                             priv->camera,
                             FALSE);
 
+  /* Draw again until the placeholders are replaced */
+  if (gthree_renderer_get_render_stats (priv->renderer)->n_pending_programs > 0)
+    gtk_widget_queue_draw (GTK_WIDGET (area));
+
+  if (priv->show_stats)
+    {
+      gint64 now = g_get_monotonic_time ();
+
+      if (now - priv->stats_update_time >= STATS_UPDATE_INTERVAL)
+        {
+          update_stats_overlay (area);
+          priv->stats_update_time = now;
+        }
+
+      gthree_renderer_draw_overlay (priv->renderer);
+    }
+
   return TRUE;
 }
 
@@ -196,6 +313,11 @@ gthree_area_realize (GtkWidget *widget)
   gtk_gl_area_make_current (glarea);
 
   priv->renderer = gthree_renderer_new ();
+  g_signal_connect (priv->renderer, "frame-stats", G_CALLBACK (frame_stats_cb), area);
+  /* New materials showing up shouldn't drop frames */
+  gthree_renderer_set_async_compile (priv->renderer, TRUE);
+  if (priv->show_stats)
+    gthree_renderer_set_timing (priv->renderer, TRUE);
 }
 
 static void
@@ -208,6 +330,8 @@ gthree_area_unrealize (GtkWidget *widget)
     gthree_scene_set_context (priv->scene, NULL);
 
   g_clear_object (&priv->renderer);
+  priv->stats_update_time = 0;
+  priv->gpu_total = -1;
 
   GTK_WIDGET_CLASS (gthree_area_parent_class)->unrealize (widget);
 }
@@ -268,3 +392,38 @@ gthree_area_get_camera (GthreeArea *area)
 
   return priv->camera;
 }
+
+/* Draws the counters and times of the last render on top of it. This
+ * turns on timing in the renderer, which costs a little. */
+void
+gthree_area_set_show_stats (GthreeArea *area,
+                            gboolean    show_stats)
+{
+  GthreeAreaPrivate *priv = gthree_area_get_instance_private (area);
+
+  show_stats = !!show_stats;
+  if (priv->show_stats == show_stats)
+    return;
+
+  priv->show_stats = show_stats;
+  priv->stats_update_time = 0;
+
+  if (priv->renderer)
+    {
+      gtk_gl_area_make_current (GTK_GL_AREA (area));
+      gthree_renderer_set_timing (priv->renderer, show_stats);
+      if (!show_stats)
+        gthree_renderer_update_overlay (priv->renderer, NULL);
+    }
+
+  gtk_widget_queue_draw (GTK_WIDGET (area));
+  g_object_notify_by_pspec (G_OBJECT (area), obj_props[PROP_SHOW_STATS]);
+}
+
+gboolean
+gthree_area_get_show_stats (GthreeArea *area)
+{
+  GthreeAreaPrivate *priv = gthree_area_get_instance_private (area);
+
+  return priv->show_stats;
+}
@@ -38,6 +38,9 @@ GthreeCamera *gthree_area_get_camera (GthreeArea *area);
 void gthree_area_set_camera (GthreeArea *area,
                              GthreeCamera *camera);
 GthreeRenderer *gthree_area_get_renderer (GthreeArea *area);
+void gthree_area_set_show_stats (GthreeArea *area,
+                                 gboolean show_stats);
+gboolean gthree_area_get_show_stats (GthreeArea *area);
 
 G_END_DECLS
 
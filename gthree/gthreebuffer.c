@@ -3,6 +3,11 @@
 
 #include "gthreebufferprivate.h"
 
+typedef struct {
+  GthreeVertexArrayFlags flags;
+  guint name;
+} VertexArrayObject;
+
 G_DEFINE_TYPE (GthreeBuffer, gthree_buffer, G_TYPE_OBJECT)
 
 GthreeBuffer *
@@ -14,12 +19,48 @@ gthree_buffer_new (void)
 static void
 gthree_buffer_init (GthreeBuffer *buffer)
 {
+  static guint next_id = 1;
+
+  buffer->id = next_id++;
+  buffer->vertex_array_objects = g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+static void
+delete_vertex_array_objects (GArray *vaos)
+{
+  int i;
+
+  for (i = 0; i < vaos->len; i++)
+    glDeleteVertexArrays (1, &g_array_index (vaos, VertexArrayObject, i).name);
+  g_array_free (vaos, TRUE);
+}
+
+static void
+program_finalized (gpointer  data,
+                   GObject  *where_the_program_was)
+{
+  GthreeBuffer *buffer = data;
+  GArray *vaos;
+
+  vaos = g_hash_table_lookup (buffer->vertex_array_objects, where_the_program_was);
+  g_hash_table_remove (buffer->vertex_array_objects, where_the_program_was);
+  delete_vertex_array_objects (vaos);
 }
 
 static void
 gthree_buffer_finalize (GObject *obj)
 {
   GthreeBuffer *buffer = GTHREE_BUFFER (obj);
+  GHashTableIter iter;
+  gpointer program, vaos;
+
+  g_hash_table_iter_init (&iter, buffer->vertex_array_objects);
+  while (g_hash_table_iter_next (&iter, &program, &vaos))
+    {
+      g_object_weak_unref (program, program_finalized, buffer);
+      delete_vertex_array_objects (vaos);
+    }
+  g_hash_table_destroy (buffer->vertex_array_objects);
 
   if (buffer->vertex_buffer)
     glDeleteBuffers (1, &buffer->vertex_buffer);
@@ -43,6 +84,46 @@ gthree_buffer_finalize (GObject *obj)
   G_OBJECT_CLASS (gthree_buffer_parent_class)->finalize (obj);
 }
 
+/* The vertex array objects capture the attribute layout of a program
+ * and the element buffer, so they are keyed on both, plus the flags
+ * for which optional attributes are enabled. They are deleted with the
+ * program or the buffer, whichever goes first.
+ */
+guint
+gthree_buffer_get_vertex_array_object (GthreeBuffer           *buffer,
+                                       GthreeProgram          *program,
+                                       GthreeVertexArrayFlags  flags,
+                                       gboolean               *created)
+{
+  VertexArrayObject vao;
+  GArray *vaos;
+  int i;
+
+  vaos = g_hash_table_lookup (buffer->vertex_array_objects, program);
+  if (vaos == NULL)
+    {
+      vaos = g_array_new (FALSE, FALSE, sizeof (VertexArrayObject));
+      g_hash_table_insert (buffer->vertex_array_objects, program, vaos);
+      g_object_weak_ref (G_OBJECT (program), program_finalized, buffer);
+    }
+
+  for (i = 0; i < vaos->len; i++)
+    {
+      if (g_array_index (vaos, VertexArrayObject, i).flags == flags)
+        {
+          *created = FALSE;
+          return g_array_index (vaos, VertexArrayObject, i).name;
+        }
+    }
+
+  vao.flags = flags;
+  glGenVertexArrays (1, &vao.name);
+  g_array_append_val (vaos, vao);
+  *created = TRUE;
+
+  return vao.name;
+}
+
 static void
 gthree_buffer_class_init (GthreeBufferClass *klass)
 {
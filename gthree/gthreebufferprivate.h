@@ -3,6 +3,7 @@
 
 #include <gthreeobject.h>
 #include <gthreematerial.h>
+#include <gthreeprogram.h>
 
 G_BEGIN_DECLS
 
@@ -16,6 +17,7 @@ G_BEGIN_DECLS
 typedef struct {
   GObject parent;
 
+  guint id;
   gint material_index;
 
   guint vertex_buffer;
@@ -31,8 +33,22 @@ typedef struct {
   guint line_buffer;
   guint line_count;
 
+  /* Object space bounds, for buffers that only cover part of the object */
+  gboolean has_bounding_sphere;
+  graphene_sphere_t bounding_sphere;
+
+  /* program -> GArray of VertexArrayObject, see gthreebuffer.c */
+  GHashTable *vertex_array_objects;
 } GthreeBuffer;
 
+/* What a vertex array object records besides the buffer and program */
+typedef enum {
+  GTHREE_VERTEX_ARRAY_WIREFRAME = 1 << 0,
+  GTHREE_VERTEX_ARRAY_COLOR     = 1 << 1,
+  GTHREE_VERTEX_ARRAY_UV        = 1 << 2,
+  GTHREE_VERTEX_ARRAY_UV2       = 1 << 3,
+} GthreeVertexArrayFlags;
+
 typedef struct {
   GObjectClass parent_class;
 
@@ -42,6 +58,11 @@ GType gthree_buffer_get_type (void) G_GNUC_CONST;
 
 GthreeBuffer *gthree_buffer_new (void);
 
+guint gthree_buffer_get_vertex_array_object (GthreeBuffer           *buffer,
+                                             GthreeProgram          *program,
+                                             GthreeVertexArrayFlags  flags,
+                                             gboolean               *created);
+
 G_END_DECLS
 
 #endif /* __GTHREE_BUFFER_H__ */
@@ -110,6 +110,7 @@ gthree_cube_texture_real_load (GthreeTexture *texture, int slot)
 	    {
               glTexImage2D (GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, gl_format, width, height, 0, gl_format, gl_type,
                             gdk_pixbuf_get_pixels (cube_pixbufs[i]));
+              gthree_render_stats_add_texture_upload (gdk_pixbuf_get_byte_length (cube_pixbufs[i]));
 	      
 	    }
 #ifdef TODO
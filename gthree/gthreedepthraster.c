@@ -0,0 +1,442 @@
+#include <math.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "gthreedepthrasterprivate.h"
+#include "gthreemesh.h"
+
+/* Geometry in front of the near plane, where the GPU would clip it, is
+ * not rasterized, and volumes that reach it are never occluded. This
+ * also keeps w away from zero. */
+#define NEAR_W 1e-5f
+
+#define ROWS_PER_BAND 16
+
+typedef struct {
+  float x[3], y[3], z[3]; /* pixels, pixels, ndc */
+} ScreenTriangle;
+
+typedef struct {
+  GthreeDepthRaster *raster;
+  int first_row;
+  int n_rows;
+} Band;
+
+struct _GthreeDepthRaster {
+  int width; /* multiple of 4 */
+  int height;
+  float *depth;
+
+  graphene_matrix_t proj_screen_matrix;
+  GPtrArray *occluders; /* GthreeMesh */
+  GArray *triangles; /* ScreenTriangle */
+  Band *bands;
+  int n_bands;
+
+  GThreadPool *pool;
+  GMutex lock;
+  GCond done;
+  int pending;
+};
+
+static void raster_thread_func (gpointer data,
+                                gpointer user_data);
+
+GthreeDepthRaster *
+gthree_depth_raster_new (int width,
+                         int height)
+{
+  GthreeDepthRaster *raster = g_new0 (GthreeDepthRaster, 1);
+  int i;
+
+  raster->width = (width + 3) & ~3;
+  raster->height = height;
+  raster->depth = g_new (float, raster->width * raster->height);
+  raster->occluders = g_ptr_array_new ();
+  raster->triangles = g_array_new (FALSE, FALSE, sizeof (ScreenTriangle));
+
+  raster->n_bands = (height + ROWS_PER_BAND - 1) / ROWS_PER_BAND;
+  raster->bands = g_new (Band, raster->n_bands);
+  for (i = 0; i < raster->n_bands; i++)
+    {
+      raster->bands[i].raster = raster;
+      raster->bands[i].first_row = i * ROWS_PER_BAND;
+      raster->bands[i].n_rows = MIN (ROWS_PER_BAND, height - i * ROWS_PER_BAND);
+    }
+
+  raster->pool = g_thread_pool_new (raster_thread_func, raster,
+                                    MIN (g_get_num_processors (), raster->n_bands),
+                                    FALSE, NULL);
+  g_mutex_init (&raster->lock);
+  g_cond_init (&raster->done);
+
+  return raster;
+}
+
+void
+gthree_depth_raster_free (GthreeDepthRaster *raster)
+{
+  gthree_depth_raster_wait (raster);
+
+  g_thread_pool_free (raster->pool, FALSE, TRUE);
+  g_mutex_clear (&raster->lock);
+  g_cond_clear (&raster->done);
+  g_ptr_array_free (raster->occluders, TRUE);
+  g_array_free (raster->triangles, TRUE);
+  g_free (raster->bands);
+  g_free (raster->depth);
+  g_free (raster);
+}
+
+int
+gthree_depth_raster_get_width (GthreeDepthRaster *raster)
+{
+  return raster->width;
+}
+
+int
+gthree_depth_raster_get_height (GthreeDepthRaster *raster)
+{
+  return raster->height;
+}
+
+static void
+job_done (GthreeDepthRaster *raster)
+{
+  g_mutex_lock (&raster->lock);
+  if (--raster->pending == 0)
+    g_cond_signal (&raster->done);
+  g_mutex_unlock (&raster->lock);
+}
+
+/* Returns FALSE if the point is in front of the near plane, or behind
+ * the eye */
+static gboolean
+project_point (GthreeDepthRaster *raster,
+               const graphene_matrix_t *m,
+               float x, float y, float z,
+               float *sx, float *sy, float *sz)
+{
+  graphene_vec4_t v;
+  float w;
+
+  graphene_vec4_init (&v, x, y, z, 1);
+  graphene_matrix_transform_vec4 (m, &v, &v);
+
+  w = graphene_vec4_get_w (&v);
+  if (w < NEAR_W || graphene_vec4_get_z (&v) < -w)
+    return FALSE;
+
+  *sx = (graphene_vec4_get_x (&v) / w * 0.5f + 0.5f) * raster->width;
+  *sy = (0.5f - graphene_vec4_get_y (&v) / w * 0.5f) * raster->height;
+  *sz = graphene_vec4_get_z (&v) / w;
+
+  return TRUE;
+}
+
+static void
+setup_triangles (GthreeDepthRaster *raster)
+{
+  int i, j, k;
+
+  g_array_set_size (raster->triangles, 0);
+
+  for (i = 0; i < raster->occluders->len; i++)
+    {
+      GthreeMesh *mesh = g_ptr_array_index (raster->occluders, i);
+      GthreeGeometry *geometry = gthree_mesh_get_geometry (mesh);
+      const graphene_vec3_t *vertices;
+      graphene_matrix_t m;
+      float *screen;
+      gboolean *valid;
+      int n_vertices, n_faces;
+
+      if (geometry == NULL)
+        continue;
+
+      graphene_matrix_multiply (gthree_object_get_world_matrix (GTHREE_OBJECT (mesh)),
+                                &raster->proj_screen_matrix, &m);
+
+      n_vertices = gthree_geometry_get_n_vertices (geometry);
+      n_faces = gthree_geometry_get_n_faces (geometry);
+      vertices = gthree_geometry_get_vertices (geometry);
+
+      screen = g_new (float, n_vertices * 3);
+      valid = g_new (gboolean, n_vertices);
+      for (j = 0; j < n_vertices; j++)
+        valid[j] = project_point (raster, &m,
+                                  graphene_vec3_get_x (&vertices[j]),
+                                  graphene_vec3_get_y (&vertices[j]),
+                                  graphene_vec3_get_z (&vertices[j]),
+                                  &screen[j * 3], &screen[j * 3 + 1], &screen[j * 3 + 2]);
+
+      for (j = 0; j < n_faces; j++)
+        {
+          int index[3];
+          ScreenTriangle t;
+
+          index[0] = gthree_geometry_face_get_a (geometry, j);
+          index[1] = gthree_geometry_face_get_b (geometry, j);
+          index[2] = gthree_geometry_face_get_c (geometry, j);
+
+          /* Dropping an occluder triangle is always safe, clipping it
+             is not worth it */
+          if (!valid[index[0]] || !valid[index[1]] || !valid[index[2]])
+            continue;
+
+          for (k = 0; k < 3; k++)
+            {
+              t.x[k] = screen[index[k] * 3];
+              t.y[k] = screen[index[k] * 3 + 1];
+              t.z[k] = screen[index[k] * 3 + 2];
+            }
+
+          if (MAX (t.x[0], MAX (t.x[1], t.x[2])) < 0 ||
+              MIN (t.x[0], MIN (t.x[1], t.x[2])) > raster->width ||
+              MAX (t.y[0], MAX (t.y[1], t.y[2])) < 0 ||
+              MIN (t.y[0], MIN (t.y[1], t.y[2])) > raster->height ||
+              MIN (t.z[0], MIN (t.z[1], t.z[2])) > 1)
+            continue;
+
+          g_array_append_val (raster->triangles, t);
+        }
+
+      g_free (screen);
+      g_free (valid);
+    }
+}
+
+static void
+raster_triangle (GthreeDepthRaster *raster,
+                 const ScreenTriangle *t,
+                 int first_row,
+                 int last_row)
+{
+  float a[3], b[3], c[3];
+  float area, inv_area, zx, zy, zc;
+  int min_x, max_x, min_y, max_y, x, y, i;
+
+  min_y = MAX (first_row, (int) floorf (MIN (t->y[0], MIN (t->y[1], t->y[2]))));
+  max_y = MIN (last_row, (int) ceilf (MAX (t->y[0], MAX (t->y[1], t->y[2]))));
+  if (min_y > max_y)
+    return;
+
+  min_x = MAX (0, (int) floorf (MIN (t->x[0], MIN (t->x[1], t->x[2]))));
+  max_x = MIN (raster->width - 1, (int) ceilf (MAX (t->x[0], MAX (t->x[1], t->x[2]))));
+  if (min_x > max_x)
+    return;
+
+  /* Edge i is opposite vertex i: e_i(x, y) = a_i * x + b_i * y + c_i */
+  for (i = 0; i < 3; i++)
+    {
+      int v1 = (i + 1) % 3, v2 = (i + 2) % 3;
+
+      a[i] = t->y[v1] - t->y[v2];
+      b[i] = t->x[v2] - t->x[v1];
+      c[i] = -(a[i] * t->x[v1] + b[i] * t->y[v1]);
+    }
+
+  area = a[0] * t->x[0] + b[0] * t->y[0] + c[0];
+  if (fabsf (area) < 1e-8f)
+    return;
+
+  /* Occluders are drawn from both sides */
+  if (area < 0)
+    for (i = 0; i < 3; i++)
+      {
+        a[i] = -a[i];
+        b[i] = -b[i];
+        c[i] = -c[i];
+      }
+
+  inv_area = 1.0f / fabsf (area);
+  zx = (a[0] * t->z[0] + a[1] * t->z[1] + a[2] * t->z[2]) * inv_area;
+  zy = (b[0] * t->z[0] + b[1] * t->z[1] + b[2] * t->z[2]) * inv_area;
+  zc = (c[0] * t->z[0] + c[1] * t->z[1] + c[2] * t->z[2]) * inv_area;
+
+  min_x &= ~3;
+
+  for (y = min_y; y <= max_y; y++)
+    {
+      float py = y + 0.5f;
+      float *row = raster->depth + y * raster->width;
+#ifdef __SSE2__
+      __m128 offsets = _mm_setr_ps (0.5f, 1.5f, 2.5f, 3.5f);
+      __m128 zero = _mm_setzero_ps ();
+      __m128 a0 = _mm_set1_ps (a[0]), a1 = _mm_set1_ps (a[1]), a2 = _mm_set1_ps (a[2]);
+      __m128 r0 = _mm_set1_ps (b[0] * py + c[0]);
+      __m128 r1 = _mm_set1_ps (b[1] * py + c[1]);
+      __m128 r2 = _mm_set1_ps (b[2] * py + c[2]);
+      __m128 vzx = _mm_set1_ps (zx);
+      __m128 rz = _mm_set1_ps (zy * py + zc);
+
+      for (x = min_x; x <= max_x; x += 4)
+        {
+          __m128 px = _mm_add_ps (_mm_set1_ps ((float) x), offsets);
+          __m128 e0 = _mm_add_ps (_mm_mul_ps (a0, px), r0);
+          __m128 e1 = _mm_add_ps (_mm_mul_ps (a1, px), r1);
+          __m128 e2 = _mm_add_ps (_mm_mul_ps (a2, px), r2);
+          __m128 inside = _mm_and_ps (_mm_and_ps (_mm_cmpge_ps (e0, zero),
+                                                  _mm_cmpge_ps (e1, zero)),
+                                      _mm_cmpge_ps (e2, zero));
+          __m128 z, depth;
+
+          if (_mm_movemask_ps (inside) == 0)
+            continue;
+
+          z = _mm_add_ps (_mm_mul_ps (vzx, px), rz);
+          depth = _mm_loadu_ps (row + x);
+          depth = _mm_or_ps (_mm_and_ps (inside, _mm_min_ps (depth, z)),
+                             _mm_andnot_ps (inside, depth));
+          _mm_storeu_ps (row + x, depth);
+        }
+#else
+      for (x = min_x; x <= max_x; x++)
+        {
+          float px = x + 0.5f;
+
+          if (a[0] * px + b[0] * py + c[0] >= 0 &&
+              a[1] * px + b[1] * py + c[1] >= 0 &&
+              a[2] * px + b[2] * py + c[2] >= 0)
+            row[x] = MIN (row[x], zx * px + zy * py + zc);
+        }
+#endif
+    }
+}
+
+static void
+raster_band (Band *band)
+{
+  GthreeDepthRaster *raster = band->raster;
+  int last_row = band->first_row + band->n_rows - 1;
+  int i;
+
+  for (i = band->first_row * raster->width; i < (last_row + 1) * raster->width; i++)
+    raster->depth[i] = 1.0f;
+
+  for (i = 0; i < raster->triangles->len; i++)
+    raster_triangle (raster, &g_array_index (raster->triangles, ScreenTriangle, i),
+                     band->first_row, last_row);
+}
+
+/* The first job sets up the triangles, then hands out the bands */
+static void
+raster_thread_func (gpointer data,
+                    gpointer user_data)
+{
+  GthreeDepthRaster *raster = user_data;
+  int i;
+
+  if (data == raster)
+    {
+      setup_triangles (raster);
+      for (i = 0; i < raster->n_bands; i++)
+        g_thread_pool_push (raster->pool, &raster->bands[i], NULL);
+    }
+  else
+    raster_band (data);
+
+  job_done (raster);
+}
+
+/* Starts rasterizing the occluders, the meshes and their geometries
+ * must not change until gthree_depth_raster_wait() returns. */
+void
+gthree_depth_raster_begin (GthreeDepthRaster       *raster,
+                           const graphene_matrix_t *proj_screen_matrix,
+                           GPtrArray               *occluders)
+{
+  int i;
+
+  gthree_depth_raster_wait (raster);
+
+  raster->proj_screen_matrix = *proj_screen_matrix;
+  g_ptr_array_set_size (raster->occluders, 0);
+  for (i = 0; i < occluders->len; i++)
+    g_ptr_array_add (raster->occluders, g_ptr_array_index (occluders, i));
+
+  raster->pending = 1 + raster->n_bands;
+  g_thread_pool_push (raster->pool, raster, NULL);
+}
+
+void
+gthree_depth_raster_wait (GthreeDepthRaster *raster)
+{
+  g_mutex_lock (&raster->lock);
+  while (raster->pending > 0)
+    g_cond_wait (&raster->done, &raster->lock);
+  g_mutex_unlock (&raster->lock);
+}
+
+/* Conservative: only returns TRUE if the bounding box of the sphere is
+ * behind the occluders at every pixel it covers. */
+gboolean
+gthree_depth_raster_is_occluded (GthreeDepthRaster       *raster,
+                                 const graphene_sphere_t *sphere)
+{
+  graphene_point3d_t center;
+  float radius, min_x, max_x, min_y, max_y, min_z;
+  int x0, x1, y0, y1, x, y, i;
+
+  graphene_sphere_get_center (sphere, &center);
+  radius = graphene_sphere_get_radius (sphere);
+
+  min_x = min_y = min_z = G_MAXFLOAT;
+  max_x = max_y = -G_MAXFLOAT;
+
+  for (i = 0; i < 8; i++)
+    {
+      float sx, sy, sz;
+
+      if (!project_point (raster, &raster->proj_screen_matrix,
+                          center.x + ((i & 1) ? radius : -radius),
+                          center.y + ((i & 2) ? radius : -radius),
+                          center.z + ((i & 4) ? radius : -radius),
+                          &sx, &sy, &sz))
+        return FALSE;
+
+      min_x = MIN (min_x, sx);
+      max_x = MAX (max_x, sx);
+      min_y = MIN (min_y, sy);
+      max_y = MAX (max_y, sy);
+      min_z = MIN (min_z, sz);
+    }
+
+  x0 = MAX (0, (int) floorf (min_x));
+  x1 = MIN (raster->width - 1, (int) ceilf (max_x));
+  y0 = MAX (0, (int) floorf (min_y));
+  y1 = MIN (raster->height - 1, (int) ceilf (max_y));
+
+  /* Off screen, that is for the frustum culling to decide */
+  if (x0 > x1 || y0 > y1)
+    return FALSE;
+
+  for (y = y0; y <= y1; y++)
+    {
+      const float *row = raster->depth + y * raster->width;
+#ifdef __SSE2__
+      __m128 lane = _mm_setr_ps (0, 1, 2, 3);
+      __m128 first = _mm_set1_ps ((float) x0);
+      __m128 last = _mm_set1_ps ((float) x1);
+      __m128 z = _mm_set1_ps (min_z);
+
+      for (x = x0 & ~3; x <= x1; x += 4)
+        {
+          __m128 px = _mm_add_ps (_mm_set1_ps ((float) x), lane);
+          __m128 in_rect = _mm_and_ps (_mm_cmpge_ps (px, first), _mm_cmple_ps (px, last));
+
+          /* Any covered pixel with the occluders not in front */
+          if (_mm_movemask_ps (_mm_and_ps (in_rect, _mm_cmpge_ps (_mm_loadu_ps (row + x), z))))
+            return FALSE;
+        }
+#else
+      for (x = x0; x <= x1; x++)
+        if (row[x] >= min_z)
+          return FALSE;
+#endif
+    }
+
+  return TRUE;
+}
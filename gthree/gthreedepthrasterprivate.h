@@ -0,0 +1,27 @@
+#ifndef __GTHREE_DEPTH_RASTER_PRIVATE_H__
+#define __GTHREE_DEPTH_RASTER_PRIVATE_H__
+
+#include <gthree/gthreeobject.h>
+
+G_BEGIN_DECLS
+
+/* A small CPU depth buffer that occluder meshes are rasterized into on
+ * worker threads, to test bounding volumes against without a GPU round
+ * trip. Depths are in normalized device coordinates. */
+typedef struct _GthreeDepthRaster GthreeDepthRaster;
+
+GthreeDepthRaster *gthree_depth_raster_new         (int                      width,
+                                                    int                      height);
+void               gthree_depth_raster_free        (GthreeDepthRaster       *raster);
+int                gthree_depth_raster_get_width   (GthreeDepthRaster       *raster);
+int                gthree_depth_raster_get_height  (GthreeDepthRaster       *raster);
+void               gthree_depth_raster_begin       (GthreeDepthRaster       *raster,
+                                                    const graphene_matrix_t *proj_screen_matrix,
+                                                    GPtrArray               *occluders);
+void               gthree_depth_raster_wait        (GthreeDepthRaster       *raster);
+gboolean           gthree_depth_raster_is_occluded (GthreeDepthRaster       *raster,
+                                                    const graphene_sphere_t *sphere);
+
+G_END_DECLS
+
+#endif /* __GTHREE_DEPTH_RASTER_PRIVATE_H__ */
@@ -7,6 +7,8 @@
 typedef struct {
   float intensity;
   GthreeObject *target;
+  float shadow_camera_width;
+  float shadow_camera_height;
 } GthreeDirectionalLightPrivate;
 
 enum {
@@ -39,6 +41,8 @@ gthree_directional_light_init (GthreeDirectionalLight *directional)
   graphene_point3d_t pos = {0, 1, 0};
   
   priv->intensity = 1;
+  priv->shadow_camera_width = 10;
+  priv->shadow_camera_height = 10;
 
   priv->target = g_object_ref_sink (gthree_object_new ());
   
@@ -85,6 +89,32 @@ gthree_directional_light_get_target (GthreeDirectionalLight *directional)
   return priv->target;
 }
 
+/* The size of the area around the target covered by the shadow map,
+ * in world units */
+void
+gthree_directional_light_set_shadow_camera_size (GthreeDirectionalLight *directional,
+                                                 float width,
+                                                 float height)
+{
+  GthreeDirectionalLightPrivate *priv = gthree_directional_light_get_instance_private (directional);
+
+  priv->shadow_camera_width = width;
+  priv->shadow_camera_height = height;
+}
+
+void
+gthree_directional_light_get_shadow_camera_size (GthreeDirectionalLight *directional,
+                                                 float *width,
+                                                 float *height)
+{
+  GthreeDirectionalLightPrivate *priv = gthree_directional_light_get_instance_private (directional);
+
+  if (width)
+    *width = priv->shadow_camera_width;
+  if (height)
+    *height = priv->shadow_camera_height;
+}
+
 static void
 gthree_directional_light_finalize (GObject *obj)
 {
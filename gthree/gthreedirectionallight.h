@@ -35,6 +35,12 @@ float gthree_directional_light_get_intensity (GthreeDirectionalLight *directiona
 void gthree_directional_light_set_target (GthreeDirectionalLight *directional,
                                           GthreeObject *target);
 GthreeObject *gthree_directional_light_get_target (GthreeDirectionalLight *directional);
+void gthree_directional_light_set_shadow_camera_size (GthreeDirectionalLight *directional,
+                                                      float width,
+                                                      float height);
+void gthree_directional_light_get_shadow_camera_size (GthreeDirectionalLight *directional,
+                                                      float *width,
+                                                      float *height);
 
 G_END_DECLS
 
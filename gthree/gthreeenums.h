@@ -77,6 +77,22 @@ typedef enum {
   GTHREE_MAPPING_SPHERICAL_REFRACTION,
 } GthreeMapping;
 
+typedef enum {
+  GTHREE_RENDER_PHASE_UPDATE_MATRICES,
+  GTHREE_RENDER_PHASE_REALIZE,
+  GTHREE_RENDER_PHASE_PROJECT,
+  GTHREE_RENDER_PHASE_SORT,
+  GTHREE_RENDER_PHASE_OPAQUE,
+  GTHREE_RENDER_PHASE_TRANSPARENT,
+  GTHREE_N_RENDER_PHASES
+} GthreeRenderPhase;
+
+typedef enum {
+  GTHREE_SHADOW_MAP_BASIC,
+  GTHREE_SHADOW_MAP_PCF,
+  GTHREE_SHADOW_MAP_PCF_SOFT,
+} GthreeShadowMapType;
+
 G_END_DECLS
 
 #endif /* __GTHREE_ENUM_H__ */
@@ -0,0 +1,858 @@
+#include <math.h>
+#include <string.h>
+
+#include "gthreegeometry.h"
+
+/* Quadric error metric simplification, as in Garland & Heckbert. Edges
+ * are collapsed into one of their end points, so no new attributes have
+ * to be made up. Vertices on a border, a uv seam or between materials
+ * may only move along that line, and only if every face keeps a
+ * matching uv, color and material afterwards. */
+
+#define LOCKED_EDGE_WEIGHT 100.0
+
+typedef struct {
+  double q[10]; /* xx xy xz xw yy yz yw zz zw ww */
+} Quadric;
+
+typedef struct {
+  int v[3];
+  int corner[3]; /* Index into the corners of the source geometry */
+  int material_index;
+  gboolean removed;
+} SFace;
+
+typedef struct {
+  double cost;
+  int vertex;
+  int target;
+  guint stamp;
+} HeapEntry;
+
+typedef struct {
+  GthreeGeometry *source;
+  int n_vertices;
+  graphene_vec3_t *positions;
+  Quadric *quadrics;
+  GArray **vertex_faces; /* int, per vertex */
+  guint *stamps;
+  gboolean *removed;
+
+  GArray *faces; /* SFace */
+  int n_live_faces;
+
+  /* Per source corner */
+  graphene_vec2_t *uv;
+  graphene_vec2_t *uv2;
+  GdkRGBA *colors;
+
+  GArray *heap; /* HeapEntry */
+} Simplifier;
+
+static void
+quadric_add_plane (Quadric *quadric,
+                   double a, double b, double c, double d,
+                   double weight)
+{
+  double *q = quadric->q;
+
+  q[0] += weight * a * a;
+  q[1] += weight * a * b;
+  q[2] += weight * a * c;
+  q[3] += weight * a * d;
+  q[4] += weight * b * b;
+  q[5] += weight * b * c;
+  q[6] += weight * b * d;
+  q[7] += weight * c * c;
+  q[8] += weight * c * d;
+  q[9] += weight * d * d;
+}
+
+static void
+quadric_add (Quadric *dest,
+             const Quadric *src)
+{
+  int i;
+
+  for (i = 0; i < 10; i++)
+    dest->q[i] += src->q[i];
+}
+
+static double
+quadric_eval (const Quadric *quadric,
+              const graphene_vec3_t *p)
+{
+  const double *q = quadric->q;
+  double x = graphene_vec3_get_x (p);
+  double y = graphene_vec3_get_y (p);
+  double z = graphene_vec3_get_z (p);
+
+  return
+    x * x * q[0] + 2 * x * y * q[1] + 2 * x * z * q[2] + 2 * x * q[3] +
+    y * y * q[4] + 2 * y * z * q[5] + 2 * y * q[6] +
+    z * z * q[7] + 2 * z * q[8] +
+    q[9];
+}
+
+static void
+face_normal (const graphene_vec3_t *a,
+             const graphene_vec3_t *b,
+             const graphene_vec3_t *c,
+             graphene_vec3_t *normal)
+{
+  graphene_vec3_t ab, ac;
+
+  graphene_vec3_subtract (b, a, &ab);
+  graphene_vec3_subtract (c, a, &ac);
+  graphene_vec3_cross (&ab, &ac, normal);
+}
+
+static void
+heap_push (GArray *heap,
+           HeapEntry *entry)
+{
+  int i = heap->len;
+
+  g_array_append_val (heap, *entry);
+
+  while (i > 0)
+    {
+      int parent = (i - 1) / 2;
+      HeapEntry tmp;
+
+      if (g_array_index (heap, HeapEntry, parent).cost <= g_array_index (heap, HeapEntry, i).cost)
+        break;
+
+      tmp = g_array_index (heap, HeapEntry, parent);
+      g_array_index (heap, HeapEntry, parent) = g_array_index (heap, HeapEntry, i);
+      g_array_index (heap, HeapEntry, i) = tmp;
+      i = parent;
+    }
+}
+
+static gboolean
+heap_pop (GArray *heap,
+          HeapEntry *entry)
+{
+  HeapEntry *e = (HeapEntry *)heap->data;
+  int n, i;
+
+  if (heap->len == 0)
+    return FALSE;
+
+  *entry = e[0];
+  e[0] = e[heap->len - 1];
+  g_array_set_size (heap, heap->len - 1);
+  e = (HeapEntry *)heap->data;
+  n = heap->len;
+
+  i = 0;
+  while (TRUE)
+    {
+      int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+      HeapEntry tmp;
+
+      if (l < n && e[l].cost < e[smallest].cost)
+        smallest = l;
+      if (r < n && e[r].cost < e[smallest].cost)
+        smallest = r;
+      if (smallest == i)
+        break;
+
+      tmp = e[i];
+      e[i] = e[smallest];
+      e[smallest] = tmp;
+      i = smallest;
+    }
+
+  return TRUE;
+}
+
+static int
+face_slot (SFace *face,
+           int vertex)
+{
+  int i;
+
+  for (i = 0; i < 3; i++)
+    if (face->v[i] == vertex)
+      return i;
+
+  return -1;
+}
+
+static gboolean
+corners_match (Simplifier *s,
+               int a,
+               int b)
+{
+  if (s->uv && !graphene_vec2_equal (&s->uv[a], &s->uv[b]))
+    return FALSE;
+  if (s->uv2 && !graphene_vec2_equal (&s->uv2[a], &s->uv2[b]))
+    return FALSE;
+  if (s->colors && !gdk_rgba_equal (&s->colors[a], &s->colors[b]))
+    return FALSE;
+  return TRUE;
+}
+
+/* Adds the vertices sharing a live face with v to neighbours, once each */
+static void
+collect_neighbours (Simplifier *s,
+                    int v,
+                    GArray *neighbours)
+{
+  GArray *ring = s->vertex_faces[v];
+  int i, j, k;
+
+  g_array_set_size (neighbours, 0);
+
+  for (i = 0; i < ring->len; i++)
+    {
+      SFace *face = &g_array_index (s->faces, SFace, g_array_index (ring, int, i));
+
+      for (j = 0; j < 3; j++)
+        {
+          int w = face->v[j];
+
+          if (w == v)
+            continue;
+
+          for (k = 0; k < neighbours->len; k++)
+            if (g_array_index (neighbours, int, k) == w)
+              break;
+
+          if (k == neighbours->len)
+            g_array_append_val (neighbours, w);
+        }
+    }
+}
+
+/* An edge is locked if it is a border, or the faces on either side
+ * disagree on material or on the attributes of an end point */
+static gboolean
+edge_is_locked (Simplifier *s,
+                int v,
+                int w)
+{
+  GArray *ring = s->vertex_faces[v];
+  SFace *shared[2];
+  int n_shared = 0;
+  int i;
+
+  for (i = 0; i < ring->len; i++)
+    {
+      SFace *face = &g_array_index (s->faces, SFace, g_array_index (ring, int, i));
+
+      if (face_slot (face, w) < 0)
+        continue;
+
+      if (n_shared == 2)
+        return TRUE;
+      shared[n_shared++] = face;
+    }
+
+  if (n_shared != 2)
+    return TRUE;
+
+  if (shared[0]->material_index != shared[1]->material_index)
+    return TRUE;
+
+  return
+    !corners_match (s,
+                    shared[0]->corner[face_slot (shared[0], v)],
+                    shared[1]->corner[face_slot (shared[1], v)]) ||
+    !corners_match (s,
+                    shared[0]->corner[face_slot (shared[0], w)],
+                    shared[1]->corner[face_slot (shared[1], w)]);
+}
+
+/* Checks whether v can be collapsed into u and if so returns the cost,
+ * or a negative value if not */
+static double
+collapse_cost (Simplifier *s,
+               int v,
+               int u,
+               GArray *v_neighbours,
+               GArray *u_neighbours)
+{
+  GArray *ring = s->vertex_faces[v];
+  int n_locked = 0;
+  gboolean uv_locked = FALSE;
+  int n_collapsing = 0;
+  Quadric q;
+  int i, j;
+
+  /* Vertices on a locked line may only slide along it */
+  for (i = 0; i < v_neighbours->len; i++)
+    {
+      int w = g_array_index (v_neighbours, int, i);
+
+      if (edge_is_locked (s, v, w))
+        {
+          n_locked++;
+          if (w == u)
+            uv_locked = TRUE;
+        }
+    }
+
+  if (n_locked != 0 && (n_locked != 2 || !uv_locked))
+    return -1;
+
+  /* Link condition, the only shared neighbours may be the opposite
+   * corners of the faces that collapse, or the mesh becomes non-manifold */
+  collect_neighbours (s, u, u_neighbours);
+  for (i = 0; i < v_neighbours->len; i++)
+    {
+      int w = g_array_index (v_neighbours, int, i);
+      gboolean shared = FALSE, opposite = FALSE;
+
+      if (w == u)
+        continue;
+
+      for (j = 0; j < u_neighbours->len; j++)
+        if (g_array_index (u_neighbours, int, j) == w)
+          shared = TRUE;
+
+      if (!shared)
+        continue;
+
+      for (j = 0; j < ring->len; j++)
+        {
+          SFace *face = &g_array_index (s->faces, SFace, g_array_index (ring, int, j));
+          if (face_slot (face, u) >= 0 && face_slot (face, w) >= 0)
+            opposite = TRUE;
+        }
+
+      if (!opposite)
+        return -1;
+    }
+
+  for (i = 0; i < ring->len; i++)
+    {
+      SFace *face = &g_array_index (s->faces, SFace, g_array_index (ring, int, i));
+      int slot = face_slot (face, v);
+      graphene_vec3_t before, after;
+      const graphene_vec3_t *p[3];
+      gboolean matched = FALSE;
+      float len;
+
+      if (face_slot (face, u) >= 0)
+        {
+          n_collapsing++;
+          continue;
+        }
+
+      /* Every remaining face needs u's attributes from its own side */
+      for (j = 0; j < ring->len; j++)
+        {
+          SFace *other = &g_array_index (s->faces, SFace, g_array_index (ring, int, j));
+
+          if (face_slot (other, u) >= 0 &&
+              other->material_index == face->material_index &&
+              corners_match (s, other->corner[face_slot (other, v)], face->corner[slot]))
+            matched = TRUE;
+        }
+
+      if (!matched)
+        return -1;
+
+      /* Don't flip faces over */
+      for (j = 0; j < 3; j++)
+        p[j] = &s->positions[face->v[j]];
+      face_normal (p[0], p[1], p[2], &before);
+      p[slot] = &s->positions[u];
+      face_normal (p[0], p[1], p[2], &after);
+
+      len = graphene_vec3_length (&after);
+      if (len < 1e-12 ||
+          graphene_vec3_dot (&before, &after) < 0.2 * graphene_vec3_length (&before) * len)
+        return -1;
+    }
+
+  if (n_collapsing == 0)
+    return -1;
+
+  q = s->quadrics[v];
+  quadric_add (&q, &s->quadrics[u]);
+
+  return MAX (quadric_eval (&q, &s->positions[u]), 0);
+}
+
+static void
+update_vertex (Simplifier *s,
+               int v,
+               GArray *v_neighbours,
+               GArray *u_neighbours)
+{
+  HeapEntry entry;
+  int i;
+
+  s->stamps[v]++;
+
+  if (s->removed[v])
+    return;
+
+  entry.cost = -1;
+  entry.vertex = v;
+  entry.target = -1;
+  entry.stamp = s->stamps[v];
+
+  collect_neighbours (s, v, v_neighbours);
+  for (i = 0; i < v_neighbours->len; i++)
+    {
+      int u = g_array_index (v_neighbours, int, i);
+      double cost = collapse_cost (s, v, u, v_neighbours, u_neighbours);
+
+      if (cost >= 0 && (entry.target < 0 || cost < entry.cost))
+        {
+          entry.cost = cost;
+          entry.target = u;
+        }
+    }
+
+  if (entry.target >= 0)
+    heap_push (s->heap, &entry);
+}
+
+static void
+remove_face_from_vertex (Simplifier *s,
+                         int v,
+                         int face_index)
+{
+  GArray *ring = s->vertex_faces[v];
+  int i;
+
+  for (i = 0; i < ring->len; i++)
+    {
+      if (g_array_index (ring, int, i) == face_index)
+        {
+          g_array_remove_index_fast (ring, i);
+          return;
+        }
+    }
+}
+
+static void
+collapse (Simplifier *s,
+          int v,
+          int u)
+{
+  GArray *ring = s->vertex_faces[v];
+  int i, j;
+
+  /* First move the remaining faces over, while the collapsing ones are
+   * still around to take u's attributes from */
+  for (i = 0; i < ring->len; i++)
+    {
+      int face_index = g_array_index (ring, int, i);
+      SFace *face = &g_array_index (s->faces, SFace, face_index);
+      int slot = face_slot (face, v);
+
+      if (face_slot (face, u) >= 0)
+        continue;
+
+      for (j = 0; j < ring->len; j++)
+        {
+          SFace *other = &g_array_index (s->faces, SFace, g_array_index (ring, int, j));
+
+          /* Faces moved already reference u but no longer v */
+          if (face_slot (other, u) >= 0 && face_slot (other, v) >= 0 &&
+              other->material_index == face->material_index &&
+              corners_match (s, other->corner[face_slot (other, v)], face->corner[slot]))
+            {
+              face->corner[slot] = other->corner[face_slot (other, u)];
+              break;
+            }
+        }
+
+      face->v[slot] = u;
+      g_array_append_val (s->vertex_faces[u], face_index);
+    }
+
+  for (i = 0; i < ring->len; i++)
+    {
+      int face_index = g_array_index (ring, int, i);
+      SFace *face = &g_array_index (s->faces, SFace, face_index);
+
+      /* The moved faces now reference u twice, if at all */
+      if (face_slot (face, v) < 0)
+        continue;
+
+      face->removed = TRUE;
+      s->n_live_faces--;
+
+      for (j = 0; j < 3; j++)
+        if (face->v[j] != v)
+          remove_face_from_vertex (s, face->v[j], face_index);
+    }
+
+  g_array_set_size (ring, 0);
+  s->removed[v] = TRUE;
+  quadric_add (&s->quadrics[u], &s->quadrics[v]);
+}
+
+static void
+simplifier_init (Simplifier *s,
+                 GthreeGeometry *source)
+{
+  int n_faces = gthree_geometry_get_n_faces (source);
+  int n_corners = n_faces * 3;
+  int i, j;
+
+  memset (s, 0, sizeof (Simplifier));
+
+  s->source = source;
+  s->n_vertices = gthree_geometry_get_n_vertices (source);
+  s->positions = g_memdup (gthree_geometry_get_vertices (source), s->n_vertices * sizeof (graphene_vec3_t));
+  s->quadrics = g_new0 (Quadric, s->n_vertices);
+  s->vertex_faces = g_new (GArray *, s->n_vertices);
+  s->stamps = g_new0 (guint, s->n_vertices);
+  s->removed = g_new0 (gboolean, s->n_vertices);
+  s->faces = g_array_sized_new (FALSE, FALSE, sizeof (SFace), n_faces);
+  s->heap = g_array_new (FALSE, FALSE, sizeof (HeapEntry));
+
+  for (i = 0; i < s->n_vertices; i++)
+    s->vertex_faces[i] = g_array_new (FALSE, FALSE, sizeof (int));
+
+  /* uvs are stored per face corner, see gthreegeometrygroup.c */
+  if (gthree_geometry_get_n_uv (source) >= n_corners)
+    s->uv = g_memdup (gthree_geometry_get_uvs (source), n_corners * sizeof (graphene_vec2_t));
+  if (gthree_geometry_get_n_uv2 (source) >= n_corners)
+    s->uv2 = g_memdup (gthree_geometry_get_uv2s (source), n_corners * sizeof (graphene_vec2_t));
+
+  for (i = 0; i < n_faces; i++)
+    {
+      const GdkRGBA *c[3];
+
+      if (!gthree_geometry_face_get_vertex_colors (source, i, &c[0], &c[1], &c[2]))
+        continue;
+
+      if (s->colors == NULL)
+        s->colors = g_new0 (GdkRGBA, n_corners);
+
+      for (j = 0; j < 3; j++)
+        s->colors[i * 3 + j] = *c[j];
+    }
+
+  for (i = 0; i < n_faces; i++)
+    {
+      SFace face;
+      graphene_vec3_t normal;
+      int index = s->faces->len;
+
+      face.v[0] = gthree_geometry_face_get_a (source, i);
+      face.v[1] = gthree_geometry_face_get_b (source, i);
+      face.v[2] = gthree_geometry_face_get_c (source, i);
+      face.material_index = gthree_geometry_face_get_material_index (source, i);
+      face.removed = FALSE;
+
+      if (face.v[0] == face.v[1] || face.v[1] == face.v[2] || face.v[0] == face.v[2])
+        continue;
+
+      for (j = 0; j < 3; j++)
+        face.corner[j] = i * 3 + j;
+
+      g_array_append_val (s->faces, face);
+      s->n_live_faces++;
+
+      for (j = 0; j < 3; j++)
+        g_array_append_val (s->vertex_faces[face.v[j]], index);
+
+      face_normal (&s->positions[face.v[0]], &s->positions[face.v[1]], &s->positions[face.v[2]], &normal);
+      if (graphene_vec3_length (&normal) < 1e-12)
+        continue;
+      graphene_vec3_normalize (&normal, &normal);
+
+      for (j = 0; j < 3; j++)
+        quadric_add_plane (&s->quadrics[face.v[j]],
+                           graphene_vec3_get_x (&normal),
+                           graphene_vec3_get_y (&normal),
+                           graphene_vec3_get_z (&normal),
+                           -graphene_vec3_dot (&normal, &s->positions[face.v[j]]),
+                           1.0);
+    }
+
+  /* Planes perpendicular to the locked edges keep borders and seams in place */
+  for (i = 0; i < s->faces->len; i++)
+    {
+      SFace *face = &g_array_index (s->faces, SFace, i);
+      graphene_vec3_t normal, edge, perp;
+
+      face_normal (&s->positions[face->v[0]], &s->positions[face->v[1]], &s->positions[face->v[2]], &normal);
+
+      for (j = 0; j < 3; j++)
+        {
+          int a = face->v[j], b = face->v[(j + 1) % 3];
+          double d;
+
+          if (!edge_is_locked (s, a, b))
+            continue;
+
+          graphene_vec3_subtract (&s->positions[b], &s->positions[a], &edge);
+          graphene_vec3_cross (&edge, &normal, &perp);
+          if (graphene_vec3_length (&perp) < 1e-12)
+            continue;
+          graphene_vec3_normalize (&perp, &perp);
+
+          d = -graphene_vec3_dot (&perp, &s->positions[a]);
+          quadric_add_plane (&s->quadrics[a],
+                             graphene_vec3_get_x (&perp), graphene_vec3_get_y (&perp), graphene_vec3_get_z (&perp), d,
+                             LOCKED_EDGE_WEIGHT);
+          quadric_add_plane (&s->quadrics[b],
+                             graphene_vec3_get_x (&perp), graphene_vec3_get_y (&perp), graphene_vec3_get_z (&perp), d,
+                             LOCKED_EDGE_WEIGHT);
+        }
+    }
+}
+
+static void
+simplifier_destroy (Simplifier *s)
+{
+  int i;
+
+  for (i = 0; i < s->n_vertices; i++)
+    g_array_free (s->vertex_faces[i], TRUE);
+  g_free (s->vertex_faces);
+  g_free (s->positions);
+  g_free (s->quadrics);
+  g_free (s->stamps);
+  g_free (s->removed);
+  g_free (s->uv);
+  g_free (s->uv2);
+  g_free (s->colors);
+  g_array_free (s->faces, TRUE);
+  g_array_free (s->heap, TRUE);
+}
+
+static GthreeGeometry *
+simplifier_build (Simplifier *s)
+{
+  GthreeGeometry *source = s->source;
+  GthreeGeometry *geometry = gthree_geometry_new ();
+  int *remap = g_new (int, s->n_vertices);
+  gboolean has_vertex_normals = FALSE;
+  int n_vertices = 0;
+  int i, j;
+
+  if (gthree_geometry_get_n_faces (source) > 0)
+    {
+      const graphene_vec3_t *na, *nb, *nc;
+      has_vertex_normals = gthree_geometry_face_get_vertex_normals (source, 0, &na, &nb, &nc);
+    }
+
+  for (i = 0; i < s->n_vertices; i++)
+    remap[i] = -1;
+
+  for (i = 0; i < s->faces->len; i++)
+    {
+      SFace *face = &g_array_index (s->faces, SFace, i);
+      int source_face, index;
+
+      if (face->removed)
+        continue;
+
+      for (j = 0; j < 3; j++)
+        {
+          if (remap[face->v[j]] < 0)
+            {
+              remap[face->v[j]] = n_vertices++;
+              gthree_geometry_add_vertex (geometry, &s->positions[face->v[j]]);
+            }
+        }
+
+      index = gthree_geometry_add_face (geometry, remap[face->v[0]], remap[face->v[1]], remap[face->v[2]]);
+      source_face = face->corner[0] / 3;
+
+      gthree_geometry_face_set_material_index (geometry, index, face->material_index);
+      gthree_geometry_face_set_color (geometry, index, gthree_geometry_face_get_color (source, source_face));
+
+      if (s->colors)
+        gthree_geometry_face_set_vertex_colors (geometry, index,
+                                                &s->colors[face->corner[0]],
+                                                &s->colors[face->corner[1]],
+                                                &s->colors[face->corner[2]]);
+
+      for (j = 0; j < 3; j++)
+        {
+          if (s->uv)
+            gthree_geometry_set_uv_n (geometry, 0, index * 3 + j, &s->uv[face->corner[j]]);
+          if (s->uv2)
+            gthree_geometry_set_uv_n (geometry, 1, index * 3 + j, &s->uv2[face->corner[j]]);
+        }
+    }
+
+  g_free (remap);
+
+  gthree_geometry_compute_face_normals (geometry);
+  if (has_vertex_normals)
+    gthree_geometry_compute_vertex_normals (geometry, TRUE);
+
+  return geometry;
+}
+
+static GthreeGeometry *
+simplify (GthreeGeometry *source,
+          float ratio,
+          float max_error,
+          GCancellable *cancellable)
+{
+  Simplifier s;
+  GArray *v_neighbours, *u_neighbours;
+  GthreeGeometry *geometry = NULL;
+  double max_cost;
+  int target_faces;
+  HeapEntry entry;
+  int i, n_collapses = 0;
+
+  simplifier_init (&s, source);
+
+  target_faces = ceil (CLAMP (ratio, 0, 1) * s.n_live_faces);
+  max_cost = max_error < 0 ? G_MAXDOUBLE : (double)max_error * max_error;
+
+  v_neighbours = g_array_new (FALSE, FALSE, sizeof (int));
+  u_neighbours = g_array_new (FALSE, FALSE, sizeof (int));
+
+  for (i = 0; i < s.n_vertices; i++)
+    update_vertex (&s, i, v_neighbours, u_neighbours);
+
+  while (s.n_live_faces > target_faces && heap_pop (s.heap, &entry))
+    {
+      GArray *affected;
+
+      if (entry.stamp != s.stamps[entry.vertex] || s.removed[entry.vertex] || s.removed[entry.target])
+        continue;
+
+      if (entry.cost > max_cost)
+        break;
+
+      /* Changes further out can still have made this invalid */
+      collect_neighbours (&s, entry.vertex, v_neighbours);
+      if (collapse_cost (&s, entry.vertex, entry.target, v_neighbours, u_neighbours) < 0)
+        {
+          update_vertex (&s, entry.vertex, v_neighbours, u_neighbours);
+          continue;
+        }
+
+      if ((++n_collapses % 256) == 0 && g_cancellable_is_cancelled (cancellable))
+        goto out;
+
+      collapse (&s, entry.vertex, entry.target);
+
+      /* The target's quadric and all of its neighbours' options changed */
+      affected = g_array_new (FALSE, FALSE, sizeof (int));
+      collect_neighbours (&s, entry.target, affected);
+      g_array_append_val (affected, entry.target);
+      for (i = 0; i < affected->len; i++)
+        update_vertex (&s, g_array_index (affected, int, i), v_neighbours, u_neighbours);
+      g_array_free (affected, TRUE);
+    }
+
+  geometry = simplifier_build (&s);
+
+ out:
+  g_array_free (v_neighbours, TRUE);
+  g_array_free (u_neighbours, TRUE);
+  simplifier_destroy (&s);
+
+  return geometry;
+}
+
+/* Returns a new geometry with at most ratio times the faces, or fewer
+ * as long as no vertex moves further than about max_error. Pass a
+ * negative max_error to only go by ratio, or a ratio of 0 to only go
+ * by max_error. */
+GthreeGeometry *
+gthree_geometry_simplify (GthreeGeometry *geometry,
+                          float           ratio,
+                          float           max_error)
+{
+  return simplify (geometry, ratio, max_error, NULL);
+}
+
+/* Returns n_levels geometries, each simplified by ratio from the one
+ * before, starting from geometry itself. The result can be put into a
+ * GthreeLOD. */
+GPtrArray *
+gthree_geometry_simplify_chain (GthreeGeometry *geometry,
+                                int             n_levels,
+                                float           ratio,
+                                float           max_error)
+{
+  GPtrArray *chain = g_ptr_array_new_with_free_func (g_object_unref);
+  GthreeGeometry *level = geometry;
+  int i;
+
+  for (i = 0; i < n_levels; i++)
+    {
+      level = simplify (level, ratio, max_error, NULL);
+      g_ptr_array_add (chain, level);
+    }
+
+  return chain;
+}
+
+typedef struct {
+  int n_levels;
+  float ratio;
+  float max_error;
+} ChainData;
+
+static void
+simplify_chain_thread (GTask        *task,
+                       gpointer      source_object,
+                       gpointer      task_data,
+                       GCancellable *cancellable)
+{
+  ChainData *data = task_data;
+  GPtrArray *chain = g_ptr_array_new_with_free_func (g_object_unref);
+  GthreeGeometry *level = source_object;
+  int i;
+
+  for (i = 0; i < data->n_levels; i++)
+    {
+      level = simplify (level, data->ratio, data->max_error, cancellable);
+      if (level == NULL)
+        break;
+      g_ptr_array_add (chain, level);
+    }
+
+  if (g_task_return_error_if_cancelled (task))
+    g_ptr_array_unref (chain);
+  else
+    g_task_return_pointer (task, chain, (GDestroyNotify)g_ptr_array_unref);
+}
+
+/* Like gthree_geometry_simplify_chain(), but on a worker thread. The
+ * geometry must not be changed until callback is called. */
+void
+gthree_geometry_simplify_chain_async (GthreeGeometry      *geometry,
+                                      int                  n_levels,
+                                      float                ratio,
+                                      float                max_error,
+                                      GCancellable        *cancellable,
+                                      GAsyncReadyCallback  callback,
+                                      gpointer             user_data)
+{
+  GTask *task;
+  ChainData *data;
+
+  data = g_new (ChainData, 1);
+  data->n_levels = n_levels;
+  data->ratio = ratio;
+  data->max_error = max_error;
+
+  task = g_task_new (geometry, cancellable, callback, user_data);
+  g_task_set_task_data (task, data, g_free);
+  g_task_run_in_thread (task, simplify_chain_thread);
+  g_object_unref (task);
+}
+
+GPtrArray *
+gthree_geometry_simplify_chain_finish (GthreeGeometry  *geometry,
+                                       GAsyncResult    *result,
+                                       GError         **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, geometry), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -36,6 +36,8 @@ typedef struct {
   guint bounding_sphere_set;
 
   GPtrArray *groups; /* GthreeGeometryGroup * */
+
+  guint version; /* bumped on every change to the data */
 } GthreeGeometryPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GthreeGeometry, gthree_geometry, G_TYPE_OBJECT);
@@ -65,6 +67,7 @@ gthree_geometry_add_vertex (GthreeGeometry *geometry,
   GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
 
   g_array_append_val (priv->vertices,*v);
+  priv->version++;
 }
 
 guint
@@ -122,6 +125,7 @@ gthree_geometry_add_uv (GthreeGeometry *geometry,
   GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
 
   g_array_append_val (priv->uv, *v);
+  priv->version++;
 }
 
 const graphene_vec2_t *
@@ -147,6 +151,7 @@ gthree_geometry_add_uv2 (GthreeGeometry *geometry,
   GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
 
   g_array_append_val (priv->uv2, *v);
+  priv->version++;
 }
 
 void
@@ -170,7 +175,12 @@ gthree_geometry_set_uv_n (GthreeGeometry  *geometry,
       g_array_index (priv->uv2, graphene_vec2_t, index) = *v;
     }
   else
-    g_warning ("only 2 uv layers supported");
+    {
+      g_warning ("only 2 uv layers supported");
+      return;
+    }
+
+  priv->version++;
 }
 
 
@@ -229,6 +239,8 @@ gthree_geometry_compute_face_normals (GthreeGeometry *geometry)
 
       face->normal = cb;
     }
+
+  priv->version++;
 }
 
 void
@@ -297,6 +309,7 @@ gthree_geometry_compute_vertex_normals (GthreeGeometry *geometry, gboolean area_
     }
 
   g_free (vertex_normals);
+  priv->version++;
 }
 
 int
@@ -317,6 +330,8 @@ gthree_geometry_add_face (GthreeGeometry        *geometry,
   face->b = b;
   face->c = c;
 
+  priv->version++;
+
   return i;
 }
 
@@ -364,6 +379,7 @@ gthree_geometry_face_set_normal (GthreeGeometry        *geometry,
 
   face = &g_array_index (priv->faces, GthreeFace, index);
   face->normal = *normal;
+  priv->version++;
 }
 
 const graphene_vec3_t *
@@ -395,6 +411,7 @@ gthree_geometry_face_set_vertex_normals (GthreeGeometry        *geometry,
   face->vertex_normals[0] = *normal_a;
   face->vertex_normals[1] = *normal_b;
   face->vertex_normals[2] = *normal_c;
+  priv->version++;
 }
 
 gboolean
@@ -434,6 +451,7 @@ gthree_geometry_face_set_color (GthreeGeometry        *geometry,
 
   face = &g_array_index (priv->faces, GthreeFace, index);
   face->color = *color;
+  priv->version++;
 }
 
 const GdkRGBA *
@@ -464,6 +482,7 @@ gthree_geometry_face_set_vertex_colors (GthreeGeometry        *geometry,
   face->vertex_colors[0] = *a;
   face->vertex_colors[1] = *b;
   face->vertex_colors[2] = *c;
+  priv->version++;
 }
 
 gboolean
@@ -503,6 +522,7 @@ gthree_geometry_face_set_material_index (GthreeGeometry        *geometry,
 
   face = &g_array_index (priv->faces, GthreeFace, index);
   face->material_index = material_index;
+  priv->version++;
 }
 
 int
@@ -615,6 +635,14 @@ make_geometry_groups (GthreeGeometry *geometry,
   return groups;
 }
 
+guint
+gthree_geometry_get_version (GthreeGeometry *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+
+  return priv->version;
+}
+
 void
 gthree_geometry_realize (GthreeGeometry *geometry,
                          GthreeMaterial *material)
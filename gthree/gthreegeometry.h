@@ -79,6 +79,24 @@ GthreeGeometry *gthree_geometry_new_sphere_full (float radius,
                                                  float thetaStart,
                                                  float thetaLength);
 
+GthreeGeometry *gthree_geometry_simplify              (GthreeGeometry       *geometry,
+                                                      float                 ratio,
+                                                      float                 max_error);
+GPtrArray      *gthree_geometry_simplify_chain        (GthreeGeometry       *geometry,
+                                                      int                   n_levels,
+                                                      float                 ratio,
+                                                      float                 max_error);
+void            gthree_geometry_simplify_chain_async  (GthreeGeometry       *geometry,
+                                                      int                   n_levels,
+                                                      float                 ratio,
+                                                      float                 max_error,
+                                                      GCancellable         *cancellable,
+                                                      GAsyncReadyCallback   callback,
+                                                      gpointer              user_data);
+GPtrArray      *gthree_geometry_simplify_chain_finish (GthreeGeometry       *geometry,
+                                                      GAsyncResult         *result,
+                                                      GError              **error);
+
 int                    gthree_geometry_face_get_a              (GthreeGeometry         *geometry,
 								int                     index);
 int                    gthree_geometry_face_get_b              (GthreeGeometry         *geometry,
@@ -3,6 +3,7 @@
 
 #include "gthreegeometrygroupprivate.h"
 #include "gthreegeometry.h"
+#include "gthreeprivate.h"
 
 G_DEFINE_TYPE (GthreeGeometryGroup, gthree_geometry_group, GTHREE_TYPE_BUFFER);
 
@@ -265,6 +266,7 @@ gthree_geometry_group_update (GthreeGeometryGroup *group,
 
       glBindBuffer (GL_ARRAY_BUFFER, GTHREE_BUFFER (group)->vertex_buffer);
       glBufferData (GL_ARRAY_BUFFER, offset * sizeof (float), group->vertex_array, hint);
+      gthree_render_stats_add_buffer_upload (offset * sizeof (float));
 
       group->vertices_need_update = FALSE;
     }
@@ -303,6 +305,7 @@ gthree_geometry_group_update (GthreeGeometryGroup *group,
         {
           glBindBuffer (GL_ARRAY_BUFFER, GTHREE_BUFFER (group)->color_buffer);
           glBufferData (GL_ARRAY_BUFFER, offset_color * sizeof (float), group->color_array, hint);
+          gthree_render_stats_add_buffer_upload (offset_color * sizeof (float));
         }
       group->colors_need_update = FALSE;
     }
@@ -347,6 +350,7 @@ gthree_geometry_group_update (GthreeGeometryGroup *group,
         {
           glBindBuffer (GL_ARRAY_BUFFER, GTHREE_BUFFER (group)->normal_buffer);
           glBufferData (GL_ARRAY_BUFFER, offset_normal * sizeof (float), group->normal_array, hint);
+          gthree_render_stats_add_buffer_upload (offset_normal * sizeof (float));
         }
       group->normals_need_update = FALSE;
     }
@@ -381,6 +385,7 @@ gthree_geometry_group_update (GthreeGeometryGroup *group,
         {
           glBindBuffer (GL_ARRAY_BUFFER, GTHREE_BUFFER (group)->uv_buffer);
           glBufferData (GL_ARRAY_BUFFER, offset_uv * sizeof (float), group->uv_array, hint);
+          gthree_render_stats_add_buffer_upload (offset_uv * sizeof (float));
         }
       group->uvs_need_update = FALSE;
     }
@@ -415,6 +420,7 @@ gthree_geometry_group_update (GthreeGeometryGroup *group,
         {
           glBindBuffer (GL_ARRAY_BUFFER, GTHREE_BUFFER (group)->uv2_buffer);
           glBufferData (GL_ARRAY_BUFFER, offset_uv2 * sizeof (float), group->uv2_array, hint);
+          gthree_render_stats_add_buffer_upload (offset_uv2 * sizeof (float));
         }
       group->uvs_need_update = FALSE;
     }
@@ -452,10 +458,12 @@ gthree_geometry_group_update (GthreeGeometryGroup *group,
 
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, GTHREE_BUFFER (group)->face_buffer);
       glBufferData(GL_ELEMENT_ARRAY_BUFFER, offset_face * sizeof (guint16), group->face_array, hint);
+      gthree_render_stats_add_buffer_upload (offset_face * sizeof (guint16));
       GTHREE_BUFFER(group)->face_count = offset_face;
 
       glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, GTHREE_BUFFER (group)->line_buffer);
       glBufferData(GL_ELEMENT_ARRAY_BUFFER, offset_line * sizeof (guint16), group->line_array, hint);
+      gthree_render_stats_add_buffer_upload (offset_line * sizeof (guint16));
       GTHREE_BUFFER(group)->line_count = offset_line;
 
       group->elements_need_update = FALSE;
@@ -0,0 +1,248 @@
+#include "config.h"
+
+#include <epoxy/gl.h>
+#ifdef HAVE_EGL
+#include <epoxy/egl.h>
+#endif
+
+#include "gthreeheadlesscontext.h"
+#include "gthreerenderer.h"
+#include "gthreerendertarget.h"
+
+typedef struct {
+#ifdef HAVE_EGL
+  EGLDisplay display;
+  EGLContext context;
+  EGLSurface surface; /* Only without EGL_KHR_surfaceless_context */
+#endif
+
+  GthreeRenderer *renderer;
+  GthreeRenderTarget *render_target;
+} GthreeHeadlessContextPrivate;
+
+G_DEFINE_QUARK (gthree-headless-context-error-quark, gthree_headless_context_error)
+
+G_DEFINE_TYPE_WITH_PRIVATE (GthreeHeadlessContext, gthree_headless_context, G_TYPE_OBJECT)
+
+static void
+gthree_headless_context_init (GthreeHeadlessContext *context)
+{
+#ifdef HAVE_EGL
+  GthreeHeadlessContextPrivate *priv = gthree_headless_context_get_instance_private (context);
+
+  priv->display = EGL_NO_DISPLAY;
+  priv->context = EGL_NO_CONTEXT;
+  priv->surface = EGL_NO_SURFACE;
+#endif
+}
+
+static void
+gthree_headless_context_finalize (GObject *obj)
+{
+  GthreeHeadlessContext *context = GTHREE_HEADLESS_CONTEXT (obj);
+  GthreeHeadlessContextPrivate *priv = gthree_headless_context_get_instance_private (context);
+
+  /* These free GL objects, so need the context */
+  if (priv->renderer)
+    gthree_headless_context_make_current (context);
+  g_clear_object (&priv->renderer);
+  if (priv->render_target)
+    gthree_render_target_unrealize (priv->render_target);
+  g_clear_object (&priv->render_target);
+
+#ifdef HAVE_EGL
+  /* The display is left initialized, it may be shared with others */
+  if (priv->display != EGL_NO_DISPLAY)
+    {
+      eglMakeCurrent (priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+      if (priv->context != EGL_NO_CONTEXT)
+        eglDestroyContext (priv->display, priv->context);
+      if (priv->surface != EGL_NO_SURFACE)
+        eglDestroySurface (priv->display, priv->surface);
+    }
+#endif
+
+  G_OBJECT_CLASS (gthree_headless_context_parent_class)->finalize (obj);
+}
+
+static void
+gthree_headless_context_class_init (GthreeHeadlessContextClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = gthree_headless_context_finalize;
+}
+
+#ifdef HAVE_EGL
+static EGLDisplay
+get_display (void)
+{
+  EGLDisplay display = EGL_NO_DISPLAY;
+
+  /* Surfaceless works without any window system or render node
+     permissions beyond the GPU, and with llvmpipe without a GPU */
+  if (epoxy_has_egl_extension (EGL_NO_DISPLAY, "EGL_EXT_platform_base") &&
+      epoxy_has_egl_extension (EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless"))
+    display = eglGetPlatformDisplayEXT (EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+
+  if (display == EGL_NO_DISPLAY)
+    display = eglGetDisplay (EGL_DEFAULT_DISPLAY);
+
+  return display;
+}
+
+static gboolean
+create_context (GthreeHeadlessContextPrivate *priv,
+                GError **error)
+{
+  static const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8,
+    EGL_GREEN_SIZE, 8,
+    EGL_BLUE_SIZE, 8,
+    EGL_ALPHA_SIZE, 8,
+    EGL_NONE
+  };
+  /* Same as GthreeArea asks for */
+  static const EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+    EGL_CONTEXT_MINOR_VERSION_KHR, 2,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+    EGL_NONE
+  };
+  static const EGLint pbuffer_attribs[] = {
+    EGL_WIDTH, 1,
+    EGL_HEIGHT, 1,
+    EGL_NONE
+  };
+  EGLint major, minor, n_configs;
+  EGLConfig config;
+
+  priv->display = get_display ();
+  if (priv->display == EGL_NO_DISPLAY ||
+      !eglInitialize (priv->display, &major, &minor))
+    {
+      priv->display = EGL_NO_DISPLAY;
+      g_set_error (error, GTHREE_HEADLESS_CONTEXT_ERROR, GTHREE_HEADLESS_CONTEXT_ERROR_NOT_SUPPORTED,
+                   "No EGL display");
+      return FALSE;
+    }
+
+  if (!epoxy_has_egl_extension (priv->display, "EGL_KHR_create_context"))
+    {
+      g_set_error (error, GTHREE_HEADLESS_CONTEXT_ERROR, GTHREE_HEADLESS_CONTEXT_ERROR_NOT_SUPPORTED,
+                   "EGL_KHR_create_context is not supported");
+      return FALSE;
+    }
+
+  if (!eglBindAPI (EGL_OPENGL_API) ||
+      !eglChooseConfig (priv->display, config_attribs, &config, 1, &n_configs) ||
+      n_configs == 0)
+    {
+      g_set_error (error, GTHREE_HEADLESS_CONTEXT_ERROR, GTHREE_HEADLESS_CONTEXT_ERROR_NOT_SUPPORTED,
+                   "No EGL config for desktop OpenGL");
+      return FALSE;
+    }
+
+  priv->context = eglCreateContext (priv->display, config, EGL_NO_CONTEXT, context_attribs);
+  if (priv->context == EGL_NO_CONTEXT)
+    {
+      g_set_error (error, GTHREE_HEADLESS_CONTEXT_ERROR, GTHREE_HEADLESS_CONTEXT_ERROR_FAIL,
+                   "Could not create an OpenGL 3.2 core context: 0x%x", eglGetError ());
+      return FALSE;
+    }
+
+  /* Drawing goes to a framebuffer object, the surface is only needed
+     for making the context current at all */
+  if (!epoxy_has_egl_extension (priv->display, "EGL_KHR_surfaceless_context"))
+    {
+      priv->surface = eglCreatePbufferSurface (priv->display, config, pbuffer_attribs);
+      if (priv->surface == EGL_NO_SURFACE)
+        {
+          g_set_error (error, GTHREE_HEADLESS_CONTEXT_ERROR, GTHREE_HEADLESS_CONTEXT_ERROR_FAIL,
+                       "Could not create a pbuffer surface: 0x%x", eglGetError ());
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+#endif
+
+/* Creates the context and makes it current */
+GthreeHeadlessContext *
+gthree_headless_context_new (int      width,
+                             int      height,
+                             GError **error)
+{
+  GthreeHeadlessContext *context;
+  GthreeHeadlessContextPrivate *priv;
+
+  context = g_object_new (gthree_headless_context_get_type (), NULL);
+  priv = gthree_headless_context_get_instance_private (context);
+
+#ifdef HAVE_EGL
+  if (!create_context (priv, error) ||
+      !gthree_headless_context_make_current (context))
+    {
+      if (error && *error == NULL)
+        g_set_error (error, GTHREE_HEADLESS_CONTEXT_ERROR, GTHREE_HEADLESS_CONTEXT_ERROR_FAIL,
+                     "Could not make the context current: 0x%x", eglGetError ());
+      g_object_unref (context);
+      return NULL;
+    }
+#else
+  g_set_error (error, GTHREE_HEADLESS_CONTEXT_ERROR, GTHREE_HEADLESS_CONTEXT_ERROR_NOT_SUPPORTED,
+               "Built without EGL support");
+  g_object_unref (context);
+  return NULL;
+#endif
+
+  priv->renderer = gthree_renderer_new ();
+  priv->render_target = gthree_render_target_new (width, height);
+  gthree_headless_context_set_size (context, width, height);
+  gthree_renderer_set_render_target (priv->renderer, priv->render_target);
+
+  return context;
+}
+
+gboolean
+gthree_headless_context_make_current (GthreeHeadlessContext *context)
+{
+#ifdef HAVE_EGL
+  GthreeHeadlessContextPrivate *priv = gthree_headless_context_get_instance_private (context);
+
+  if (priv->context == EGL_NO_CONTEXT)
+    return FALSE;
+
+  return eglMakeCurrent (priv->display, priv->surface, priv->surface, priv->context);
+#else
+  return FALSE;
+#endif
+}
+
+void
+gthree_headless_context_set_size (GthreeHeadlessContext *context,
+                                  int                    width,
+                                  int                    height)
+{
+  GthreeHeadlessContextPrivate *priv = gthree_headless_context_get_instance_private (context);
+
+  gthree_render_target_set_size (priv->render_target, width, height);
+  gthree_renderer_set_size (priv->renderer, width, height);
+}
+
+GthreeRenderer *
+gthree_headless_context_get_renderer (GthreeHeadlessContext *context)
+{
+  GthreeHeadlessContextPrivate *priv = gthree_headless_context_get_instance_private (context);
+
+  return priv->renderer;
+}
+
+GthreeRenderTarget *
+gthree_headless_context_get_render_target (GthreeHeadlessContext *context)
+{
+  GthreeHeadlessContextPrivate *priv = gthree_headless_context_get_instance_private (context);
+
+  return priv->render_target;
+}
@@ -0,0 +1,55 @@
+#ifndef __GTHREE_HEADLESS_CONTEXT_H__
+#define __GTHREE_HEADLESS_CONTEXT_H__
+
+#if !defined (__GTHREE_H_INSIDE__) && !defined (GTHREE_COMPILATION)
+#error "Only <gthree/gthree.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+#include <gthree/gthreetypes.h>
+
+G_BEGIN_DECLS
+
+#define GTHREE_TYPE_HEADLESS_CONTEXT      (gthree_headless_context_get_type ())
+#define GTHREE_HEADLESS_CONTEXT(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), \
+                                                                       GTHREE_TYPE_HEADLESS_CONTEXT, \
+                                                                       GthreeHeadlessContext))
+#define GTHREE_IS_HEADLESS_CONTEXT(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst),    \
+                                                                       GTHREE_TYPE_HEADLESS_CONTEXT))
+
+/* A GL context made through EGL without any window system, for
+ * rendering in batch jobs and tests. Its renderer draws into an
+ * offscreen render target. */
+struct _GthreeHeadlessContext {
+  GObject parent;
+};
+
+typedef struct {
+  GObjectClass parent_class;
+
+} GthreeHeadlessContextClass;
+
+typedef enum {
+  GTHREE_HEADLESS_CONTEXT_ERROR_NOT_SUPPORTED,
+  GTHREE_HEADLESS_CONTEXT_ERROR_FAIL,
+} GthreeHeadlessContextError;
+
+#define GTHREE_HEADLESS_CONTEXT_ERROR     (gthree_headless_context_error_quark ())
+
+GQuark gthree_headless_context_error_quark (void);
+GType gthree_headless_context_get_type (void) G_GNUC_CONST;
+
+GthreeHeadlessContext *gthree_headless_context_new (int      width,
+                                                    int      height,
+                                                    GError **error);
+
+gboolean            gthree_headless_context_make_current      (GthreeHeadlessContext *context);
+void                gthree_headless_context_set_size          (GthreeHeadlessContext *context,
+                                                               int                    width,
+                                                               int                    height);
+GthreeRenderer     *gthree_headless_context_get_renderer      (GthreeHeadlessContext *context);
+GthreeRenderTarget *gthree_headless_context_get_render_target (GthreeHeadlessContext *context);
+
+G_END_DECLS
+
+#endif /* __GTHREE_HEADLESS_CONTEXT_H__ */
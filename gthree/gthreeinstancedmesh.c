@@ -0,0 +1,406 @@
+#include <math.h>
+#include <epoxy/gl.h>
+
+#include "gthreeinstancedmesh.h"
+#include "gthreeprivate.h"
+#include "gthreeobjectprivate.h"
+
+typedef struct {
+  int count;
+  GArray *matrices; /* 16 floats per instance */
+  GArray *colors; /* 3 floats per instance, NULL until a color is set */
+
+  graphene_sphere_t bounding_sphere;
+
+  guint instance_buffer;
+  guint version; /* bumped on every change to the instance data */
+
+  guint instances_need_update : 1;
+  guint bounds_need_update : 1;
+} GthreeInstancedMeshPrivate;
+
+enum {
+  PROP_0,
+
+  PROP_COUNT,
+
+  N_PROPS
+};
+
+static GParamSpec *obj_props[N_PROPS] = { NULL, };
+
+G_DEFINE_TYPE_WITH_PRIVATE (GthreeInstancedMesh, gthree_instanced_mesh, GTHREE_TYPE_MESH)
+
+GthreeInstancedMesh *
+gthree_instanced_mesh_new (GthreeGeometry *geometry,
+                           GthreeMaterial *material,
+                           int             count)
+{
+  return g_object_new (gthree_instanced_mesh_get_type (),
+                       "geometry", geometry,
+                       "material", material,
+                       "count", count,
+                       NULL);
+}
+
+static void
+gthree_instanced_mesh_init (GthreeInstancedMesh *mesh)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  priv->matrices = g_array_new (FALSE, FALSE, sizeof (float) * 16);
+  priv->instances_need_update = TRUE;
+  priv->bounds_need_update = TRUE;
+}
+
+static void
+gthree_instanced_mesh_finalize (GObject *obj)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (obj);
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  if (priv->instance_buffer)
+    glDeleteBuffers (1, &priv->instance_buffer);
+
+  g_array_free (priv->matrices, TRUE);
+  if (priv->colors)
+    g_array_free (priv->colors, TRUE);
+
+  G_OBJECT_CLASS (gthree_instanced_mesh_parent_class)->finalize (obj);
+}
+
+static void
+gthree_instanced_mesh_update_bounds (GthreeInstancedMesh *mesh)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+  GthreeGeometry *geometry = gthree_mesh_get_geometry (GTHREE_MESH (mesh));
+  const graphene_sphere_t *geometry_sphere;
+  graphene_point3d_t min, max;
+  graphene_box_t box;
+  int i;
+
+  if (geometry == NULL || priv->count == 0)
+    {
+      graphene_sphere_init (&priv->bounding_sphere, NULL, 0);
+      return;
+    }
+
+  geometry_sphere = gthree_geometry_get_bounding_sphere (geometry);
+
+  min.x = min.y = min.z = G_MAXFLOAT;
+  max.x = max.y = max.z = -G_MAXFLOAT;
+
+  for (i = 0; i < priv->count; i++)
+    {
+      graphene_matrix_t m;
+      graphene_sphere_t s;
+      graphene_point3d_t center;
+      float radius;
+
+      graphene_matrix_init_from_float (&m, &g_array_index (priv->matrices, float, i * 16));
+      graphene_matrix_transform_sphere (&m, geometry_sphere, &s);
+      graphene_sphere_get_center (&s, &center);
+      radius = graphene_sphere_get_radius (&s);
+
+      min.x = MIN (min.x, center.x - radius);
+      min.y = MIN (min.y, center.y - radius);
+      min.z = MIN (min.z, center.z - radius);
+      max.x = MAX (max.x, center.x + radius);
+      max.y = MAX (max.y, center.y + radius);
+      max.z = MAX (max.z, center.z + radius);
+    }
+
+  graphene_box_init (&box, &min, &max);
+  graphene_box_get_bounding_sphere (&box, &priv->bounding_sphere);
+}
+
+/* The renderer calls this on the main thread before traversal, so
+ * in_frustum only reads the bounds, also from the traversal threads */
+void
+gthree_instanced_mesh_ensure_bounds (GthreeInstancedMesh *mesh)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  if (priv->bounds_need_update)
+    {
+      gthree_instanced_mesh_update_bounds (mesh);
+      priv->bounds_need_update = FALSE;
+    }
+}
+
+static void
+gthree_instanced_mesh_update (GthreeObject *object)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (object);
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  GTHREE_OBJECT_CLASS (gthree_instanced_mesh_parent_class)->update (object);
+
+  if (priv->instances_need_update)
+    {
+      gsize matrices_size = priv->count * 16 * sizeof (float);
+      gsize colors_size = priv->colors ? priv->count * 3 * sizeof (float) : 0;
+
+      if (priv->instance_buffer == 0)
+        glGenBuffers (1, &priv->instance_buffer);
+
+      glBindBuffer (GL_ARRAY_BUFFER, priv->instance_buffer);
+      glBufferData (GL_ARRAY_BUFFER, matrices_size + colors_size, NULL, GL_DYNAMIC_DRAW);
+      glBufferSubData (GL_ARRAY_BUFFER, 0, matrices_size, priv->matrices->data);
+      if (priv->colors)
+        glBufferSubData (GL_ARRAY_BUFFER, matrices_size, colors_size, priv->colors->data);
+      gthree_render_stats_add_buffer_upload (matrices_size + (priv->colors ? colors_size : 0));
+
+      priv->instances_need_update = FALSE;
+    }
+}
+
+static gboolean
+gthree_instanced_mesh_in_frustum (GthreeObject *object,
+                                  const graphene_frustum_t *frustum)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (object);
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+  graphene_sphere_t sphere;
+
+  if (priv->count == 0 || gthree_mesh_get_geometry (GTHREE_MESH (mesh)) == NULL)
+    return FALSE;
+
+  gthree_instanced_mesh_ensure_bounds (mesh);
+
+  graphene_matrix_transform_sphere (gthree_object_get_world_matrix (object),
+                                    &priv->bounding_sphere,
+                                    &sphere);
+
+  return graphene_frustum_intersects_sphere (frustum, &sphere);
+}
+
+static gboolean
+gthree_instanced_mesh_get_bounding_sphere (GthreeObject      *object,
+                                           graphene_sphere_t *sphere)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (object);
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  if (priv->count == 0 || gthree_mesh_get_geometry (GTHREE_MESH (mesh)) == NULL)
+    return FALSE;
+
+  gthree_instanced_mesh_ensure_bounds (mesh);
+
+  *sphere = priv->bounding_sphere;
+
+  return TRUE;
+}
+
+static void
+gthree_instanced_mesh_set_property (GObject *obj,
+                                    guint prop_id,
+                                    const GValue *value,
+                                    GParamSpec *pspec)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (obj);
+
+  switch (prop_id)
+    {
+    case PROP_COUNT:
+      gthree_instanced_mesh_set_count (mesh, g_value_get_int (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
+static void
+gthree_instanced_mesh_get_property (GObject *obj,
+                                    guint prop_id,
+                                    GValue *value,
+                                    GParamSpec *pspec)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (obj);
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  switch (prop_id)
+    {
+    case PROP_COUNT:
+      g_value_set_int (value, priv->count);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
+static void
+gthree_instanced_mesh_class_init (GthreeInstancedMeshClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GthreeObjectClass *object_class = GTHREE_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = gthree_instanced_mesh_set_property;
+  gobject_class->get_property = gthree_instanced_mesh_get_property;
+  gobject_class->finalize = gthree_instanced_mesh_finalize;
+
+  object_class->in_frustum = gthree_instanced_mesh_in_frustum;
+  object_class->get_bounding_sphere = gthree_instanced_mesh_get_bounding_sphere;
+  object_class->update = gthree_instanced_mesh_update;
+
+  obj_props[PROP_COUNT] =
+    g_param_spec_int ("count", "Count", "Number of instances",
+                      0, G_MAXINT, 0,
+                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, N_PROPS, obj_props);
+}
+
+int
+gthree_instanced_mesh_get_count (GthreeInstancedMesh *mesh)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  return priv->count;
+}
+
+void
+gthree_instanced_mesh_set_count (GthreeInstancedMesh *mesh,
+                                 int                  count)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+  int i;
+
+  g_return_if_fail (count >= 0);
+
+  if (priv->count == count)
+    return;
+
+  g_array_set_size (priv->matrices, count);
+  for (i = priv->count; i < count; i++)
+    {
+      graphene_matrix_t identity;
+
+      graphene_matrix_init_identity (&identity);
+      graphene_matrix_to_float (&identity, &g_array_index (priv->matrices, float, i * 16));
+    }
+
+  if (priv->colors)
+    {
+      g_array_set_size (priv->colors, count * 3);
+      for (i = priv->count * 3; i < count * 3; i++)
+        g_array_index (priv->colors, float, i) = 1.0;
+    }
+
+  priv->count = count;
+  priv->instances_need_update = TRUE;
+  priv->version++;
+  priv->bounds_need_update = TRUE;
+  gthree_object_bounds_changed (GTHREE_OBJECT (mesh));
+
+  g_object_notify_by_pspec (G_OBJECT (mesh), obj_props[PROP_COUNT]);
+}
+
+void
+gthree_instanced_mesh_set_matrix_at (GthreeInstancedMesh     *mesh,
+                                     int                      index,
+                                     const graphene_matrix_t *matrix)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  g_return_if_fail (index >= 0 && index < priv->count);
+
+  graphene_matrix_to_float (matrix, &g_array_index (priv->matrices, float, index * 16));
+
+  priv->instances_need_update = TRUE;
+  priv->version++;
+  priv->bounds_need_update = TRUE;
+  gthree_object_bounds_changed (GTHREE_OBJECT (mesh));
+}
+
+void
+gthree_instanced_mesh_get_matrix_at (GthreeInstancedMesh *mesh,
+                                     int                  index,
+                                     graphene_matrix_t   *matrix)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  g_return_if_fail (index >= 0 && index < priv->count);
+
+  graphene_matrix_init_from_float (matrix, &g_array_index (priv->matrices, float, index * 16));
+}
+
+void
+gthree_instanced_mesh_set_color_at (GthreeInstancedMesh *mesh,
+                                    int                  index,
+                                    const GdkRGBA       *color)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+  float *c;
+  int i;
+
+  g_return_if_fail (index >= 0 && index < priv->count);
+
+  if (priv->colors == NULL)
+    {
+      priv->colors = g_array_sized_new (FALSE, FALSE, sizeof (float), priv->count * 3);
+      g_array_set_size (priv->colors, priv->count * 3);
+      for (i = 0; i < priv->count * 3; i++)
+        g_array_index (priv->colors, float, i) = 1.0;
+    }
+
+  c = &g_array_index (priv->colors, float, index * 3);
+  c[0] = color->red;
+  c[1] = color->green;
+  c[2] = color->blue;
+
+  priv->instances_need_update = TRUE;
+  priv->version++;
+}
+
+gboolean
+gthree_instanced_mesh_get_color_at (GthreeInstancedMesh *mesh,
+                                    int                  index,
+                                    GdkRGBA             *color)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+  float *c;
+
+  g_return_val_if_fail (index >= 0 && index < priv->count, FALSE);
+
+  if (priv->colors == NULL)
+    return FALSE;
+
+  c = &g_array_index (priv->colors, float, index * 3);
+  color->red = c[0];
+  color->green = c[1];
+  color->blue = c[2];
+  color->alpha = 1.0;
+
+  return TRUE;
+}
+
+gboolean
+gthree_instanced_mesh_has_colors (GthreeInstancedMesh *mesh)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  return priv->colors != NULL;
+}
+
+guint
+gthree_instanced_mesh_get_version (GthreeInstancedMesh *mesh)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  return priv->version;
+}
+
+guint
+gthree_instanced_mesh_get_instance_buffer (GthreeInstancedMesh *mesh,
+                                           gsize               *color_offset)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  if (color_offset)
+    *color_offset = priv->count * 16 * sizeof (float);
+
+  return priv->instance_buffer;
+}
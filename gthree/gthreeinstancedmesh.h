@@ -0,0 +1,51 @@
+#ifndef __GTHREE_INSTANCED_MESH_H__
+#define __GTHREE_INSTANCED_MESH_H__
+
+#if !defined (__GTHREE_H_INSIDE__) && !defined (GTHREE_COMPILATION)
+#error "Only <gthree/gthree.h> can be included directly."
+#endif
+
+#include <gthree/gthreemesh.h>
+
+G_BEGIN_DECLS
+
+#define GTHREE_TYPE_INSTANCED_MESH      (gthree_instanced_mesh_get_type ())
+#define GTHREE_INSTANCED_MESH(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), \
+                                                                     GTHREE_TYPE_INSTANCED_MESH, \
+                                                                     GthreeInstancedMesh))
+#define GTHREE_IS_INSTANCED_MESH(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst),    \
+                                                                     GTHREE_TYPE_INSTANCED_MESH))
+
+struct _GthreeInstancedMesh {
+  GthreeMesh parent;
+};
+
+typedef struct {
+  GthreeMeshClass parent_class;
+
+} GthreeInstancedMeshClass;
+
+GthreeInstancedMesh *gthree_instanced_mesh_new (GthreeGeometry *geometry,
+                                                GthreeMaterial *material,
+                                                int             count);
+GType gthree_instanced_mesh_get_type (void) G_GNUC_CONST;
+
+int      gthree_instanced_mesh_get_count     (GthreeInstancedMesh     *mesh);
+void     gthree_instanced_mesh_set_count     (GthreeInstancedMesh     *mesh,
+                                              int                      count);
+void     gthree_instanced_mesh_set_matrix_at (GthreeInstancedMesh     *mesh,
+                                              int                      index,
+                                              const graphene_matrix_t *matrix);
+void     gthree_instanced_mesh_get_matrix_at (GthreeInstancedMesh     *mesh,
+                                              int                      index,
+                                              graphene_matrix_t       *matrix);
+void     gthree_instanced_mesh_set_color_at  (GthreeInstancedMesh     *mesh,
+                                              int                      index,
+                                              const GdkRGBA           *color);
+gboolean gthree_instanced_mesh_get_color_at  (GthreeInstancedMesh     *mesh,
+                                              int                      index,
+                                              GdkRGBA                 *color);
+
+G_END_DECLS
+
+#endif /* __GTHREE_INSTANCED_MESH_H__ */
@@ -102,12 +102,6 @@ gthree_lambert_material_real_set_uniforms (GthreeMaterial *material,
 #endif
 }
 
-static gboolean
-gthree_lambert_material_needs_view_matrix (GthreeMaterial *material)
-{
-  return TRUE;
-}
-
 static gboolean
 gthree_lambert_material_needs_lights (GthreeMaterial *material)
 {
@@ -130,7 +124,6 @@ gthree_lambert_material_class_init (GthreeLambertMaterialClass *klass)
   GTHREE_MATERIAL_CLASS(klass)->get_shader = gthree_lambert_material_real_get_shader;
   GTHREE_MATERIAL_CLASS(klass)->set_params = gthree_lambert_material_real_set_params;
   GTHREE_MATERIAL_CLASS(klass)->set_uniforms = gthree_lambert_material_real_set_uniforms;
-  GTHREE_MATERIAL_CLASS(klass)->needs_view_matrix = gthree_lambert_material_needs_view_matrix;
   GTHREE_MATERIAL_CLASS(klass)->needs_lights = gthree_lambert_material_needs_lights;
   GTHREE_MATERIAL_CLASS(klass)->needs_normals = gthree_lambert_material_needs_normals;
 }
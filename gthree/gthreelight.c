@@ -8,6 +8,14 @@ typedef struct {
   gboolean visible;
   gboolean only_shadow;
   gboolean casts_shadow;
+
+  int shadow_map_width;
+  int shadow_map_height;
+  float shadow_bias;
+  float shadow_darkness;
+  float shadow_camera_near;
+  float shadow_camera_far;
+  gboolean shadow_needs_update;
 } GthreeLightPrivate;
 
 enum {
@@ -145,6 +153,13 @@ gthree_light_init (GthreeLight *light)
   priv->visible = TRUE;
   priv->only_shadow = FALSE;
   priv->casts_shadow = FALSE;
+
+  priv->shadow_map_width = 512;
+  priv->shadow_map_height = 512;
+  priv->shadow_bias = 0;
+  priv->shadow_darkness = 0.5;
+  priv->shadow_camera_near = 0.5;
+  priv->shadow_camera_far = 500;
 }
 
 GthreeLight *
@@ -225,6 +240,111 @@ gthree_light_get_casts_shadow (GthreeLight *light)
   return priv->casts_shadow;
 }
 
+void
+gthree_light_set_shadow_map_size (GthreeLight *light,
+                                  int width,
+                                  int height)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  priv->shadow_map_width = MAX (width, 1);
+  priv->shadow_map_height = MAX (height, 1);
+}
+
+void
+gthree_light_get_shadow_map_size (GthreeLight *light,
+                                  int *width,
+                                  int *height)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  if (width)
+    *width = priv->shadow_map_width;
+  if (height)
+    *height = priv->shadow_map_height;
+}
+
+/* Added to the depth of the receiving fragment, a small negative value
+ * avoids shadow acne */
+void
+gthree_light_set_shadow_bias (GthreeLight *light,
+                              float bias)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  priv->shadow_bias = bias;
+}
+
+float
+gthree_light_get_shadow_bias (GthreeLight *light)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  return priv->shadow_bias;
+}
+
+void
+gthree_light_set_shadow_darkness (GthreeLight *light,
+                                  float darkness)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  priv->shadow_darkness = CLAMP (darkness, 0, 1);
+}
+
+float
+gthree_light_get_shadow_darkness (GthreeLight *light)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  return priv->shadow_darkness;
+}
+
+/* The depth range covered by the shadow map, as distances from the light */
+void
+gthree_light_set_shadow_camera_range (GthreeLight *light,
+                                      float near,
+                                      float far)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  priv->shadow_camera_near = near;
+  priv->shadow_camera_far = far;
+}
+
+void
+gthree_light_get_shadow_camera_range (GthreeLight *light,
+                                      float *near,
+                                      float *far)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  if (near)
+    *near = priv->shadow_camera_near;
+  if (far)
+    *far = priv->shadow_camera_far;
+}
+
+/* Shadow maps are only re-rendered when the light or a caster inside
+ * it moved. Use this when something else changed what they contain,
+ * like a vertex animation of a caster. */
+void
+gthree_light_set_shadow_needs_update (GthreeLight *light,
+                                      gboolean needs_update)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  priv->shadow_needs_update = !!needs_update;
+}
+
+gboolean
+gthree_light_get_shadow_needs_update (GthreeLight *light)
+{
+  GthreeLightPrivate *priv = gthree_light_get_instance_private (light);
+
+  return priv->shadow_needs_update;
+}
+
 void
 gthree_light_set_params (GthreeLight             *light,
 			 GthreeProgramParameters *params)
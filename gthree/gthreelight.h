@@ -45,6 +45,27 @@ void           gthree_light_set_is_only_shadow (GthreeLight   *light,
 gboolean       gthree_light_get_casts_shadow   (GthreeLight   *light);
 void           gthree_light_set_casts_shadow   (GthreeLight   *light,
                                                 gboolean       casts_shadow);
+void           gthree_light_set_shadow_map_size (GthreeLight  *light,
+                                                 int           width,
+                                                 int           height);
+void           gthree_light_get_shadow_map_size (GthreeLight  *light,
+                                                 int          *width,
+                                                 int          *height);
+void           gthree_light_set_shadow_bias     (GthreeLight  *light,
+                                                 float         bias);
+float          gthree_light_get_shadow_bias     (GthreeLight  *light);
+void           gthree_light_set_shadow_darkness (GthreeLight  *light,
+                                                 float         darkness);
+float          gthree_light_get_shadow_darkness (GthreeLight  *light);
+void           gthree_light_set_shadow_camera_range (GthreeLight *light,
+                                                     float        near,
+                                                     float        far);
+void           gthree_light_get_shadow_camera_range (GthreeLight *light,
+                                                     float       *near,
+                                                     float       *far);
+void           gthree_light_set_shadow_needs_update (GthreeLight *light,
+                                                     gboolean     needs_update);
+gboolean       gthree_light_get_shadow_needs_update (GthreeLight *light);
 const GdkRGBA *gthree_light_get_color          (GthreeLight   *light);
 void           gthree_light_set_color          (GthreeLight   *light,
 						const GdkRGBA *color);
@@ -0,0 +1,239 @@
+#include <math.h>
+
+#include "gthreelod.h"
+#include "gthreecamera.h"
+#include "gthreeprivate.h"
+
+typedef struct {
+  GthreeObject *object;
+  float threshold;
+} Level;
+
+typedef struct {
+  GArray *levels; /* Level, finest first */
+  int current_level;
+  float hysteresis;
+  gboolean use_screen_size;
+} GthreeLODPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (GthreeLOD, gthree_lod, GTHREE_TYPE_OBJECT)
+
+GthreeLOD *
+gthree_lod_new (void)
+{
+  return g_object_new (gthree_lod_get_type (), NULL);
+}
+
+static void
+gthree_lod_init (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  priv->levels = g_array_new (FALSE, FALSE, sizeof (Level));
+  priv->hysteresis = 0.1;
+}
+
+static void
+gthree_lod_finalize (GObject *obj)
+{
+  GthreeLOD *lod = GTHREE_LOD (obj);
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  int i;
+
+  for (i = 0; i < priv->levels->len; i++)
+    g_object_unref (g_array_index (priv->levels, Level, i).object);
+  g_array_free (priv->levels, TRUE);
+
+  G_OBJECT_CLASS (gthree_lod_parent_class)->finalize (obj);
+}
+
+static void
+gthree_lod_class_init (GthreeLODClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = gthree_lod_finalize;
+}
+
+static gboolean
+level_is_finer (GthreeLODPrivate *priv,
+                float a,
+                float b)
+{
+  return priv->use_screen_size ? a > b : a < b;
+}
+
+/* Adds object as a child, drawn from threshold on. That is a distance
+ * to the camera, or with gthree_lod_set_use_screen_size() the fraction
+ * of the viewport height covered by the finest level. */
+void
+gthree_lod_add_level (GthreeLOD    *lod,
+                      GthreeObject *object,
+                      float         threshold)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  Level level;
+  int i;
+
+  level.object = g_object_ref (object);
+  level.threshold = threshold;
+
+  for (i = 0; i < priv->levels->len; i++)
+    {
+      if (level_is_finer (priv, threshold, g_array_index (priv->levels, Level, i).threshold))
+        break;
+    }
+
+  g_array_insert_val (priv->levels, i, level);
+
+  gthree_object_add_child (GTHREE_OBJECT (lod), object);
+}
+
+int
+gthree_lod_get_n_levels (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  return priv->levels->len;
+}
+
+/* As of the last render */
+int
+gthree_lod_get_current_level (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  return priv->current_level;
+}
+
+/* The fraction a threshold must be passed by before switching back,
+ * to avoid flickering between levels near it */
+void
+gthree_lod_set_hysteresis (GthreeLOD *lod,
+                           float      hysteresis)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  priv->hysteresis = CLAMP (hysteresis, 0, 1);
+}
+
+float
+gthree_lod_get_hysteresis (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  return priv->hysteresis;
+}
+
+void
+gthree_lod_set_use_screen_size (GthreeLOD *lod,
+                                gboolean   use_screen_size)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  GArray *levels = priv->levels;
+  int i, j;
+
+  if (priv->use_screen_size == !!use_screen_size)
+    return;
+
+  priv->use_screen_size = !!use_screen_size;
+
+  /* Re-sort, the finest level is the one for the largest size now */
+  for (i = 1; i < levels->len; i++)
+    {
+      Level level = g_array_index (levels, Level, i);
+
+      for (j = i; j > 0 && level_is_finer (priv, level.threshold, g_array_index (levels, Level, j - 1).threshold); j--)
+        g_array_index (levels, Level, j) = g_array_index (levels, Level, j - 1);
+      g_array_index (levels, Level, j) = level;
+    }
+}
+
+gboolean
+gthree_lod_get_use_screen_size (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  return priv->use_screen_size;
+}
+
+static void
+get_position (const graphene_matrix_t *matrix,
+              graphene_point3d_t *pos)
+{
+  graphene_vec4_t row;
+
+  graphene_matrix_get_row (matrix, 3, &row);
+  graphene_point3d_init (pos,
+                         graphene_vec4_get_x (&row),
+                         graphene_vec4_get_y (&row),
+                         graphene_vec4_get_z (&row));
+}
+
+/* Picks the current level for camera, call after the world matrices
+ * are updated. */
+void
+gthree_lod_update (GthreeLOD    *lod,
+                   GthreeCamera *camera)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  graphene_point3d_t lod_pos, camera_pos;
+  float metric;
+  int i, level;
+
+  if (priv->levels->len == 0)
+    return;
+
+  get_position (gthree_object_get_world_matrix (GTHREE_OBJECT (lod)), &lod_pos);
+  get_position (gthree_object_get_world_matrix (GTHREE_OBJECT (camera)), &camera_pos);
+
+  metric = graphene_point3d_distance (&lod_pos, &camera_pos, NULL);
+
+  if (priv->use_screen_size)
+    {
+      const graphene_matrix_t *projection = gthree_camera_get_projection_matrix (camera);
+      GthreeObject *finest = g_array_index (priv->levels, Level, 0).object;
+      graphene_sphere_t sphere;
+      float radius = 1;
+
+      if (gthree_object_get_world_bounding_sphere (finest, &sphere))
+        radius = graphene_sphere_get_radius (&sphere);
+
+      /* The y scale of the projection is 1 / tan (fov / 2) */
+      metric = radius * graphene_matrix_get_value (projection, 1, 1) / MAX (metric, 1e-5);
+    }
+
+  /* Thresholds between the current level and the candidate are moved
+     away by the hysteresis */
+  level = 0;
+  for (i = 1; i < priv->levels->len; i++)
+    {
+      float threshold = g_array_index (priv->levels, Level, i).threshold;
+      float scale = i <= priv->current_level ? 1 - priv->hysteresis : 1 + priv->hysteresis;
+
+      if (priv->use_screen_size)
+        scale = 2 - scale;
+
+      if (level_is_finer (priv, metric, threshold * scale))
+        break;
+
+      level = i;
+    }
+
+  priv->current_level = level;
+}
+
+/* Whether child, which may not be a level at all, is to be drawn */
+gboolean
+gthree_lod_is_child_active (GthreeLOD    *lod,
+                            GthreeObject *child)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  int i;
+
+  for (i = 0; i < priv->levels->len; i++)
+    {
+      if (g_array_index (priv->levels, Level, i).object == child)
+        return i == priv->current_level;
+    }
+
+  return TRUE;
+}
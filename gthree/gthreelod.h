@@ -0,0 +1,48 @@
+#ifndef __GTHREE_LOD_H__
+#define __GTHREE_LOD_H__
+
+#if !defined (__GTHREE_H_INSIDE__) && !defined (GTHREE_COMPILATION)
+#error "Only <gthree/gthree.h> can be included directly."
+#endif
+
+#include <gthree/gthreeobject.h>
+
+G_BEGIN_DECLS
+
+#define GTHREE_TYPE_LOD      (gthree_lod_get_type ())
+#define GTHREE_LOD(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), \
+                                                          GTHREE_TYPE_LOD, \
+                                                          GthreeLOD))
+#define GTHREE_IS_LOD(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst),    \
+                                                          GTHREE_TYPE_LOD))
+
+/* Draws only one of its levels, picked each render by the distance to
+ * the camera, or by the size on screen. Other children are always
+ * drawn. */
+struct _GthreeLOD {
+  GthreeObject parent;
+};
+
+typedef struct {
+  GthreeObjectClass parent_class;
+
+} GthreeLODClass;
+
+GthreeLOD *gthree_lod_new (void);
+GType gthree_lod_get_type (void) G_GNUC_CONST;
+
+void     gthree_lod_add_level           (GthreeLOD    *lod,
+                                         GthreeObject *object,
+                                         float         threshold);
+int      gthree_lod_get_n_levels        (GthreeLOD    *lod);
+int      gthree_lod_get_current_level   (GthreeLOD    *lod);
+void     gthree_lod_set_hysteresis      (GthreeLOD    *lod,
+                                         float         hysteresis);
+float    gthree_lod_get_hysteresis      (GthreeLOD    *lod);
+void     gthree_lod_set_use_screen_size (GthreeLOD    *lod,
+                                         gboolean      use_screen_size);
+gboolean gthree_lod_get_use_screen_size (GthreeLOD    *lod);
+
+G_END_DECLS
+
+#endif /* __GTHREE_LOD_H__ */
@@ -2,6 +2,7 @@
 #include <epoxy/gl.h>
 
 #include "gthreematerial.h"
+#include "gthreeprivate.h"
 
 typedef struct {
   gboolean transparent;
@@ -20,9 +21,14 @@ typedef struct {
   gboolean depth_write;
   float alpha_test;
   GthreeSide side;
+  gboolean depth_prepass;
 
   GthreeShader *shader;
   gboolean needs_update;
+  guint id;
+
+  const GthreeRenderState *render_state; /* NULL when out of date */
+  GthreeProgram *program_variants[GTHREE_N_PROGRAM_VARIANTS];
 } GthreeMaterialPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GthreeMaterial, gthree_material, G_TYPE_OBJECT);
@@ -43,7 +49,9 @@ static void
 gthree_material_init (GthreeMaterial *material)
 {
   GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+  static guint next_id = 1;
 
+  priv->id = next_id++;
   priv->needs_update = TRUE;
 
   priv->visible = TRUE;
@@ -71,8 +79,8 @@ static void
 gthree_material_finalize (GObject *obj)
 {
   GthreeMaterial *material = GTHREE_MATERIAL (obj);
-  //GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
 
+  gthree_material_clear_program_variants (material);
   g_clear_object (&material->program);
   g_clear_object (&material->shader);
 
@@ -135,25 +143,17 @@ gthree_material_real_set_uniforms (GthreeMaterial *material,
     gthree_uniform_set_float (uni, priv->opacity);
 }
 
+/* Deprecated: the camera position and view matrix are always in the
+ * frame uniform block, so nothing asks materials for them any more */
 gboolean
 gthree_material_needs_camera_pos (GthreeMaterial *material)
 {
-  GthreeMaterialClass *class = GTHREE_MATERIAL_GET_CLASS(material);
-
-  if (class->needs_camera_pos)
-    return class->needs_camera_pos (material);
-
   return FALSE;
 }
 
 gboolean
 gthree_material_needs_view_matrix (GthreeMaterial *material)
 {
-  GthreeMaterialClass *class = GTHREE_MATERIAL_GET_CLASS(material);
-
-  if (class->needs_view_matrix)
-    return class->needs_view_matrix (material);
-
   return FALSE;
 }
 
@@ -345,6 +345,14 @@ gthree_material_get_needs_update (GthreeMaterial *material)
   return priv->needs_update;
 }
 
+guint
+gthree_material_get_id (GthreeMaterial *material)
+{
+  GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+
+  return priv->id;
+}
+
 void
 gthree_material_set_needs_update (GthreeMaterial *material, gboolean needs_update)
 {
@@ -353,6 +361,39 @@ gthree_material_set_needs_update (GthreeMaterial *material, gboolean needs_updat
   priv->needs_update = needs_update;
 }
 
+GthreeProgram *
+gthree_material_get_program_variant (GthreeMaterial *material,
+                                     guint           variant)
+{
+  GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+
+  g_return_val_if_fail (variant < GTHREE_N_PROGRAM_VARIANTS, NULL);
+
+  return priv->program_variants[variant];
+}
+
+void
+gthree_material_set_program_variant (GthreeMaterial *material,
+                                     guint           variant,
+                                     GthreeProgram  *program)
+{
+  GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+
+  g_return_if_fail (variant < GTHREE_N_PROGRAM_VARIANTS);
+
+  g_set_object (&priv->program_variants[variant], program);
+}
+
+void
+gthree_material_clear_program_variants (GthreeMaterial *material)
+{
+  GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+  int i;
+
+  for (i = 0; i < GTHREE_N_PROGRAM_VARIANTS; i++)
+    g_clear_object (&priv->program_variants[i]);
+}
+
 void
 gthree_material_set_blend_mode (GthreeMaterial       *material,
                                 GthreeBlendMode       mode,
@@ -366,6 +407,7 @@ gthree_material_set_blend_mode (GthreeMaterial       *material,
   priv->blend_equation = equation;
   priv->blend_src_factor = src_factor;
   priv->blend_dst_factor = dst_factor;
+  priv->render_state = NULL;
 
   priv->needs_update = TRUE;
 }
@@ -397,6 +439,7 @@ gthree_material_set_polygon_offset (GthreeMaterial       *material,
   priv->polygon_offset = polygon_offset;
   priv->polygon_offset_factor = factor;
   priv->polygon_offset_units = units;
+  priv->render_state = NULL;
 
   priv->needs_update = TRUE;
 }
@@ -416,6 +459,7 @@ gthree_material_set_depth_test (GthreeMaterial       *material,
   GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
 
   priv->depth_test = depth_test;
+  priv->render_state = NULL;
 
   priv->needs_update = TRUE;
 }
@@ -435,11 +479,33 @@ gthree_material_set_depth_write (GthreeMaterial       *material,
   GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
 
   priv->depth_write = depth_write;
+  priv->render_state = NULL;
 
   priv->needs_update = TRUE;
 }
 
 
+/* Draws objects with the material in a depth only pass first, so the
+ * fragment shader then only runs for the visible fragments. Worth it
+ * for expensive shaders with a lot of overdraw. Ignored for materials
+ * without depth test and write, wireframes and alpha testing. */
+void
+gthree_material_set_depth_prepass (GthreeMaterial *material,
+                                   gboolean        depth_prepass)
+{
+  GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+
+  priv->depth_prepass = !!depth_prepass;
+}
+
+gboolean
+gthree_material_get_depth_prepass (GthreeMaterial *material)
+{
+  GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+
+  return priv->depth_prepass;
+}
+
 GthreeSide
 gthree_material_get_side (GthreeMaterial *material)
 {
@@ -455,10 +521,103 @@ gthree_material_set_side (GthreeMaterial *material,
   GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
 
   priv->side = side;
+  priv->render_state = NULL;
 
   priv->needs_update = TRUE;
 }
 
+static guint
+render_state_hash (gconstpointer key)
+{
+  const GthreeRenderState *state = key;
+  guint hash;
+
+  hash = state->blend_mode;
+  hash = hash * 31 + state->blend_equation;
+  hash = hash * 31 + state->blend_src_factor;
+  hash = hash * 31 + state->blend_dst_factor;
+  hash = hash * 31 + state->side;
+  hash = hash * 31 + (state->depth_test | state->depth_write << 1 | state->polygon_offset << 2);
+  hash = hash * 31 + (gint)(state->polygon_offset_factor * 1024);
+  hash = hash * 31 + (gint)(state->polygon_offset_units * 1024);
+
+  return hash;
+}
+
+static gboolean
+render_state_equal (gconstpointer a, gconstpointer b)
+{
+  const GthreeRenderState *sa = a;
+  const GthreeRenderState *sb = b;
+
+  return
+    sa->blend_mode == sb->blend_mode &&
+    sa->blend_equation == sb->blend_equation &&
+    sa->blend_src_factor == sb->blend_src_factor &&
+    sa->blend_dst_factor == sb->blend_dst_factor &&
+    sa->side == sb->side &&
+    sa->depth_test == sb->depth_test &&
+    sa->depth_write == sb->depth_write &&
+    sa->polygon_offset == sb->polygon_offset &&
+    sa->polygon_offset_factor == sb->polygon_offset_factor &&
+    sa->polygon_offset_units == sb->polygon_offset_units;
+}
+
+/* Blocks are never freed, there are only ever a handful of distinct ones */
+static const GthreeRenderState *
+render_state_intern (const GthreeRenderState *state)
+{
+  static GHashTable *render_states = NULL;
+  static guint next_id = 1;
+  GthreeRenderState *interned;
+
+  if (render_states == NULL)
+    render_states = g_hash_table_new (render_state_hash, render_state_equal);
+
+  interned = g_hash_table_lookup (render_states, state);
+  if (interned == NULL)
+    {
+      interned = g_memdup (state, sizeof (GthreeRenderState));
+      interned->id = next_id++;
+      g_hash_table_add (render_states, interned);
+    }
+
+  return interned;
+}
+
+const GthreeRenderState *
+gthree_material_get_render_state (GthreeMaterial *material)
+{
+  GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+  GthreeRenderState state = { 0 };
+
+  if (priv->render_state)
+    return priv->render_state;
+
+  /* Only keep the parts GL will look at, so equivalent materials
+     end up sharing a block */
+  state.blend_mode = priv->blend_mode;
+  if (priv->blend_mode == GTHREE_BLEND_CUSTOM)
+    {
+      state.blend_equation = priv->blend_equation;
+      state.blend_src_factor = priv->blend_src_factor;
+      state.blend_dst_factor = priv->blend_dst_factor;
+    }
+  state.side = priv->side;
+  state.depth_test = !!priv->depth_test;
+  state.depth_write = !!priv->depth_write;
+  state.polygon_offset = !!priv->polygon_offset;
+  if (priv->polygon_offset)
+    {
+      state.polygon_offset_factor = priv->polygon_offset_factor;
+      state.polygon_offset_units = priv->polygon_offset_units;
+    }
+
+  priv->render_state = render_state_intern (&state);
+
+  return priv->render_state;
+}
+
 GthreeShader *
 gthree_material_get_shader (GthreeMaterial *material)
 {
@@ -47,6 +47,7 @@ typedef struct {
                                   int                   attribute_location,
                                   GQuark                attribute);
 
+  /* Unused, the camera comes from the frame uniform block */
   gboolean           (*needs_view_matrix) (GthreeMaterial *material);
   gboolean           (*needs_camera_pos) (GthreeMaterial *material);
   gboolean           (*needs_lights)  (GthreeMaterial *material);
@@ -96,6 +97,9 @@ void            gthree_material_set_depth_test           (GthreeMaterial       *
 gboolean        gthree_material_get_depth_write          (GthreeMaterial       *material);
 void            gthree_material_set_depth_write          (GthreeMaterial       *material,
                                                           gboolean              depth_write);
+gboolean        gthree_material_get_depth_prepass        (GthreeMaterial       *material);
+void            gthree_material_set_depth_prepass        (GthreeMaterial       *material,
+                                                          gboolean              depth_prepass);
 float           gthree_material_get_alpha_test           (GthreeMaterial       *material);
 void            gthree_material_set_alpha_test           (GthreeMaterial       *material,
                                                           float                 alpha_test);
@@ -117,8 +121,11 @@ void            gthree_material_load_default_attribute   (GthreeMaterial       *
 gboolean          gthree_material_get_needs_update (GthreeMaterial *material);
 void              gthree_material_set_needs_update (GthreeMaterial *material,
                                                     gboolean needs_update);
+guint             gthree_material_get_id           (GthreeMaterial *material);
 
+G_GNUC_DEPRECATED
 gboolean          gthree_material_needs_camera_pos (GthreeMaterial *material);
+G_GNUC_DEPRECATED
 gboolean          gthree_material_needs_view_matrix (GthreeMaterial *material);
 gboolean          gthree_material_needs_uv      (GthreeMaterial *material);
 gboolean          gthree_material_needs_lights  (GthreeMaterial *material);
@@ -45,6 +45,22 @@ gthree_mesh_init (GthreeMesh *mesh)
 {
 }
 
+GthreeGeometry *
+gthree_mesh_get_geometry (GthreeMesh *mesh)
+{
+  GthreeMeshPrivate *priv = gthree_mesh_get_instance_private (mesh);
+
+  return priv->geometry;
+}
+
+GthreeMaterial *
+gthree_mesh_get_material (GthreeMesh *mesh)
+{
+  GthreeMeshPrivate *priv = gthree_mesh_get_instance_private (mesh);
+
+  return priv->material;
+}
+
 static void
 gthree_mesh_finalize (GObject *obj)
 {
@@ -78,6 +94,10 @@ gthree_mesh_realize (GthreeObject *object)
 
   gthree_geometry_realize (priv->geometry, priv->material);
   gthree_geometry_add_buffers_to_object (priv->geometry, priv->material, object);
+
+  /* The bounding sphere is computed lazily, make sure that doesn't
+     happen from several traversal threads at once */
+  gthree_geometry_get_bounding_sphere (priv->geometry);
 }
 
 static void
@@ -104,6 +124,21 @@ gthree_mesh_in_frustum (GthreeObject *object,
   return graphene_frustum_intersects_sphere (frustum, &sphere);
 }
 
+static gboolean
+gthree_mesh_get_bounding_sphere (GthreeObject      *object,
+                                 graphene_sphere_t *sphere)
+{
+  GthreeMesh *mesh = GTHREE_MESH (object);
+  GthreeMeshPrivate *priv = gthree_mesh_get_instance_private (mesh);
+
+  if (!priv->geometry)
+    return FALSE;
+
+  *sphere = *gthree_geometry_get_bounding_sphere (priv->geometry);
+
+  return TRUE;
+}
+
 static gboolean
 gthree_mesh_real_has_attribute_data (GthreeObject *object,
                                      GQuark        attribute)
@@ -183,6 +218,7 @@ gthree_mesh_class_init (GthreeMeshClass *klass)
   gobject_class->finalize = gthree_mesh_finalize;
 
   object_class->in_frustum = gthree_mesh_in_frustum;
+  object_class->get_bounding_sphere = gthree_mesh_get_bounding_sphere;
   object_class->has_attribute_data = gthree_mesh_real_has_attribute_data;
   object_class->update = gthree_mesh_update;
   object_class->realize = gthree_mesh_realize;
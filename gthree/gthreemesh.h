@@ -31,6 +31,9 @@ GthreeMesh *gthree_mesh_new (GthreeGeometry *geometry,
                              GthreeMaterial *material);
 GType gthree_mesh_get_type (void) G_GNUC_CONST;
 
+GthreeGeometry *gthree_mesh_get_geometry (GthreeMesh *mesh);
+GthreeMaterial *gthree_mesh_get_material (GthreeMesh *mesh);
+
 G_END_DECLS
 
 #endif /* __GTHREE_MESH_H__ */
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <string.h>
 #include <epoxy/gl.h>
 
 #include "gthreeobjectprivate.h"
@@ -15,6 +16,9 @@ enum
 
 static guint object_signals[LAST_SIGNAL] = { 0, };
 
+/* Bumped on every change to any object graph */
+static guint graph_serial;
+
 typedef struct {
   graphene_vec3_t position;
   graphene_quaternion_t quaternion;
@@ -26,7 +30,8 @@ typedef struct {
   graphene_matrix_t world_matrix;
 
   graphene_matrix_t model_view_matrix;
-  graphene_matrix_t normal_matrix;
+  float normal_matrix[9];
+  graphene_matrix_t view_matrix; /* the one model_view_matrix is for */
 
   gboolean visible;
 
@@ -40,17 +45,29 @@ typedef struct {
   gint n_children;
   gint age;
 
+  guint id; /* never reused, unlike the address */
+
   guint realized : 1;
   guint in_destruction : 1;
   guint world_matrix_need_update : 1;
   guint matrix_auto_update : 1;
+  guint matrix_need_update : 1;
+  guint descendants_need_update : 1; /* also set on all ancestors */
+  guint model_view_need_update : 1; /* world matrix changed */
+  guint model_view_stale : 1;
+  guint normal_matrix_stale : 1;
 
   guint frustum_culled : 1;
+  guint occluder : 1;
+  guint cast_shadow : 1;
+  guint receive_shadow : 1;
 
   /* Render state */
 
   GList *buffer_objects;
 
+  GthreeOctreeEntry *octree_entry;
+
 } GthreeObjectPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GthreeObject, gthree_object, G_TYPE_OBJECT);
@@ -91,8 +108,12 @@ static void
 gthree_object_init (GthreeObject *object)
 {
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+  static guint next_id = 1;
 
+  priv->id = next_id++;
   priv->matrix_auto_update = TRUE;
+  priv->matrix_need_update = TRUE;
+  priv->model_view_need_update = TRUE;
   priv->visible = TRUE;
   priv->frustum_culled = TRUE;
 
@@ -175,6 +196,29 @@ gthree_object_class_init (GthreeObjectClass *klass)
 
 }
 
+/* Lets the next world matrix update know it has to visit object. The
+ * ancestors are marked too, so it can skip subtrees where nothing
+ * changed. */
+static void
+mark_need_update (GthreeObject *object)
+{
+  GthreeObject *parent;
+
+  for (parent = PRIV (object)->parent;
+       parent != NULL && !PRIV (parent)->descendants_need_update;
+       parent = PRIV (parent)->parent)
+    PRIV (parent)->descendants_need_update = TRUE;
+}
+
+static void
+matrix_changed (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  priv->matrix_need_update = TRUE;
+  mark_need_update (object);
+}
+
 void
 gthree_object_set_matrix_auto_update (GthreeObject *object,
                                       gboolean auto_update)
@@ -182,6 +226,8 @@ gthree_object_set_matrix_auto_update (GthreeObject *object,
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
 
   priv->matrix_auto_update = !! auto_update;
+  if (auto_update)
+    matrix_changed (object);
 }
 
 gboolean
@@ -212,6 +258,115 @@ gthree_object_is_in_frustum (GthreeObject *object,
   return TRUE;
 }
 
+/* Occluders are rasterized for the renderer's software occlusion
+ * culling, this only has an effect on meshes. Pick few, large and
+ * simple ones. */
+void
+gthree_object_set_is_occluder (GthreeObject *object,
+                               gboolean      occluder)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  priv->occluder = !!occluder;
+}
+
+gboolean
+gthree_object_get_is_occluder (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return priv->occluder;
+}
+
+/* Only has an effect with gthree_renderer_set_shadow_map_enabled() and
+ * lights that cast shadows */
+void
+gthree_object_set_cast_shadow (GthreeObject *object,
+                               gboolean      cast_shadow)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  priv->cast_shadow = !!cast_shadow;
+}
+
+gboolean
+gthree_object_get_cast_shadow (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return priv->cast_shadow;
+}
+
+void
+gthree_object_set_receive_shadow (GthreeObject *object,
+                                  gboolean      receive_shadow)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  priv->receive_shadow = !!receive_shadow;
+}
+
+gboolean
+gthree_object_get_receive_shadow (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return priv->receive_shadow;
+}
+
+/* Returns FALSE if the object has no bounds */
+gboolean
+gthree_object_get_world_bounding_sphere (GthreeObject      *object,
+                                         graphene_sphere_t *sphere)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+  GthreeObjectClass *class = GTHREE_OBJECT_GET_CLASS(object);
+  graphene_sphere_t local;
+
+  if (class->get_bounding_sphere == NULL ||
+      !class->get_bounding_sphere (object, &local))
+    return FALSE;
+
+  graphene_matrix_transform_sphere (&priv->world_matrix, &local, sphere);
+
+  return TRUE;
+}
+
+/* Subclasses call this when their object space bounds change */
+void
+gthree_object_bounds_changed (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  if (priv->octree_entry)
+    gthree_octree_entry_mark_dirty (priv->octree_entry);
+}
+
+guint
+gthree_object_get_id (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return priv->id;
+}
+
+GthreeOctreeEntry *
+gthree_object_get_octree_entry (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return priv->octree_entry;
+}
+
+void
+gthree_object_set_octree_entry (GthreeObject      *object,
+                                GthreeOctreeEntry *entry)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  priv->octree_entry = entry;
+}
+
 gboolean
 gthree_object_has_attribute_data (GthreeObject                *object,
                                   GQuark                       attribute)
@@ -236,6 +391,7 @@ gthree_object_look_at (GthreeObject *object,
   graphene_matrix_init_look_at (&m, &priv->position, &vec, &priv->up);
   graphene_quaternion_init_from_matrix (&priv->quaternion, &m);
   graphene_euler_init_from_matrix (&priv->euler, &m, GRAPHENE_EULER_ORDER_DEFAULT);
+  matrix_changed (object);
 }
 
 void
@@ -245,6 +401,7 @@ gthree_object_set_position (GthreeObject *object,
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
 
   graphene_point3d_to_vec3 (pos, &priv->position);
+  matrix_changed (object);
 }
 
 graphene_point3d_t *
@@ -263,6 +420,7 @@ gthree_object_set_scale (GthreeObject                *object,
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
 
   graphene_point3d_to_vec3 (scale, &priv->scale);
+  matrix_changed (object);
 }
 
 void
@@ -273,6 +431,7 @@ gthree_object_set_quaternion (GthreeObject *object,
 
   graphene_quaternion_init_from_quaternion (&priv->quaternion, q);
   graphene_euler_init_from_quaternion (&priv->euler, q, GRAPHENE_EULER_ORDER_DEFAULT);
+  matrix_changed (object);
 }
 
 const graphene_quaternion_t *
@@ -292,6 +451,7 @@ gthree_object_set_rotation (GthreeObject *object,
 
   priv->euler = *rot;
   graphene_quaternion_init_from_euler (&priv->quaternion, rot);
+  matrix_changed (object);
 }
 
 const graphene_euler_t *
@@ -302,10 +462,11 @@ gthree_object_get_rotation (GthreeObject *object)
   return &priv->euler;
 }
 
-void
-gthree_object_update_matrix (GthreeObject *object)
+/* Doesn't touch the ancestors, so this is safe from the traversal
+ * threads */
+static void
+update_local_matrix (GthreeObjectPrivate *priv)
 {
-  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
   graphene_point3d_t pos;
 
   graphene_quaternion_to_matrix (&priv->quaternion, &priv->matrix);
@@ -316,9 +477,19 @@ gthree_object_update_matrix (GthreeObject *object)
   graphene_point3d_init_from_vec3 (&pos, &priv->position);
   graphene_matrix_translate  (&priv->matrix, &pos);
 
+  priv->matrix_need_update = FALSE;
   priv->world_matrix_need_update = TRUE;
 }
 
+void
+gthree_object_update_matrix (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  update_local_matrix (priv);
+  mark_need_update (object);
+}
+
 const graphene_matrix_t *
 gthree_object_get_world_matrix (GthreeObject *object)
 {
@@ -327,15 +498,20 @@ gthree_object_get_world_matrix (GthreeObject *object)
   return &priv->world_matrix;
 }
 
-void
-gthree_object_update_matrix_world (GthreeObject *object,
-                                   gboolean force)
+/* Returns whether the world matrix changed, in which case the ones of
+ * the children must be forced to update too. The children still have
+ * to be visited if gthree_object_needs_matrix_world_update() said so
+ * before. */
+gboolean
+gthree_object_update_own_matrix_world (GthreeObject *object,
+                                       gboolean force)
 {
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
-  GthreeObject *child;
 
-  if (priv->matrix_auto_update)
-    gthree_object_update_matrix (object);
+  priv->descendants_need_update = FALSE;
+
+  if (priv->matrix_auto_update && priv->matrix_need_update)
+    update_local_matrix (priv);
 
   if (priv->world_matrix_need_update || force)
     {
@@ -347,25 +523,147 @@ gthree_object_update_matrix_world (GthreeObject *object,
                                   &priv->world_matrix);
 
       priv->world_matrix_need_update = FALSE;
-      force = TRUE;
+      priv->model_view_need_update = TRUE;
+
+      if (priv->octree_entry)
+        gthree_octree_entry_mark_dirty (priv->octree_entry);
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+guint
+gthree_object_get_graph_serial (void)
+{
+  return graph_serial;
+}
+
+/* For updating the matrices somewhere else, see GthreeTransforms. This
+ * clears GTHREE_TRANSFORM_DESCENDANTS_CHANGED, the caller has to visit
+ * the children. */
+GthreeTransformChanges
+gthree_object_get_transform_changes (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+  GthreeTransformChanges changes = 0;
+
+  if (priv->matrix_auto_update && priv->matrix_need_update)
+    changes |= GTHREE_TRANSFORM_LOCAL_CHANGED;
+  if (priv->world_matrix_need_update)
+    changes |= GTHREE_TRANSFORM_WORLD_CHANGED;
+  if (priv->descendants_need_update)
+    changes |= GTHREE_TRANSFORM_DESCENDANTS_CHANGED;
+
+  priv->descendants_need_update = FALSE;
+
+  return changes;
+}
+
+void
+gthree_object_get_transform (GthreeObject *object,
+                             float        *position,
+                             float        *quaternion,
+                             float        *scale)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+  graphene_vec4_t q;
+
+  graphene_vec3_to_float (&priv->position, position);
+  graphene_quaternion_to_vec4 (&priv->quaternion, &q);
+  graphene_vec4_to_float (&q, quaternion);
+  graphene_vec3_to_float (&priv->scale, scale);
+}
+
+void
+gthree_object_get_matrix_floats (GthreeObject *object,
+                                 float        *dest)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  graphene_matrix_to_float (&priv->matrix, dest);
+}
+
+/* matrix may be NULL if the local matrix didn't change */
+void
+gthree_object_set_computed_matrices (GthreeObject *object,
+                                     const float  *matrix,
+                                     const float  *world_matrix)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  if (matrix)
+    {
+      graphene_matrix_init_from_float (&priv->matrix, matrix);
+      priv->matrix_need_update = FALSE;
     }
 
+  graphene_matrix_init_from_float (&priv->world_matrix, world_matrix);
+  priv->world_matrix_need_update = FALSE;
+  priv->model_view_need_update = TRUE;
+
+  if (priv->octree_entry)
+    gthree_octree_entry_mark_dirty (priv->octree_entry);
+}
+
+/* Whether the world matrix of object or any descendant is out of date,
+ * when the parent's didn't change */
+gboolean
+gthree_object_needs_matrix_world_update (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return
+    priv->world_matrix_need_update ||
+    priv->descendants_need_update ||
+    (priv->matrix_auto_update && priv->matrix_need_update);
+}
+
+void
+gthree_object_update_matrix_world (GthreeObject *object,
+                                   gboolean force)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+  GthreeObject *child;
+
+  if (!force && !gthree_object_needs_matrix_world_update (object))
+    return;
+
+  force = gthree_object_update_own_matrix_world (object, force);
+
   for (child = priv->first_child;
        child != NULL;
        child = PRIV (child)->next_sibling)
     gthree_object_update_matrix_world (child, force);
 }
 
+/* Only records the camera, the matrices are computed when a program
+   asks for them, and kept as long as neither input changes */
 void
 gthree_object_update_matrix_view (GthreeObject *object,
                                   const graphene_matrix_t *camera_matrix)
 {
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
 
-  graphene_matrix_multiply (&priv->world_matrix, camera_matrix, &priv->model_view_matrix);
+  if (!priv->model_view_need_update &&
+      memcmp (camera_matrix, &priv->view_matrix, sizeof (graphene_matrix_t)) == 0)
+    return;
+
+  priv->view_matrix = *camera_matrix;
+  priv->model_view_need_update = FALSE;
+  priv->model_view_stale = TRUE;
+  priv->normal_matrix_stale = TRUE;
+}
+
+static void
+ensure_model_view_matrix (GthreeObjectPrivate *priv)
+{
+  if (!priv->model_view_stale)
+    return;
 
-  graphene_matrix_inverse (&priv->model_view_matrix, &priv->normal_matrix);
-  graphene_matrix_transpose (&priv->normal_matrix, &priv->normal_matrix);
+  priv->model_view_stale = FALSE;
+  graphene_matrix_multiply (&priv->world_matrix, &priv->view_matrix, &priv->model_view_matrix);
 }
 
 void
@@ -374,21 +672,75 @@ gthree_object_get_model_view_matrix_floats (GthreeObject *object,
 {
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
 
+  ensure_model_view_matrix (priv);
   graphene_matrix_to_float (&priv->model_view_matrix, dest);
 }
 
+/* If the upper 3x3 is a rotation times a uniform scale s (the common
+   case), its inverse transpose is just itself divided by s² */
+static gboolean
+normal_matrix_from_similarity (const float *m, float *dest)
+{
+  const float eps = 1e-5f;
+  float l0, l1, l2, d01, d02, d12, inv;
+  int i;
+
+  l0 = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+  l1 = m[4] * m[4] + m[5] * m[5] + m[6] * m[6];
+  l2 = m[8] * m[8] + m[9] * m[9] + m[10] * m[10];
+  d01 = m[0] * m[4] + m[1] * m[5] + m[2] * m[6];
+  d02 = m[0] * m[8] + m[1] * m[9] + m[2] * m[10];
+  d12 = m[4] * m[8] + m[5] * m[9] + m[6] * m[10];
+
+  if (l0 <= 0 ||
+      fabsf (l1 - l0) > eps * l0 || fabsf (l2 - l0) > eps * l0 ||
+      fabsf (d01) > eps * l0 || fabsf (d02) > eps * l0 || fabsf (d12) > eps * l0)
+    return FALSE;
+
+  inv = 1.0f / l0;
+  for (i = 0; i < 3; i++)
+    {
+      dest[i * 3 + 0] = m[i * 4 + 0] * inv;
+      dest[i * 3 + 1] = m[i * 4 + 1] * inv;
+      dest[i * 3 + 2] = m[i * 4 + 2] * inv;
+    }
+
+  return TRUE;
+}
+
+static void
+ensure_normal_matrix (GthreeObjectPrivate *priv)
+{
+  graphene_matrix_t normal_matrix;
+  float mv[16], n[16];
+
+  if (!priv->normal_matrix_stale)
+    return;
+
+  priv->normal_matrix_stale = FALSE;
+  ensure_model_view_matrix (priv);
+  graphene_matrix_to_float (&priv->model_view_matrix, mv);
+
+  if (normal_matrix_from_similarity (mv, priv->normal_matrix))
+    return;
+
+  graphene_matrix_inverse (&priv->model_view_matrix, &normal_matrix);
+  graphene_matrix_transpose (&normal_matrix, &normal_matrix);
+  graphene_matrix_to_float (&normal_matrix, n);
+
+  priv->normal_matrix[0] = n[0];  priv->normal_matrix[1] = n[1]; priv->normal_matrix[2] = n[2];
+  priv->normal_matrix[3] = n[4];  priv->normal_matrix[4] = n[5]; priv->normal_matrix[5] = n[6];
+  priv->normal_matrix[6] = n[8];  priv->normal_matrix[7] = n[9]; priv->normal_matrix[8] = n[10];
+}
+
 void
 gthree_object_get_normal_matrix3_floats (GthreeObject *object,
                                          float *dest)
 {
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
-  float dest4[16];
-
-  graphene_matrix_to_float (&priv->normal_matrix, dest4);
 
-  dest[0] = dest4[0];  dest[1] = dest4[1]; dest[2] = dest4[2];
-  dest[3] = dest4[4];  dest[4] = dest4[5]; dest[5] = dest4[6];
-  dest[6] = dest4[8];  dest[7] = dest4[9]; dest[8] = dest4[10];
+  ensure_normal_matrix (priv);
+  memcpy (dest, priv->normal_matrix, sizeof (priv->normal_matrix));
 }
 
 void
@@ -428,6 +780,9 @@ gthree_object_add_child (GthreeObject              *object,
   g_object_ref_sink (child);
 
   child_priv->parent = object;
+  child_priv->world_matrix_need_update = TRUE;
+  mark_need_update (child);
+  graph_serial++;
 
   last_child = priv->last_child;
   child_priv->prev_sibling = last_child;
@@ -510,6 +865,7 @@ gthree_object_remove_child (GthreeObject                 *object,
   child_priv->parent = NULL;
   child_priv->prev_sibling = NULL;
   child_priv->next_sibling = NULL;
+  graph_serial++;
 
   priv->n_children -= 1;
 
@@ -31,6 +31,8 @@ typedef struct {
 
   gboolean (* in_frustum)       (GthreeObject             *object,
                                  const graphene_frustum_t *frustum);
+  gboolean (* get_bounding_sphere) (GthreeObject          *object,
+                                    graphene_sphere_t     *sphere);
 
   void (* parent_set)           (GthreeObject          *object,
                                  GthreeObject          *old_parent);
@@ -91,6 +93,17 @@ gboolean      gthree_object_get_visible          (GthreeObject *object);
 gboolean      gthree_object_get_is_frustum_culled(GthreeObject *object);
 gboolean      gthree_object_is_in_frustum        (GthreeObject *object,
                                                   const graphene_frustum_t *frustum);
+gboolean      gthree_object_get_world_bounding_sphere (GthreeObject      *object,
+                                                       graphene_sphere_t *sphere);
+void          gthree_object_set_is_occluder      (GthreeObject *object,
+                                                  gboolean      occluder);
+gboolean      gthree_object_get_is_occluder      (GthreeObject *object);
+void          gthree_object_set_cast_shadow      (GthreeObject *object,
+                                                  gboolean      cast_shadow);
+gboolean      gthree_object_get_cast_shadow      (GthreeObject *object);
+void          gthree_object_set_receive_shadow   (GthreeObject *object,
+                                                  gboolean      receive_shadow);
+gboolean      gthree_object_get_receive_shadow   (GthreeObject *object);
 
 void          gthree_object_add_child            (GthreeObject *object,
                                                   GthreeObject *child);
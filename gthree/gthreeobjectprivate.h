@@ -4,14 +4,23 @@
 #include <gthree/gthreeobject.h>
 #include <gthree/gthreebufferprivate.h>
 #include <gthree/gthreematerial.h>
+#include <gthree/gthreeoctreeprivate.h>
 
 typedef struct {
   GthreeObject *object;
   GthreeBuffer *buffer;
   float z;
+  guint64 sort_key;
   GthreeMaterial *material;
+  guint occlusion_query; /* draw conditionally on this, if non-zero */
 } GthreeObjectBuffer;
 
+typedef enum {
+  GTHREE_TRANSFORM_LOCAL_CHANGED = 1 << 0, /* position, rotation or scale */
+  GTHREE_TRANSFORM_WORLD_CHANGED = 1 << 1,
+  GTHREE_TRANSFORM_DESCENDANTS_CHANGED = 1 << 2,
+} GthreeTransformChanges;
+
 G_BEGIN_DECLS
 
 GList *gthree_object_get_object_buffers (GthreeObject       *object);
@@ -24,6 +33,28 @@ void   gthree_object_remove_buffers     (GthreeObject       *object);
 
 GthreeMaterial * gthree_object_buffer_resolve_material (GthreeObjectBuffer *object_buffer);
 
+gboolean gthree_object_update_own_matrix_world   (GthreeObject *object,
+                                                  gboolean      force);
+gboolean gthree_object_needs_matrix_world_update (GthreeObject *object);
+guint    gthree_object_get_graph_serial          (void);
+
+GthreeTransformChanges gthree_object_get_transform_changes (GthreeObject *object);
+void                   gthree_object_get_transform         (GthreeObject *object,
+                                                            float        *position,
+                                                            float        *quaternion,
+                                                            float        *scale);
+void                   gthree_object_get_matrix_floats     (GthreeObject *object,
+                                                            float        *dest);
+void                   gthree_object_set_computed_matrices (GthreeObject *object,
+                                                            const float  *matrix,
+                                                            const float  *world_matrix);
+void     gthree_object_bounds_changed            (GthreeObject *object);
+guint    gthree_object_get_id                    (GthreeObject *object);
+
+GthreeOctreeEntry *gthree_object_get_octree_entry (GthreeObject      *object);
+void               gthree_object_set_octree_entry (GthreeObject      *object,
+                                                   GthreeOctreeEntry *entry);
+
 G_END_DECLS
 
 #endif /* __GTHREE_OBJECT_PRIVATE_H__ */
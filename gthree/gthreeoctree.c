@@ -0,0 +1,751 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "gthreeoctreeprivate.h"
+#include "gthreeobjectprivate.h"
+
+#define OCTREE_MAX_DEPTH 10
+#define OCTREE_MAX_GROW 64
+#define OCTREE_MIN_ROOT_HALF_SIZE 1.0f
+
+typedef struct _OctreeNode OctreeNode;
+
+struct _OctreeNode {
+  graphene_point3d_t center;
+  float half_size; /* of the cell, the loose bounds are twice that */
+  int depth; /* negative once the root has grown */
+
+  OctreeNode *parent;
+  OctreeNode *children[8];
+
+  GPtrArray *entries; /* GthreeOctreeEntry, NULL until used */
+  int n_entries; /* in this subtree */
+};
+
+struct _GthreeOctreeEntry {
+  GthreeOctree *octree;
+  GthreeObject *object;
+
+  OctreeNode *node; /* NULL if in unbounded */
+  int index; /* in node->entries or unbounded */
+
+  graphene_point3d_t center;
+  float radius;
+
+  gint dirty;
+  GthreeOctreeEntry *next_dirty;
+};
+
+struct _GthreeOctree {
+  OctreeNode *root;
+  GPtrArray *unbounded; /* GthreeOctreeEntry, not frustum culled or without bounds */
+  GthreeOctreeEntry *dirty;
+};
+
+enum {
+  OUTSIDE,
+  INTERSECTS,
+  INSIDE,
+};
+
+static OctreeNode *
+node_new (OctreeNode *parent,
+          const graphene_point3d_t *center,
+          float half_size,
+          int depth)
+{
+  OctreeNode *node = g_slice_new0 (OctreeNode);
+
+  node->parent = parent;
+  node->center = *center;
+  node->half_size = half_size;
+  node->depth = depth;
+
+  return node;
+}
+
+static void
+node_free (OctreeNode *node)
+{
+  int i;
+
+  for (i = 0; i < 8; i++)
+    if (node->children[i])
+      node_free (node->children[i]);
+
+  if (node->entries)
+    g_ptr_array_free (node->entries, TRUE);
+
+  g_slice_free (OctreeNode, node);
+}
+
+static int
+node_child_index (OctreeNode *node,
+                  const graphene_point3d_t *point)
+{
+  return
+    (point->x >= node->center.x ? 1 : 0) |
+    (point->y >= node->center.y ? 2 : 0) |
+    (point->z >= node->center.z ? 4 : 0);
+}
+
+static OctreeNode *
+node_get_child (OctreeNode *node,
+                int index)
+{
+  graphene_point3d_t center;
+  float quarter = node->half_size / 2;
+
+  if (node->children[index])
+    return node->children[index];
+
+  center.x = node->center.x + ((index & 1) ? quarter : -quarter);
+  center.y = node->center.y + ((index & 2) ? quarter : -quarter);
+  center.z = node->center.z + ((index & 4) ? quarter : -quarter);
+
+  node->children[index] = node_new (node, &center, quarter, node->depth + 1);
+
+  return node->children[index];
+}
+
+static gboolean
+node_fits (OctreeNode *node,
+           const graphene_point3d_t *center,
+           float radius)
+{
+  return
+    radius <= node->half_size &&
+    fabsf (center->x - node->center.x) <= node->half_size &&
+    fabsf (center->y - node->center.y) <= node->half_size &&
+    fabsf (center->z - node->center.z) <= node->half_size;
+}
+
+static gboolean
+node_can_descend (GthreeOctree *octree,
+                  OctreeNode *node,
+                  float radius)
+{
+  return
+    radius <= node->half_size / 2 &&
+    node->depth - octree->root->depth < OCTREE_MAX_DEPTH;
+}
+
+static void
+node_add_entry (OctreeNode *node,
+                GthreeOctreeEntry *entry)
+{
+  if (node->entries == NULL)
+    node->entries = g_ptr_array_new ();
+
+  entry->node = node;
+  entry->index = node->entries->len;
+  g_ptr_array_add (node->entries, entry);
+
+  for (; node != NULL; node = node->parent)
+    node->n_entries++;
+}
+
+static void
+remove_entry_fast (GPtrArray *entries,
+                   GthreeOctreeEntry *entry)
+{
+  g_ptr_array_remove_index_fast (entries, entry->index);
+  if (entry->index < entries->len)
+    ((GthreeOctreeEntry *)g_ptr_array_index (entries, entry->index))->index = entry->index;
+}
+
+static void
+node_remove_entry (GthreeOctree *octree,
+                   GthreeOctreeEntry *entry)
+{
+  OctreeNode *node = entry->node;
+  OctreeNode *parent;
+
+  remove_entry_fast (node->entries, entry);
+  entry->node = NULL;
+
+  for (parent = node; parent != NULL; parent = parent->parent)
+    parent->n_entries--;
+
+  /* Drop the cells that went empty */
+  while (node != octree->root && node->n_entries == 0)
+    {
+      parent = node->parent;
+      parent->children[node_child_index (parent, &node->center)] = NULL;
+      node_free (node);
+      node = parent;
+    }
+}
+
+/* Doubles the root, so that the old one becomes the octant of the new
+ * one that lies towards point. */
+static void
+grow_root (GthreeOctree *octree,
+           const graphene_point3d_t *point)
+{
+  OctreeNode *old_root = octree->root;
+  graphene_point3d_t center;
+  float h = old_root->half_size;
+
+  center.x = old_root->center.x + (point->x >= old_root->center.x ? h : -h);
+  center.y = old_root->center.y + (point->y >= old_root->center.y ? h : -h);
+  center.z = old_root->center.z + (point->z >= old_root->center.z ? h : -h);
+
+  octree->root = node_new (NULL, &center, h * 2, old_root->depth - 1);
+  octree->root->n_entries = old_root->n_entries;
+  octree->root->children[node_child_index (octree->root, &old_root->center)] = old_root;
+  old_root->parent = octree->root;
+}
+
+static void
+add_unbounded (GthreeOctree *octree,
+               GthreeOctreeEntry *entry)
+{
+  entry->node = NULL;
+  entry->index = octree->unbounded->len;
+  g_ptr_array_add (octree->unbounded, entry);
+}
+
+static void
+unlink_entry (GthreeOctree *octree,
+              GthreeOctreeEntry *entry)
+{
+  if (entry->node)
+    node_remove_entry (octree, entry);
+  else
+    remove_entry_fast (octree->unbounded, entry);
+}
+
+static gboolean
+entry_update_bounds (GthreeOctreeEntry *entry)
+{
+  graphene_sphere_t sphere;
+
+  if (!gthree_object_get_is_frustum_culled (entry->object) ||
+      !gthree_object_get_world_bounding_sphere (entry->object, &sphere))
+    return FALSE;
+
+  graphene_sphere_get_center (&sphere, &entry->center);
+  entry->radius = graphene_sphere_get_radius (&sphere);
+
+  return isfinite (entry->center.x) && isfinite (entry->center.y) &&
+    isfinite (entry->center.z) && isfinite (entry->radius);
+}
+
+static void
+link_entry (GthreeOctree *octree,
+            GthreeOctreeEntry *entry)
+{
+  OctreeNode *node;
+  int i;
+
+  if (!entry_update_bounds (entry))
+    {
+      add_unbounded (octree, entry);
+      return;
+    }
+
+  if (octree->root == NULL)
+    octree->root = node_new (NULL, &entry->center,
+                             MAX (entry->radius, OCTREE_MIN_ROOT_HALF_SIZE), 0);
+
+  for (i = 0; !node_fits (octree->root, &entry->center, entry->radius); i++)
+    {
+      if (i == OCTREE_MAX_GROW)
+        {
+          add_unbounded (octree, entry);
+          return;
+        }
+      grow_root (octree, &entry->center);
+    }
+
+  node = octree->root;
+  while (node_can_descend (octree, node, entry->radius))
+    node = node_get_child (node, node_child_index (node, &entry->center));
+
+  node_add_entry (node, entry);
+}
+
+GthreeOctree *
+gthree_octree_new (void)
+{
+  GthreeOctree *octree = g_new0 (GthreeOctree, 1);
+
+  octree->unbounded = g_ptr_array_new ();
+
+  return octree;
+}
+
+static void
+node_unset_entries (OctreeNode *node)
+{
+  int i;
+
+  if (node->entries)
+    for (i = 0; i < node->entries->len; i++)
+      {
+        GthreeOctreeEntry *entry = g_ptr_array_index (node->entries, i);
+
+        gthree_object_set_octree_entry (entry->object, NULL);
+        g_slice_free (GthreeOctreeEntry, entry);
+      }
+
+  for (i = 0; i < 8; i++)
+    if (node->children[i])
+      node_unset_entries (node->children[i]);
+}
+
+void
+gthree_octree_free (GthreeOctree *octree)
+{
+  int i;
+
+  for (i = 0; i < octree->unbounded->len; i++)
+    {
+      GthreeOctreeEntry *entry = g_ptr_array_index (octree->unbounded, i);
+
+      gthree_object_set_octree_entry (entry->object, NULL);
+      g_slice_free (GthreeOctreeEntry, entry);
+    }
+  g_ptr_array_free (octree->unbounded, TRUE);
+
+  if (octree->root)
+    {
+      node_unset_entries (octree->root);
+      node_free (octree->root);
+    }
+
+  g_free (octree);
+}
+
+void
+gthree_octree_insert (GthreeOctree *octree,
+                      GthreeObject *object)
+{
+  GthreeOctreeEntry *entry;
+
+  if (gthree_object_get_octree_entry (object) != NULL)
+    return;
+
+  entry = g_slice_new0 (GthreeOctreeEntry);
+  entry->octree = octree;
+  entry->object = object;
+
+  link_entry (octree, entry);
+
+  gthree_object_set_octree_entry (object, entry);
+}
+
+void
+gthree_octree_remove (GthreeOctree *octree,
+                      GthreeObject *object)
+{
+  GthreeOctreeEntry *entry = gthree_object_get_octree_entry (object);
+  GthreeOctreeEntry **l;
+
+  if (entry == NULL)
+    return;
+
+  if (entry->dirty)
+    {
+      for (l = &octree->dirty; *l != entry; l = &(*l)->next_dirty)
+        ;
+      *l = entry->next_dirty;
+    }
+
+  unlink_entry (octree, entry);
+  gthree_object_set_octree_entry (object, NULL);
+  g_slice_free (GthreeOctreeEntry, entry);
+}
+
+void
+gthree_octree_entry_mark_dirty (GthreeOctreeEntry *entry)
+{
+  GthreeOctree *octree = entry->octree;
+  GthreeOctreeEntry *head;
+
+  if (!g_atomic_int_compare_and_exchange (&entry->dirty, 0, 1))
+    return;
+
+  do
+    {
+      head = g_atomic_pointer_get (&octree->dirty);
+      entry->next_dirty = head;
+    }
+  while (!g_atomic_pointer_compare_and_exchange (&octree->dirty, head, entry));
+}
+
+/* Moves the objects whose bounds changed since the last update, must
+ * not run while gthree_octree_entry_mark_dirty() may be called. */
+void
+gthree_octree_update (GthreeOctree *octree)
+{
+  GthreeOctreeEntry *entry, *next;
+
+  entry = octree->dirty;
+  octree->dirty = NULL;
+
+  for (; entry != NULL; entry = next)
+    {
+      OctreeNode *node = entry->node;
+
+      next = entry->next_dirty;
+      entry->next_dirty = NULL;
+      entry->dirty = 0;
+
+      /* Small moves usually stay in the same cell */
+      if (node != NULL && entry_update_bounds (entry) &&
+          node_fits (node, &entry->center, entry->radius) &&
+          !node_can_descend (octree, node, entry->radius))
+        continue;
+
+      unlink_entry (octree, entry);
+      link_entry (octree, entry);
+    }
+}
+
+static int
+classify_box (const float planes[6][4],
+              const graphene_point3d_t *center,
+              float extent)
+{
+  int result = INSIDE;
+  int i;
+
+  for (i = 0; i < 6; i++)
+    {
+      const float *p = planes[i];
+      float d = p[0] * center->x + p[1] * center->y + p[2] * center->z + p[3];
+      float r = extent * (fabsf (p[0]) + fabsf (p[1]) + fabsf (p[2]));
+
+      if (d < -r)
+        return OUTSIDE;
+      if (d < r)
+        result = INTERSECTS;
+    }
+
+  return result;
+}
+
+static gboolean
+sphere_in_planes (const float planes[6][4],
+                  const graphene_point3d_t *center,
+                  float radius)
+{
+  int i;
+
+  for (i = 0; i < 6; i++)
+    {
+      const float *p = planes[i];
+
+      if (p[0] * center->x + p[1] * center->y + p[2] * center->z + p[3] < -radius)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+cull_node (OctreeNode *node,
+           const float planes[6][4],
+           gboolean inside,
+           GPtrArray *objects)
+{
+  int i;
+
+  if (node->n_entries == 0)
+    return;
+
+  if (!inside)
+    {
+      switch (classify_box (planes, &node->center, node->half_size * 2))
+        {
+        case OUTSIDE:
+          return;
+        case INSIDE:
+          inside = TRUE;
+          break;
+        default:
+          break;
+        }
+    }
+
+  if (node->entries)
+    for (i = 0; i < node->entries->len; i++)
+      {
+        GthreeOctreeEntry *entry = g_ptr_array_index (node->entries, i);
+
+        if (inside || sphere_in_planes (planes, &entry->center, entry->radius))
+          g_ptr_array_add (objects, entry->object);
+      }
+
+  for (i = 0; i < 8; i++)
+    if (node->children[i])
+      cull_node (node->children[i], planes, inside, objects);
+}
+
+/* The number of objects that can be frustum culled */
+int
+gthree_octree_get_n_bounded (GthreeOctree *octree)
+{
+  /* There is no root until the first bounded object is added */
+  if (octree->root == NULL)
+    return 0;
+
+  return octree->root->n_entries;
+}
+
+/* Adds the bounded objects that intersect the frustum to culled_objects,
+ * and the objects that must be checked on their own to unbounded_objects. */
+void
+gthree_octree_cull (GthreeOctree             *octree,
+                    const graphene_frustum_t *frustum,
+                    GPtrArray                *culled_objects,
+                    GPtrArray                *unbounded_objects)
+{
+  graphene_plane_t frustum_planes[6];
+  float planes[6][4];
+  int i;
+
+  graphene_frustum_get_planes (frustum, frustum_planes);
+  for (i = 0; i < 6; i++)
+    {
+      graphene_vec3_t normal;
+
+      graphene_plane_get_normal (&frustum_planes[i], &normal);
+      planes[i][0] = graphene_vec3_get_x (&normal);
+      planes[i][1] = graphene_vec3_get_y (&normal);
+      planes[i][2] = graphene_vec3_get_z (&normal);
+      planes[i][3] = graphene_plane_get_constant (&frustum_planes[i]);
+    }
+
+  if (octree->root)
+    cull_node (octree->root, (const float (*)[4])planes, FALSE, culled_objects);
+
+  for (i = 0; i < octree->unbounded->len; i++)
+    g_ptr_array_add (unbounded_objects,
+                     ((GthreeOctreeEntry *)g_ptr_array_index (octree->unbounded, i))->object);
+}
+
+/* Squared distance from point to the box center +- extent */
+static float
+box_distance2 (const graphene_point3d_t *point,
+               const graphene_point3d_t *min,
+               const graphene_point3d_t *max)
+{
+  float dx = MAX (MAX (min->x - point->x, 0), point->x - max->x);
+  float dy = MAX (MAX (min->y - point->y, 0), point->y - max->y);
+  float dz = MAX (MAX (min->z - point->z, 0), point->z - max->z);
+
+  return dx * dx + dy * dy + dz * dz;
+}
+
+static void
+node_get_loose_box (OctreeNode *node,
+                    graphene_point3d_t *min,
+                    graphene_point3d_t *max)
+{
+  float extent = node->half_size * 2;
+
+  graphene_point3d_init (min, node->center.x - extent, node->center.y - extent, node->center.z - extent);
+  graphene_point3d_init (max, node->center.x + extent, node->center.y + extent, node->center.z + extent);
+}
+
+static void
+query_box_node (OctreeNode *node,
+                const graphene_point3d_t *min,
+                const graphene_point3d_t *max,
+                GPtrArray *objects)
+{
+  graphene_point3d_t node_min, node_max;
+  int i;
+
+  if (node->n_entries == 0)
+    return;
+
+  node_get_loose_box (node, &node_min, &node_max);
+  if (node_min.x > max->x || node_max.x < min->x ||
+      node_min.y > max->y || node_max.y < min->y ||
+      node_min.z > max->z || node_max.z < min->z)
+    return;
+
+  if (node->entries)
+    for (i = 0; i < node->entries->len; i++)
+      {
+        GthreeOctreeEntry *entry = g_ptr_array_index (node->entries, i);
+
+        if (box_distance2 (&entry->center, min, max) <= entry->radius * entry->radius)
+          g_ptr_array_add (objects, entry->object);
+      }
+
+  for (i = 0; i < 8; i++)
+    if (node->children[i])
+      query_box_node (node->children[i], min, max, objects);
+}
+
+void
+gthree_octree_query_box (GthreeOctree             *octree,
+                         const graphene_box_t     *box,
+                         GPtrArray                *objects)
+{
+  graphene_point3d_t min, max;
+
+  if (octree->root == NULL)
+    return;
+
+  graphene_box_get_min (box, &min);
+  graphene_box_get_max (box, &max);
+
+  query_box_node (octree->root, &min, &max, objects);
+}
+
+static void
+query_sphere_node (OctreeNode *node,
+                   const graphene_point3d_t *center,
+                   float radius,
+                   GPtrArray *objects)
+{
+  graphene_point3d_t node_min, node_max;
+  int i;
+
+  if (node->n_entries == 0)
+    return;
+
+  node_get_loose_box (node, &node_min, &node_max);
+  if (box_distance2 (center, &node_min, &node_max) > radius * radius)
+    return;
+
+  if (node->entries)
+    for (i = 0; i < node->entries->len; i++)
+      {
+        GthreeOctreeEntry *entry = g_ptr_array_index (node->entries, i);
+        float r = radius + entry->radius;
+
+        if (graphene_point3d_distance (center, &entry->center, NULL) <= r)
+          g_ptr_array_add (objects, entry->object);
+      }
+
+  for (i = 0; i < 8; i++)
+    if (node->children[i])
+      query_sphere_node (node->children[i], center, radius, objects);
+}
+
+void
+gthree_octree_query_sphere (GthreeOctree             *octree,
+                            const graphene_sphere_t  *sphere,
+                            GPtrArray                *objects)
+{
+  graphene_point3d_t center;
+
+  if (octree->root == NULL)
+    return;
+
+  graphene_sphere_get_center (sphere, &center);
+  query_sphere_node (octree->root, &center, graphene_sphere_get_radius (sphere), objects);
+}
+
+typedef struct {
+  float distance;
+  GthreeObject *object;
+} Nearest;
+
+typedef struct {
+  float distance2;
+  OctreeNode *node;
+} NearestChild;
+
+static int
+nearest_child_compare (gconstpointer a,
+                       gconstpointer b)
+{
+  float da = ((const NearestChild *)a)->distance2;
+  float db = ((const NearestChild *)b)->distance2;
+
+  return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+/* Branch and bound, visiting the closest cells first so that the
+ * bound tightens early. nearest is kept sorted by distance. */
+static void
+query_nearest_node (OctreeNode *node,
+                    const graphene_point3d_t *point,
+                    int max_objects,
+                    GArray *nearest)
+{
+  NearestChild children[8];
+  int i, j, n_children;
+
+  if (node->entries)
+    for (i = 0; i < node->entries->len; i++)
+      {
+        GthreeOctreeEntry *entry = g_ptr_array_index (node->entries, i);
+        Nearest n;
+
+        n.distance = MAX (graphene_point3d_distance (point, &entry->center, NULL) - entry->radius, 0);
+        n.object = entry->object;
+
+        if (nearest->len == max_objects &&
+            n.distance >= g_array_index (nearest, Nearest, nearest->len - 1).distance)
+          continue;
+
+        for (j = nearest->len; j > 0 && g_array_index (nearest, Nearest, j - 1).distance > n.distance; j--)
+          ;
+        g_array_insert_val (nearest, j, n);
+        if (nearest->len > max_objects)
+          g_array_set_size (nearest, max_objects);
+      }
+
+  n_children = 0;
+  for (i = 0; i < 8; i++)
+    {
+      OctreeNode *child = node->children[i];
+      graphene_point3d_t min, max;
+
+      if (child == NULL || child->n_entries == 0)
+        continue;
+
+      node_get_loose_box (child, &min, &max);
+      children[n_children].distance2 = box_distance2 (point, &min, &max);
+      children[n_children].node = child;
+      n_children++;
+    }
+
+  qsort (children, n_children, sizeof (NearestChild), nearest_child_compare);
+
+  for (i = 0; i < n_children; i++)
+    {
+      if (nearest->len == max_objects)
+        {
+          float worst = g_array_index (nearest, Nearest, nearest->len - 1).distance;
+
+          if (children[i].distance2 > worst * worst)
+            break;
+        }
+
+      query_nearest_node (children[i].node, point, max_objects, nearest);
+    }
+}
+
+/* Adds up to max_objects objects, closest first, where the distance is
+ * the one to the surface of the bounding sphere. */
+void
+gthree_octree_query_nearest (GthreeOctree             *octree,
+                             const graphene_point3d_t *point,
+                             int                       max_objects,
+                             GPtrArray                *objects)
+{
+  GArray *nearest;
+  int i;
+
+  if (octree->root == NULL || max_objects <= 0)
+    return;
+
+  nearest = g_array_sized_new (FALSE, FALSE, sizeof (Nearest), max_objects + 1);
+
+  query_nearest_node (octree->root, point, max_objects, nearest);
+
+  for (i = 0; i < nearest->len; i++)
+    g_ptr_array_add (objects, g_array_index (nearest, Nearest, i).object);
+
+  g_array_free (nearest, TRUE);
+}
@@ -0,0 +1,44 @@
+#ifndef __GTHREE_OCTREE_PRIVATE_H__
+#define __GTHREE_OCTREE_PRIVATE_H__
+
+#include <gthree/gthreeobject.h>
+
+G_BEGIN_DECLS
+
+/* A loose octree of the world space bounding spheres of objects. Each
+ * cell accepts objects whose center is inside it and whose radius is at
+ * most the cell's half size, so objects are never split across cells
+ * and the cells' bounds are twice their size. */
+typedef struct _GthreeOctree GthreeOctree;
+typedef struct _GthreeOctreeEntry GthreeOctreeEntry;
+
+GthreeOctree *gthree_octree_new    (void);
+void          gthree_octree_free   (GthreeOctree *octree);
+void          gthree_octree_insert (GthreeOctree *octree,
+                                    GthreeObject *object);
+void          gthree_octree_remove (GthreeOctree *octree,
+                                    GthreeObject *object);
+void          gthree_octree_update (GthreeOctree *octree);
+int           gthree_octree_get_n_bounded (GthreeOctree *octree);
+
+void gthree_octree_cull          (GthreeOctree             *octree,
+                                  const graphene_frustum_t *frustum,
+                                  GPtrArray                *culled_objects,
+                                  GPtrArray                *unbounded_objects);
+void gthree_octree_query_box     (GthreeOctree             *octree,
+                                  const graphene_box_t     *box,
+                                  GPtrArray                *objects);
+void gthree_octree_query_sphere  (GthreeOctree             *octree,
+                                  const graphene_sphere_t  *sphere,
+                                  GPtrArray                *objects);
+void gthree_octree_query_nearest (GthreeOctree             *octree,
+                                  const graphene_point3d_t *point,
+                                  int                       max_objects,
+                                  GPtrArray                *objects);
+
+/* Safe to call from the traversal threads */
+void gthree_octree_entry_mark_dirty (GthreeOctreeEntry *entry);
+
+G_END_DECLS
+
+#endif /* __GTHREE_OCTREE_PRIVATE_H__ */
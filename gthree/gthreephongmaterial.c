@@ -128,18 +128,6 @@ gthree_phong_material_real_set_uniforms (GthreeMaterial *material,
 #endif
 }
 
-static gboolean
-gthree_phong_material_needs_camera_pos (GthreeMaterial *material)
-{
-  return TRUE;
-}
-
-static gboolean
-gthree_phong_material_needs_view_matrix (GthreeMaterial *material)
-{
-  return TRUE;
-}
-
 static gboolean
 gthree_phong_material_needs_lights (GthreeMaterial *material)
 {
@@ -162,8 +150,6 @@ gthree_phong_material_class_init (GthreePhongMaterialClass *klass)
   GTHREE_MATERIAL_CLASS(klass)->get_shader = gthree_phong_material_real_get_shader;
   GTHREE_MATERIAL_CLASS(klass)->set_params = gthree_phong_material_real_set_params;
   GTHREE_MATERIAL_CLASS(klass)->set_uniforms = gthree_phong_material_real_set_uniforms;
-  GTHREE_MATERIAL_CLASS(klass)->needs_camera_pos = gthree_phong_material_needs_camera_pos;
-  GTHREE_MATERIAL_CLASS(klass)->needs_view_matrix = gthree_phong_material_needs_view_matrix;
   GTHREE_MATERIAL_CLASS(klass)->needs_lights = gthree_phong_material_needs_lights;
   GTHREE_MATERIAL_CLASS(klass)->needs_normals = gthree_phong_material_needs_normals;
 }
@@ -4,6 +4,8 @@
 #include <gthree/gthreeobject.h>
 #include <gthree/gthreelight.h>
 #include <gthree/gthreebufferprivate.h>
+#include <gthree/gthreeoctreeprivate.h>
+#include <gthree/gthreescene.h>
 
 struct _GthreeLightSetup
 {
@@ -36,19 +38,117 @@ struct _GthreeLightSetup
   GArray *hemi_positions;
 };
 
+/* Per-render camera and light state, shared by all programs through
+ * a std140 uniform block. Every member is a multiple of 16 bytes so
+ * the C layout matches the std140 one, vec3 and float array elements
+ * are padded to a vec4. Keep in sync with the GthreeFrame block in
+ * gthreeprogram.c. */
+#define GTHREE_FRAME_BLOCK_BINDING 0
+
+#define GTHREE_MAX_DIR_LIGHTS 8
+#define GTHREE_MAX_POINT_LIGHTS 8
+#define GTHREE_MAX_SPOT_LIGHTS 8
+#define GTHREE_MAX_HEMI_LIGHTS 4
+
+typedef struct {
+  float projection_matrix[16];
+  float view_matrix[16];
+  float camera_position[4];
+  float ambient_light_color[4];
+
+  float directional_light_color[GTHREE_MAX_DIR_LIGHTS][4];
+  float directional_light_direction[GTHREE_MAX_DIR_LIGHTS][4];
+
+  float point_light_color[GTHREE_MAX_POINT_LIGHTS][4];
+  float point_light_position[GTHREE_MAX_POINT_LIGHTS][4];
+  float point_light_distance[GTHREE_MAX_POINT_LIGHTS][4];
+
+  float spot_light_color[GTHREE_MAX_SPOT_LIGHTS][4];
+  float spot_light_position[GTHREE_MAX_SPOT_LIGHTS][4];
+  float spot_light_direction[GTHREE_MAX_SPOT_LIGHTS][4];
+  float spot_light_distance[GTHREE_MAX_SPOT_LIGHTS][4];
+  float spot_light_angle_cos[GTHREE_MAX_SPOT_LIGHTS][4];
+  float spot_light_exponent[GTHREE_MAX_SPOT_LIGHTS][4];
+
+  float hemisphere_light_sky_color[GTHREE_MAX_HEMI_LIGHTS][4];
+  float hemisphere_light_ground_color[GTHREE_MAX_HEMI_LIGHTS][4];
+  float hemisphere_light_direction[GTHREE_MAX_HEMI_LIGHTS][4];
+} GthreeFrameBlock;
+
+/* The fixed function state a material needs for drawing. Blocks are
+ * interned, so two materials with the same state share one block and
+ * comparing ids is enough to know if anything has to change. */
+typedef struct {
+  guint id;
+
+  GthreeBlendMode blend_mode;
+  guint blend_equation;
+  guint blend_src_factor;
+  guint blend_dst_factor;
+  GthreeSide side;
+  float polygon_offset_factor;
+  float polygon_offset_units;
+  guint depth_test : 1;
+  guint depth_write : 1;
+  guint polygon_offset : 1;
+} GthreeRenderState;
+
+const GthreeRenderState *gthree_material_get_render_state (GthreeMaterial *material);
+
+/* A material keeps a program for each way the objects it is drawn on
+ * change the compiled code (instancing, instance colors, shadows), so
+ * sharing it between such objects doesn't recompile on every draw. */
+#define GTHREE_N_PROGRAM_VARIANTS 8
+
+GthreeProgram *gthree_material_get_program_variant    (GthreeMaterial *material,
+                                                        guint           variant);
+void           gthree_material_set_program_variant    (GthreeMaterial *material,
+                                                        guint           variant,
+                                                        GthreeProgram  *program);
+void           gthree_material_clear_program_variants (GthreeMaterial *material);
+
 guint gthree_renderer_allocate_texture_unit (GthreeRenderer *renderer);
+void  gthree_renderer_bind_texture          (GthreeRenderer *renderer,
+                                             guint           unit,
+                                             guint           target,
+                                             guint           texture);
+void  gthree_renderer_bind_buffer           (GthreeRenderer *renderer,
+                                             guint           target,
+                                             guint           buffer);
+void  gthree_renderer_bind_vertex_array     (GthreeRenderer *renderer,
+                                             guint           vertex_array);
 
-void     gthree_texture_load             (GthreeTexture *texture,
-					  int            slot);
+void     gthree_texture_load             (GthreeTexture  *texture,
+					  GthreeRenderer *renderer,
+					  int             slot);
 gboolean gthree_texture_get_needs_update (GthreeTexture *texture);
 void     gthree_texture_set_needs_update (GthreeTexture *texture,
 					  gboolean       needs_update);
-void     gthree_texture_bind             (GthreeTexture *texture,
-					  int            slot,
-					  int            target);
+void     gthree_texture_bind             (GthreeTexture  *texture,
+					  int             slot,
+					  int             target);
+void     gthree_texture_bind_for_renderer (GthreeTexture  *texture,
+					   GthreeRenderer *renderer,
+					   int             slot,
+					   int             target);
 void     gthree_texture_set_parameters (guint texture_type,
 					GthreeTexture *texture,
 					gboolean is_image_power_of_two);
+guint    gthree_texture_get_gl_texture   (GthreeTexture  *texture);
+
+void gthree_render_target_bind    (GthreeRenderTarget *target,
+                                   GthreeRenderer     *renderer);
+void gthree_render_target_resolve (GthreeRenderTarget *target);
+guint gthree_render_target_get_framebuffer (GthreeRenderTarget *target);
+
+/* Counted into the stats of the frame being rendered, if any */
+void gthree_render_stats_add_uniform_upload (gsize bytes);
+void gthree_render_stats_add_buffer_upload  (gsize bytes);
+void gthree_render_stats_add_texture_upload (gsize bytes);
+
+void gthree_renderer_update_overlay (GthreeRenderer  *renderer,
+                                     cairo_surface_t *surface);
+void gthree_renderer_draw_overlay   (GthreeRenderer  *renderer);
 
 void gthree_geometry_realize               (GthreeGeometry *geometry,
                                             GthreeMaterial *material);
@@ -57,10 +157,62 @@ void gthree_geometry_update                (GthreeGeometry *geometry,
 void gthree_geometry_add_buffers_to_object (GthreeGeometry *geometry,
                                             GthreeMaterial *material,
                                             GthreeObject   *object);
+guint gthree_geometry_get_version          (GthreeGeometry *geometry);
 
 void   gthree_light_setup (GthreeLight       *light,
 			   GthreeLightSetup *light_setup);
 
+gboolean gthree_instanced_mesh_has_colors          (GthreeInstancedMesh *mesh);
+guint    gthree_instanced_mesh_get_instance_buffer (GthreeInstancedMesh *mesh,
+                                                    gsize               *color_offset);
+guint    gthree_instanced_mesh_get_version         (GthreeInstancedMesh *mesh);
+void     gthree_instanced_mesh_ensure_bounds       (GthreeInstancedMesh *mesh);
+
+GthreeOctree *gthree_scene_get_octree (GthreeScene *scene);
+GList        *gthree_scene_get_lods   (GthreeScene *scene);
+GList        *gthree_scene_get_instanced_meshes (GthreeScene *scene);
+
+void     gthree_lod_update          (GthreeLOD    *lod,
+                                     GthreeCamera *camera);
+gboolean gthree_lod_is_child_active (GthreeLOD    *lod,
+                                     GthreeObject *child);
+
+guint gthree_program_create_shader (int         type,
+                                    const char *code);
+
+/* The uniforms and attributes the renderer sets itself, their
+ * locations are kept in a flat array per program. The projection and
+ * view matrices are in the frame block instead. */
+typedef enum {
+  GTHREE_UNIFORM_SLOT_MODEL_VIEW_MATRIX,
+  GTHREE_UNIFORM_SLOT_NORMAL_MATRIX,
+  GTHREE_UNIFORM_SLOT_MODEL_MATRIX,
+  GTHREE_UNIFORM_SLOT_MORPH_TARGET_INFLUENCES,
+  GTHREE_UNIFORM_SLOT_BIND_MATRIX,
+  GTHREE_UNIFORM_SLOT_BIND_MATRIX_INVERSE,
+  GTHREE_N_UNIFORM_SLOTS
+} GthreeUniformSlot;
+
+typedef enum {
+  GTHREE_ATTRIBUTE_SLOT_POSITION,
+  GTHREE_ATTRIBUTE_SLOT_NORMAL,
+  GTHREE_ATTRIBUTE_SLOT_UV,
+  GTHREE_ATTRIBUTE_SLOT_UV2,
+  GTHREE_ATTRIBUTE_SLOT_TANGENT,
+  GTHREE_ATTRIBUTE_SLOT_COLOR,
+  GTHREE_ATTRIBUTE_SLOT_SKIN_INDEX,
+  GTHREE_ATTRIBUTE_SLOT_SKIN_WEIGHT,
+  GTHREE_ATTRIBUTE_SLOT_LINE_DISTANCE,
+  GTHREE_ATTRIBUTE_SLOT_INSTANCE_MATRIX,
+  GTHREE_ATTRIBUTE_SLOT_INSTANCE_COLOR,
+  GTHREE_N_ATTRIBUTE_SLOTS
+} GthreeAttributeSlot;
+
+gint gthree_program_get_uniform_slot   (GthreeProgram       *program,
+                                        GthreeUniformSlot    slot);
+gint gthree_program_get_attribute_slot (GthreeProgram       *program,
+                                        GthreeAttributeSlot  slot);
+
 graphene_matrix_t *gthree_camera_get_projection_matrix_for_write (GthreeCamera *camera);
 
 #endif /* __GTHREE_PRIVATE_H__ */
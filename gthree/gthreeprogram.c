@@ -1,15 +1,35 @@
 #include <math.h>
+#include <string.h>
 #include <epoxy/gl.h>
+#include <glib/gstdio.h>
 
 #include "gthreeprogram.h"
 #include "gthreeuniforms.h"
 #include "gthreeshader.h"
+#include "gthreeprivate.h"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 typedef struct {
+  /* Created on the first lookup by name, the renderer uses the slots */
   GHashTable *uniform_locations;
   GHashTable *attribute_locations;
 
   GLuint gl_program;
+  guint id;
+
+  /* Until the link is finished, see gthree_program_poll() */
+  GLuint vertex_shader;
+  GLuint fragment_shader;
+  guint linked : 1;
+  guint from_binary : 1;
+  char *binary_path; /* NULL without a disk cache */
+
+  /* The well known ones, resolved at link time, -1 if unused */
+  gint uniform_slots[GTHREE_N_UNIFORM_SLOTS];
+  gint attribute_slots[GTHREE_N_ATTRIBUTE_SLOTS];
 
   /* Cache keys: */
   GthreeProgramCache *cache;
@@ -20,12 +40,28 @@ typedef struct {
 struct _GthreeProgramCache
 {
     GHashTable *hash;
+
+    /* Program binaries, NULL if the driver can't give them out */
+    char *binary_dir;
+    char *gl_identity;
 };
 
 static void gthree_program_cache_remove (GthreeProgramCache *cache, GthreeProgram *program);
 
 G_DEFINE_TYPE_WITH_PRIVATE (GthreeProgram, gthree_program, G_TYPE_OBJECT);
 
+/* In GthreeUniformSlot and GthreeAttributeSlot order */
+static const char *uniform_slot_names[GTHREE_N_UNIFORM_SLOTS] = {
+  "modelViewMatrix", "normalMatrix", "modelMatrix",
+  "morphTargetInfluences", "bindMatrix", "bindMatrixInverse"
+};
+
+static const char *attribute_slot_names[GTHREE_N_ATTRIBUTE_SLOTS] = {
+  "position", "normal", "uv", "uv2", "tangent", "color",
+  "skinIndex", "skinWeight", "lineDistance", "instanceMatrix",
+  "instanceColor"
+};
+
 const char *
 precision_to_string (GthreePrecision prec)
 {
@@ -51,15 +87,22 @@ get_vertex_type_name (int type)
   return "unknown";
 }
 
-GLuint
-create_shader (int type, const char const *code)
+static GLuint
+compile_shader (int type, const char *code)
 {
   GLuint shader = glCreateShader (type);
-  GLint status;
 
   glShaderSource (shader, 1, &code, NULL);
   glCompileShader (shader);
 
+  return shader;
+}
+
+static void
+check_shader (int type, GLuint shader)
+{
+  GLint status;
+
   glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
   if (status == GL_FALSE)
     {
@@ -76,20 +119,48 @@ create_shader (int type, const char const *code)
 
       g_free (buffer);
     }
+}
+
+GLuint
+gthree_program_create_shader (int type, const char *code)
+{
+  GLuint shader = compile_shader (type, code);
+
+  check_shader (type, shader);
 
   return shader;
 }
 
+/* Must match GthreeFrameBlock */
 static void
-cache_uniform_locations (GHashTable *uniforms, GLuint program, char **identifiers)
+generate_frame_block (GString *out)
 {
-  int i;
-
-  for (i = 0; identifiers[i] != NULL; i++)
-    {
-      int location = glGetUniformLocation (program, identifiers[i]);
-      g_hash_table_insert (uniforms, GINT_TO_POINTER (g_quark_from_string (identifiers[i])), GINT_TO_POINTER (location));
-    }
+  g_string_append_printf (out,
+                          "layout(std140) uniform GthreeFrame {\n"
+                          "	mat4 projectionMatrix;\n"
+                          "	mat4 viewMatrix;\n"
+                          "	vec3 cameraPosition;\n"
+                          "	vec3 ambientLightColor;\n"
+                          "	vec3 directionalLightColor[%d];\n"
+                          "	vec3 directionalLightDirection[%d];\n"
+                          "	vec3 pointLightColor[%d];\n"
+                          "	vec3 pointLightPosition[%d];\n"
+                          "	float pointLightDistance[%d];\n"
+                          "	vec3 spotLightColor[%d];\n"
+                          "	vec3 spotLightPosition[%d];\n"
+                          "	vec3 spotLightDirection[%d];\n"
+                          "	float spotLightDistance[%d];\n"
+                          "	float spotLightAngleCos[%d];\n"
+                          "	float spotLightExponent[%d];\n"
+                          "	vec3 hemisphereLightSkyColor[%d];\n"
+                          "	vec3 hemisphereLightGroundColor[%d];\n"
+                          "	vec3 hemisphereLightDirection[%d];\n"
+                          "};\n",
+                          GTHREE_MAX_DIR_LIGHTS, GTHREE_MAX_DIR_LIGHTS,
+                          GTHREE_MAX_POINT_LIGHTS, GTHREE_MAX_POINT_LIGHTS, GTHREE_MAX_POINT_LIGHTS,
+                          GTHREE_MAX_SPOT_LIGHTS, GTHREE_MAX_SPOT_LIGHTS, GTHREE_MAX_SPOT_LIGHTS,
+                          GTHREE_MAX_SPOT_LIGHTS, GTHREE_MAX_SPOT_LIGHTS, GTHREE_MAX_SPOT_LIGHTS,
+                          GTHREE_MAX_HEMI_LIGHTS, GTHREE_MAX_HEMI_LIGHTS, GTHREE_MAX_HEMI_LIGHTS);
 }
 
 static void
@@ -109,34 +180,130 @@ generate_defines (GString *out, GPtrArray *defines)
     }
 }
 
-static void
-cache_attribute_locations (GHashTable *attributes, GLuint program, char **identifiers)
+/* Binaries are only valid for the exact same sources and driver */
+static char *
+get_binary_path (GthreeProgramCache *cache,
+                 const char *vertex,
+                 const char *fragment,
+                 const char *index0_attribute)
 {
-  int i;
+  GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  char *filename, *path;
+
+  g_checksum_update (checksum, (const guchar *)cache->gl_identity, strlen (cache->gl_identity) + 1);
+  g_checksum_update (checksum, (const guchar *)vertex, strlen (vertex) + 1);
+  g_checksum_update (checksum, (const guchar *)fragment, strlen (fragment) + 1);
+  if (index0_attribute)
+    g_checksum_update (checksum, (const guchar *)index0_attribute, strlen (index0_attribute) + 1);
+
+  filename = g_strconcat (g_checksum_get_string (checksum), ".bin", NULL);
+  path = g_build_filename (cache->binary_dir, filename, NULL);
+
+  g_free (filename);
+  g_checksum_free (checksum);
+
+  return path;
+}
+
+/* A cache file is this header followed by the binary */
+typedef struct {
+  guint32 magic;
+  guint32 version;
+  guint32 format;
+  guint32 size;
+} ProgramBinaryHeader;
+
+#define PROGRAM_BINARY_MAGIC 0x42505447 /* "GTPB" */
+#define PROGRAM_BINARY_VERSION 1
+
+/* Binaries that weren't used for this long are removed, and then the
+ * least recently used ones until the rest fit in the size */
+#define PROGRAM_BINARY_MAX_AGE (30 * G_TIME_SPAN_DAY / G_TIME_SPAN_SECOND)
+#define PROGRAM_BINARY_MAX_TOTAL_SIZE (64 * 1024 * 1024)
+
+/* Anything the driver doesn't take just means compiling the sources
+ * instead. Files that aren't ours are removed, they'd never load. */
+static gboolean
+load_program_binary (GLuint gl_program, const char *path)
+{
+  ProgramBinaryHeader header;
+  char *data;
+  gsize len;
+  GLint status = GL_FALSE;
+
+  if (!g_file_get_contents (path, &data, &len, NULL))
+    return FALSE;
+
+  if (len < sizeof (header))
+    goto out;
+
+  memcpy (&header, data, sizeof (header));
+  if (header.magic != PROGRAM_BINARY_MAGIC ||
+      header.version != PROGRAM_BINARY_VERSION ||
+      header.size != len - sizeof (header))
+    goto out;
+
+  glProgramBinary (gl_program, header.format, data + sizeof (header), header.size);
+  glGetProgramiv (gl_program, GL_LINK_STATUS, &status);
 
-  for (i = 0; identifiers[i] != NULL; i++)
+ out:
+  if (status == GL_TRUE)
     {
-      int location = glGetAttribLocation (program, identifiers[i]);
-      g_hash_table_insert (attributes, GINT_TO_POINTER (g_quark_from_string (identifiers[i])), GINT_TO_POINTER (location));
+      /* The mtime is when it was last used, see prune_binary_dir() */
+      g_utime (path, NULL);
     }
+  else
+    g_unlink (path);
+
+  g_free (data);
+
+  return status == GL_TRUE;
 }
 
-GthreeProgram *
-gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
+static void
+save_program_binary (GLuint gl_program, const char *path)
+{
+  ProgramBinaryHeader header;
+  GLint len = 0;
+  GLenum format;
+  char *data, *dir;
+
+  glGetProgramiv (gl_program, GL_PROGRAM_BINARY_LENGTH, &len);
+  if (len <= 0)
+    return;
+
+  data = g_malloc (sizeof (header) + len);
+  glGetProgramBinary (gl_program, len, &len, &format, data + sizeof (header));
+
+  header.magic = PROGRAM_BINARY_MAGIC;
+  header.version = PROGRAM_BINARY_VERSION;
+  header.format = format;
+  header.size = len;
+  memcpy (data, &header, sizeof (header));
+
+  /* Failing just means compiling again the next time */
+  dir = g_path_get_dirname (path);
+  if (g_mkdir_with_parents (dir, 0700) == 0)
+    g_file_set_contents (path, data, sizeof (header) + len, NULL);
+
+  g_free (dir);
+  g_free (data);
+}
+
+/* Only starts compiling and linking, without waiting for the driver.
+ * With a disk cache a stored binary is loaded instead if there is one. */
+static GthreeProgram *
+program_submit (GthreeProgramCache *cache, GthreeShader *shader, GthreeProgramParameters *parameters)
 {
   GthreeProgram *program;
   GthreeProgramPrivate *priv;
   GPtrArray *defines;
-  GthreeUniforms *uniforms;
   const char *vertex_shader, *fragment_shader;
   char *index0AttributeName;
-  //char *shadowMapTypeDefine;
+  const char *shadowMapTypeDefine;
   GLuint gl_program;
   GString *vertex, *fragment;
   GLuint glVertexShader, glFragmentShader;
-  GLint status;
-  GPtrArray *identifiers;
-  GList *uniform_list, *l;
 
   program = g_object_new (gthree_program_get_type (),
                           NULL);
@@ -147,7 +314,6 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
 
   //var attributes = material.attributes;
   defines = gthree_shader_get_defines (shader);
-  uniforms = gthree_shader_get_uniforms (shader);
   vertex_shader = gthree_shader_get_vertex_shader_text (shader);
   fragment_shader = gthree_shader_get_fragment_shader_text (shader);
 
@@ -161,15 +327,12 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
   }
 #endif
 
-  //shadowMapTypeDefine = "SHADOWMAP_TYPE_BASIC";
+  shadowMapTypeDefine = "SHADOWMAP_TYPE_BASIC";
 
-#if TODO
-  if (parameters.shadowMapType === THREE.PCFShadowMap) {
+  if (parameters->shadow_map_type == GTHREE_SHADOW_MAP_PCF)
     shadowMapTypeDefine = "SHADOWMAP_TYPE_PCF";
-  } else if (parameters.shadowMapType === THREE.PCFSoftShadowMap) {
+  else if (parameters->shadow_map_type == GTHREE_SHADOW_MAP_PCF_SOFT)
     shadowMapTypeDefine = "SHADOWMAP_TYPE_PCF_SOFT";
-  }
-#endif
 
   // console.log( "building new program " );
 
@@ -185,6 +348,9 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
   if (TRUE /*! material instanceof THREE.RawShaderMaterial */)
     {
       g_string_append (vertex, "#version 120\n");
+      g_string_append (vertex, "#extension GL_ARB_uniform_buffer_object : require\n");
+      /* The depth pre-pass needs every program to compute the same depths */
+      g_string_append (vertex, "invariant gl_Position;\n");
       //g_string_append_printf (vertex, "precision %s float;\n", precision_to_string (parameters->precision));
       //g_string_append_printf (vertex, "precision %s int;\n", precision_to_string (parameters->precision));
 
@@ -242,14 +408,23 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
         parameters.morphNormals ? "#define USE_MORPHNORMALS" : "",
 #endif
 
+      if (parameters->instancing)
+        g_string_append (vertex, "#define USE_INSTANCING\n");
+      if (parameters->instancing_color)
+        g_string_append (vertex, "#define USE_INSTANCING_COLOR\n");
+
       if (parameters->double_sided)
         g_string_append (vertex, "#define DOUBLE_SIDED\n");
       if (parameters->flip_sided)
         g_string_append (vertex, "#define FLIP_SIDED\n");
 
+      if (parameters->shadow_map)
+        g_string_append_printf (vertex,
+                                "#define USE_SHADOWMAP\n"
+                                "#define %s\n",
+                                shadowMapTypeDefine);
+
 #ifdef TODO
-      parameters.shadowMapEnabled ? "#define USE_SHADOWMAP" : "",
-        parameters.shadowMapEnabled ? "#define " + shadowMapTypeDefine : "",
         parameters.shadowMapDebug ? "#define SHADOWMAP_DEBUG" : "",
         parameters.shadowMapCascade ? "#define SHADOWMAP_CASCADE" : "",
 
@@ -259,13 +434,12 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
         //_this._glExtensionFragDepth ? "#define USE_LOGDEPTHBUF_EXT" : "",
 #endif
 
+      generate_frame_block (vertex);
+
         g_string_append (vertex,
                          "uniform mat4 modelMatrix;\n"
                          "uniform mat4 modelViewMatrix;\n"
-                         "uniform mat4 projectionMatrix;\n"
-                         "uniform mat4 viewMatrix;\n"
                          "uniform mat3 normalMatrix;\n"
-                         "uniform vec3 cameraPosition;\n"
 
                          "attribute vec3 position;\n"
                          "attribute vec3 normal;\n"
@@ -276,6 +450,13 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
                          "	attribute vec3 color;\n"
                          "#endif\n"
 
+                         "#ifdef USE_INSTANCING\n"
+                         "	attribute mat4 instanceMatrix;\n"
+                         "#endif\n"
+                         "#ifdef USE_INSTANCING_COLOR\n"
+                         "	attribute vec3 instanceColor;\n"
+                         "#endif\n"
+
                          "#ifdef USE_MORPHTARGETS\n"
                          "	attribute vec3 morphTarget0;\n"
                          "	attribute vec3 morphTarget1;\n"
@@ -302,6 +483,7 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
       /* fragment shader prefix */
 
       g_string_append (fragment, "#version 120\n");
+      g_string_append (fragment, "#extension GL_ARB_uniform_buffer_object : require\n");
       //g_string_append_printf (fragment, "precision %s float;\n", precision_to_string (parameters->precision));
       //g_string_append_printf (fragment, "precision %s int;\n", precision_to_string (parameters->precision));
 
@@ -320,12 +502,12 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
                               parameters->max_spot_lights,
                               parameters->max_hemi_lights);
 
-      g_string_append_printf (vertex,
+      g_string_append_printf (fragment,
                               "#define MAX_SHADOWS %d\n",
                               parameters->max_shadows);
 
       if (parameters->alpha_test != 0)
-        g_string_append_printf (vertex,
+        g_string_append_printf (fragment,
                                 "#define ALPHATEST %f\n",
                                 parameters->alpha_test);
 
@@ -352,7 +534,8 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
       if (parameters->alpha_map)
         g_string_append (fragment, "#define USE_ALPHAMAP\n");
 
-      if (parameters->vertex_colors != GTHREE_COLOR_NONE)
+      /* The fragment shader only sees vColor, whatever it came from */
+      if (parameters->vertex_colors != GTHREE_COLOR_NONE || parameters->instancing_color)
         g_string_append (fragment, "#define USE_COLOR\n");
 
       if (parameters->metal)
@@ -364,18 +547,20 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
       if (parameters->flip_sided)
         g_string_append (fragment, "#define FLIP_SIDED\n");
 
+      if (parameters->shadow_map)
+        g_string_append_printf (fragment,
+                                "#define USE_SHADOWMAP\n"
+                                "#define %s\n",
+                                shadowMapTypeDefine);
+
 #ifdef TODO
-      parameters.shadowMapEnabled ? "#define USE_SHADOWMAP" : "",
-        parameters.shadowMapEnabled ? "#define " + shadowMapTypeDefine : "",
         parameters.shadowMapDebug ? "#define SHADOWMAP_DEBUG" : "",
         parameters.shadowMapCascade ? "#define SHADOWMAP_CASCADE" : "",
 
         parameters.logarithmicDepthBuffer ? "#define USE_LOGDEPTHBUF" : "",
         //_this._glExtensionFragDepth ? "#define USE_LOGDEPTHBUF_EXT" : "",
 #endif
-        g_string_append (fragment,
-                         "uniform mat4 viewMatrix;\n"
-                         "uniform vec3 cameraPosition;\n");
+      generate_frame_block (fragment);
   }
 
   g_string_append (vertex, vertex_shader);
@@ -389,8 +574,24 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
                fragment->str);
     }
 
-  glVertexShader = create_shader (GL_VERTEX_SHADER, vertex->str);
-  glFragmentShader = create_shader (GL_FRAGMENT_SHADER, fragment->str);
+  priv->gl_program = gl_program;
+
+  if (cache && cache->binary_dir)
+    {
+      priv->binary_path = get_binary_path (cache, vertex->str, fragment->str, index0AttributeName);
+      if (load_program_binary (gl_program, priv->binary_path))
+        {
+          priv->from_binary = TRUE;
+          g_string_free (vertex, TRUE);
+          g_string_free (fragment, TRUE);
+          return program;
+        }
+
+      glProgramParameteri (gl_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+  glVertexShader = compile_shader (GL_VERTEX_SHADER, vertex->str);
+  glFragmentShader = compile_shader (GL_FRAGMENT_SHADER, fragment->str);
 
   g_string_free (vertex, TRUE);
   g_string_free (fragment, TRUE);
@@ -409,7 +610,30 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
 
   glLinkProgram (gl_program);
 
+  priv->vertex_shader = glVertexShader;
+  priv->fragment_shader = glFragmentShader;
+
+  return program;
+}
+
+/* Waits for the link, and looks up the locations */
+static void
+program_finish (GthreeProgram *program)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+  GLuint gl_program = priv->gl_program;
+  GLint status;
+
+  if (!priv->from_binary)
+    {
+      check_shader (GL_VERTEX_SHADER, priv->vertex_shader);
+      check_shader (GL_FRAGMENT_SHADER, priv->fragment_shader);
+    }
+
   glGetProgramiv (gl_program, GL_LINK_STATUS, &status);
+  if (status == GL_TRUE && priv->binary_path && !priv->from_binary)
+    save_program_binary (gl_program, priv->binary_path);
+
   if (status == GL_FALSE)
     {
       GLint log_len;
@@ -423,105 +647,84 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
       g_free (buffer);
     }
 
-  // clean up
-
-  glDeleteShader (glVertexShader);
-  glDeleteShader (glFragmentShader);
-
-  // cache uniform locations
-
-  identifiers = g_ptr_array_new ();
-
   {
-    int i;
-    char *s[] =  {
-      "viewMatrix", "modelViewMatrix", "projectionMatrix", "normalMatrix",
-      "modelMatrix", "cameraPosition", "morphTargetInfluences", "bindMatrix",
-      "bindMatrixInverse"
-    };
-
-    for (i = 0; i < G_N_ELEMENTS (s); i++)
-      g_ptr_array_add (identifiers, s[i]);
+    GLuint block_index = glGetUniformBlockIndex (gl_program, "GthreeFrame");
+    if (block_index != GL_INVALID_INDEX)
+      glUniformBlockBinding (gl_program, block_index, GTHREE_FRAME_BLOCK_BINDING);
   }
 
-  if (parameters->use_vertex_texture)
-    {
-      g_ptr_array_add (identifiers, "boneTexture");
-      g_ptr_array_add (identifiers, "boneTextureWidth");
-      g_ptr_array_add (identifiers, "boneTextureHeight");
-    }
-  else
-    {
-      g_ptr_array_add (identifiers, "boneGlobalMatrices");
-    }
-
-#if TODO
-  if ( parameters.logarithmicDepthBuffer ) {
-    identifiers.push('logDepthBufFC');
-  }
-#endif
-
-  uniform_list = gthree_uniforms_get_all (uniforms);
-
-  for (l = uniform_list; l != NULL; l = l->next)
-    g_ptr_array_add (identifiers, (char *)gthree_uniform_get_name (l->data));
-
-  g_list_free (uniform_list);
-  g_ptr_array_add (identifiers, NULL);
-
-  cache_uniform_locations (priv->uniform_locations, gl_program, (char **)identifiers->pdata);
-
-  g_ptr_array_free (identifiers, FALSE);
-
-  // cache attributes locations
+  // clean up
 
-  identifiers = g_ptr_array_new ();
+  if (priv->vertex_shader)
+    glDeleteShader (priv->vertex_shader);
+  if (priv->fragment_shader)
+    glDeleteShader (priv->fragment_shader);
+  priv->vertex_shader = 0;
+  priv->fragment_shader = 0;
 
+  /* The renderer's own uniforms and attributes, anything else is
+     looked up by name when asked for */
   {
     int i;
-    char *s[] =  {
-      "position", "normal", "uv", "uv2", "tangent", "color",
-      "skinIndex", "skinWeight", "lineDistance"
-    };
 
-    for (i = 0; i < G_N_ELEMENTS (s); i++)
-      g_ptr_array_add (identifiers, s[i]);
+    for (i = 0; i < GTHREE_N_UNIFORM_SLOTS; i++)
+      priv->uniform_slots[i] = glGetUniformLocation (gl_program, uniform_slot_names[i]);
+    for (i = 0; i < GTHREE_N_ATTRIBUTE_SLOTS; i++)
+      priv->attribute_slots[i] = glGetAttribLocation (gl_program, attribute_slot_names[i]);
   }
 
-#ifdef TODO
-  for ( var i = 0; i < parameters.maxMorphTargets; i ++ ) {
-    identifiers.push( "morphTarget" + i );
-  }
+  priv->linked = TRUE;
+}
 
-  for ( var i = 0; i < parameters.maxMorphNormals; i ++ ) {
+GthreeProgram *
+gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters)
+{
+  GthreeProgram *program = program_submit (NULL, shader, parameters);
 
-    identifiers.push( "morphNormal" + i );
+  program_finish (program);
 
-  }
+  return program;
+}
 
-  for ( var a in attributes ) {
-    identifiers.push( a );
-  }
-#endif
+/* Finishes the program if the driver is done with it, this needs
+ * GL_KHR_parallel_shader_compile (or the ARB one) to not block. */
+gboolean
+gthree_program_poll (GthreeProgram *program)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+  GLint done;
 
-  g_ptr_array_add (identifiers, NULL);
+  if (priv->linked)
+    return TRUE;
 
-  cache_attribute_locations (priv->attribute_locations, gl_program, (char **)identifiers->pdata);
+  glGetProgramiv (priv->gl_program, GL_COMPLETION_STATUS_KHR, &done);
+  if (done)
+    program_finish (program);
 
-  g_ptr_array_free (identifiers, FALSE);
+  return priv->linked;
+}
 
-  priv->gl_program = gl_program;
+void
+gthree_program_finish (GthreeProgram *program)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
 
-  return program;
+  if (!priv->linked)
+    program_finish (program);
 }
 
 static void
 gthree_program_init (GthreeProgram *program)
 {
   GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+  static guint next_id = 1;
+  int i;
 
-  priv->uniform_locations = g_hash_table_new (g_direct_hash, g_direct_equal);
-  priv->attribute_locations = g_hash_table_new (g_direct_hash, g_direct_equal);
+  priv->id = next_id++;
+  for (i = 0; i < GTHREE_N_UNIFORM_SLOTS; i++)
+    priv->uniform_slots[i] = -1;
+  for (i = 0; i < GTHREE_N_ATTRIBUTE_SLOTS; i++)
+    priv->attribute_slots[i] = -1;
 }
 
 static void
@@ -530,14 +733,22 @@ gthree_program_finalize (GObject *obj)
   GthreeProgram *program = GTHREE_PROGRAM (obj);
   GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
 
+  if (priv->vertex_shader)
+    glDeleteShader (priv->vertex_shader);
+  if (priv->fragment_shader)
+    glDeleteShader (priv->fragment_shader);
+
   if (priv->gl_program)
     {
       glDeleteProgram (priv->gl_program);
       priv->gl_program = 0;
     }
 
-  g_hash_table_destroy (priv->uniform_locations);
-  g_hash_table_destroy (priv->attribute_locations);
+  if (priv->uniform_locations)
+    g_hash_table_destroy (priv->uniform_locations);
+  if (priv->attribute_locations)
+    g_hash_table_destroy (priv->attribute_locations);
+  g_free (priv->binary_path);
 
   if (priv->cache)
     gthree_program_cache_remove (priv->cache, program);
@@ -561,17 +772,61 @@ gthree_program_use (GthreeProgram *program)
   glUseProgram (priv->gl_program);
 }
 
+guint
+gthree_program_get_id (GthreeProgram *program)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+
+  return priv->id;
+}
+
+const GthreeProgramParameters *
+gthree_program_get_parameters (GthreeProgram *program)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+
+  return &priv->params;
+}
+
+gint
+gthree_program_get_uniform_slot (GthreeProgram     *program,
+                                 GthreeUniformSlot  slot)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+
+  return priv->uniform_slots[slot];
+}
+
+gint
+gthree_program_get_attribute_slot (GthreeProgram       *program,
+                                   GthreeAttributeSlot  slot)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+
+  return priv->attribute_slots[slot];
+}
+
 gint
 gthree_program_lookup_uniform_location (GthreeProgram *program,
                                         GQuark uniform)
 {
   GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
   gpointer location;
+  gint gl_location;
+
+  if (!priv->linked)
+    return -1;
 
-  if (g_hash_table_lookup_extended (priv->uniform_locations,
-                                    GINT_TO_POINTER (uniform), NULL, &location))
+  if (priv->uniform_locations == NULL)
+    priv->uniform_locations = g_hash_table_new (g_direct_hash, g_direct_equal);
+  else if (g_hash_table_lookup_extended (priv->uniform_locations,
+                                         GINT_TO_POINTER (uniform), NULL, &location))
     return GPOINTER_TO_INT (location);
-  return -1;
+
+  gl_location = glGetUniformLocation (priv->gl_program, g_quark_to_string (uniform));
+  g_hash_table_insert (priv->uniform_locations, GINT_TO_POINTER (uniform), GINT_TO_POINTER (gl_location));
+
+  return gl_location;
 }
 
 gint
@@ -587,11 +842,21 @@ gthree_program_lookup_attribute_location (GthreeProgram *program,
 {
   GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
   gpointer location;
+  gint gl_location;
+
+  if (!priv->linked)
+    return -1;
 
-  if (g_hash_table_lookup_extended (priv->attribute_locations,
-                                    GINT_TO_POINTER (attribute), NULL, &location))
+  if (priv->attribute_locations == NULL)
+    priv->attribute_locations = g_hash_table_new (g_direct_hash, g_direct_equal);
+  else if (g_hash_table_lookup_extended (priv->attribute_locations,
+                                         GINT_TO_POINTER (attribute), NULL, &location))
     return GPOINTER_TO_INT (location);
-  return -1;
+
+  gl_location = glGetAttribLocation (priv->gl_program, g_quark_to_string (attribute));
+  g_hash_table_insert (priv->attribute_locations, GINT_TO_POINTER (attribute), GINT_TO_POINTER (gl_location));
+
+  return gl_location;
 }
 
 gint
@@ -636,15 +901,113 @@ gthree_program_priv_equal (GthreeProgramPrivate *a,
     gthree_program_parameters_equal (&a->params, &b->params);
 }
 
+typedef struct {
+  char *path;
+  gint64 mtime;
+  gint64 size;
+} BinaryFile;
+
+static gint
+binary_file_newest_first (gconstpointer a, gconstpointer b)
+{
+  const BinaryFile *fa = a, *fb = b;
+
+  if (fa->mtime != fb->mtime)
+    return fa->mtime > fb->mtime ? -1 : 1;
+  return 0;
+}
+
+/* Old drivers and sources leave binaries nobody will load again, this
+ * keeps them from piling up. */
+static void
+prune_binary_dir (const char *binary_dir)
+{
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  gint64 total_size = 0;
+  GArray *files;
+  const char *name;
+  GDir *dir;
+  int i;
+
+  dir = g_dir_open (binary_dir, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  files = g_array_new (FALSE, FALSE, sizeof (BinaryFile));
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      BinaryFile file;
+      GStatBuf st;
+
+      if (!g_str_has_suffix (name, ".bin"))
+        continue;
+
+      file.path = g_build_filename (binary_dir, name, NULL);
+      if (g_stat (file.path, &st) != 0 ||
+          now - st.st_mtime > PROGRAM_BINARY_MAX_AGE)
+        {
+          g_unlink (file.path);
+          g_free (file.path);
+          continue;
+        }
+
+      file.mtime = st.st_mtime;
+      file.size = st.st_size;
+      g_array_append_val (files, file);
+    }
+
+  g_dir_close (dir);
+
+  g_array_sort (files, binary_file_newest_first);
+
+  for (i = 0; i < files->len; i++)
+    {
+      BinaryFile *file = &g_array_index (files, BinaryFile, i);
+
+      total_size += file->size;
+      if (total_size > PROGRAM_BINARY_MAX_TOTAL_SIZE)
+        g_unlink (file->path);
+      g_free (file->path);
+    }
+
+  g_array_free (files, TRUE);
+}
+
 GthreeProgramCache *
 gthree_program_cache_new (void)
 {
+  static gsize pruned = 0;
   GthreeProgramCache *cache;
 
   cache = g_new0 (GthreeProgramCache, 1);
 
   cache->hash = g_hash_table_new ((GHashFunc)gthree_program_priv_hash, (GEqualFunc)gthree_program_priv_equal);
 
+  /* Programs are stored under $XDG_CACHE_HOME/gthree/programs, keyed
+     by the driver too, so a driver update starts over */
+  if (epoxy_gl_version () >= 41 || epoxy_has_gl_extension ("GL_ARB_get_program_binary"))
+    {
+      GLint n_formats = 0;
+
+      glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+      if (n_formats > 0)
+        {
+          cache->binary_dir = g_build_filename (g_get_user_cache_dir (), "gthree", "programs", NULL);
+          cache->gl_identity = g_strdup_printf ("%s\n%s\n%s",
+                                                (const char *)glGetString (GL_VENDOR),
+                                                (const char *)glGetString (GL_RENDERER),
+                                                (const char *)glGetString (GL_VERSION));
+
+          /* Once per process is plenty */
+          if (g_once_init_enter (&pruned))
+            {
+              prune_binary_dir (cache->binary_dir);
+              g_once_init_leave (&pruned, 1);
+            }
+        }
+    }
+
   return cache;
 }
 
@@ -656,8 +1019,9 @@ gthree_program_cache_remove (GthreeProgramCache *cache, GthreeProgram *program)
   priv->cache = NULL;
 }
 
+/* The program may still be compiling, see gthree_program_poll() */
 GthreeProgram *
-gthree_program_cache_get (GthreeProgramCache *cache, GthreeShader *shader, GthreeProgramParameters *parameters)
+gthree_program_cache_submit (GthreeProgramCache *cache, GthreeShader *shader, GthreeProgramParameters *parameters)
 {
   GthreeProgramPrivate *priv;
   GthreeProgramPrivate key = {NULL};
@@ -670,7 +1034,7 @@ gthree_program_cache_get (GthreeProgramCache *cache, GthreeShader *shader, Gthre
   if (program)
     return g_object_ref (program);
 
-  program = gthree_program_new (shader, parameters);
+  program = program_submit (cache, shader, parameters);
   priv = gthree_program_get_instance_private (program);
   priv->cache = cache;
 
@@ -679,6 +1043,16 @@ gthree_program_cache_get (GthreeProgramCache *cache, GthreeShader *shader, Gthre
   return program;
 }
 
+GthreeProgram *
+gthree_program_cache_get (GthreeProgramCache *cache, GthreeShader *shader, GthreeProgramParameters *parameters)
+{
+  GthreeProgram *program = gthree_program_cache_submit (cache, shader, parameters);
+
+  gthree_program_finish (program);
+
+  return program;
+}
+
 void
 gthree_program_cache_free (GthreeProgramCache *cache)
 {
@@ -696,5 +1070,7 @@ gthree_program_cache_free (GthreeProgramCache *cache)
     }
 
   g_hash_table_destroy (cache->hash);
+  g_free (cache->binary_dir);
+  g_free (cache->gl_identity);
   g_free (cache);
 }
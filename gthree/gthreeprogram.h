@@ -44,8 +44,12 @@ typedef struct {
   guint wrap_around : 1;
   guint double_sided : 1;
   guint flip_sided : 1;
+  guint instancing : 1;
+  guint instancing_color : 1;
+  guint shadow_map : 1;
+  guint shadow_map_type : 2; /* GthreeShadowMapType */
 
-  guint unused : 12;
+  guint unused : 7;
 
   guint16 max_dir_lights;
   guint16 max_point_lights;
@@ -61,8 +65,12 @@ typedef struct {
 GType gthree_program_get_type (void) G_GNUC_CONST;
 
 GthreeProgram *gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters);
+gboolean       gthree_program_poll   (GthreeProgram *program);
+void           gthree_program_finish (GthreeProgram *program);
 
 void gthree_program_use (GthreeProgram *program);
+guint gthree_program_get_id (GthreeProgram *program);
+const GthreeProgramParameters *gthree_program_get_parameters (GthreeProgram *program);
 
 gint gthree_program_lookup_uniform_location (GthreeProgram *program,
                                              GQuark uniform);
@@ -80,6 +88,9 @@ void                gthree_program_cache_free (GthreeProgramCache      *cache);
 GthreeProgram *     gthree_program_cache_get  (GthreeProgramCache      *cache,
                                                GthreeShader            *shader,
                                                GthreeProgramParameters *parameters);
+GthreeProgram *     gthree_program_cache_submit (GthreeProgramCache      *cache,
+                                                 GthreeShader            *shader,
+                                                 GthreeProgramParameters *parameters);
 
 G_END_DECLS
 
@@ -1,13 +1,135 @@
 #include <math.h>
+#include <string.h>
 #include <epoxy/gl.h>
 
 #include "gthreerenderer.h"
 #include "gthreeobjectprivate.h"
+#include "gthreedepthrasterprivate.h"
+#include "gthreetransformsprivate.h"
 #include "gthreeshader.h"
 #include "gthreematerial.h"
+#include "gthreeinstancedmesh.h"
+#include "gthreelod.h"
+#include "gthreerendertarget.h"
+#include "gthreeshadermaterial.h"
+#include "gthreedirectionallight.h"
+#include "gthreepointlight.h"
 #include "gthreeprivate.h"
 #include "gthreeobjectprivate.h"
 
+#define MAX_TRACKED_TEXTURE_UNITS 32
+#define GL_STATE_UNKNOWN G_MAXUINT
+
+/* The last state handed to GL, so that redundant changes can be
+ * skipped. The bindings are forgotten at the start of each render,
+ * as anything else using the context may have changed them since. */
+typedef struct {
+  struct {
+    guint vertex_array;
+    guint array_buffer;
+    guint element_array_buffer;
+    guint uniform_buffer;
+    guint active_texture_unit;
+    guint texture_2d[MAX_TRACKED_TEXTURE_UNITS];
+    guint texture_cube_map[MAX_TRACKED_TEXTURE_UNITS];
+    guint render_state_id;
+  } bindings;
+
+  gboolean render_state_blending;
+  gboolean render_state_depth_equal;
+
+  gboolean flip_sided;
+  gboolean double_sided;
+  gboolean depth_test;
+  gboolean depth_write;
+  guint depth_func;
+  float line_width;
+  gboolean polygon_offset;
+  float polygon_offset_factor;
+  float polygon_offset_units;
+  GthreeBlendMode blending;
+  guint blend_equation;
+  guint blend_src;
+  guint blend_dst;
+} GthreeGLState;
+
+/* The top of the scene graph is walked by the render thread, and the
+ * subtrees below are handed out as jobs to the traversal threads. */
+typedef struct {
+  GthreeObject *object;
+  int parent; /* index of the parent node, -1 for the root */
+  gboolean changed; /* world matrix changed this frame */
+  gboolean visible; /* this and all ancestors are visible */
+} TraversalNode;
+
+/* A run of siblings, the children of a TraversalNode */
+typedef struct {
+  GthreeObject *first;
+  int n_objects;
+  int parent;
+
+  GPtrArray *update_objects; /* GthreeObject */
+  GPtrArray *opaque_objects; /* GthreeObjectBuffer */
+  GPtrArray *transparent_objects; /* GthreeObjectBuffer */
+} TraversalJob;
+
+/* Per object, for occlusion culling. Dropped when the object is
+ * finalized or moved in the scene graph. */
+typedef struct {
+  GthreeObject *object;
+  gulong parent_set_id;
+
+  guint query;
+  guint last_used_frame;
+  guint checked_frame;
+  graphene_point3d_t min, max;
+
+  guint pending : 1; /* result not read yet */
+  guint visible : 1; /* as of the last result */
+  guint needs_query : 1;
+} OcclusionQuery;
+
+/* Visible objects are re-tested less often, as they are drawn anyway */
+#define OCCLUSION_VISIBLE_QUERY_INTERVAL 4
+#define OCCLUSION_MAX_UNUSED_FRAMES 64
+
+/* GPU timestamps are read back this many frames late at most, frames
+ * that would have to wait longer only get CPU times */
+#define TIMER_FRAMES 4
+
+/* One rendered depth map. A directional light has one, a point light
+ * six, one per cube face. */
+typedef struct {
+  GthreeRenderTarget *target;
+  graphene_matrix_t view;
+  graphene_matrix_t projection;
+  graphene_matrix_t matrix; /* world to shadow map coordinates */
+  graphene_vec4_t eye;
+  guint64 signature; /* of the casters and view it was rendered with */
+  gboolean valid;
+} ShadowView;
+
+/* Kept per light, so that maps are only re-rendered when the light or
+ * a caster in view of it moved */
+typedef struct {
+  ShadowView views[6];
+  int n_views;
+  guint last_used_frame;
+} ShadowLight;
+
+/* Each is another sampler in the receiving programs */
+#define MAX_SHADOW_MAPS 8
+#define SHADOW_MAX_UNUSED_FRAMES 64
+
+#define TRAVERSAL_JOBS_PER_THREAD 4
+#define TRAVERSAL_MAX_SPLIT_DEPTH 4
+
+typedef struct {
+  GthreeRenderStats stats;
+  guint queries[GTHREE_N_RENDER_PHASES + 1]; /* GL_TIMESTAMP, at phase starts and the end */
+  gboolean pending;
+} TimerFrame;
+
 typedef struct {
   int width;
   int height;
@@ -24,6 +146,9 @@ typedef struct {
   float viewport_width;
   float viewport_height;
 
+  GthreeRenderTarget *render_target;
+  int default_framebuffer; /* Bound when render_target is unset */
+
   /* Render state */
   GthreeProgramCache *program_cache;
 
@@ -32,34 +157,106 @@ typedef struct {
 
   guint used_texture_units;
 
-  gboolean lights_need_update;
   GthreeLightSetup light_setup;
+  gboolean warned_light_limits;
+  gboolean warned_shadow_limit;
+
+  GthreeFrameBlock frame_block;
+  guint frame_block_buffer;
 
-  gboolean old_flip_sided;
-  gboolean old_double_sided;
-  gboolean old_depth_test;
-  gboolean old_depth_write;
-  float old_line_width;
-  gboolean old_polygon_offset;
-  float old_polygon_offset_factor;
-  float old_polygon_offset_units;
-  GthreeBlendMode old_blending;
-  guint old_blend_equation;
-  guint old_blend_src;
-  guint old_blend_dst;
+  GthreeGLState gl_state;
   GthreeProgram *current_program;
   GthreeMaterial *current_material;
   GthreeCamera *current_camera;
 
   GthreeBuffer *current_geometry_group_buffer;
   GthreeProgram *current_geometry_group_program;
-  gboolean current_geometry_group_wireframe;
+  GthreeVertexArrayFlags current_geometry_group_flags;
 
+  GPtrArray *update_objects; /* GthreeObject */
   GPtrArray *opaque_objects; /* GthreeObjectBuffer */
   GPtrArray *transparent_objects; /* GthreeObjectBuffer */
 
-  guint8 new_attributes[8];
-  guint8 enabled_attributes[8];
+  GthreeTransforms *transforms; /* without traversal threads */
+
+  gboolean occlusion_culling;
+  gboolean occlusion_conditional;
+  guint occlusion_target;
+  guint frame_count;
+  GHashTable *occlusion_queries; /* GthreeObject -> OcclusionQuery */
+  GArray *dead_occlusion_queries; /* query names, deleted on the next render */
+  GPtrArray *occlusion_tests; /* OcclusionQuery, to issue this frame */
+  GPtrArray *occluded_objects; /* GthreeObjectBuffer, drawn after the tests */
+  GthreeProgram *occlusion_program;
+  int occlusion_proj_location;
+  int occlusion_min_location;
+  int occlusion_max_location;
+  guint occlusion_vertex_array;
+  guint occlusion_vertex_buffer;
+  guint occlusion_index_buffer;
+  int n_occlusion_queries;
+  int n_occlusion_culled;
+
+  gboolean shadow_map_enabled;
+  GthreeShadowMapType shadow_map_type;
+  gboolean shadow_pass;
+  GHashTable *shadow_lights; /* GthreeLight -> ShadowLight */
+  GthreeMaterial *shadow_materials[2]; /* for plain and instanced meshes */
+  GPtrArray *shadow_casters; /* GthreeObject */
+  GPtrArray *shadow_render_list; /* GthreeObjectBuffer */
+  int n_shadows; /* maps sampled by receivers this frame */
+  GPtrArray *shadow_textures; /* GthreeTexture */
+  GArray *shadow_map_sizes;
+  GArray *shadow_biases;
+  GArray *shadow_darknesses;
+  GArray *shadow_matrices;
+
+  gboolean depth_prepass; /* for all materials that allow it */
+  gboolean in_depth_prepass;
+  GthreeMaterial *prepass_materials[2]; /* for plain and instanced meshes */
+  GPtrArray *prepass_objects; /* GthreeObjectBuffer, taken out of opaque_objects */
+  guint prepass_queries[2]; /* GL_SAMPLES_PASSED, of the pre-pass and the shaded pass */
+  gboolean prepass_queries_pending;
+  guint64 prepass_samples[2]; /* as of the last result */
+
+  gboolean async_compile;
+  gboolean supports_parallel_compile;
+  GthreeMaterial *placeholder_materials[2]; /* for plain and instanced meshes */
+
+  gboolean software_occlusion;
+  GthreeDepthRaster *depth_raster;
+  GPtrArray *occluders; /* GthreeMesh */
+  GHashTable *software_occluded; /* GthreeObject -> occluded, this render */
+
+  GPtrArray *culled_objects; /* GthreeObject, from the octree */
+  GPtrArray *unbounded_objects; /* GthreeObject, from the octree */
+
+  int n_traversal_threads;
+  GThreadPool *traversal_pool;
+  GArray *traversal_nodes; /* TraversalNode */
+  GArray *traversal_jobs; /* TraversalJob, never shrinks so the lists get reused */
+  int n_traversal_jobs;
+  gboolean traversal_project;
+  int traversal_pending;
+  GMutex traversal_lock;
+  GCond traversal_done;
+
+  gboolean timing;
+  gboolean gpu_timing;
+  TimerFrame timer_frames[TIMER_FRAMES];
+  int next_timer_frame; /* Also the oldest pending one */
+  TimerFrame *timer_frame; /* Or NULL if not timing the GPU this frame */
+  GthreeRenderStats frame_stats;
+  gint64 phase_start;
+  GthreeRenderStats last_stats;
+
+  guint overlay_program;
+  int overlay_rect_location;
+  guint overlay_vertex_array;
+  guint overlay_vertex_buffer;
+  guint overlay_texture;
+  int overlay_width;
+  int overlay_height;
 
   int max_textures;
   int max_vertex_textures;
@@ -70,41 +267,45 @@ typedef struct {
   gboolean supports_vertex_textures;
   gboolean supports_bone_textures;
 
-  guint vertex_array_object;
-
 } GthreeRendererPrivate;
 
 static void gthree_set_default_gl_state (GthreeRenderer *renderer);
+static void delete_dead_occlusion_queries (GthreeRenderer *renderer);
+static void free_occlusion_queries (GthreeRenderer *renderer,
+                                    guint max_unused_frames);
+static void free_shadow_lights (GthreeRenderer *renderer,
+                                guint max_unused_frames);
+static void reset_gl_state_cache (GthreeRenderer *renderer);
+
+enum {
+  FRAME_STATS,
+
+  LAST_SIGNAL
+};
+
+static guint renderer_signals[LAST_SIGNAL] = { 0, };
+
+/* The renderer that is rendering on this thread, if any. Uploads done
+ * by code that doesn't know about the renderer, like object updates,
+ * are counted into its stats. Like the current GL context this is per
+ * thread, so headless renders elsewhere don't mix in. */
+static GPrivate rendering_renderer = G_PRIVATE_INIT (NULL);
 
-static GQuark q_position;
 static GQuark q_color;
 static GQuark q_uv;
 static GQuark q_uv2;
-static GQuark q_normal;
-static GQuark q_viewMatrix;
-static GQuark q_modelMatrix;
-static GQuark q_modelViewMatrix;
-static GQuark q_normalMatrix;
-static GQuark q_projectionMatrix;
-static GQuark q_cameraPosition;
-static GQuark q_ambientLightColor;
-static GQuark q_directionalLightColor;
-static GQuark q_directionalLightDirection;
-static GQuark q_pointLightColor;
-static GQuark q_pointLightPosition;
-static GQuark q_pointLightDistance;
-static GQuark q_spotLightColor;
-static GQuark q_spotLightPosition;
-static GQuark q_spotLightDistance;
-static GQuark q_spotLightDirection;
-static GQuark q_spotLightAngleCos;
-static GQuark q_spotLightExponent;
-static GQuark q_hemisphereLightSkyColor;
-static GQuark q_hemisphereLightGroundColor;
-static GQuark q_hemisphereLightDirection;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GthreeRenderer, gthree_renderer, G_TYPE_OBJECT);
 
+static GthreeRenderStats *
+gthree_render_stats_copy (const GthreeRenderStats *stats)
+{
+  return g_memdup (stats, sizeof (GthreeRenderStats));
+}
+
+G_DEFINE_BOXED_TYPE (GthreeRenderStats, gthree_render_stats,
+                     gthree_render_stats_copy, g_free)
+
 GthreeRenderer *
 gthree_renderer_new ()
 {
@@ -130,7 +331,6 @@ gthree_renderer_init (GthreeRenderer *renderer)
   priv->sort_objects = TRUE;
   priv->width = 1;
   priv->height = 1;
-  priv->lights_need_update = TRUE;
 
   priv->light_setup.dir_len = 0;
   priv->light_setup.dir_colors = g_array_new (FALSE, TRUE, sizeof (float));
@@ -154,21 +354,51 @@ gthree_renderer_init (GthreeRenderer *renderer)
   priv->light_setup.hemi_ground_colors = g_array_new (FALSE, TRUE, sizeof (float));
   priv->light_setup.hemi_positions = g_array_new (FALSE, TRUE, sizeof (float));
 
+  priv->update_objects = g_ptr_array_new ();
   priv->opaque_objects = g_ptr_array_new ();
   priv->transparent_objects = g_ptr_array_new ();
-
-  priv->old_blending = -1;
-  priv->old_blend_equation = -1;
-  priv->old_blend_src = -1;
-  priv->old_blend_dst = -1;
-  priv->old_depth_write = -1;
-  priv->old_depth_test = -1;
+  priv->culled_objects = g_ptr_array_new ();
+  priv->unbounded_objects = g_ptr_array_new ();
+  priv->transforms = gthree_transforms_new ();
+
+  priv->occlusion_queries = g_hash_table_new (NULL, NULL);
+  priv->dead_occlusion_queries = g_array_new (FALSE, FALSE, sizeof (guint));
+  priv->occlusion_tests = g_ptr_array_new ();
+  priv->occluded_objects = g_ptr_array_new ();
+  priv->occluders = g_ptr_array_new ();
+  priv->software_occluded = g_hash_table_new (NULL, NULL);
+
+  priv->shadow_lights = g_hash_table_new (NULL, NULL);
+  priv->shadow_casters = g_ptr_array_new ();
+  priv->shadow_render_list = g_ptr_array_new ();
+  priv->shadow_textures = g_ptr_array_new_with_free_func (g_object_unref);
+  priv->shadow_map_sizes = g_array_new (FALSE, FALSE, sizeof (float));
+  priv->shadow_biases = g_array_new (FALSE, FALSE, sizeof (float));
+  priv->shadow_darknesses = g_array_new (FALSE, FALSE, sizeof (float));
+  priv->shadow_matrices = g_array_new (FALSE, FALSE, sizeof (float));
+
+  priv->prepass_objects = g_ptr_array_new ();
+
+  priv->n_traversal_threads = 1;
+  priv->traversal_nodes = g_array_new (FALSE, FALSE, sizeof (TraversalNode));
+  priv->traversal_jobs = g_array_new (FALSE, TRUE, sizeof (TraversalJob));
+  g_mutex_init (&priv->traversal_lock);
+  g_cond_init (&priv->traversal_done);
+
+  priv->gl_state.blending = -1;
+  priv->gl_state.blend_equation = -1;
+  priv->gl_state.blend_src = -1;
+  priv->gl_state.blend_dst = -1;
+  priv->gl_state.depth_write = -1;
+  priv->gl_state.depth_test = -1;
 
   gthree_set_default_gl_state (renderer);
+  reset_gl_state_cache (renderer);
 
-  /* We only use one vao, so bind it here */
-  glGenVertexArrays (1, &priv->vertex_array_object);
-  glBindVertexArray (priv->vertex_array_object);
+  glGenBuffers (1, &priv->frame_block_buffer);
+  gthree_renderer_bind_buffer (renderer, GL_UNIFORM_BUFFER, priv->frame_block_buffer);
+  glBufferData (GL_UNIFORM_BUFFER, sizeof (GthreeFrameBlock), NULL, GL_DYNAMIC_DRAW);
+  glBindBufferBase (GL_UNIFORM_BUFFER, GTHREE_FRAME_BLOCK_BINDING, priv->frame_block_buffer);
 
   // GPU capabilities
   glGetIntegerv (GL_MAX_TEXTURE_IMAGE_UNITS, &priv->max_textures);
@@ -185,6 +415,10 @@ gthree_renderer_init (GthreeRenderer *renderer)
     priv->supports_vertex_textures &&
     epoxy_has_gl_extension("GL_ARB_texture_float");
 
+  priv->supports_parallel_compile =
+    epoxy_has_gl_extension ("GL_KHR_parallel_shader_compile") ||
+    epoxy_has_gl_extension ("GL_ARB_parallel_shader_compile");
+
   //priv->compressed_texture_formats = _glExtensionCompressedTextureS3TC ? glGetParameter( _gl.COMPRESSED_TEXTURE_FORMATS ) : [];
 
 }
@@ -194,9 +428,12 @@ gthree_renderer_finalize (GObject *obj)
 {
   GthreeRenderer *renderer = GTHREE_RENDERER (obj);
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int i;
 
   gthree_program_cache_free (priv->program_cache);
 
+  glDeleteBuffers (1, &priv->frame_block_buffer);
+
   g_array_free (priv->light_setup.dir_colors, TRUE);
   g_array_free (priv->light_setup.dir_positions, TRUE);
 
@@ -215,8 +452,84 @@ gthree_renderer_finalize (GObject *obj)
   g_array_free (priv->light_setup.hemi_ground_colors, TRUE);
   g_array_free (priv->light_setup.hemi_positions, TRUE);
 
+  g_ptr_array_free (priv->update_objects, TRUE);
   g_ptr_array_free (priv->opaque_objects, TRUE);
   g_ptr_array_free (priv->transparent_objects, TRUE);
+  g_ptr_array_free (priv->culled_objects, TRUE);
+  g_ptr_array_free (priv->unbounded_objects, TRUE);
+  gthree_transforms_free (priv->transforms);
+
+  free_occlusion_queries (renderer, G_MAXUINT);
+  g_hash_table_destroy (priv->occlusion_queries);
+  delete_dead_occlusion_queries (renderer);
+  g_array_free (priv->dead_occlusion_queries, TRUE);
+  g_ptr_array_free (priv->occlusion_tests, TRUE);
+  g_ptr_array_free (priv->occluded_objects, TRUE);
+  g_ptr_array_free (priv->occluders, TRUE);
+  g_hash_table_destroy (priv->software_occluded);
+  if (priv->depth_raster)
+    gthree_depth_raster_free (priv->depth_raster);
+  if (priv->occlusion_program)
+    {
+      g_object_unref (priv->occlusion_program);
+      glDeleteVertexArrays (1, &priv->occlusion_vertex_array);
+      glDeleteBuffers (1, &priv->occlusion_vertex_buffer);
+      glDeleteBuffers (1, &priv->occlusion_index_buffer);
+    }
+  if (priv->overlay_program)
+    {
+      glDeleteProgram (priv->overlay_program);
+      glDeleteVertexArrays (1, &priv->overlay_vertex_array);
+      glDeleteBuffers (1, &priv->overlay_vertex_buffer);
+    }
+  if (priv->overlay_texture)
+    glDeleteTextures (1, &priv->overlay_texture);
+
+  free_shadow_lights (renderer, G_MAXUINT);
+  g_hash_table_destroy (priv->shadow_lights);
+  g_clear_object (&priv->shadow_materials[0]);
+  g_clear_object (&priv->shadow_materials[1]);
+  g_ptr_array_free (priv->shadow_casters, TRUE);
+  g_ptr_array_free (priv->shadow_render_list, TRUE);
+  /* Materials may still hold on to these */
+  g_ptr_array_unref (priv->shadow_textures);
+  g_array_unref (priv->shadow_map_sizes);
+  g_array_unref (priv->shadow_biases);
+  g_array_unref (priv->shadow_darknesses);
+  g_array_unref (priv->shadow_matrices);
+
+  g_clear_object (&priv->prepass_materials[0]);
+  g_clear_object (&priv->prepass_materials[1]);
+  g_ptr_array_free (priv->prepass_objects, TRUE);
+  if (priv->prepass_queries[0])
+    glDeleteQueries (2, priv->prepass_queries);
+
+  g_clear_object (&priv->placeholder_materials[0]);
+  g_clear_object (&priv->placeholder_materials[1]);
+
+  if (priv->traversal_pool)
+    g_thread_pool_free (priv->traversal_pool, FALSE, TRUE);
+
+  g_clear_object (&priv->render_target);
+
+  if (priv->gpu_timing)
+    {
+      for (i = 0; i < TIMER_FRAMES; i++)
+        glDeleteQueries (GTHREE_N_RENDER_PHASES + 1, priv->timer_frames[i].queries);
+    }
+
+  for (i = 0; i < priv->traversal_jobs->len; i++)
+    {
+      TraversalJob *job = &g_array_index (priv->traversal_jobs, TraversalJob, i);
+
+      g_ptr_array_free (job->update_objects, TRUE);
+      g_ptr_array_free (job->opaque_objects, TRUE);
+      g_ptr_array_free (job->transparent_objects, TRUE);
+    }
+  g_array_free (priv->traversal_jobs, TRUE);
+  g_array_free (priv->traversal_nodes, TRUE);
+  g_mutex_clear (&priv->traversal_lock);
+  g_cond_clear (&priv->traversal_done);
 
   G_OBJECT_CLASS (gthree_renderer_parent_class)->finalize (obj);
 }
@@ -226,33 +539,22 @@ gthree_renderer_class_init (GthreeRendererClass *klass)
 {
   G_OBJECT_CLASS (klass)->finalize = gthree_renderer_finalize;
 
+  /* Emitted with timing enabled, a few frames late if the GPU times
+     are being waited for, so not necessarily in frame order */
+  renderer_signals[FRAME_STATS] =
+    g_signal_new ("frame-stats",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__BOXED,
+                  G_TYPE_NONE, 1,
+                  GTHREE_TYPE_RENDER_STATS | G_SIGNAL_TYPE_STATIC_SCOPE);
+
 #define INIT_QUARK(name) q_##name = g_quark_from_static_string (#name)
-  INIT_QUARK(position);
   INIT_QUARK(color);
   INIT_QUARK(uv);
   INIT_QUARK(uv2);
-  INIT_QUARK(normal);
-  INIT_QUARK(viewMatrix);
-  INIT_QUARK(modelMatrix);
-  INIT_QUARK(modelViewMatrix);
-  INIT_QUARK(normalMatrix);
-  INIT_QUARK(projectionMatrix);
-  INIT_QUARK(cameraPosition);
-  INIT_QUARK(ambientLightColor);
-  INIT_QUARK(directionalLightColor);
-  INIT_QUARK(directionalLightDirection);
-  INIT_QUARK(pointLightColor);
-  INIT_QUARK(pointLightPosition);
-  INIT_QUARK(pointLightDistance);
-  INIT_QUARK(spotLightColor);
-  INIT_QUARK(spotLightPosition);
-  INIT_QUARK(spotLightDistance);
-  INIT_QUARK(spotLightDirection);
-  INIT_QUARK(spotLightAngleCos);
-  INIT_QUARK(spotLightExponent);
-  INIT_QUARK(hemisphereLightSkyColor);
-  INIT_QUARK(hemisphereLightGroundColor);
-  INIT_QUARK(hemisphereLightDirection);
 }
 
 void
@@ -343,6 +645,7 @@ gthree_set_default_gl_state (GthreeRenderer *renderer)
 
   glEnable (GL_DEPTH_TEST);
   glDepthFunc (GL_LEQUAL);
+  priv->gl_state.depth_func = GL_LEQUAL;
 
   glFrontFace (GL_CCW);
   glCullFace (GL_BACK);
@@ -361,15 +664,51 @@ gthree_renderer_clear (GthreeRenderer *renderer)
 {
 }
 
+/* Render list sort keys, from the most significant bits down:
+ *  63     pass (0 = opaque, 1 = transparent)
+ *  48-62  program id
+ *  32-47  material id
+ *  16-31  buffer id
+ *   0-15  depth, quantized front to back
+ * Ids wrap, which at worst costs an extra state change.
+ */
+#define SORT_KEY_PASS_SHIFT 63
+#define SORT_KEY_PROGRAM_SHIFT 48
+#define SORT_KEY_MATERIAL_SHIFT 32
+#define SORT_KEY_BUFFER_SHIFT 16
+
+static guint64
+make_sort_key (gboolean        transparent,
+               GthreeMaterial *material,
+               GthreeBuffer   *buffer,
+               float           z)
+{
+  guint64 program_id = 0;
+  guint64 depth;
+
+  if (material->program != NULL)
+    program_id = gthree_program_get_id (material->program);
+
+  /* z is in normalized device coordinates */
+  depth = (guint64) ((CLAMP (z, -1.0f, 1.0f) + 1.0f) * 0.5f * 0xffff);
+
+  return
+    ((guint64) !!transparent << SORT_KEY_PASS_SHIFT) |
+    ((program_id & 0x7fff) << SORT_KEY_PROGRAM_SHIFT) |
+    (((guint64) gthree_material_get_id (material) & 0xffff) << SORT_KEY_MATERIAL_SHIFT) |
+    (((guint64) buffer->id & 0xffff) << SORT_KEY_BUFFER_SHIFT) |
+    (depth & 0xffff);
+}
+
 static gint
-painter_sort_stable (gconstpointer  _a, gconstpointer  _b)
+state_sort_stable (gconstpointer  _a, gconstpointer  _b)
 {
   const GthreeObjectBuffer *a = *(GthreeObjectBuffer **)_a;
   const GthreeObjectBuffer *b = *(GthreeObjectBuffer **)_b;
 
-  if (a->z != b->z)
+  if (a->sort_key != b->sort_key)
     {
-      if (a->z > b->z)
+      if (a->sort_key > b->sort_key)
         return 1;
       else
         return -1;
@@ -409,32 +748,123 @@ reverse_painter_sort_stable (gconstpointer _a, gconstpointer _b)
   return 0;
 }
 
+static void
+reset_gl_state_cache (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  memset (&priv->gl_state.bindings, 0xff, sizeof (priv->gl_state.bindings));
+}
+
+void
+gthree_renderer_bind_vertex_array (GthreeRenderer *renderer,
+                                   guint           vertex_array)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  if (priv->gl_state.bindings.vertex_array == vertex_array)
+    return;
+
+  glBindVertexArray (vertex_array);
+  priv->gl_state.bindings.vertex_array = vertex_array;
+  priv->frame_stats.n_buffer_binds++;
+
+  /* The element array binding is part of the vertex array object */
+  priv->gl_state.bindings.element_array_buffer = GL_STATE_UNKNOWN;
+}
+
+void
+gthree_renderer_bind_buffer (GthreeRenderer *renderer,
+                             guint           target,
+                             guint           buffer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  guint *bound;
+
+  switch (target)
+    {
+    case GL_ARRAY_BUFFER:
+      bound = &priv->gl_state.bindings.array_buffer;
+      break;
+    case GL_ELEMENT_ARRAY_BUFFER:
+      bound = &priv->gl_state.bindings.element_array_buffer;
+      break;
+    case GL_UNIFORM_BUFFER:
+      bound = &priv->gl_state.bindings.uniform_buffer;
+      break;
+    default:
+      glBindBuffer (target, buffer);
+      priv->frame_stats.n_buffer_binds++;
+      return;
+    }
+
+  if (*bound == buffer)
+    return;
+
+  glBindBuffer (target, buffer);
+  *bound = buffer;
+  priv->frame_stats.n_buffer_binds++;
+}
+
+/* Leaves unit active even if the texture was already bound, callers
+ * may go on to upload to it. */
+void
+gthree_renderer_bind_texture (GthreeRenderer *renderer,
+                              guint           unit,
+                              guint           target,
+                              guint           texture)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  guint *bound = NULL;
+
+  if (priv->gl_state.bindings.active_texture_unit != unit)
+    {
+      glActiveTexture (GL_TEXTURE0 + unit);
+      priv->gl_state.bindings.active_texture_unit = unit;
+    }
+
+  if (unit < MAX_TRACKED_TEXTURE_UNITS)
+    {
+      if (target == GL_TEXTURE_2D)
+        bound = &priv->gl_state.bindings.texture_2d[unit];
+      else if (target == GL_TEXTURE_CUBE_MAP)
+        bound = &priv->gl_state.bindings.texture_cube_map[unit];
+    }
+
+  if (bound && *bound == texture)
+    return;
+
+  glBindTexture (target, texture);
+  if (bound)
+    *bound = texture;
+  priv->frame_stats.n_texture_binds++;
+}
+
 static void
 set_material_faces (GthreeRenderer *renderer,
-                    GthreeMaterial *material)
+                    GthreeSide side)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  GthreeSide side = gthree_material_get_side (material);
   gboolean double_sided = side == GTHREE_SIDE_DOUBLE;
   gboolean flip_sided = side == GTHREE_SIDE_BACK;
 
-  if (priv->old_double_sided != double_sided )
+  if (priv->gl_state.double_sided != double_sided )
     {
       if (double_sided)
         glDisable (GL_CULL_FACE);
       else
         glEnable (GL_CULL_FACE);
 
-      priv->old_double_sided = double_sided;
+      priv->gl_state.double_sided = double_sided;
     }
 
-  if (priv->old_flip_sided != flip_sided ) {
+  if (priv->gl_state.flip_sided != flip_sided ) {
     if (flip_sided)
       glFrontFace (GL_CW);
     else
       glFrontFace (GL_CCW);
 
-    priv->old_flip_sided = flip_sided;
+    priv->gl_state.flip_sided = flip_sided;
   }
 }
 
@@ -444,14 +874,14 @@ set_depth_test (GthreeRenderer *renderer,
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  if (priv->old_depth_test != depth_test)
+  if (priv->gl_state.depth_test != depth_test)
     {
       if (depth_test)
         glEnable (GL_DEPTH_TEST);
       else
         glDisable (GL_DEPTH_TEST);
 
-      priv->old_depth_test = depth_test;
+      priv->gl_state.depth_test = depth_test;
     }
 }
 
@@ -461,10 +891,23 @@ set_depth_write (GthreeRenderer *renderer,
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  if (priv->old_depth_write != depth_write)
+  if (priv->gl_state.depth_write != depth_write)
     {
       glDepthMask (depth_write);
-      priv->old_depth_write = depth_write;
+      priv->gl_state.depth_write = depth_write;
+    }
+}
+
+static void
+set_depth_func (GthreeRenderer *renderer,
+                guint depth_func)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  if (priv->gl_state.depth_func != depth_func)
+    {
+      glDepthFunc (depth_func);
+      priv->gl_state.depth_func = depth_func;
     }
 }
 
@@ -474,10 +917,10 @@ set_line_width (GthreeRenderer *renderer,
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  if (priv->old_line_width != line_width)
+  if (priv->gl_state.line_width != line_width)
     {
       glLineWidth (line_width);
-      priv->old_line_width = line_width;
+      priv->gl_state.line_width = line_width;
     }
 }
 
@@ -488,21 +931,21 @@ set_polygon_offset (GthreeRenderer *renderer,
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  if (priv->old_polygon_offset != polygon_offset)
+  if (priv->gl_state.polygon_offset != polygon_offset)
     {
       if (polygon_offset)
         glEnable (GL_POLYGON_OFFSET_FILL);
       else
         glDisable (GL_POLYGON_OFFSET_FILL);
 
-      priv->old_polygon_offset = polygon_offset;
+      priv->gl_state.polygon_offset = polygon_offset;
     }
 
-  if (polygon_offset && (priv->old_polygon_offset_factor != factor || priv->old_polygon_offset_units != units ))
+  if (polygon_offset && (priv->gl_state.polygon_offset_factor != factor || priv->gl_state.polygon_offset_units != units ))
     {
       glPolygonOffset (factor, units);
-      priv->old_polygon_offset_factor = factor;
-      priv->old_polygon_offset_units = units;
+      priv->gl_state.polygon_offset_factor = factor;
+      priv->gl_state.polygon_offset_units = units;
   }
 }
 
@@ -515,7 +958,7 @@ set_blending (GthreeRenderer *renderer,
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  if (blending != priv->old_blending)
+  if (blending != priv->gl_state.blending)
     {
       switch (blending)
         {
@@ -554,54 +997,109 @@ set_blending (GthreeRenderer *renderer,
           glEnable (GL_BLEND);
           break;
         }
-      priv->old_blending = blending;
+      priv->gl_state.blending = blending;
     }
 
   if (blending == GTHREE_BLEND_CUSTOM)
     {
-      if (blend_equation != priv->old_blend_equation)
+      if (blend_equation != priv->gl_state.blend_equation)
         {
           glBlendEquation (blend_equation);
-          priv->old_blend_equation = blend_equation;
+          priv->gl_state.blend_equation = blend_equation;
         }
 
-      if (blend_src != priv->old_blend_src || blend_dst != priv->old_blend_dst)
+      if (blend_src != priv->gl_state.blend_src || blend_dst != priv->gl_state.blend_dst)
         {
           glBlendFunc (blend_src, blend_dst);
 
-          priv->old_blend_src = blend_src;
-          priv->old_blend_dst = blend_dst;
+          priv->gl_state.blend_src = blend_src;
+          priv->gl_state.blend_dst = blend_dst;
         }
     }
   else
     {
-      priv->old_blend_equation = -1;
-      priv->old_blend_src = -1;
-      priv->old_blend_dst = -1;
+      priv->gl_state.blend_equation = -1;
+      priv->gl_state.blend_src = -1;
+      priv->gl_state.blend_dst = -1;
     }
 }
 
+/* With depth_equal the depth buffer already has the depths of what is
+ * drawn, from the depth pre-pass */
 static void
-project_object (GthreeRenderer *renderer,
-                GthreeScene    *scene,
-                GthreeObject   *object,
-                GthreeCamera   *camera)
+set_render_state (GthreeRenderer *renderer,
+                  const GthreeRenderState *state,
+                  gboolean use_blending,
+                  gboolean depth_equal)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  if (state->id == priv->gl_state.bindings.render_state_id &&
+      use_blending == priv->gl_state.render_state_blending &&
+      depth_equal == priv->gl_state.render_state_depth_equal)
+    return;
+
+  if (use_blending)
+    set_blending (renderer, state->blend_mode, state->blend_equation,
+                  state->blend_src_factor, state->blend_dst_factor);
+
+  set_depth_test (renderer, state->depth_test);
+  set_depth_func (renderer, depth_equal ? GL_EQUAL : GL_LEQUAL);
+  set_depth_write (renderer, state->depth_write && !depth_equal);
+  set_polygon_offset (renderer, state->polygon_offset,
+                      state->polygon_offset_factor, state->polygon_offset_units);
+  set_material_faces (renderer, state->side);
+
+  priv->gl_state.bindings.render_state_id = state->id;
+  priv->gl_state.render_state_blending = use_blending;
+  priv->gl_state.render_state_depth_equal = depth_equal;
+}
+
+/* FALSE for the levels of a GthreeLOD other than the current one */
+static gboolean
+lod_level_active (GthreeObject *object)
+{
+  GthreeObject *parent = gthree_object_get_parent (object);
+
+  return parent == NULL || !GTHREE_IS_LOD (parent) ||
+    gthree_lod_is_child_active (GTHREE_LOD (parent), object);
+}
+
+/* Culls a single object and adds its buffers to the render lists.
+ * Objects that need gthree_object_update() are put in update_objects
+ * rather than updated here, as that talks to GL and this may run on a
+ * traversal thread. Returns FALSE if the object and its children are
+ * invisible. */
+static gboolean
+project_single_object (GthreeRenderer *renderer,
+                       GthreeObject   *object,
+                       gboolean        check_frustum,
+                       GPtrArray      *update_objects,
+                       GPtrArray      *opaque_objects,
+                       GPtrArray      *transparent_objects)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
   GList *l, *object_buffers;
-  GthreeObject *child;
-  GthreeObjectIter iter;
+  gboolean added = FALSE, culled = FALSE;
   float z = 0;
 
-  if (!gthree_object_get_visible (object))
-    return;
+  if (!gthree_object_get_visible (object) || !lod_level_active (object))
+    return FALSE;
 
   object_buffers = gthree_object_get_object_buffers (object);
 
-  if (object_buffers != NULL &&
-      (!gthree_object_get_is_frustum_culled (object) || gthree_object_is_in_frustum (object, &priv->frustum)))
+  if (object_buffers == NULL)
+    return TRUE;
+
+  if (check_frustum && gthree_object_get_is_frustum_culled (object) &&
+      !gthree_object_is_in_frustum (object, &priv->frustum))
     {
-      gthree_object_update (object);
+      /* This runs on the traversal threads */
+      g_atomic_int_inc (&priv->frame_stats.n_objects_culled);
+    }
+  else
+    {
+      g_ptr_array_add (update_objects, object);
 
       if (priv->sort_objects)
         {
@@ -629,953 +1127,3181 @@ project_object (GthreeRenderer *renderer,
         {
           GthreeObjectBuffer *buffer_obj = l->data;
           GthreeMaterial *material = gthree_object_buffer_resolve_material (buffer_obj);
+          float buffer_z = z;
+
+          if (buffer_obj->buffer->has_bounding_sphere)
+            {
+              graphene_sphere_t sphere;
+              graphene_point3d_t center;
+              graphene_vec4_t vector;
+
+              graphene_matrix_transform_sphere (gthree_object_get_world_matrix (object),
+                                                &buffer_obj->buffer->bounding_sphere,
+                                                &sphere);
+
+              if (gthree_object_get_is_frustum_culled (object) &&
+                  !graphene_frustum_intersects_sphere (&priv->frustum, &sphere))
+                {
+                  culled = TRUE;
+                  continue;
+                }
+
+              graphene_sphere_get_center (&sphere, &center);
+              graphene_vec4_init (&vector, center.x, center.y, center.z, 1);
+              graphene_matrix_transform_vec4 (&priv->proj_screen_matrix, &vector, &vector);
+              buffer_z = graphene_vec4_get_z (&vector) / graphene_vec4_get_w (&vector);
+            }
 
           if (material)
             {
-              buffer_obj->z = z;
+              gboolean transparent = gthree_material_get_is_transparent (material);
 
-              if (gthree_material_get_is_transparent (material))
-                g_ptr_array_add (priv->transparent_objects, buffer_obj);
+              buffer_obj->z = buffer_z;
+              buffer_obj->sort_key = make_sort_key (transparent, material, buffer_obj->buffer, buffer_z);
+
+              if (transparent)
+                g_ptr_array_add (transparent_objects, buffer_obj);
               else
-                g_ptr_array_add (priv->opaque_objects, buffer_obj);
+                g_ptr_array_add (opaque_objects, buffer_obj);
+              added = TRUE;
             }
 
         }
+
+      /* The stats count objects, not buffers */
+      if (added)
+        g_atomic_int_inc (&priv->frame_stats.n_objects_drawn);
+      else if (culled)
+        g_atomic_int_inc (&priv->frame_stats.n_objects_culled);
     }
 
+  return TRUE;
+}
+
+static void
+project_object (GthreeRenderer *renderer,
+                GthreeObject   *object,
+                GPtrArray      *update_objects,
+                GPtrArray      *opaque_objects,
+                GPtrArray      *transparent_objects)
+{
+  GthreeObject *child;
+  GthreeObjectIter iter;
+
+  if (!project_single_object (renderer, object, TRUE, update_objects, opaque_objects, transparent_objects))
+    return;
+
   gthree_object_iter_init (&iter, object);
   while (gthree_object_iter_next (&iter, &child))
-    project_object (renderer, scene, child, camera);
+    project_object (renderer, child, update_objects, opaque_objects, transparent_objects);
 }
 
-static GthreeProgram *
-init_material (GthreeRenderer *renderer,
-               GthreeMaterial *material,
-               GList *lights,
-               gpointer fog,
-               GthreeObject *object)
+static void
+add_traversal_job (GthreeRenderer *renderer,
+                   GthreeObject   *first,
+                   int             n_objects,
+                   int             parent)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  GList *l;
-  GthreeProgram *program;
-  GthreeShader *shader;
-  GthreeProgramParameters parameters = {0};
-
-  shader = gthree_material_get_shader (material);
+  TraversalJob *job;
 
-  //material.addEventListener( 'dispose', onMaterialDispose );
-  //var u, a, identifiers, i, parameters, maxBones, maxShadows, shaderID;
+  if (priv->n_traversal_jobs == priv->traversal_jobs->len)
+    {
+      g_array_set_size (priv->traversal_jobs, priv->n_traversal_jobs + 1);
+      job = &g_array_index (priv->traversal_jobs, TraversalJob, priv->n_traversal_jobs);
+      job->update_objects = g_ptr_array_new ();
+      job->opaque_objects = g_ptr_array_new ();
+      job->transparent_objects = g_ptr_array_new ();
+    }
 
-  // heuristics to create shader parameters according to lights in the scene
-  // (not to blow over maxLights budget)
+  job = &g_array_index (priv->traversal_jobs, TraversalJob, priv->n_traversal_jobs++);
+  job->first = first;
+  job->n_objects = n_objects;
+  job->parent = parent;
+}
 
-#ifdef TODO
-  maxShadows = allocateShadows( lights );
-  maxBones = allocateBones( object );
-#endif
+/* Splits the graph level by level until there are enough subtrees to
+ * keep all threads busy, the levels above that become nodes. */
+static void
+split_traversal (GthreeRenderer *renderer,
+                 GthreeObject   *root)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int wanted = priv->n_traversal_threads * TRAVERSAL_JOBS_PER_THREAD;
+  TraversalNode root_node = { root, -1, FALSE, TRUE };
+  int level_start, level_end, depth, i;
 
-  parameters.precision = GTHREE_PRECISION_HIGH;
-  parameters.supports_vertex_textures = priv->supports_vertex_textures;
+  g_array_set_size (priv->traversal_nodes, 0);
+  priv->n_traversal_jobs = 0;
 
-  gthree_material_set_params (material, &parameters);
-  for (l = lights; l != NULL; l = l->next)
-    gthree_light_set_params (l->data, &parameters);
+  g_array_append_val (priv->traversal_nodes, root_node);
 
-#ifdef TODO
-  parameters =
+  level_start = 0;
+  for (depth = 1; TRUE; depth++)
     {
-    lightMap: !! material.lightMap,
-    bumpMap: !! material.bumpMap,
-    normalMap: !! material.normalMap,
-    specularMap: !! material.specularMap,
-    alphaMap: !! material.alphaMap,
-
-    fog: fog,
-    useFog: material.fog,
-    fogExp: fog instanceof THREE.FogExp2,
+      int n_children = 0;
+      gboolean last_level;
 
-    sizeAttenuation: material.sizeAttenuation,
-    logarithmicDepthBuffer: _logarithmicDepthBuffer,
+      level_end = priv->traversal_nodes->len;
 
-    skinning: material.skinning,
-    maxBones: maxBones,
-    useVertexTexture: _supportsBoneTextures && object && object.skeleton && object.skeleton.useVertexTexture,
+      for (i = level_start; i < level_end; i++)
+        {
+          GthreeObject *child;
 
-    morphTargets: material.morphTargets,
-    morphNormals: material.morphNormals,
-    maxMorphTargets: this.maxMorphTargets,
-    maxMorphNormals: this.maxMorphNormals,
+          for (child = gthree_object_get_first_child (g_array_index (priv->traversal_nodes, TraversalNode, i).object);
+               child != NULL;
+               child = gthree_object_get_next_sibling (child))
+            n_children++;
+        }
 
-    maxShadows: maxShadows,
-    shadowMapEnabled: this.shadowMapEnabled && object.receiveShadow && maxShadows > 0,
-    shadowMapType: this.shadowMapType,
-    shadowMapDebug: this.shadowMapDebug,
-    shadowMapCascade: this.shadowMapCascade,
-    };
-#endif
+      if (n_children == 0)
+        break;
 
-  program = gthree_program_cache_get (priv->program_cache, shader, &parameters);
-  g_clear_object (&material->program);
-  material->program = program;
+      last_level = n_children >= wanted || depth == TRAVERSAL_MAX_SPLIT_DEPTH;
 
-#ifdef TODO
-  var attributes = material.program.attributes;
-  if (material.morphTargets)
-    {
-      material.numSupportedMorphTargets = 0;
-      var id, base = 'morphTarget';
-      for ( i = 0; i < this.maxMorphTargets; i ++ )
+      for (i = level_start; i < level_end; i++)
         {
-          id = base + i;
-          if ( attributes[ id ] >= 0 )
+          GthreeObject *object = g_array_index (priv->traversal_nodes, TraversalNode, i).object;
+          GthreeObject *child, *first;
+          int run, max_run;
+
+          if (!last_level)
             {
-              material.numSupportedMorphTargets ++;
+              for (child = gthree_object_get_first_child (object);
+                   child != NULL;
+                   child = gthree_object_get_next_sibling (child))
+                {
+                  TraversalNode node = { child, i, FALSE, FALSE };
+
+                  g_array_append_val (priv->traversal_nodes, node);
+                }
+              continue;
             }
 
-        }
-    }
+          max_run = MAX (1, n_children / wanted);
+          first = NULL;
+          run = 0;
+          for (child = gthree_object_get_first_child (object);
+               child != NULL;
+               child = gthree_object_get_next_sibling (child))
+            {
+              if (first == NULL)
+                first = child;
 
-  if (material.morphNormals )
-    {
-      material.numSupportedMorphNormals = 0;
-      var id, base = 'morphNormal';
+              if (++run == max_run)
+                {
+                  add_traversal_job (renderer, first, run, i);
+                  first = NULL;
+                  run = 0;
+                }
+            }
 
-      for ( i = 0; i < this.maxMorphNormals; i ++ )
-        {
-          id = base + i;
-          if ( attributes[ id ] >= 0 )
-            material.numSupportedMorphNormals ++;
+          if (first != NULL)
+            add_traversal_job (renderer, first, run, i);
         }
-    }
-#endif
 
-  gthree_shader_update_uniform_locations_for_program (shader, program);
+      if (last_level)
+        break;
 
-  return NULL;
+      level_start = level_end;
+    }
 }
 
-#if 0
 static void
-print_matrix4 (float *s)
+traversal_thread_func (gpointer data,
+                       gpointer user_data)
 {
-  int i,j;
-  for (i = 0; i < 4; i++)
+  GthreeRenderer *renderer = user_data;
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  TraversalJob *job = data;
+  TraversalNode *parent = &g_array_index (priv->traversal_nodes, TraversalNode, job->parent);
+  GthreeObject *object;
+  int i;
+
+  for (object = job->first, i = 0; i < job->n_objects; object = gthree_object_get_next_sibling (object), i++)
     {
-      if (i == 0)
-        g_print("[ ");
-      else
-        g_print("  ");
-      for (j = 0; j < 4; j++)
-        {
-          if (j != 0)
-            g_print (", ");
-          g_print ("%f", *s++);
-        }
-      if (i == 3)
-        g_print("]\n");
-      else
-        g_print("\n");
+      if (!priv->traversal_project)
+        gthree_object_update_matrix_world (object, parent->changed);
+      else if (parent->visible)
+        project_object (renderer, object, job->update_objects,
+                        job->opaque_objects, job->transparent_objects);
     }
+
+  g_mutex_lock (&priv->traversal_lock);
+  if (--priv->traversal_pending == 0)
+    g_cond_signal (&priv->traversal_done);
+  g_mutex_unlock (&priv->traversal_lock);
 }
-#endif
 
 static void
-load_uniforms_matrices (GthreeRenderer *renderer,
-                        GthreeProgram *program,
-                        GthreeObject *object)
+run_traversal_jobs (GthreeRenderer *renderer,
+                    gboolean        project)
 {
-  float matrix[16];
-  int mvm_location = gthree_program_lookup_uniform_location (program, q_modelViewMatrix);
-  int nm_location = gthree_program_lookup_uniform_location (program, q_normalMatrix);
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int i;
 
-  gthree_object_get_model_view_matrix_floats (object, matrix);
-  glUniformMatrix4fv (mvm_location, 1, FALSE, matrix);
+  if (priv->n_traversal_jobs == 0)
+    return;
 
-  if (nm_location >= 0)
-    {
-      gthree_object_get_normal_matrix3_floats (object, matrix);
-      glUniformMatrix3fv (nm_location, 1, FALSE, matrix);
-    }
+  priv->traversal_project = project;
+  priv->traversal_pending = priv->n_traversal_jobs;
+
+  for (i = 0; i < priv->n_traversal_jobs; i++)
+    g_thread_pool_push (priv->traversal_pool,
+                        &g_array_index (priv->traversal_jobs, TraversalJob, i), NULL);
+
+  g_mutex_lock (&priv->traversal_lock);
+  while (priv->traversal_pending > 0)
+    g_cond_wait (&priv->traversal_done, &priv->traversal_lock);
+  g_mutex_unlock (&priv->traversal_lock);
 }
 
+/* This doesn't use the GthreeTransforms store. Its arrays are one
+ * depth ordered sequence where each level needs the one above it done,
+ * so it can't be split into independent subtrees for the threads. */
 static void
-setup_lights (GthreeRenderer *renderer, GList *lights)
+update_matrix_world_threaded (GthreeRenderer *renderer,
+                              GthreeScene    *scene)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  GthreeLightSetup *setup = &priv->light_setup;
-  GList *l;
   int i;
 
-  setup->ambient.red = 0;
-  setup->ambient.green = 0;
-  setup->ambient.blue = 0;
-  setup->ambient.alpha = 1;
-
-  setup->dir_len = 0;
-  setup->dir_count = 0;
-  setup->point_len = 0;
-  setup->point_count = 0;
-  setup->spot_len = 0;
-  setup->spot_count = 0;
-  setup->hemi_len = 0;
-  setup->hemi_count = 0;
+  split_traversal (renderer, GTHREE_OBJECT (scene));
 
-  for (l = lights; l != NULL; l = l->next)
+  /* Nodes come parents first */
+  for (i = 0; i < priv->traversal_nodes->len; i++)
     {
-      GthreeLight *light = l->data;
-
-      if (gthree_light_get_is_only_shadow (light))
-	continue;
-
-      gthree_light_setup (light, &priv->light_setup);
+      TraversalNode *node = &g_array_index (priv->traversal_nodes, TraversalNode, i);
+      gboolean force = FALSE;
 
-#if TODO
-      else if ( light instanceof THREE.SpotLight )
-	{
-	  spotCount += 1;
+      if (node->parent >= 0)
+        force = g_array_index (priv->traversal_nodes, TraversalNode, node->parent).changed;
 
-	  if ( ! light.visible ) continue;
+      node->changed = gthree_object_update_own_matrix_world (node->object, force);
+    }
 
-	  spotOffset = spotLength * 3;
+  run_traversal_jobs (renderer, FALSE);
+}
 
-	  if ( _this.gammaInput )
-	    setColorGamma( spotColors, spotOffset, color, intensity * intensity );
-	  else
-	    setColorLinear( spotColors, spotOffset, color, intensity );
+static void
+append_ptr_array (GPtrArray *dest,
+                  GPtrArray *src)
+{
+  int i;
 
-	  _vector3.setFromMatrixPosition( light.matrixWorld );
+  for (i = 0; i < src->len; i++)
+    g_ptr_array_add (dest, g_ptr_array_index (src, i));
+}
 
-	  spotPositions[ spotOffset ]     = _vector3.x;
-	  spotPositions[ spotOffset + 1 ] = _vector3.y;
-	  spotPositions[ spotOffset + 2 ] = _vector3.z;
+static gboolean
+ancestors_visible (GthreeObject *object)
+{
+  GthreeObject *parent;
 
-	  spotDistances[ spotLength ] = distance;
+  for (parent = gthree_object_get_parent (object);
+       parent != NULL;
+       parent = gthree_object_get_parent (parent))
+    {
+      if (!gthree_object_get_visible (parent) || !lod_level_active (parent))
+        return FALSE;
+    }
 
-	  _direction.copy( _vector3 );
-	  _vector3.setFromMatrixPosition( light.target.matrixWorld );
-	  _direction.sub( _vector3 );
-	  _direction.normalize();
+  return TRUE;
+}
 
-	  spotDirections[ spotOffset ]     = _direction.x;
-	  spotDirections[ spotOffset + 1 ] = _direction.y;
-	  spotDirections[ spotOffset + 2 ] = _direction.z;
+/* Only visits the objects in cells that intersect the frustum, rather
+ * than the whole graph. */
+static void
+project_octree (GthreeRenderer *renderer,
+                GthreeOctree   *octree)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int i;
 
-	  spotAnglesCos[ spotLength ] = Math.cos( light.angle );
-	  spotExponents[ spotLength ] = light.exponent;
+  g_ptr_array_set_size (priv->culled_objects, 0);
+  g_ptr_array_set_size (priv->unbounded_objects, 0);
 
-	  spotLength += 1;
-	}
-      else if ( light instanceof THREE.HemisphereLight )
-	{
-	  hemiCount += 1;
+  gthree_octree_update (octree);
+  gthree_octree_cull (octree, &priv->frustum, priv->culled_objects, priv->unbounded_objects);
 
-	  if ( ! light.visible ) continue;
+  priv->frame_stats.n_objects_culled += gthree_octree_get_n_bounded (octree) - priv->culled_objects->len;
 
-	  _direction.setFromMatrixPosition( light.matrixWorld );
-	  _direction.normalize();
+  for (i = 0; i < priv->culled_objects->len; i++)
+    {
+      GthreeObject *object = g_ptr_array_index (priv->culled_objects, i);
 
-	  hemiOffset = hemiLength * 3;
+      if (ancestors_visible (object))
+        project_single_object (renderer, object, FALSE, priv->update_objects,
+                               priv->opaque_objects, priv->transparent_objects);
+    }
 
-	  hemiPositions[ hemiOffset ]     = _direction.x;
-	  hemiPositions[ hemiOffset + 1 ] = _direction.y;
-	  hemiPositions[ hemiOffset + 2 ] = _direction.z;
+  for (i = 0; i < priv->unbounded_objects->len; i++)
+    {
+      GthreeObject *object = g_ptr_array_index (priv->unbounded_objects, i);
 
-	  skyColor = light.color;
-	  groundColor = light.groundColor;
+      if (ancestors_visible (object))
+        project_single_object (renderer, object, TRUE, priv->update_objects,
+                               priv->opaque_objects, priv->transparent_objects);
+    }
+}
 
-	  if ( _this.gammaInput )
-	    {
-	      intensitySq = intensity * intensity;
+static void occlusion_object_finalized (gpointer  data,
+                                        GObject  *where_the_object_was);
 
-	      setColorGamma( hemiSkyColors, hemiOffset, skyColor, intensitySq );
-	      setColorGamma( hemiGroundColors, hemiOffset, groundColor, intensitySq );
-	    }
-	  else
-	    {
-	      setColorLinear( hemiSkyColors, hemiOffset, skyColor, intensity );
-	      setColorLinear( hemiGroundColors, hemiOffset, groundColor, intensity );
-	    }
+/* The GL context may not be current when objects go away, so the
+ * query names are only deleted on the next render */
+static void
+occlusion_query_free (GthreeRenderer *renderer,
+                      OcclusionQuery *q,
+                      gboolean        object_alive)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-	  hemiLength += 1;
-	}
-#endif
+  if (object_alive)
+    {
+      g_signal_handler_disconnect (q->object, q->parent_set_id);
+      g_object_weak_unref (G_OBJECT (q->object), occlusion_object_finalized, renderer);
     }
 
+  if (q->query)
+    g_array_append_val (priv->dead_occlusion_queries, q->query);
+  g_slice_free (OcclusionQuery, q);
+}
 
-  // null eventual remains from removed lights
-  // (this is to avoid if in shader)
-  g_array_set_size (setup->dir_colors, MAX(setup->dir_colors->len, setup->dir_count * 3));
-  for (i = setup->dir_len * 3; i < setup->dir_colors->len; i++)
-    g_array_index (setup->dir_colors, float, i) = 0.0;
-	 
-  g_array_set_size (setup->point_colors, MAX(setup->point_colors->len, setup->point_count * 3));
-  for (i = setup->point_len * 3; i < setup->point_colors->len; i++)
-    g_array_index (setup->point_colors, float, i) = 0.0;
-	 
-  g_array_set_size (setup->spot_colors, MAX(setup->spot_colors->len, setup->spot_count * 3));
-  for (i = setup->spot_len * 3; i < setup->spot_colors->len; i++)
-    g_array_index (setup->spot_colors, float, i) = 0.0;
+static void
+drop_occlusion_query (GthreeRenderer *renderer,
+                      GthreeObject   *object,
+                      gboolean        object_alive)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  OcclusionQuery *q;
 
-  g_array_set_size (setup->hemi_sky_colors, MAX(setup->hemi_sky_colors->len, setup->hemi_count * 3));
-  for (i = setup->hemi_len * 3; i < setup->hemi_sky_colors->len; i++)
-    g_array_index (setup->hemi_sky_colors, float, i) = 0.0;
+  q = g_hash_table_lookup (priv->occlusion_queries, object);
+  if (q == NULL)
+    return;
 
-  g_array_set_size (setup->hemi_ground_colors, MAX(setup->hemi_ground_colors->len, setup->hemi_count * 3));
-  for (i = setup->hemi_len * 3; i < setup->hemi_ground_colors->len; i++)
-    g_array_index (setup->hemi_ground_colors, float, i) = 0.0;
+  g_hash_table_remove (priv->occlusion_queries, object);
+  occlusion_query_free (renderer, q, object_alive);
 }
 
+/* Another object allocated at the same address must not inherit the
+ * visibility of this one */
 static void
-refresh_uniforms_lights (GthreeUniforms *uniforms, GthreeLightSetup *lights_setup)
+occlusion_object_finalized (gpointer  data,
+                            GObject  *where_the_object_was)
 {
-  GthreeUniform *uni;
-
-  uni = gthree_uniforms_lookup (uniforms, q_ambientLightColor);
-  if (uni != NULL)
-    gthree_uniform_set_color (uni, &lights_setup->ambient);
-
+  drop_occlusion_query (data, (GthreeObject *)where_the_object_was, FALSE);
+}
 
-  uni = gthree_uniforms_lookup (uniforms, q_directionalLightColor);
-  if (uni != NULL)
-    gthree_uniform_set_float3_array (uni, lights_setup->dir_colors);
+static void
+occlusion_object_parent_set (GthreeObject *object,
+                             GthreeObject *old_parent,
+                             gpointer      data)
+{
+  drop_occlusion_query (data, object, TRUE);
+}
 
-  uni = gthree_uniforms_lookup (uniforms, q_directionalLightDirection);
-  if (uni != NULL)
-    gthree_uniform_set_float3_array (uni, lights_setup->dir_positions);
+static void
+delete_dead_occlusion_queries (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  uni = gthree_uniforms_lookup (uniforms, q_pointLightColor);
-  if (uni != NULL)
-    gthree_uniform_set_float3_array (uni, lights_setup->point_colors);
+  if (priv->dead_occlusion_queries->len == 0)
+    return;
 
-  uni = gthree_uniforms_lookup (uniforms, q_pointLightPosition);
-  if (uni != NULL)
-    gthree_uniform_set_float3_array (uni, lights_setup->point_positions);
+  glDeleteQueries (priv->dead_occlusion_queries->len, (guint *)priv->dead_occlusion_queries->data);
+  g_array_set_size (priv->dead_occlusion_queries, 0);
+}
 
-  uni = gthree_uniforms_lookup (uniforms, q_pointLightDistance);
-  if (uni != NULL)
-    gthree_uniform_set_float_array (uni, lights_setup->point_distances);
+/* Frees the queries of objects that weren't drawn for a while */
+static void
+free_occlusion_queries (GthreeRenderer *renderer,
+                        guint max_unused_frames)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GHashTableIter iter;
+  OcclusionQuery *q;
 
-#ifdef TODO
-  uniforms.spotLightColor.value = lights_setup->spot.colors;
-  uniforms.spotLightPosition.value = lights_setup->spot.positions;
-  uniforms.spotLightDistance.value = lights_setup->spot.distances;
-  uniforms.spotLightDirection.value = lights_setup->spot.directions;
-  uniforms.spotLightAngleCos.value = lights_setup->spot.anglesCos;
-  uniforms.spotLightExponent.value = lights_setup->spot.exponents;
-
-  uniforms.hemisphereLightSkyColor.value = lights_setup->hemi.skyColors;
-  uniforms.hemisphereLightGroundColor.value = lights_setup->hemi.groundColors;
-  uniforms.hemisphereLightDirection.value = lights_setup->hemi.positions;
-#endif
-};
+  g_hash_table_iter_init (&iter, priv->occlusion_queries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&q))
+    {
+      if (max_unused_frames != G_MAXUINT &&
+          priv->frame_count - q->last_used_frame <= max_unused_frames)
+        continue;
 
-// If uniforms are marked as clean, they don't need to be loaded to the GPU.
-static void
-mark_uniforms_lights_needs_update (GthreeUniforms *uniforms, gboolean needs_update)
-{
-  GthreeUniform *uni;
-
-  uni = gthree_uniforms_lookup (uniforms, q_ambientLightColor);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-
-  uni = gthree_uniforms_lookup (uniforms, q_directionalLightColor);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_directionalLightDirection);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-
-  uni = gthree_uniforms_lookup (uniforms, q_pointLightColor);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_pointLightPosition);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_pointLightDistance);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-
-  uni = gthree_uniforms_lookup (uniforms, q_spotLightColor);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_spotLightPosition);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_spotLightDistance);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_spotLightDirection);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_spotLightAngleCos);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_spotLightExponent);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-
-  uni = gthree_uniforms_lookup (uniforms, q_hemisphereLightSkyColor);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_hemisphereLightGroundColor);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
-  uni = gthree_uniforms_lookup (uniforms, q_hemisphereLightDirection);
-  if (uni)
-    gthree_uniform_set_needs_update (uni, needs_update);
+      g_hash_table_iter_remove (&iter);
+      occlusion_query_free (renderer, q, TRUE);
+    }
 }
 
-static GthreeProgram *
-set_program (GthreeRenderer *renderer,
-             GthreeCamera *camera,
-             GList *lights,
-             gpointer fog,
-             GthreeMaterial *material,
-             GthreeObject *object)
+/* Decides visibility from the last available query result, so this
+ * never waits for the GPU. Returns NULL for objects without bounds. */
+static OcclusionQuery *
+update_occlusion (GthreeRenderer *renderer,
+                  GthreeObject *object,
+                  const graphene_point3d_t *camera_pos)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  gboolean refreshProgram = false;
-  gboolean refreshMaterial = false;
-  gboolean refreshLights = false;
-  GthreeProgram *program;
-  GthreeShader *shader;
-  GthreeUniforms *m_uniforms;
-  int location;
+  OcclusionQuery *q;
+  graphene_sphere_t sphere;
+  graphene_point3d_t center;
+  float radius, margin;
 
-  priv->used_texture_units = 0;
+  q = g_hash_table_lookup (priv->occlusion_queries, object);
+  if (q != NULL && q->checked_frame == priv->frame_count)
+    return q;
 
-  if (gthree_material_get_needs_update (material))
+  if (!gthree_object_get_world_bounding_sphere (object, &sphere))
+    return NULL;
+
+  if (q == NULL)
     {
-      init_material (renderer, material, lights, fog, object);
-      gthree_material_set_needs_update (material, FALSE);
+      q = g_slice_new0 (OcclusionQuery);
+      q->object = object;
+      q->visible = TRUE;
+      q->parent_set_id = g_signal_connect (object, "parent-set",
+                                           G_CALLBACK (occlusion_object_parent_set), renderer);
+      g_object_weak_ref (G_OBJECT (object), occlusion_object_finalized, renderer);
+      g_hash_table_insert (priv->occlusion_queries, object, q);
     }
 
-  program = material->program;
-  shader = gthree_material_get_shader (material);
-  m_uniforms = gthree_shader_get_uniforms (shader);
+  q->checked_frame = priv->frame_count;
+  q->last_used_frame = priv->frame_count;
 
-  if (program != priv->current_program )
+  graphene_sphere_get_center (&sphere, &center);
+  radius = graphene_sphere_get_radius (&sphere);
+  graphene_point3d_init (&q->min, center.x - radius, center.y - radius, center.z - radius);
+  graphene_point3d_init (&q->max, center.x + radius, center.y + radius, center.z + radius);
+
+  if (q->pending)
     {
-      gthree_program_use (program);
-      priv->current_program = program;
+      GLuint available, result;
 
-      refreshProgram = TRUE;
-      refreshMaterial = TRUE;
-      refreshLights = TRUE;
+      glGetQueryObjectuiv (q->query, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (available)
+        {
+          glGetQueryObjectuiv (q->query, GL_QUERY_RESULT, &result);
+          q->visible = result != 0;
+          q->pending = FALSE;
+        }
     }
 
-  if (material != priv->current_material)
+  /* The box would be clipped by the near plane */
+  margin = radius * 0.1;
+  if (camera_pos->x >= q->min.x - margin && camera_pos->x <= q->max.x + margin &&
+      camera_pos->y >= q->min.y - margin && camera_pos->y <= q->max.y + margin &&
+      camera_pos->z >= q->min.z - margin && camera_pos->z <= q->max.z + margin)
     {
-      if (priv->current_material == NULL)
-        refreshLights = TRUE;
-      priv->current_material = material;
-      refreshMaterial = TRUE;
+      q->visible = TRUE;
+      q->needs_query = FALSE;
+      return q;
     }
 
-  if (refreshProgram || camera != priv->current_camera)
+  if (!q->visible)
+    q->needs_query = priv->occlusion_conditional || !q->pending;
+  else
+    q->needs_query = !q->pending &&
+      (priv->frame_count + GPOINTER_TO_UINT (object) / 64) % OCCLUSION_VISIBLE_QUERY_INTERVAL == 0;
+
+  if (q->needs_query)
     {
-      const graphene_matrix_t *projection_matrix = gthree_camera_get_projection_matrix (camera);
-      float projection_matrixv[16];
-      gint proction_matrix_location = gthree_program_lookup_uniform_location (program, q_projectionMatrix);
+      if (q->query == 0)
+        glGenQueries (1, &q->query);
+      g_ptr_array_add (priv->occlusion_tests, q);
+    }
 
-      graphene_matrix_to_float (projection_matrix, projection_matrixv);
-      glUniformMatrix4fv (proction_matrix_location, 1, FALSE, projection_matrixv);
+  /* With conditional rendering it is still drawn, maybe */
+  if (!q->visible && !priv->occlusion_conditional)
+    priv->n_occlusion_culled++;
 
-#ifdef TODO
-      if ( _logarithmicDepthBuffer )
-        glUniform1f (uniform_locations.logDepthBufFC, 2.0 / ( Math.log( camera.far + 1.0 ) / Math.LN2 ));
+  return q;
+}
 
-#endif
-      if (camera != priv->current_camera)
-        priv->current_camera = camera;
+/* Removes the buffers of objects that were occluded last time they
+ * were tested. With conditional rendering they are instead drawn
+ * depending on a new test, the opaque ones after all tests are issued. */
+static void
+filter_occluded (GthreeRenderer *renderer,
+                 GPtrArray *render_list,
+                 gboolean defer,
+                 const graphene_point3d_t *camera_pos)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int i, j;
+
+  for (i = 0, j = 0; i < render_list->len; i++)
+    {
+      GthreeObjectBuffer *object_buffer = g_ptr_array_index (render_list, i);
+      OcclusionQuery *q = update_occlusion (renderer, object_buffer->object, camera_pos);
 
-      // load material specific uniforms
-      // (shader material also gets them for the sake of genericity)
+      object_buffer->occlusion_query = 0;
 
-      if (gthree_material_needs_camera_pos (material)
-#if TODO
-          || material.envMap
-#endif
-          )
+      if (q != NULL && !q->visible)
         {
-          gint camera_position_location = gthree_program_lookup_uniform_location (program, q_cameraPosition);
-          if (camera_position_location >= 0)
-            {
-              const graphene_matrix_t *camera_matrix_world = gthree_object_get_world_matrix (GTHREE_OBJECT (camera));
-              graphene_vec4_t pos;
-              graphene_matrix_get_row (camera_matrix_world, 3, &pos);
-              glUniform3f (camera_position_location,
-                           graphene_vec4_get_x (&pos), graphene_vec4_get_y (&pos), graphene_vec4_get_z (&pos));
-            }
-        }
+          if (!priv->occlusion_conditional)
+            continue;
 
-      if (gthree_material_needs_view_matrix (material)
-#if TODO
-	  || material.skinning
-#endif
-	  )
-        {
-	  gint view_matrix_location = gthree_program_lookup_uniform_location (program, q_viewMatrix);
-          if (view_matrix_location >= 0)
+          object_buffer->occlusion_query = q->query;
+          if (defer)
             {
-	      const graphene_matrix_t *m = gthree_camera_get_world_inverse_matrix (camera);
-	      float floats[16];
-	      graphene_matrix_to_float (m, floats);
-              glUniformMatrix4fv (view_matrix_location, 1, FALSE, floats);
+              g_ptr_array_add (priv->occluded_objects, object_buffer);
+              continue;
             }
         }
+
+      render_list->pdata[j++] = object_buffer;
     }
 
-  // skinning uniforms must be set even if material didn't change
-  // auto-setting of texture unit for bone texture must go before other textures
-  // not sure why, but otherwise weird things happen
+  g_ptr_array_set_size (render_list, j);
+}
 
-#if TODO
-  if ( material.skinning )
-    {
-      if ( object.bindMatrix && uniform_locations.bindMatrix !== null )
-        glUniformMatrix4fv( uniform_locations.bindMatrix, false, object.bindMatrix.elements );
+static void
+ensure_occlusion_program (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  static const float vertices[] = {
+    0, 0, 0,  1, 0, 0,  0, 1, 0,  1, 1, 0,
+    0, 0, 1,  1, 0, 1,  0, 1, 1,  1, 1, 1,
+  };
+  static const guint8 indices[] = {
+    0, 2, 1,  1, 2, 3,  4, 5, 6,  5, 7, 6,
+    0, 1, 4,  1, 5, 4,  2, 6, 3,  3, 6, 7,
+    0, 4, 2,  2, 4, 6,  1, 3, 5,  3, 7, 5,
+  };
+  GthreeProgramParameters parameters;
+  int position_location;
+
+  if (priv->occlusion_program)
+    return;
 
-      if ( object.bindMatrixInverse && uniform_locations.bindMatrixInverse !== null )
-        glUniformMatrix4fv( uniform_locations.bindMatrixInverse, false, object.bindMatrixInverse.elements );
+  /* Built like the material programs, so it gets the same prefix */
+  memset (&parameters, 0, sizeof (parameters));
+  priv->occlusion_program = gthree_program_cache_get (priv->program_cache,
+                                                      gthree_get_shader_from_library ("occlusionBox"),
+                                                      &parameters);
+
+  priv->occlusion_proj_location = gthree_program_lookup_uniform_location_from_string (priv->occlusion_program, "projScreenMatrix");
+  priv->occlusion_min_location = gthree_program_lookup_uniform_location_from_string (priv->occlusion_program, "boxMin");
+  priv->occlusion_max_location = gthree_program_lookup_uniform_location_from_string (priv->occlusion_program, "boxMax");
+  position_location = gthree_program_get_attribute_slot (priv->occlusion_program, GTHREE_ATTRIBUTE_SLOT_POSITION);
+
+  glGenVertexArrays (1, &priv->occlusion_vertex_array);
+  gthree_renderer_bind_vertex_array (renderer, priv->occlusion_vertex_array);
+
+  glGenBuffers (1, &priv->occlusion_vertex_buffer);
+  gthree_renderer_bind_buffer (renderer, GL_ARRAY_BUFFER, priv->occlusion_vertex_buffer);
+  glBufferData (GL_ARRAY_BUFFER, sizeof (vertices), vertices, GL_STATIC_DRAW);
+  glEnableVertexAttribArray (position_location);
+  glVertexAttribPointer (position_location, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+  glGenBuffers (1, &priv->occlusion_index_buffer);
+  gthree_renderer_bind_buffer (renderer, GL_ELEMENT_ARRAY_BUFFER, priv->occlusion_index_buffer);
+  glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof (indices), indices, GL_STATIC_DRAW);
+}
 
-      if ( _supportsBoneTextures && object.skeleton && object.skeleton.useVertexTexture )
-        {
-          if ( uniform_locations.boneTexture !== null )
-            {
-              var textureUnit = getTextureUnit();
-              glUniform1i( uniform_locations.boneTexture, textureUnit );
-              _this.setTexture( object.skeleton.boneTexture, textureUnit );
-            }
+/* Draws the bounding boxes of the objects to test against the depth
+ * buffer, without touching the color or depth buffers. */
+static void
+issue_occlusion_queries (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  float proj[16];
+  int i;
 
-          if ( uniform_locations.boneTextureWidth !== null )
-            glUniform1i( uniform_locations.boneTextureWidth, object.skeleton.boneTextureWidth );
+  if (priv->occlusion_tests->len == 0)
+    return;
 
-          if ( uniform_locations.boneTextureHeight !== null )
-            glUniform1i( uniform_locations.boneTextureHeight, object.skeleton.boneTextureHeight );
+  ensure_occlusion_program (renderer);
 
-        }
-      else if ( object.skeleton && object.skeleton.boneMatrices )
-        {
-          if ( uniform_locations.boneGlobalMatrices !== null )
-            glUniformMatrix4fv( uniform_locations.boneGlobalMatrices, false, object.skeleton.boneMatrices );
-        }
+  gthree_program_use (priv->occlusion_program);
+  priv->current_program = NULL;
+
+  graphene_matrix_to_float (&priv->proj_screen_matrix, proj);
+  glUniformMatrix4fv (priv->occlusion_proj_location, 1, FALSE, proj);
+
+  gthree_renderer_bind_vertex_array (renderer, priv->occlusion_vertex_array);
+
+  set_depth_test (renderer, TRUE);
+  set_depth_func (renderer, GL_LEQUAL);
+  set_depth_write (renderer, FALSE);
+  set_material_faces (renderer, GTHREE_SIDE_DOUBLE);
+  priv->gl_state.bindings.render_state_id = GL_STATE_UNKNOWN;
+  glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+  for (i = 0; i < priv->occlusion_tests->len; i++)
+    {
+      OcclusionQuery *q = g_ptr_array_index (priv->occlusion_tests, i);
+
+      glUniform3f (priv->occlusion_min_location, q->min.x, q->min.y, q->min.z);
+      glUniform3f (priv->occlusion_max_location, q->max.x, q->max.y, q->max.z);
+      gthree_render_stats_add_uniform_upload (2 * 3 * sizeof (float));
+
+      glBeginQuery (priv->occlusion_target, q->query);
+      glDrawElements (GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, NULL);
+      priv->frame_stats.n_draw_calls++;
+      priv->frame_stats.n_triangles += 12;
+      glEndQuery (priv->occlusion_target);
+
+      q->pending = TRUE;
     }
-#endif
 
-  if ( refreshMaterial )
+  glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+  priv->n_occlusion_queries += priv->occlusion_tests->len;
+}
+
+#define SOFTWARE_OCCLUSION_WIDTH 256
+
+/* Kicks off rasterizing the visible occluders, which runs while the
+ * render thread prepares the rest of the frame. */
+static void
+begin_software_occlusion (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int width, height, i;
+
+  width = SOFTWARE_OCCLUSION_WIDTH;
+  height = CLAMP (width * priv->height / MAX (priv->width, 1), 16, width);
+
+  if (priv->depth_raster &&
+      (gthree_depth_raster_get_width (priv->depth_raster) != width ||
+       gthree_depth_raster_get_height (priv->depth_raster) != height))
     {
-      gthree_material_set_uniforms (material, m_uniforms, camera);
+      gthree_depth_raster_free (priv->depth_raster);
+      priv->depth_raster = NULL;
+    }
 
-#if TODO
-    // refresh uniforms common to several materials
-      if ( fog && material.fog )
-        refreshUniformsFog( m_uniforms, fog );
-#endif
+  if (priv->depth_raster == NULL)
+    priv->depth_raster = gthree_depth_raster_new (width, height);
+
+  /* The buffers of an object are next to each other */
+  g_ptr_array_set_size (priv->occluders, 0);
+  for (i = 0; i < priv->opaque_objects->len; i++)
+    {
+      GthreeObject *object = ((GthreeObjectBuffer *)g_ptr_array_index (priv->opaque_objects, i))->object;
+
+      if (gthree_object_get_is_occluder (object) &&
+          GTHREE_IS_MESH (object) && !GTHREE_IS_INSTANCED_MESH (object) &&
+          (priv->occluders->len == 0 ||
+           g_ptr_array_index (priv->occluders, priv->occluders->len - 1) != object))
+        g_ptr_array_add (priv->occluders, object);
+    }
+
+  gthree_depth_raster_begin (priv->depth_raster, &priv->proj_screen_matrix, priv->occluders);
+}
+
+static void
+filter_software_occluded (GthreeRenderer *renderer,
+                          GPtrArray *render_list)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeObject *last_object = NULL;
+  gboolean last_occluded = FALSE;
+  int i, j;
+
+  for (i = 0, j = 0; i < render_list->len; i++)
+    {
+      GthreeObjectBuffer *object_buffer = g_ptr_array_index (render_list, i);
+      GthreeObject *object = object_buffer->object;
 
-      if (gthree_material_needs_lights (material))
+      if (object != last_object)
         {
-          if (priv->lights_need_update )
-            {
-              refreshLights = TRUE;
-              setup_lights (renderer, lights);
-              priv->lights_need_update = false;
-            }
+          gpointer result;
 
-          if (refreshLights)
-            {
-              refresh_uniforms_lights (m_uniforms, &priv->light_setup);
-              mark_uniforms_lights_needs_update (m_uniforms, TRUE);
-            }
+          last_object = object;
+
+          /* Objects with both opaque and transparent buffers are in
+             several lists, test and count them once */
+          if (g_hash_table_lookup_extended (priv->software_occluded, object, NULL, &result))
+            last_occluded = GPOINTER_TO_INT (result);
           else
             {
-              mark_uniforms_lights_needs_update (m_uniforms, FALSE);
+              graphene_sphere_t sphere;
+
+              last_occluded =
+                !gthree_object_get_is_occluder (object) &&
+                gthree_object_get_world_bounding_sphere (object, &sphere) &&
+                gthree_depth_raster_is_occluded (priv->depth_raster, &sphere);
+              g_hash_table_insert (priv->software_occluded, object, GINT_TO_POINTER (last_occluded));
+
+              if (last_occluded)
+                priv->n_occlusion_culled++;
             }
         }
 
-      // refresh single material specific uniforms
+      if (!last_occluded)
+        render_list->pdata[j++] = object_buffer;
+    }
 
-#if TODO
-      if ( material instanceof THREE.LineBasicMaterial )
-        {
-          refreshUniformsLine( m_uniforms, material );
-        }
-      else if ( material instanceof THREE.LineDashedMaterial )
+  g_ptr_array_set_size (render_list, j);
+}
+
+/* Reuses the split from update_matrix_world_threaded() */
+static void
+project_threaded (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int i;
+
+  for (i = 0; i < priv->traversal_nodes->len; i++)
+    {
+      TraversalNode *node = &g_array_index (priv->traversal_nodes, TraversalNode, i);
+
+      node->visible =
+        (node->parent < 0 || g_array_index (priv->traversal_nodes, TraversalNode, node->parent).visible) &&
+        project_single_object (renderer, node->object, TRUE, priv->update_objects,
+                               priv->opaque_objects, priv->transparent_objects);
+    }
+
+  for (i = 0; i < priv->n_traversal_jobs; i++)
+    {
+      TraversalJob *job = &g_array_index (priv->traversal_jobs, TraversalJob, i);
+
+      g_ptr_array_set_size (job->update_objects, 0);
+      g_ptr_array_set_size (job->opaque_objects, 0);
+      g_ptr_array_set_size (job->transparent_objects, 0);
+    }
+
+  run_traversal_jobs (renderer, TRUE);
+
+  /* Merge in job order, so the result doesn't depend on scheduling */
+  for (i = 0; i < priv->n_traversal_jobs; i++)
+    {
+      TraversalJob *job = &g_array_index (priv->traversal_jobs, TraversalJob, i);
+
+      append_ptr_array (priv->update_objects, job->update_objects);
+      append_ptr_array (priv->opaque_objects, job->opaque_objects);
+      append_ptr_array (priv->transparent_objects, job->transparent_objects);
+    }
+}
+
+/* Not while rendering the shadow maps themselves, or the depth pre-pass */
+static gboolean
+object_receives_shadows (GthreeRenderer *renderer,
+                         GthreeObject   *object)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->shadow_map_enabled && !priv->shadow_pass && !priv->in_depth_prepass &&
+    priv->n_shadows > 0 &&
+    gthree_object_get_receive_shadow (object);
+}
+
+static GthreeProgram *
+init_material (GthreeRenderer *renderer,
+               GthreeMaterial *material,
+               GList *lights,
+               gpointer fog,
+               GthreeObject *object,
+               gboolean async)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GList *l;
+  GthreeProgram *program;
+  GthreeShader *shader;
+  GthreeProgramParameters parameters = {0};
+
+  shader = gthree_material_get_shader (material);
+
+  //material.addEventListener( 'dispose', onMaterialDispose );
+  //var u, a, identifiers, i, parameters, maxBones, maxShadows, shaderID;
+
+  // heuristics to create shader parameters according to lights in the scene
+  // (not to blow over maxLights budget)
+
+#ifdef TODO
+  maxBones = allocateBones( object );
+#endif
+
+  parameters.precision = GTHREE_PRECISION_HIGH;
+  parameters.supports_vertex_textures = priv->supports_vertex_textures;
+
+  if (GTHREE_IS_INSTANCED_MESH (object))
+    {
+      parameters.instancing = TRUE;
+      parameters.instancing_color = gthree_instanced_mesh_has_colors (GTHREE_INSTANCED_MESH (object));
+    }
+
+  gthree_material_set_params (material, &parameters);
+  for (l = lights; l != NULL; l = l->next)
+    gthree_light_set_params (l->data, &parameters);
+
+  /* The light arrays in the frame block have a fixed size */
+  parameters.max_dir_lights = MIN (parameters.max_dir_lights, GTHREE_MAX_DIR_LIGHTS);
+  parameters.max_point_lights = MIN (parameters.max_point_lights, GTHREE_MAX_POINT_LIGHTS);
+  parameters.max_spot_lights = MIN (parameters.max_spot_lights, GTHREE_MAX_SPOT_LIGHTS);
+  parameters.max_hemi_lights = MIN (parameters.max_hemi_lights, GTHREE_MAX_HEMI_LIGHTS);
+
+  if (object_receives_shadows (renderer, object))
+    {
+      parameters.shadow_map = TRUE;
+      parameters.shadow_map_type = priv->shadow_map_type;
+      parameters.max_shadows = priv->n_shadows;
+    }
+
+#ifdef TODO
+  parameters =
+    {
+    lightMap: !! material.lightMap,
+    bumpMap: !! material.bumpMap,
+    normalMap: !! material.normalMap,
+    specularMap: !! material.specularMap,
+    alphaMap: !! material.alphaMap,
+
+    fog: fog,
+    useFog: material.fog,
+    fogExp: fog instanceof THREE.FogExp2,
+
+    sizeAttenuation: material.sizeAttenuation,
+    logarithmicDepthBuffer: _logarithmicDepthBuffer,
+
+    skinning: material.skinning,
+    maxBones: maxBones,
+    useVertexTexture: _supportsBoneTextures && object && object.skeleton && object.skeleton.useVertexTexture,
+
+    morphTargets: material.morphTargets,
+    morphNormals: material.morphNormals,
+    maxMorphTargets: this.maxMorphTargets,
+    maxMorphNormals: this.maxMorphNormals,
+
+    shadowMapDebug: this.shadowMapDebug,
+    shadowMapCascade: this.shadowMapCascade,
+    };
+#endif
+
+  if (async)
+    program = gthree_program_cache_submit (priv->program_cache, shader, &parameters);
+  else
+    program = gthree_program_cache_get (priv->program_cache, shader, &parameters);
+
+#ifdef TODO
+  var attributes = material.program.attributes;
+  if (material.morphTargets)
+    {
+      material.numSupportedMorphTargets = 0;
+      var id, base = 'morphTarget';
+      for ( i = 0; i < this.maxMorphTargets; i ++ )
         {
-          refreshUniformsLine( m_uniforms, material );
-          refreshUniformsDash( m_uniforms, material );
+          id = base + i;
+          if ( attributes[ id ] >= 0 )
+            {
+              material.numSupportedMorphTargets ++;
+            }
+
         }
-      else if ( material instanceof THREE.PointCloudMaterial )
+    }
+
+  if (material.morphNormals )
+    {
+      material.numSupportedMorphNormals = 0;
+      var id, base = 'morphNormal';
+
+      for ( i = 0; i < this.maxMorphNormals; i ++ )
         {
-          refreshUniformsParticle( m_uniforms, material );
+          id = base + i;
+          if ( attributes[ id ] >= 0 )
+            material.numSupportedMorphNormals ++;
         }
+    }
+#endif
 
-      if ( object.receiveShadow && ! material._shadowPass )
+  return program;
+}
+
+#if 0
+static void
+print_matrix4 (float *s)
+{
+  int i,j;
+  for (i = 0; i < 4; i++)
+    {
+      if (i == 0)
+        g_print("[ ");
+      else
+        g_print("  ");
+      for (j = 0; j < 4; j++)
         {
-          refreshUniformsShadow( m_uniforms, lights );
+          if (j != 0)
+            g_print (", ");
+          g_print ("%f", *s++);
         }
+      if (i == 3)
+        g_print("]\n");
+      else
+        g_print("\n");
+    }
+}
 #endif
 
-      // load common uniforms
-      gthree_uniforms_load (m_uniforms, renderer);
-    }
+/* The model view and normal matrices are only computed for programs
+   that actually use them */
+static void
+load_uniforms_matrices (GthreeRenderer *renderer,
+                        GthreeProgram *program,
+                        GthreeObject *object)
+{
+  float matrix[16];
+  int mvm_location = gthree_program_get_uniform_slot (program, GTHREE_UNIFORM_SLOT_MODEL_VIEW_MATRIX);
+  int nm_location = gthree_program_get_uniform_slot (program, GTHREE_UNIFORM_SLOT_NORMAL_MATRIX);
+
+  if (mvm_location >= 0)
+    {
+      gthree_object_get_model_view_matrix_floats (object, matrix);
+      glUniformMatrix4fv (mvm_location, 1, FALSE, matrix);
+      gthree_render_stats_add_uniform_upload (16 * sizeof (float));
+    }
+
+  if (nm_location >= 0)
+    {
+      gthree_object_get_normal_matrix3_floats (object, matrix);
+      glUniformMatrix3fv (nm_location, 1, FALSE, matrix);
+      gthree_render_stats_add_uniform_upload (9 * sizeof (float));
+    }
+}
+
+static void
+setup_lights (GthreeRenderer *renderer, GList *lights)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeLightSetup *setup = &priv->light_setup;
+  GList *l;
+  int i;
+
+  setup->ambient.red = 0;
+  setup->ambient.green = 0;
+  setup->ambient.blue = 0;
+  setup->ambient.alpha = 1;
+
+  setup->dir_len = 0;
+  setup->dir_count = 0;
+  setup->point_len = 0;
+  setup->point_count = 0;
+  setup->spot_len = 0;
+  setup->spot_count = 0;
+  setup->hemi_len = 0;
+  setup->hemi_count = 0;
+
+  for (l = lights; l != NULL; l = l->next)
+    {
+      GthreeLight *light = l->data;
+
+      if (gthree_light_get_is_only_shadow (light))
+	continue;
+
+      gthree_light_setup (light, &priv->light_setup);
+
+#if TODO
+      else if ( light instanceof THREE.SpotLight )
+	{
+	  spotCount += 1;
+
+	  if ( ! light.visible ) continue;
+
+	  spotOffset = spotLength * 3;
+
+	  if ( _this.gammaInput )
+	    setColorGamma( spotColors, spotOffset, color, intensity * intensity );
+	  else
+	    setColorLinear( spotColors, spotOffset, color, intensity );
+
+	  _vector3.setFromMatrixPosition( light.matrixWorld );
+
+	  spotPositions[ spotOffset ]     = _vector3.x;
+	  spotPositions[ spotOffset + 1 ] = _vector3.y;
+	  spotPositions[ spotOffset + 2 ] = _vector3.z;
+
+	  spotDistances[ spotLength ] = distance;
+
+	  _direction.copy( _vector3 );
+	  _vector3.setFromMatrixPosition( light.target.matrixWorld );
+	  _direction.sub( _vector3 );
+	  _direction.normalize();
+
+	  spotDirections[ spotOffset ]     = _direction.x;
+	  spotDirections[ spotOffset + 1 ] = _direction.y;
+	  spotDirections[ spotOffset + 2 ] = _direction.z;
+
+	  spotAnglesCos[ spotLength ] = Math.cos( light.angle );
+	  spotExponents[ spotLength ] = light.exponent;
+
+	  spotLength += 1;
+	}
+      else if ( light instanceof THREE.HemisphereLight )
+	{
+	  hemiCount += 1;
+
+	  if ( ! light.visible ) continue;
+
+	  _direction.setFromMatrixPosition( light.matrixWorld );
+	  _direction.normalize();
+
+	  hemiOffset = hemiLength * 3;
+
+	  hemiPositions[ hemiOffset ]     = _direction.x;
+	  hemiPositions[ hemiOffset + 1 ] = _direction.y;
+	  hemiPositions[ hemiOffset + 2 ] = _direction.z;
+
+	  skyColor = light.color;
+	  groundColor = light.groundColor;
+
+	  if ( _this.gammaInput )
+	    {
+	      intensitySq = intensity * intensity;
+
+	      setColorGamma( hemiSkyColors, hemiOffset, skyColor, intensitySq );
+	      setColorGamma( hemiGroundColors, hemiOffset, groundColor, intensitySq );
+	    }
+	  else
+	    {
+	      setColorLinear( hemiSkyColors, hemiOffset, skyColor, intensity );
+	      setColorLinear( hemiGroundColors, hemiOffset, groundColor, intensity );
+	    }
+
+	  hemiLength += 1;
+	}
+#endif
+    }
+
+  /* Only this many fit in the frame block, the rest are not drawn */
+  if (!priv->warned_light_limits &&
+      (setup->dir_len > GTHREE_MAX_DIR_LIGHTS ||
+       setup->point_len > GTHREE_MAX_POINT_LIGHTS ||
+       setup->spot_len > GTHREE_MAX_SPOT_LIGHTS ||
+       setup->hemi_len > GTHREE_MAX_HEMI_LIGHTS))
+    {
+      g_warning ("Scene has %d directional, %d point, %d spot and %d hemisphere lights, "
+                 "only up to %d, %d, %d and %d are used",
+                 setup->dir_len, setup->point_len, setup->spot_len, setup->hemi_len,
+                 GTHREE_MAX_DIR_LIGHTS, GTHREE_MAX_POINT_LIGHTS,
+                 GTHREE_MAX_SPOT_LIGHTS, GTHREE_MAX_HEMI_LIGHTS);
+      priv->warned_light_limits = TRUE;
+    }
+
+  // null eventual remains from removed lights
+  // (this is to avoid if in shader)
+  g_array_set_size (setup->dir_colors, MAX(setup->dir_colors->len, setup->dir_count * 3));
+  for (i = setup->dir_len * 3; i < setup->dir_colors->len; i++)
+    g_array_index (setup->dir_colors, float, i) = 0.0;
+	 
+  g_array_set_size (setup->point_colors, MAX(setup->point_colors->len, setup->point_count * 3));
+  for (i = setup->point_len * 3; i < setup->point_colors->len; i++)
+    g_array_index (setup->point_colors, float, i) = 0.0;
+	 
+  g_array_set_size (setup->spot_colors, MAX(setup->spot_colors->len, setup->spot_count * 3));
+  for (i = setup->spot_len * 3; i < setup->spot_colors->len; i++)
+    g_array_index (setup->spot_colors, float, i) = 0.0;
+
+  g_array_set_size (setup->hemi_sky_colors, MAX(setup->hemi_sky_colors->len, setup->hemi_count * 3));
+  for (i = setup->hemi_len * 3; i < setup->hemi_sky_colors->len; i++)
+    g_array_index (setup->hemi_sky_colors, float, i) = 0.0;
+
+  g_array_set_size (setup->hemi_ground_colors, MAX(setup->hemi_ground_colors->len, setup->hemi_count * 3));
+  for (i = setup->hemi_len * 3; i < setup->hemi_ground_colors->len; i++)
+    g_array_index (setup->hemi_ground_colors, float, i) = 0.0;
+}
+
+static void
+copy_vec3_array (float   (*dest)[4],
+                 GArray   *src,
+                 int       max)
+{
+  int i, n = MIN (src->len / 3, max);
+
+  for (i = 0; i < n; i++)
+    {
+      dest[i][0] = g_array_index (src, float, i * 3);
+      dest[i][1] = g_array_index (src, float, i * 3 + 1);
+      dest[i][2] = g_array_index (src, float, i * 3 + 2);
+    }
+}
+
+static void
+copy_float_array (float   (*dest)[4],
+                  GArray   *src,
+                  int       max)
+{
+  int i, n = MIN (src->len, max);
+
+  for (i = 0; i < n; i++)
+    dest[i][0] = g_array_index (src, float, i);
+}
+
+/* Uploads the per-render view and light state shared by all programs */
+static void
+upload_frame_block (GthreeRenderer          *renderer,
+                    const graphene_matrix_t *projection,
+                    const graphene_matrix_t *view,
+                    const graphene_vec4_t   *position)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeFrameBlock *block = &priv->frame_block;
+  GthreeLightSetup *setup = &priv->light_setup;
+
+  memset (block, 0, sizeof (GthreeFrameBlock));
+
+  graphene_matrix_to_float (projection, block->projection_matrix);
+  graphene_matrix_to_float (view, block->view_matrix);
+  graphene_vec4_to_float (position, block->camera_position);
+
+  block->ambient_light_color[0] = setup->ambient.red;
+  block->ambient_light_color[1] = setup->ambient.green;
+  block->ambient_light_color[2] = setup->ambient.blue;
+
+  copy_vec3_array (block->directional_light_color, setup->dir_colors, GTHREE_MAX_DIR_LIGHTS);
+  copy_vec3_array (block->directional_light_direction, setup->dir_positions, GTHREE_MAX_DIR_LIGHTS);
+
+  copy_vec3_array (block->point_light_color, setup->point_colors, GTHREE_MAX_POINT_LIGHTS);
+  copy_vec3_array (block->point_light_position, setup->point_positions, GTHREE_MAX_POINT_LIGHTS);
+  copy_float_array (block->point_light_distance, setup->point_distances, GTHREE_MAX_POINT_LIGHTS);
+
+  copy_vec3_array (block->spot_light_color, setup->spot_colors, GTHREE_MAX_SPOT_LIGHTS);
+  copy_vec3_array (block->spot_light_position, setup->spot_positions, GTHREE_MAX_SPOT_LIGHTS);
+  copy_vec3_array (block->spot_light_direction, setup->spot_directions, GTHREE_MAX_SPOT_LIGHTS);
+  copy_float_array (block->spot_light_distance, setup->spot_distances, GTHREE_MAX_SPOT_LIGHTS);
+  copy_float_array (block->spot_light_angle_cos, setup->spot_angles_cos, GTHREE_MAX_SPOT_LIGHTS);
+  copy_float_array (block->spot_light_exponent, setup->spot_exponents, GTHREE_MAX_SPOT_LIGHTS);
+
+  copy_vec3_array (block->hemisphere_light_sky_color, setup->hemi_sky_colors, GTHREE_MAX_HEMI_LIGHTS);
+  copy_vec3_array (block->hemisphere_light_ground_color, setup->hemi_ground_colors, GTHREE_MAX_HEMI_LIGHTS);
+  copy_vec3_array (block->hemisphere_light_direction, setup->hemi_positions, GTHREE_MAX_HEMI_LIGHTS);
+
+  gthree_renderer_bind_buffer (renderer, GL_UNIFORM_BUFFER, priv->frame_block_buffer);
+  glBufferSubData (GL_UNIFORM_BUFFER, 0, sizeof (GthreeFrameBlock), block);
+  gthree_render_stats_add_uniform_upload (sizeof (GthreeFrameBlock));
+}
+
+static void
+update_frame_block (GthreeRenderer *renderer,
+                    GthreeCamera   *camera)
+{
+  graphene_vec4_t pos;
+
+  graphene_matrix_get_row (gthree_object_get_world_matrix (GTHREE_OBJECT (camera)), 3, &pos);
+  upload_frame_block (renderer,
+                      gthree_camera_get_projection_matrix (camera),
+                      gthree_camera_get_world_inverse_matrix (camera),
+                      &pos);
+}
+
+static gboolean
+program_matches_object (GthreeRenderer *renderer,
+                        GthreeProgram  *program,
+                        GthreeObject   *object)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  const GthreeProgramParameters *params = gthree_program_get_parameters (program);
+  gboolean instancing = FALSE, instancing_color = FALSE;
+  gboolean shadow_map = object_receives_shadows (renderer, object);
+
+  if (GTHREE_IS_INSTANCED_MESH (object))
+    {
+      instancing = TRUE;
+      instancing_color = gthree_instanced_mesh_has_colors (GTHREE_INSTANCED_MESH (object));
+    }
+
+  if (params->instancing != instancing || params->instancing_color != instancing_color)
+    return FALSE;
+
+  /* The number of maps is compiled in */
+  if (params->shadow_map != shadow_map)
+    return FALSE;
+  if (shadow_map &&
+      (params->max_shadows != priv->n_shadows || params->shadow_map_type != priv->shadow_map_type))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Dropping a program deletes its vertex array objects, which must not
+   happen to the one that is bound */
+static void
+forget_vertex_array (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  gthree_renderer_bind_vertex_array (renderer, 0);
+  priv->current_geometry_group_buffer = NULL;
+}
+
+/* Which of the material's programs the object needs, see
+   GTHREE_N_PROGRAM_VARIANTS */
+static guint
+program_variant (GthreeRenderer *renderer,
+                 GthreeObject   *object)
+{
+  guint variant = 0;
+
+  if (GTHREE_IS_INSTANCED_MESH (object))
+    {
+      variant |= 1;
+      if (gthree_instanced_mesh_has_colors (GTHREE_INSTANCED_MESH (object)))
+        variant |= 2;
+    }
+
+  if (object_receives_shadows (renderer, object))
+    variant |= 4;
+
+  return variant;
+}
+
+/* Returns the material's program for the object, creating it if the
+   material doesn't have it yet. Unless async, the program is finished
+   and made material->program, with the uniform locations looked up in
+   it; those aren't known before linking is done. */
+static GthreeProgram *
+select_material_program (GthreeRenderer *renderer,
+                         GthreeMaterial *material,
+                         GList *lights,
+                         gpointer fog,
+                         GthreeObject *object,
+                         gboolean async)
+{
+  guint variant = program_variant (renderer, object);
+  GthreeProgram *program;
+
+  if (gthree_material_get_needs_update (material))
+    {
+      forget_vertex_array (renderer);
+      gthree_material_clear_program_variants (material);
+      gthree_material_set_needs_update (material, FALSE);
+    }
+
+  program = gthree_material_get_program_variant (material, variant);
+  if (program == NULL || !program_matches_object (renderer, program, object))
+    {
+      forget_vertex_array (renderer);
+      program = init_material (renderer, material, lights, fog, object, async);
+      gthree_material_set_program_variant (material, variant, program);
+      g_object_unref (program);
+    }
+
+  if (async)
+    return program;
+
+  gthree_program_finish (program);
+
+  if (material->program != program)
+    {
+      g_set_object (&material->program, program);
+      gthree_shader_update_uniform_locations_for_program (gthree_material_get_shader (material), program);
+    }
+
+  return program;
+}
+
+static void
+refresh_uniforms_shadow (GthreeRenderer *renderer,
+                         GthreeUniforms *uniforms)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  gthree_uniforms_set_texture_array (uniforms, "shadowMap", priv->shadow_textures);
+  gthree_uniforms_set_vec2_array (uniforms, "shadowMapSize", priv->shadow_map_sizes);
+  gthree_uniforms_set_float_array (uniforms, "shadowBias", priv->shadow_biases);
+  gthree_uniforms_set_float_array (uniforms, "shadowDarkness", priv->shadow_darknesses);
+  gthree_uniforms_set_matrix4_array (uniforms, "shadowMatrix", priv->shadow_matrices);
+}
+
+static GthreeProgram *
+set_program (GthreeRenderer *renderer,
+             GthreeCamera *camera,
+             GList *lights,
+             gpointer fog,
+             GthreeMaterial *material,
+             GthreeObject *object)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  gboolean refreshProgram = false;
+  gboolean refreshMaterial = false;
+  GthreeProgram *program;
+  GthreeShader *shader;
+  GthreeUniforms *m_uniforms;
+  int location;
+
+  priv->used_texture_units = 0;
+
+  program = select_material_program (renderer, material, lights, fog, object, FALSE);
+  shader = gthree_material_get_shader (material);
+  m_uniforms = gthree_shader_get_uniforms (shader);
+
+  if (program != priv->current_program )
+    {
+      gthree_program_use (program);
+      priv->current_program = program;
+      priv->frame_stats.n_program_switches++;
+
+      refreshProgram = TRUE;
+      refreshMaterial = TRUE;
+    }
+
+  if (material != priv->current_material)
+    {
+      priv->current_material = material;
+      priv->frame_stats.n_material_switches++;
+      refreshMaterial = TRUE;
+    }
+
+  /* The camera matrices and position live in the frame uniform block,
+     see update_frame_block() */
+  if (refreshProgram || camera != priv->current_camera)
+    {
+#ifdef TODO
+      if ( _logarithmicDepthBuffer )
+        glUniform1f (uniform_locations.logDepthBufFC, 2.0 / ( Math.log( camera.far + 1.0 ) / Math.LN2 ));
+
+#endif
+      if (camera != priv->current_camera)
+        priv->current_camera = camera;
+    }
+
+  // skinning uniforms must be set even if material didn't change
+  // auto-setting of texture unit for bone texture must go before other textures
+  // not sure why, but otherwise weird things happen
+
+#if TODO
+  if ( material.skinning )
+    {
+      if ( object.bindMatrix && uniform_locations.bindMatrix !== null )
+        glUniformMatrix4fv( uniform_locations.bindMatrix, false, object.bindMatrix.elements );
+
+      if ( object.bindMatrixInverse && uniform_locations.bindMatrixInverse !== null )
+        glUniformMatrix4fv( uniform_locations.bindMatrixInverse, false, object.bindMatrixInverse.elements );
+
+      if ( _supportsBoneTextures && object.skeleton && object.skeleton.useVertexTexture )
+        {
+          if ( uniform_locations.boneTexture !== null )
+            {
+              var textureUnit = getTextureUnit();
+              glUniform1i( uniform_locations.boneTexture, textureUnit );
+              _this.setTexture( object.skeleton.boneTexture, textureUnit );
+            }
+
+          if ( uniform_locations.boneTextureWidth !== null )
+            glUniform1i( uniform_locations.boneTextureWidth, object.skeleton.boneTextureWidth );
+
+          if ( uniform_locations.boneTextureHeight !== null )
+            glUniform1i( uniform_locations.boneTextureHeight, object.skeleton.boneTextureHeight );
+
+        }
+      else if ( object.skeleton && object.skeleton.boneMatrices )
+        {
+          if ( uniform_locations.boneGlobalMatrices !== null )
+            glUniformMatrix4fv( uniform_locations.boneGlobalMatrices, false, object.skeleton.boneMatrices );
+        }
+    }
+#endif
+
+  if ( refreshMaterial )
+    {
+      gthree_material_set_uniforms (material, m_uniforms, camera);
+
+#if TODO
+    // refresh uniforms common to several materials
+      if ( fog && material.fog )
+        refreshUniformsFog( m_uniforms, fog );
+#endif
+
+      /* Lights are in the frame uniform block too */
+
+      // refresh single material specific uniforms
+
+#if TODO
+      if ( material instanceof THREE.LineBasicMaterial )
+        {
+          refreshUniformsLine( m_uniforms, material );
+        }
+      else if ( material instanceof THREE.LineDashedMaterial )
+        {
+          refreshUniformsLine( m_uniforms, material );
+          refreshUniformsDash( m_uniforms, material );
+        }
+      else if ( material instanceof THREE.PointCloudMaterial )
+        {
+          refreshUniformsParticle( m_uniforms, material );
+        }
+#endif
+
+      if (gthree_program_get_parameters (program)->shadow_map)
+        refresh_uniforms_shadow (renderer, m_uniforms);
+
+      // load common uniforms
+      gthree_uniforms_load (m_uniforms, renderer);
+    }
+
+  load_uniforms_matrices (renderer, program, object);
+
+  location = gthree_program_get_uniform_slot (program, GTHREE_UNIFORM_SLOT_MODEL_MATRIX);
+  if (location >= 0)
+    {
+      float matrix[16];
+      gthree_object_get_world_matrix_floats (object, matrix);
+      glUniformMatrix4fv (location, 1, FALSE, matrix);
+      gthree_render_stats_add_uniform_upload (16 * sizeof (float));
+    }
+
+  return program;
+}
+
+/* The optional attributes the object has data for, these and the
+ * program decide which arrays a vertex array object enables. */
+static GthreeVertexArrayFlags
+vertex_array_flags (GthreeObject *object,
+                    gboolean      wireframe)
+{
+  GthreeVertexArrayFlags flags = 0;
+
+  if (wireframe)
+    flags |= GTHREE_VERTEX_ARRAY_WIREFRAME;
+  if (gthree_object_has_attribute_data (object, q_color))
+    flags |= GTHREE_VERTEX_ARRAY_COLOR;
+  if (gthree_object_has_attribute_data (object, q_uv))
+    flags |= GTHREE_VERTEX_ARRAY_UV;
+  if (gthree_object_has_attribute_data (object, q_uv2))
+    flags |= GTHREE_VERTEX_ARRAY_UV2;
+
+  return flags;
+}
+
+/* Called with a freshly generated vertex array object bound, records
+ * the attribute layout of program for buffer into it. */
+static void
+setup_vertex_array_object (GthreeRenderer *renderer,
+                           GthreeProgram *program,
+                           GthreeBuffer *buffer,
+                           GthreeVertexArrayFlags flags)
+{
+  gint position_location, color_location, uv_location, uv2_location, normal_location;
+  gint matrix_location, instance_color_location;
+
+  // vertices
+  position_location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_POSITION);
+  if (/*!material.morphTargets && */ position_location >= 0)
+    {
+      gthree_renderer_bind_buffer (renderer, GL_ARRAY_BUFFER, buffer->vertex_buffer);
+      glEnableVertexAttribArray (position_location);
+      glVertexAttribPointer (position_location, 3, GL_FLOAT, FALSE, 0, NULL);
+    }
+  else
+    {
+      /*
+      if (object.morphTargetBase)
+        setupMorphTargets( material, geometryGroup, object );
+      */
+    }
+
+  // custom attributes
+  // Use the per-geometryGroup custom attribute arrays which are setup in initMeshBuffers
+#if TODO
+  if (geometryGroup.__webglCustomAttributesList )
+    {
+      for ( i = 0, il = geometryGroup.__webglCustomAttributesList.length; i < il; i ++ )
+        {
+          attribute = geometryGroup.__webglCustomAttributesList[ i ];
+          if ( attributes[ attribute.buffer.belongsToAttribute ] >= 0 )
+            {
+              _gl.bindBuffer( _gl.ARRAY_BUFFER, attribute.buffer );
+              enableAttribute( attributes[ attribute.buffer.belongsToAttribute ] );
+              _gl.vertexAttribPointer( attributes[ attribute.buffer.belongsToAttribute ], attribute.size, _gl.FLOAT, false, 0, 0 );
+            }
+        }
+    }
+#endif
+
+  // colors
+  color_location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_COLOR);
+  if (color_location >= 0 && (flags & GTHREE_VERTEX_ARRAY_COLOR))
+    {
+      gthree_renderer_bind_buffer (renderer, GL_ARRAY_BUFFER, buffer->color_buffer);
+      glEnableVertexAttribArray (color_location);
+      glVertexAttribPointer (color_location, 3, GL_FLOAT, FALSE, 0, NULL);
+    }
+
+  // uvs
+  uv_location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_UV);
+  if (uv_location >= 0 && (flags & GTHREE_VERTEX_ARRAY_UV))
+    {
+      gthree_renderer_bind_buffer (renderer, GL_ARRAY_BUFFER, buffer->uv_buffer);
+      glEnableVertexAttribArray (uv_location);
+      glVertexAttribPointer (uv_location, 2, GL_FLOAT, FALSE, 0, NULL);
+    }
+
+  uv2_location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_UV2);
+  if (uv2_location >= 0 && (flags & GTHREE_VERTEX_ARRAY_UV2))
+    {
+      gthree_renderer_bind_buffer (renderer, GL_ARRAY_BUFFER, buffer->uv2_buffer);
+      glEnableVertexAttribArray (uv2_location);
+      glVertexAttribPointer (uv2_location, 2, GL_FLOAT, FALSE, 0, NULL);
+    }
+
+  // normals
+  normal_location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_NORMAL);
+  if (normal_location >= 0 )
+    {
+      gthree_renderer_bind_buffer (renderer, GL_ARRAY_BUFFER, buffer->normal_buffer);
+      glEnableVertexAttribArray (normal_location);
+      glVertexAttribPointer (normal_location, 3, GL_FLOAT, FALSE, 0, NULL);
+    }
+
+  // instances, the pointers are set per object in bind_instance_attributes()
+  matrix_location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_INSTANCE_MATRIX);
+  if (matrix_location >= 0)
+    {
+      int i;
+
+      for (i = 0; i < 4; i++)
+        {
+          glEnableVertexAttribArray (matrix_location + i);
+          glVertexAttribDivisor (matrix_location + i, 1);
+        }
+    }
+
+  instance_color_location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_INSTANCE_COLOR);
+  if (instance_color_location >= 0)
+    {
+      glEnableVertexAttribArray (instance_color_location);
+      glVertexAttribDivisor (instance_color_location, 1);
+    }
+
+#ifdef TODO
+  // skinning
+
+  // line distances
+#endif
+
+  if (flags & GTHREE_VERTEX_ARRAY_WIREFRAME)
+    gthree_renderer_bind_buffer (renderer, GL_ELEMENT_ARRAY_BUFFER, buffer->line_buffer);
+  else
+    gthree_renderer_bind_buffer (renderer, GL_ELEMENT_ARRAY_BUFFER, buffer->face_buffer);
+}
+
+/* Constant attribute values are not part of the vertex array object
+ * state, so these have to be reloaded whenever it changes. */
+static void
+load_default_attributes (GthreeRenderer *renderer,
+                         GthreeProgram *program,
+                         GthreeMaterial *material,
+                         GthreeVertexArrayFlags flags)
+{
+  gint location;
+
+  location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_COLOR);
+  if (location >= 0 && !(flags & GTHREE_VERTEX_ARRAY_COLOR))
+    gthree_material_load_default_attribute (material, location, q_color);
+
+  location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_UV);
+  if (location >= 0 && !(flags & GTHREE_VERTEX_ARRAY_UV))
+    gthree_material_load_default_attribute (material, location, q_uv);
+
+  location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_UV2);
+  if (location >= 0 && !(flags & GTHREE_VERTEX_ARRAY_UV2))
+    gthree_material_load_default_attribute (material, location, q_uv2);
+}
+
+static void
+bind_instance_attributes (GthreeRenderer *renderer,
+                          GthreeProgram *program,
+                          GthreeInstancedMesh *instanced)
+{
+  gint matrix_location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_INSTANCE_MATRIX);
+  gint instance_color_location = gthree_program_get_attribute_slot (program, GTHREE_ATTRIBUTE_SLOT_INSTANCE_COLOR);
+  gsize color_offset;
+  guint instance_buffer = gthree_instanced_mesh_get_instance_buffer (instanced, &color_offset);
+
+  gthree_renderer_bind_buffer (renderer, GL_ARRAY_BUFFER, instance_buffer);
+
+  /* A mat4 attribute takes four consecutive locations, one per column */
+  if (matrix_location >= 0)
+    {
+      int i;
+
+      for (i = 0; i < 4; i++)
+        glVertexAttribPointer (matrix_location + i, 4, GL_FLOAT, FALSE,
+                               16 * sizeof (float), GSIZE_TO_POINTER (i * 4 * sizeof (float)));
+    }
+
+  if (instance_color_location >= 0)
+    glVertexAttribPointer (instance_color_location, 3, GL_FLOAT, FALSE, 0, GSIZE_TO_POINTER (color_offset));
+}
+
+static void
+render_buffer (GthreeRenderer *renderer,
+               GthreeCamera *camera,
+               GList *lights,
+               gpointer fog,
+               GthreeMaterial *material,
+               GthreeObjectBuffer *object_buffer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeBuffer *buffer = object_buffer->buffer;
+  GthreeObject *object = object_buffer->object;
+  GthreeProgram *program = set_program (renderer, camera, lights, fog, material, object);
+  gboolean wireframe = gthree_material_get_is_wireframe (material);
+  GthreeVertexArrayFlags flags;
+  GthreeInstancedMesh *instanced = NULL;
+
+  if (!gthree_material_get_is_visible (material))
+    return;
+
+  flags = vertex_array_flags (object, wireframe);
+  if (buffer != priv->current_geometry_group_buffer ||
+      program != priv->current_geometry_group_program ||
+      flags != priv->current_geometry_group_flags)
+    {
+      gboolean created;
+      guint vao;
+
+      priv->current_geometry_group_buffer = buffer;
+      priv->current_geometry_group_program = program;
+      priv->current_geometry_group_flags = flags;
+
+      vao = gthree_buffer_get_vertex_array_object (buffer, program, flags, &created);
+      gthree_renderer_bind_vertex_array (renderer, vao);
+      if (created)
+        setup_vertex_array_object (renderer, program, buffer, flags);
+
+      load_default_attributes (renderer, program, material, flags);
+    }
+
+  if (GTHREE_IS_INSTANCED_MESH (object))
+    {
+      instanced = GTHREE_INSTANCED_MESH (object);
+      bind_instance_attributes (renderer, program, instanced);
+    }
+
+  priv->frame_stats.n_draw_calls++;
+
+  // render mesh
+  if (TRUE /* object instanceof THREE.Mesh */ )
+    {
+      int n_instances = instanced ? gthree_instanced_mesh_get_count (instanced) : 1;
+
+      if (wireframe)
+        {
+          // wireframe
+          set_line_width (renderer, gthree_material_get_wireframe_line_width (material));
+          if (instanced)
+            glDrawElementsInstanced (GL_LINES, buffer->line_count, GL_UNSIGNED_SHORT, 0, n_instances);
+          else
+            glDrawElements (GL_LINES, buffer->line_count, GL_UNSIGNED_SHORT, 0 );
+          priv->frame_stats.n_lines += buffer->line_count / 2 * n_instances;
+        }
+      else
+        {
+          // triangles
+          if (instanced)
+            glDrawElementsInstanced (GL_TRIANGLES, buffer->face_count, GL_UNSIGNED_SHORT, 0, n_instances);
+          else
+            glDrawElements (GL_TRIANGLES, buffer->face_count, GL_UNSIGNED_SHORT, 0 );
+          priv->frame_stats.n_triangles += buffer->face_count / 3 * n_instances;
+        }
+    }
+}
+
+static void
+ensure_internal_materials (GthreeMaterial *materials[2],
+                           const char     *shader_name)
+{
+  int i;
+
+  if (materials[0])
+    return;
+
+  /* Separate ones, so neither has to switch programs between plain
+     and instanced meshes */
+  for (i = 0; i < 2; i++)
+    {
+      GthreeShader *shader = gthree_clone_shader_from_library (shader_name);
+
+      materials[i] = GTHREE_MATERIAL (gthree_shader_material_new (shader));
+      g_object_unref (shader);
+    }
+}
+
+/* Starts compiling a program for the material in the background if
+ * needed. The material can't be drawn before this returns TRUE. */
+static gboolean
+material_program_ready (GthreeRenderer *renderer,
+                        GthreeMaterial *material,
+                        GList *lights,
+                        gpointer fog,
+                        GthreeObject *object)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  if (!priv->async_compile || !priv->supports_parallel_compile)
+    return TRUE;
+
+  return gthree_program_poll (select_material_program (renderer, material, lights, fog, object, TRUE));
+}
+
+static void
+render_objects (GthreeRenderer *renderer,
+                GPtrArray *render_list,
+                GthreeCamera *camera,
+                GList *lights,
+                gpointer fog,
+                gboolean use_blending,
+                gboolean depth_equal,
+                GthreeMaterial *override_material)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeObjectBuffer *object_buffer;
+  GthreeMaterial *material;
+  int i;
+
+  for (i = 0; i < render_list->len; i++)
+    {
+      object_buffer = g_ptr_array_index (render_list, i);
+
+      gthree_object_update_matrix_view (object_buffer->object, gthree_camera_get_world_inverse_matrix (camera));
+
+      if (override_material)
+        material = override_material;
+      else
+        material = gthree_object_buffer_resolve_material (object_buffer);
+
+      if (material == NULL)
+        continue;
+
+      set_render_state (renderer, gthree_material_get_render_state (material), use_blending, depth_equal);
+
+      /* With the render state of the real material */
+      if (override_material == NULL &&
+          !material_program_ready (renderer, material, lights, fog, object_buffer->object))
+        {
+          priv->frame_stats.n_pending_programs++;
+          ensure_internal_materials (priv->placeholder_materials, "placeholder");
+          material = priv->placeholder_materials[GTHREE_IS_INSTANCED_MESH (object_buffer->object)];
+        }
+
+      if (object_buffer->occlusion_query)
+        glBeginConditionalRender (object_buffer->occlusion_query, GL_QUERY_NO_WAIT);
+
+      render_buffer (renderer, camera, lights, fog, material, object_buffer);
+
+      if (object_buffer->occlusion_query)
+        glEndConditionalRender ();
+    }
+}
+
+/* Fragments the shaded pass discards or moves would leave the wrong
+ * depths behind */
+static gboolean
+wants_depth_prepass (GthreeRenderer *renderer,
+                     GthreeMaterial *material)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  const GthreeRenderState *state;
+
+  if (!priv->depth_prepass && !gthree_material_get_depth_prepass (material))
+    return FALSE;
+
+  state = gthree_material_get_render_state (material);
+
+  return state->depth_test && state->depth_write &&
+    gthree_material_get_is_visible (material) &&
+    !gthree_material_get_is_wireframe (material) &&
+    gthree_material_get_alpha_test (material) == 0;
+}
+
+/* Moves the opaque buffers that get a depth pre-pass to
+ * prepass_objects, keeping the order of both */
+static void
+split_depth_prepass (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GPtrArray *opaque_objects = priv->opaque_objects;
+  int i, j;
+
+  g_ptr_array_set_size (priv->prepass_objects, 0);
+
+  for (i = 0, j = 0; i < opaque_objects->len; i++)
+    {
+      GthreeObjectBuffer *object_buffer = g_ptr_array_index (opaque_objects, i);
+      GthreeMaterial *material = gthree_object_buffer_resolve_material (object_buffer);
+
+      if (material != NULL && wants_depth_prepass (renderer, material))
+        g_ptr_array_add (priv->prepass_objects, object_buffer);
+      else
+        opaque_objects->pdata[j++] = object_buffer;
+    }
+
+  g_ptr_array_set_size (opaque_objects, j);
+}
+
+/* Reads back the sample counts of an earlier frame if they are done,
+ * and returns whether new queries can be started */
+static gboolean
+collect_prepass_queries (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GLuint64 samples;
+  GLint available = 0;
+  int i;
+
+  if (priv->prepass_queries[0] == 0)
+    glGenQueries (2, priv->prepass_queries);
+
+  if (!priv->prepass_queries_pending)
+    return TRUE;
+
+  glGetQueryObjectiv (priv->prepass_queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available)
+    return FALSE;
+
+  for (i = 0; i < 2; i++)
+    {
+      glGetQueryObjectui64v (priv->prepass_queries[i], GL_QUERY_RESULT, &samples);
+      priv->prepass_samples[i] = samples;
+    }
+  priv->prepass_queries_pending = FALSE;
+
+  return TRUE;
+}
+
+/* Lays down the depth of prepass_objects with a minimal program, then
+ * shades them with GL_EQUAL, so each pixel is only shaded once */
+static void
+render_depth_prepassed (GthreeRenderer *renderer,
+                        GthreeCamera *camera,
+                        GList *lights,
+                        gpointer fog)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  gboolean query;
+  int i;
+
+  ensure_internal_materials (priv->prepass_materials, "depthPrepass");
+
+  query = collect_prepass_queries (renderer);
+
+  glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  priv->in_depth_prepass = TRUE;
+
+  if (query)
+    glBeginQuery (GL_SAMPLES_PASSED, priv->prepass_queries[0]);
+
+  for (i = 0; i < priv->prepass_objects->len; i++)
+    {
+      GthreeObjectBuffer *object_buffer = g_ptr_array_index (priv->prepass_objects, i);
+      GthreeMaterial *material = gthree_object_buffer_resolve_material (object_buffer);
+
+      gthree_object_update_matrix_view (object_buffer->object, gthree_camera_get_world_inverse_matrix (camera));
+
+      /* The faces and polygon offset of the real material */
+      set_render_state (renderer, gthree_material_get_render_state (material), FALSE, FALSE);
+
+      if (object_buffer->occlusion_query)
+        glBeginConditionalRender (object_buffer->occlusion_query, GL_QUERY_NO_WAIT);
+
+      render_buffer (renderer, camera, NULL, NULL,
+                     priv->prepass_materials[GTHREE_IS_INSTANCED_MESH (object_buffer->object)],
+                     object_buffer);
+
+      if (object_buffer->occlusion_query)
+        glEndConditionalRender ();
+    }
+
+  if (query)
+    glEndQuery (GL_SAMPLES_PASSED);
+
+  priv->in_depth_prepass = FALSE;
+  glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+  if (query)
+    glBeginQuery (GL_SAMPLES_PASSED, priv->prepass_queries[1]);
+
+  render_objects (renderer, priv->prepass_objects, camera, lights, fog, FALSE, TRUE, NULL);
+
+  if (query)
+    {
+      glEndQuery (GL_SAMPLES_PASSED);
+      priv->prepass_queries_pending = TRUE;
+    }
+
+  priv->frame_stats.n_depth_prepass_objects += priv->prepass_objects->len;
+  priv->frame_stats.depth_prepass_samples = priv->prepass_samples[0];
+  priv->frame_stats.depth_prepass_shaded_samples = priv->prepass_samples[1];
+}
+
+static void
+clear (gboolean color, gboolean depth, gboolean stencil)
+{
+  guint bits = 0;
+  if (color)
+    bits |= GL_COLOR_BUFFER_BIT;
+  if (depth)
+    bits |= GL_DEPTH_BUFFER_BIT;
+  if (stencil)
+    bits |= GL_STENCIL_BUFFER_BIT;
+
+  glClear (bits);
+}
+
+/* Needs the context, the targets own GL objects */
+static void
+free_shadow_lights (GthreeRenderer *renderer,
+                    guint max_unused_frames)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GHashTableIter iter;
+  ShadowLight *shadow;
+  int i;
+
+  g_hash_table_iter_init (&iter, priv->shadow_lights);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&shadow))
+    {
+      if (max_unused_frames != G_MAXUINT &&
+          priv->frame_count - shadow->last_used_frame <= max_unused_frames)
+        continue;
+
+      for (i = 0; i < G_N_ELEMENTS (shadow->views); i++)
+        {
+          if (shadow->views[i].target)
+            gthree_render_target_unrealize (shadow->views[i].target);
+          g_clear_object (&shadow->views[i].target);
+        }
+      g_slice_free (ShadowLight, shadow);
+      g_hash_table_iter_remove (&iter);
+    }
+}
+
+/* A view matrix, looking down -z like the cameras do */
+static void
+shadow_look_at (graphene_matrix_t     *view,
+                const graphene_vec3_t *eye,
+                const graphene_vec3_t *center,
+                const graphene_vec3_t *up)
+{
+  graphene_vec3_t x, y, z;
+
+  graphene_vec3_subtract (eye, center, &z);
+  graphene_vec3_normalize (&z, &z);
+
+  if (fabsf (graphene_vec3_dot (&z, up)) > 0.999f)
+    up = graphene_vec3_z_axis ();
+
+  graphene_vec3_cross (up, &z, &x);
+  graphene_vec3_normalize (&x, &x);
+  graphene_vec3_cross (&z, &x, &y);
+
+  graphene_matrix_init_from_float (view, (float [16]) {
+      graphene_vec3_get_x (&x), graphene_vec3_get_x (&y), graphene_vec3_get_x (&z), 0,
+      graphene_vec3_get_y (&x), graphene_vec3_get_y (&y), graphene_vec3_get_y (&z), 0,
+      graphene_vec3_get_z (&x), graphene_vec3_get_z (&y), graphene_vec3_get_z (&z), 0,
+      -graphene_vec3_dot (&x, eye), -graphene_vec3_dot (&y, eye), -graphene_vec3_dot (&z, eye), 1 });
+}
+
+static void
+get_world_position (GthreeObject    *object,
+                    graphene_vec3_t *pos)
+{
+  graphene_vec4_t row;
+
+  graphene_matrix_get_row (gthree_object_get_world_matrix (object), 3, &row);
+  graphene_vec4_get_xyz (&row, pos);
+}
+
+/* Returns the number of views, 0 for lights that can't cast shadows */
+static int
+setup_shadow_views (GthreeLight *light,
+                    ShadowLight *shadow)
+{
+  static const float face_directions[6][3] = {
+    { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+  };
+  /* Maps the [-1, 1] clip space to [0, 1] texture coordinates */
+  graphene_matrix_t bias;
+  graphene_vec3_t eye, center;
+  float near, far;
+  int width, height, i;
+
+  gthree_light_get_shadow_camera_range (light, &near, &far);
+  gthree_light_get_shadow_map_size (light, &width, &height);
+  get_world_position (GTHREE_OBJECT (light), &eye);
+
+  if (GTHREE_IS_DIRECTIONAL_LIGHT (light))
+    {
+      GthreeDirectionalLight *directional = GTHREE_DIRECTIONAL_LIGHT (light);
+      graphene_vec3_t direction;
+      float w, h;
+
+      get_world_position (gthree_directional_light_get_target (directional), &center);
+      graphene_vec3_subtract (&eye, &center, &direction);
+      if (graphene_vec3_length (&direction) < 1e-6)
+        graphene_vec3_subtract (&eye, graphene_vec3_y_axis (), &center);
+
+      gthree_directional_light_get_shadow_camera_size (directional, &w, &h);
+
+      shadow->n_views = 1;
+      shadow_look_at (&shadow->views[0].view, &eye, &center, graphene_vec3_y_axis ());
+      graphene_matrix_init_ortho (&shadow->views[0].projection, -w / 2, w / 2, h / 2, -h / 2, near, far);
+    }
+  else if (GTHREE_IS_POINT_LIGHT (light))
+    {
+      shadow->n_views = 6;
+      for (i = 0; i < 6; i++)
+        {
+          graphene_vec3_t direction;
+
+          graphene_vec3_init_from_float (&direction, face_directions[i]);
+          graphene_vec3_add (&eye, &direction, &center);
+          shadow_look_at (&shadow->views[i].view, &eye, &center, graphene_vec3_y_axis ());
+          graphene_matrix_init_perspective (&shadow->views[i].projection, 90, (float) width / height, near, far);
+        }
+    }
+  else
+    shadow->n_views = 0;
+
+  graphene_matrix_init_from_float (&bias, (float [16]) {
+      0.5, 0,   0,   0,
+      0,   0.5, 0,   0,
+      0,   0,   0.5, 0,
+      0.5, 0.5, 0.5, 1 });
+
+  for (i = 0; i < shadow->n_views; i++)
+    {
+      ShadowView *view = &shadow->views[i];
+      graphene_matrix_t view_projection;
+
+      graphene_vec4_init_from_vec3 (&view->eye, &eye, 1);
+      graphene_matrix_multiply (&view->view, &view->projection, &view_projection);
+      graphene_matrix_multiply (&view_projection, &bias, &view->matrix);
+    }
+
+  return shadow->n_views;
+}
+
+static void
+collect_shadow_casters (GthreeRenderer *renderer,
+                        GthreeObject   *object)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeObject *child;
+  GthreeObjectIter iter;
+
+  if (!gthree_object_get_visible (object) || !lod_level_active (object))
+    return;
+
+  if (gthree_object_get_cast_shadow (object) &&
+      gthree_object_get_object_buffers (object) != NULL)
+    g_ptr_array_add (priv->shadow_casters, object);
+
+  gthree_object_iter_init (&iter, object);
+  while (gthree_object_iter_next (&iter, &child))
+    collect_shadow_casters (renderer, child);
+}
+
+static guint64
+hash_bytes (guint64       hash,
+            gconstpointer data,
+            gsize         len)
+{
+  const guint8 *p = data;
+  gsize i;
+
+  /* FNV-1a */
+  for (i = 0; i < len; i++)
+    hash = (hash ^ p[i]) * G_GUINT64_CONSTANT (1099511628211);
+
+  return hash;
+}
+
+/* Fills the shadow render list with the casters in view, and returns
+ * a hash of everything that affects what the map looks like */
+static guint64
+build_shadow_render_list (GthreeRenderer *renderer,
+                          ShadowView     *view,
+                          int             width,
+                          int             height)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  graphene_matrix_t view_projection;
+  graphene_frustum_t frustum;
+  guint64 hash = G_GUINT64_CONSTANT (14695981039346656037);
+  float floats[16];
+  int size[2] = { width, height };
+  int i;
+
+  g_ptr_array_set_size (priv->shadow_render_list, 0);
+
+  graphene_matrix_multiply (&view->view, &view->projection, &view_projection);
+  graphene_frustum_init_from_matrix (&frustum, &view_projection);
+
+  graphene_matrix_to_float (&view_projection, floats);
+  hash = hash_bytes (hash, floats, sizeof (floats));
+  hash = hash_bytes (hash, size, sizeof (size));
+
+  for (i = 0; i < priv->shadow_casters->len; i++)
+    {
+      GthreeObject *object = g_ptr_array_index (priv->shadow_casters, i);
+      gboolean culled = gthree_object_get_is_frustum_culled (object);
+      const graphene_matrix_t *world = gthree_object_get_world_matrix (object);
+      gboolean world_hashed = FALSE;
+      GList *l;
+
+      if (culled && !gthree_object_is_in_frustum (object, &frustum))
+        continue;
+
+      for (l = gthree_object_get_object_buffers (object); l != NULL; l = l->next)
+        {
+          GthreeObjectBuffer *buffer_obj = l->data;
+          GthreeMaterial *material = gthree_object_buffer_resolve_material (buffer_obj);
+          guint face_count = buffer_obj->buffer->face_count;
+
+          if (material == NULL || !gthree_material_get_is_visible (material))
+            continue;
+
+          if (culled && buffer_obj->buffer->has_bounding_sphere)
+            {
+              graphene_sphere_t sphere;
+
+              graphene_matrix_transform_sphere (world, &buffer_obj->buffer->bounding_sphere, &sphere);
+              if (!graphene_frustum_intersects_sphere (&frustum, &sphere))
+                continue;
+            }
+
+          g_ptr_array_add (priv->shadow_render_list, buffer_obj);
+
+          if (!world_hashed)
+            {
+              guint object_id = gthree_object_get_id (object);
+
+              graphene_matrix_to_float (world, floats);
+              hash = hash_bytes (hash, &object_id, sizeof (object_id));
+              hash = hash_bytes (hash, floats, sizeof (floats));
+              /* The change counters catch edits to the vertex and
+               * instance data, which the matrices and counts don't */
+              if (GTHREE_IS_MESH (object) &&
+                  gthree_mesh_get_geometry (GTHREE_MESH (object)) != NULL)
+                {
+                  guint version = gthree_geometry_get_version (gthree_mesh_get_geometry (GTHREE_MESH (object)));
+                  hash = hash_bytes (hash, &version, sizeof (version));
+                }
+              if (GTHREE_IS_INSTANCED_MESH (object))
+                {
+                  int count = gthree_instanced_mesh_get_count (GTHREE_INSTANCED_MESH (object));
+                  guint version = gthree_instanced_mesh_get_version (GTHREE_INSTANCED_MESH (object));
+                  hash = hash_bytes (hash, &count, sizeof (count));
+                  hash = hash_bytes (hash, &version, sizeof (version));
+                }
+              world_hashed = TRUE;
+            }
+
+          hash = hash_bytes (hash, &buffer_obj->buffer->id, sizeof (buffer_obj->buffer->id));
+          hash = hash_bytes (hash, &face_count, sizeof (face_count));
+        }
+    }
+
+  return hash;
+}
+
+static void
+render_shadow_view (GthreeRenderer *renderer,
+                    GthreeCamera   *camera,
+                    ShadowView     *view,
+                    int             width,
+                    int             height)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeObject *updated = NULL;
+  int i;
+
+  if (view->target == NULL)
+    {
+      GthreeTexture *texture;
+
+      view->target = gthree_render_target_new (width, height);
+      gthree_render_target_set_depth_buffer (view->target, TRUE);
+
+      /* Interpolating packed depth values gives garbage */
+      texture = gthree_render_target_get_texture (view->target, 0);
+      gthree_texture_set_mag_filter (texture, GTHREE_FILTER_NEAREST);
+      gthree_texture_set_min_filter (texture, GTHREE_FILTER_NEAREST);
+    }
+  else
+    gthree_render_target_set_size (view->target, width, height);
+
+  /* Updates bind buffers, keep them out of any vertex array object */
+  gthree_renderer_bind_vertex_array (renderer, 0);
+  for (i = 0; i < priv->shadow_render_list->len; i++)
+    {
+      GthreeObjectBuffer *buffer_obj = g_ptr_array_index (priv->shadow_render_list, i);
+
+      /* The buffers of an object are next to each other */
+      if (buffer_obj->object != updated)
+        gthree_object_update (buffer_obj->object);
+      updated = buffer_obj->object;
+    }
+  priv->gl_state.bindings.array_buffer = GL_STATE_UNKNOWN;
+  priv->gl_state.bindings.element_array_buffer = GL_STATE_UNKNOWN;
+  priv->current_geometry_group_buffer = NULL;
+
+  gthree_render_target_bind (view->target, renderer);
+  glViewport (0, 0, width, height);
+
+  /* Nothing drawn means as far away as possible */
+  set_depth_write (renderer, TRUE);
+  glClearColor (1, 1, 1, 1);
+  clear (TRUE, TRUE, FALSE);
+
+  upload_frame_block (renderer, &view->projection, &view->view, &view->eye);
+
+  set_blending (renderer, GTHREE_BLEND_NO, 0, 0, 0);
+  for (i = 0; i < priv->shadow_render_list->len; i++)
+    {
+      GthreeObjectBuffer *buffer_obj = g_ptr_array_index (priv->shadow_render_list, i);
+      GthreeMaterial *material = priv->shadow_materials[GTHREE_IS_INSTANCED_MESH (buffer_obj->object)];
+
+      gthree_object_update_matrix_view (buffer_obj->object, &view->view);
+      set_render_state (renderer, gthree_material_get_render_state (material), FALSE, FALSE);
+      render_buffer (renderer, camera, NULL, NULL, material, buffer_obj);
+    }
+
+  priv->frame_stats.n_shadow_map_updates++;
+}
+
+/* Re-renders the shadow maps that are out of date, and collects the
+ * uniforms for sampling them in the receiving objects */
+static void
+update_shadow_maps (GthreeRenderer *renderer,
+                    GthreeScene    *scene,
+                    GthreeCamera   *camera,
+                    GList          *lights)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  gboolean casters_collected = FALSE;
+  gboolean rendered = FALSE;
+  int framebuffer = 0;
+  GList *l;
+  int i;
+
+  priv->n_shadows = 0;
+  g_ptr_array_set_size (priv->shadow_textures, 0);
+  g_array_set_size (priv->shadow_map_sizes, 0);
+  g_array_set_size (priv->shadow_biases, 0);
+  g_array_set_size (priv->shadow_darknesses, 0);
+  g_array_set_size (priv->shadow_matrices, 0);
+
+  for (l = lights; l != NULL; l = l->next)
+    {
+      GthreeLight *light = l->data;
+      ShadowLight *shadow;
+      float bias, darkness;
+      int width, height;
+
+      if (!gthree_light_get_casts_shadow (light) || !gthree_light_get_is_visible (light))
+        continue;
+
+      shadow = g_hash_table_lookup (priv->shadow_lights, light);
+      if (shadow == NULL)
+        {
+          shadow = g_slice_new0 (ShadowLight);
+          g_hash_table_insert (priv->shadow_lights, light, shadow);
+        }
+      shadow->last_used_frame = priv->frame_count;
+
+      if (setup_shadow_views (light, shadow) == 0)
+        continue;
+
+      /* A point light takes six of them */
+      if (priv->n_shadows + shadow->n_views > MAX_SHADOW_MAPS)
+        {
+          if (!priv->warned_shadow_limit)
+            {
+              g_warning ("Shadow casting lights need more than %d shadow maps, "
+                         "some lights cast no shadows", MAX_SHADOW_MAPS);
+              priv->warned_shadow_limit = TRUE;
+            }
+          continue;
+        }
+
+      if (!casters_collected)
+        {
+          g_ptr_array_set_size (priv->shadow_casters, 0);
+          collect_shadow_casters (renderer, GTHREE_OBJECT (scene));
+          casters_collected = TRUE;
+        }
+
+      gthree_light_get_shadow_map_size (light, &width, &height);
+      bias = gthree_light_get_shadow_bias (light);
+      darkness = gthree_light_get_shadow_darkness (light);
+
+      for (i = 0; i < shadow->n_views; i++)
+        {
+          ShadowView *view = &shadow->views[i];
+          guint64 signature = build_shadow_render_list (renderer, view, width, height);
+          float size[2] = { width, height };
+          float matrix[16];
+
+          if (!view->valid || view->signature != signature ||
+              gthree_light_get_shadow_needs_update (light))
+            {
+              if (!rendered)
+                {
+                  glGetIntegerv (GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+                  ensure_internal_materials (priv->shadow_materials, "depthRGBA");
+                  priv->shadow_pass = TRUE;
+                  rendered = TRUE;
+                }
+
+              render_shadow_view (renderer, camera, view, width, height);
+              view->signature = signature;
+              view->valid = TRUE;
+            }
+
+          g_ptr_array_add (priv->shadow_textures,
+                           g_object_ref (gthree_render_target_get_texture (view->target, 0)));
+          g_array_append_vals (priv->shadow_map_sizes, size, 2);
+          g_array_append_val (priv->shadow_biases, bias);
+          g_array_append_val (priv->shadow_darknesses, darkness);
+          graphene_matrix_to_float (&view->matrix, matrix);
+          g_array_append_vals (priv->shadow_matrices, matrix, 16);
+          priv->n_shadows++;
+        }
+
+      gthree_light_set_shadow_needs_update (light, FALSE);
+    }
+
+  if (rendered)
+    {
+      priv->shadow_pass = FALSE;
+
+      glBindFramebuffer (GL_FRAMEBUFFER, framebuffer);
+      glViewport (priv->viewport_x, priv->viewport_y, priv->viewport_width, priv->viewport_height);
+      glClearColor (priv->clear_color.red, priv->clear_color.green, priv->clear_color.blue, priv->clear_color.alpha);
+      update_frame_block (renderer, camera);
+    }
+}
+
+static GthreeRenderStats *
+get_counted_stats (void)
+{
+  GthreeRenderer *renderer = g_private_get (&rendering_renderer);
+  GthreeRendererPrivate *priv;
+
+  if (renderer == NULL)
+    return NULL;
+
+  priv = gthree_renderer_get_instance_private (renderer);
+  return &priv->frame_stats;
+}
+
+void
+gthree_render_stats_add_uniform_upload (gsize bytes)
+{
+  GthreeRenderStats *stats = get_counted_stats ();
+
+  if (stats)
+    {
+      stats->n_uniform_uploads++;
+      stats->uniform_upload_bytes += bytes;
+    }
+}
+
+void
+gthree_render_stats_add_buffer_upload (gsize bytes)
+{
+  GthreeRenderStats *stats = get_counted_stats ();
+
+  if (stats)
+    stats->buffer_upload_bytes += bytes;
+}
+
+void
+gthree_render_stats_add_texture_upload (gsize bytes)
+{
+  GthreeRenderStats *stats = get_counted_stats ();
+
+  if (stats)
+    stats->texture_upload_bytes += bytes;
+}
+
+static void
+emit_stats (GthreeRenderer    *renderer,
+            GthreeRenderStats *stats)
+{
+  g_signal_emit (renderer, renderer_signals[FRAME_STATS], 0, stats);
+}
+
+/* Reads back the finished GPU timers, oldest first, without waiting */
+static void
+collect_timers (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int i, j;
+
+  for (i = 0; i < TIMER_FRAMES; i++)
+    {
+      TimerFrame *frame = &priv->timer_frames[(priv->next_timer_frame + i) % TIMER_FRAMES];
+      GLuint64 timestamps[GTHREE_N_RENDER_PHASES + 1];
+      GLint available = 0;
+
+      if (!frame->pending)
+        continue;
+
+      glGetQueryObjectiv (frame->queries[GTHREE_N_RENDER_PHASES], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available)
+        break;
+
+      for (j = 0; j <= GTHREE_N_RENDER_PHASES; j++)
+        glGetQueryObjectui64v (frame->queries[j], GL_QUERY_RESULT, &timestamps[j]);
+
+      for (j = 0; j < GTHREE_N_RENDER_PHASES; j++)
+        frame->stats.gpu_time[j] = (timestamps[j + 1] - timestamps[j]) / 1000000.0;
+      frame->stats.gpu_total = (timestamps[GTHREE_N_RENDER_PHASES] - timestamps[0]) / 1000000.0;
+      frame->stats.has_gpu_time = TRUE;
+      frame->pending = FALSE;
+
+      emit_stats (renderer, &frame->stats);
+    }
+}
+
+static void
+timing_begin (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  TimerFrame *frame;
+
+  memset (&priv->frame_stats, 0, sizeof (GthreeRenderStats));
+  priv->frame_stats.frame = priv->frame_count;
+  g_private_set (&rendering_renderer, renderer);
+
+  if (!priv->timing)
+    return;
+
+  priv->timer_frame = NULL;
+  if (priv->gpu_timing)
+    {
+      collect_timers (renderer);
+
+      frame = &priv->timer_frames[priv->next_timer_frame];
+      if (!frame->pending)
+        {
+          priv->timer_frame = frame;
+          glQueryCounter (frame->queries[0], GL_TIMESTAMP);
+        }
+    }
+
+  priv->phase_start = g_get_monotonic_time ();
+}
+
+/* Ends phase, and starts the next one */
+static void
+timing_mark (GthreeRenderer    *renderer,
+             GthreeRenderPhase  phase)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  gint64 now;
+
+  if (!priv->timing)
+    return;
+
+  now = g_get_monotonic_time ();
+  priv->frame_stats.cpu_time[phase] = (now - priv->phase_start) / 1000.0;
+  priv->frame_stats.cpu_total += priv->frame_stats.cpu_time[phase];
+  priv->phase_start = now;
+
+  if (priv->timer_frame)
+    glQueryCounter (priv->timer_frame->queries[phase + 1], GL_TIMESTAMP);
+}
+
+static void
+timing_end (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  g_private_set (&rendering_renderer, NULL);
+  priv->last_stats = priv->frame_stats;
+
+  if (!priv->timing)
+    return;
+
+  if (priv->timer_frame)
+    {
+      priv->timer_frame->stats = priv->frame_stats;
+      priv->timer_frame->pending = TRUE;
+      priv->timer_frame = NULL;
+      priv->next_timer_frame = (priv->next_timer_frame + 1) % TIMER_FRAMES;
+    }
+  else
+    emit_stats (renderer, &priv->frame_stats);
+}
+
+void
+gthree_renderer_render (GthreeRenderer *renderer,
+                        GthreeScene    *scene,
+                        GthreeCamera   *camera,
+                        gboolean force_clear)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeMaterial *override_material;
+  GList *lights, *l;
+  gpointer fog;
+  int i;
+
+  lights = gthree_scene_get_lights (scene);
+  fog = NULL;
+
+  priv->current_program = NULL;
+  priv->current_material = NULL;
+  priv->current_camera = NULL;
+  priv->current_geometry_group_buffer = NULL;
+  priv->current_geometry_group_program = NULL;
+  priv->current_geometry_group_flags = 0;
+
+  /* Anything may have used the context since the last render. Also
+     make sure the buffer uploads below can't change the element array
+     binding of some vertex array object that was left bound. */
+  reset_gl_state_cache (renderer);
+  gthree_renderer_bind_vertex_array (renderer, 0);
+
+  timing_begin (renderer);
+
+  /* update scene graph */
+
+  if (priv->traversal_pool)
+    update_matrix_world_threaded (renderer, scene);
+  else
+    gthree_transforms_update (priv->transforms, GTHREE_OBJECT (scene));
+
+  /* update camera matrices and frustum */
+
+  if (gthree_object_get_parent (GTHREE_OBJECT (camera)) == NULL)
+    gthree_object_update_matrix_world (GTHREE_OBJECT (camera), FALSE);
+
+  gthree_camera_update_matrix (camera);
+
+  gthree_camera_get_proj_screen_matrix (camera, &priv->proj_screen_matrix);
+  graphene_frustum_init_from_matrix (&priv->frustum, &priv->proj_screen_matrix);
+
+  timing_mark (renderer, GTHREE_RENDER_PHASE_UPDATE_MATRICES);
+
+  gthree_scene_realize_objects (scene);
+
+  timing_mark (renderer, GTHREE_RENDER_PHASE_REALIZE);
+
+  /* Projection only reads the picked levels and the bounds, also from
+     other threads */
+  for (l = gthree_scene_get_lods (scene); l != NULL; l = l->next)
+    gthree_lod_update (l->data, camera);
+  for (l = gthree_scene_get_instanced_meshes (scene); l != NULL; l = l->next)
+    gthree_instanced_mesh_ensure_bounds (l->data);
+
+  setup_lights (renderer, lights);
+  update_frame_block (renderer, camera);
+
+  g_ptr_array_set_size (priv->update_objects, 0);
+  g_ptr_array_set_size (priv->opaque_objects, 0);
+  g_ptr_array_set_size (priv->transparent_objects, 0);
+
+  if (gthree_scene_get_octree (scene))
+    project_octree (renderer, gthree_scene_get_octree (scene));
+  else if (priv->traversal_pool)
+    project_threaded (renderer);
+  else
+    project_object (renderer, GTHREE_OBJECT (scene), priv->update_objects,
+                    priv->opaque_objects, priv->transparent_objects);
+
+  priv->frame_count++;
+  priv->n_occlusion_queries = 0;
+  priv->n_occlusion_culled = 0;
+  g_ptr_array_set_size (priv->occlusion_tests, 0);
+  g_ptr_array_set_size (priv->occluded_objects, 0);
+  delete_dead_occlusion_queries (renderer);
+
+  if (priv->software_occlusion)
+    begin_software_occlusion (renderer);
+
+  if (priv->occlusion_culling)
+    {
+      graphene_vec4_t row;
+      graphene_point3d_t camera_pos;
+
+      graphene_matrix_get_row (gthree_object_get_world_matrix (GTHREE_OBJECT (camera)), 3, &row);
+      graphene_point3d_init (&camera_pos,
+                             graphene_vec4_get_x (&row),
+                             graphene_vec4_get_y (&row),
+                             graphene_vec4_get_z (&row));
+
+      filter_occluded (renderer, priv->opaque_objects, TRUE, &camera_pos);
+      filter_occluded (renderer, priv->transparent_objects, FALSE, &camera_pos);
+
+      if (priv->frame_count % OCCLUSION_MAX_UNUSED_FRAMES == 0)
+        free_occlusion_queries (renderer, OCCLUSION_MAX_UNUSED_FRAMES);
+    }
+
+  /* These upload to GL, so they have to happen on this thread. Objects
+     that are hidden without a conditional draw can wait. */
+  for (i = 0; i < priv->update_objects->len; i++)
+    {
+      GthreeObject *object = g_ptr_array_index (priv->update_objects, i);
+
+      if (priv->occlusion_culling && !priv->occlusion_conditional)
+        {
+          OcclusionQuery *q = g_hash_table_lookup (priv->occlusion_queries, object);
+
+          if (q != NULL && q->checked_frame == priv->frame_count && !q->visible)
+            continue;
+        }
+
+      gthree_object_update (object);
+    }
+
+  if (priv->software_occlusion)
+    {
+      gthree_depth_raster_wait (priv->depth_raster);
+      g_hash_table_remove_all (priv->software_occluded);
+      filter_software_occluded (renderer, priv->opaque_objects);
+      filter_software_occluded (renderer, priv->occluded_objects);
+      filter_software_occluded (renderer, priv->transparent_objects);
+    }
+
+  /* Object updates bind buffers behind our back */
+  priv->gl_state.bindings.array_buffer = GL_STATE_UNKNOWN;
+  priv->gl_state.bindings.element_array_buffer = GL_STATE_UNKNOWN;
+
+  timing_mark (renderer, GTHREE_RENDER_PHASE_PROJECT);
+
+  if (priv->sort_objects)
+    {
+      /* Opaque objects are grouped by state, then front to back.
+         Transparent objects must stay strictly back to front. */
+      g_ptr_array_sort (priv->opaque_objects, state_sort_stable);
+      g_ptr_array_sort (priv->transparent_objects, reverse_painter_sort_stable);
+    }
+
+  priv->frame_stats.n_objects_drawn -= priv->n_occlusion_culled;
+  priv->frame_stats.n_objects_culled += priv->n_occlusion_culled;
+
+  timing_mark (renderer, GTHREE_RENDER_PHASE_SORT);
+
+  /* Before the receivers' programs are picked, they depend on the
+     number of maps */
+  priv->n_shadows = 0;
+  if (priv->shadow_map_enabled)
+    update_shadow_maps (renderer, scene, camera, lights);
+
+  if (priv->frame_count % SHADOW_MAX_UNUSED_FRAMES == 0)
+    free_shadow_lights (renderer, SHADOW_MAX_UNUSED_FRAMES);
+
+  if (priv->render_target)
+    {
+      /* The target may have been resized since it was set */
+      gthree_render_target_bind (priv->render_target, renderer);
+      glViewport (0, 0,
+                  gthree_render_target_get_width (priv->render_target),
+                  gthree_render_target_get_height (priv->render_target));
+    }
+
+  if (priv->auto_clear || force_clear )
+    clear (priv->auto_clear_color, priv->auto_clear_depth, priv->auto_clear_stencil);
+
+  /* set matrices for regular objects (frustum culled) */
+
+
+  override_material = gthree_scene_get_override_material (scene);
+  if (override_material)
+    {
+      render_objects (renderer, priv->opaque_objects, camera, lights, fog, TRUE, FALSE, override_material );
+      issue_occlusion_queries (renderer);
+      render_objects (renderer, priv->occluded_objects, camera, lights, fog, TRUE, FALSE, override_material );
+      timing_mark (renderer, GTHREE_RENDER_PHASE_OPAQUE);
+      render_objects (renderer, priv->transparent_objects, camera, lights, fog, TRUE, FALSE, override_material );
+    }
+  else
+    {
+      // opaque pass (front-to-back order)
+
+      set_blending (renderer, GTHREE_BLEND_NO, 0, 0, 0);
+
+      split_depth_prepass (renderer);
+      if (priv->prepass_objects->len > 0)
+        render_depth_prepassed (renderer, camera, lights, fog);
+
+      render_objects (renderer, priv->opaque_objects, camera, lights, fog, FALSE, FALSE, NULL);
+
+      /* The opaque objects are the occluders */
+      issue_occlusion_queries (renderer);
+      render_objects (renderer, priv->occluded_objects, camera, lights, fog, FALSE, FALSE, NULL);
+      timing_mark (renderer, GTHREE_RENDER_PHASE_OPAQUE);
+
+      // transparent pass (back-to-front order)
+      render_objects (renderer, priv->transparent_objects, camera, lights, fog, TRUE, FALSE, NULL);
+    }
+
+  /* Don't leave a vertex array object bound for whatever binds an
+     element array buffer next, it would end up in there */
+  gthree_renderer_bind_vertex_array (renderer, 0);
+
+  if (priv->render_target)
+    gthree_render_target_resolve (priv->render_target);
+
+  timing_mark (renderer, GTHREE_RENDER_PHASE_TRANSPARENT);
+  timing_end (renderer);
+}
+
+/* Records how long each phase of a render takes, on the CPU and if
+ * timer queries are supported also on the GPU. The results are
+ * emitted with the ::frame-stats signal. */
+void
+gthree_renderer_set_timing (GthreeRenderer *renderer,
+                            gboolean        timing)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int i;
+
+  timing = !!timing;
+  if (priv->timing == timing)
+    return;
 
-  load_uniforms_matrices (renderer, program, object);
+  priv->timing = timing;
 
-  location = gthree_program_lookup_uniform_location (program, q_modelMatrix);
-  if (location >= 0)
+  if (timing && (epoxy_gl_version () >= 33 || epoxy_has_gl_extension ("GL_ARB_timer_query")))
     {
-      float matrix[16];
-      gthree_object_get_world_matrix_floats (object, matrix);
-      glUniformMatrix4fv (location, 1, FALSE, matrix);
+      priv->gpu_timing = TRUE;
+      for (i = 0; i < TIMER_FRAMES; i++)
+        glGenQueries (GTHREE_N_RENDER_PHASES + 1, priv->timer_frames[i].queries);
+    }
+  else if (!timing && priv->gpu_timing)
+    {
+      priv->gpu_timing = FALSE;
+      for (i = 0; i < TIMER_FRAMES; i++)
+        {
+          glDeleteQueries (GTHREE_N_RENDER_PHASES + 1, priv->timer_frames[i].queries);
+          priv->timer_frames[i].pending = FALSE;
+        }
     }
+}
 
-  return program;
+gboolean
+gthree_renderer_get_timing (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->timing;
 }
 
-static void
-init_attributes (GthreeRenderer *renderer)
+/* The counters and CPU times of the last render. GPU times are only
+ * known a few frames later, so they are only in ::frame-stats. */
+const GthreeRenderStats *
+gthree_renderer_get_render_stats (GthreeRenderer *renderer)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  int i;
 
-  for (i = 0; i < G_N_ELEMENTS(priv->new_attributes); i++)
-    priv->new_attributes[i] = 0;
+  return &priv->last_stats;
 }
 
 static void
-enable_attribute (GthreeRenderer *renderer,
-                  guint attribute)
+ensure_overlay_program (GthreeRenderer *renderer)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  static const float vertices[] = {
+    0, 0,  1, 0,  0, 1,  1, 1,
+  };
+  guint vertex_shader, fragment_shader;
 
-  priv->new_attributes[attribute] = 1;
-  if (priv->enabled_attributes[attribute] == 0)
-    {
-      glEnableVertexAttribArray(attribute);
-      priv->enabled_attributes[attribute] = 1;
-    }
+  if (priv->overlay_program)
+    return;
+
+  vertex_shader = gthree_program_create_shader (GL_VERTEX_SHADER,
+                                                "#version 120\n"
+                                                "uniform vec4 rect;\n"
+                                                "attribute vec2 position;\n"
+                                                "varying vec2 vUv;\n"
+                                                "void main() {\n"
+                                                "  vUv = vec2(position.x, 1.0 - position.y);\n"
+                                                "  gl_Position = vec4(rect.xy + position * rect.zw, 0.0, 1.0);\n"
+                                                "}\n");
+  fragment_shader = gthree_program_create_shader (GL_FRAGMENT_SHADER,
+                                                  "#version 120\n"
+                                                  "uniform sampler2D map;\n"
+                                                  "varying vec2 vUv;\n"
+                                                  "void main() {\n"
+                                                  "  gl_FragColor = texture2D(map, vUv);\n"
+                                                  "}\n");
+
+  priv->overlay_program = glCreateProgram ();
+  glAttachShader (priv->overlay_program, vertex_shader);
+  glAttachShader (priv->overlay_program, fragment_shader);
+  glBindAttribLocation (priv->overlay_program, 0, "position");
+  glLinkProgram (priv->overlay_program);
+  glDeleteShader (vertex_shader);
+  glDeleteShader (fragment_shader);
+
+  priv->overlay_rect_location = glGetUniformLocation (priv->overlay_program, "rect");
+  glUseProgram (priv->overlay_program);
+  glUniform1i (glGetUniformLocation (priv->overlay_program, "map"), 0);
+  priv->current_program = NULL;
+
+  glGenVertexArrays (1, &priv->overlay_vertex_array);
+  gthree_renderer_bind_vertex_array (renderer, priv->overlay_vertex_array);
+
+  glGenBuffers (1, &priv->overlay_vertex_buffer);
+  gthree_renderer_bind_buffer (renderer, GL_ARRAY_BUFFER, priv->overlay_vertex_buffer);
+  glBufferData (GL_ARRAY_BUFFER, sizeof (vertices), vertices, GL_STATIC_DRAW);
+  glEnableVertexAttribArray (0);
+  glVertexAttribPointer (0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
 }
 
-static void
-disable_unused_attributes (GthreeRenderer *renderer)
+/* Replaces the image drawn by gthree_renderer_draw_overlay(), an
+ * ARGB32 surface, or NULL for none. */
+void
+gthree_renderer_update_overlay (GthreeRenderer  *renderer,
+                                cairo_surface_t *surface)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  int i;
+  int width, height;
 
-  for (i = 0; i < G_N_ELEMENTS(priv->new_attributes); i++)
+  if (surface == NULL)
     {
-      if (priv->enabled_attributes[i] != priv->new_attributes[i])
-        {
-          glDisableVertexAttribArray(i);
-          priv->enabled_attributes[i] = 0;
-        }
+      priv->overlay_width = priv->overlay_height = 0;
+      return;
+    }
+
+  cairo_surface_flush (surface);
+  width = cairo_image_surface_get_width (surface);
+  height = cairo_image_surface_get_height (surface);
+
+  if (priv->overlay_texture == 0)
+    {
+      glGenTextures (1, &priv->overlay_texture);
+      gthree_renderer_bind_texture (renderer, 0, GL_TEXTURE_2D, priv->overlay_texture);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
+  else
+    gthree_renderer_bind_texture (renderer, 0, GL_TEXTURE_2D, priv->overlay_texture);
+
+  /* Cairo's ARGB32 is premultiplied native endian words */
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, cairo_image_surface_get_stride (surface) / 4);
+  glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+                GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                cairo_image_surface_get_data (surface));
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+
+  priv->overlay_width = width;
+  priv->overlay_height = height;
 }
 
-static void
-render_buffer (GthreeRenderer *renderer,
-               GthreeCamera *camera,
-               GList *lights,
-               gpointer fog,
-               GthreeMaterial *material,
-               GthreeObjectBuffer *object_buffer)
+/* Draws the overlay image unscaled in the top left corner of the
+ * viewport, on top of whatever was rendered. */
+void
+gthree_renderer_draw_overlay (GthreeRenderer *renderer)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  GthreeBuffer *buffer = object_buffer->buffer;
-  GthreeObject *object = object_buffer->object;
-  GthreeProgram *program = set_program (renderer, camera, lights, fog, material, object);
-  //var linewidth, a, attribute, i, il;
-  //var attributes = program.attributes;
-  gboolean update_buffers = false;
-  gint position_location, color_location, uv_location, uv2_location, normal_location;
-  gboolean wireframe = gthree_material_get_is_wireframe (material);
+  float w, h;
 
-  if (!gthree_material_get_is_visible (material))
+  if (priv->overlay_width == 0 || priv->viewport_width == 0 || priv->viewport_height == 0)
     return;
 
-  if (buffer != priv->current_geometry_group_buffer ||
-      program != priv->current_geometry_group_program ||
-      wireframe != priv->current_geometry_group_wireframe)
-    {
-      priv->current_geometry_group_buffer = buffer;
-      priv->current_geometry_group_program = program;
-      priv->current_geometry_group_wireframe = wireframe;
-      update_buffers = true;
-    }
+  ensure_overlay_program (renderer);
 
-  if (update_buffers)
-    init_attributes (renderer);
+  glUseProgram (priv->overlay_program);
+  priv->current_program = NULL;
 
-  // vertices
-  position_location = gthree_program_lookup_attribute_location (program, q_position);
-  if (/*!material.morphTargets && */ position_location >= 0)
+  w = 2.0 * priv->overlay_width / priv->viewport_width;
+  h = 2.0 * priv->overlay_height / priv->viewport_height;
+  glUniform4f (priv->overlay_rect_location, -1, 1 - h, w, h);
+
+  gthree_renderer_bind_vertex_array (renderer, priv->overlay_vertex_array);
+  gthree_renderer_bind_texture (renderer, 0, GL_TEXTURE_2D, priv->overlay_texture);
+
+  set_depth_test (renderer, FALSE);
+  set_material_faces (renderer, GTHREE_SIDE_DOUBLE);
+  set_blending (renderer, GTHREE_BLEND_CUSTOM, GL_FUNC_ADD, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  priv->gl_state.bindings.render_state_id = GL_STATE_UNKNOWN;
+
+  glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+}
+
+/* Renders like gthree_renderer_render(), then reads the result back as
+ * RGBA rows, top row first. data must have room for the size of the
+ * render target, or without one the size from gthree_renderer_set_size(). */
+void
+gthree_renderer_render_to_buffer (GthreeRenderer *renderer,
+                                  GthreeScene    *scene,
+                                  GthreeCamera   *camera,
+                                  guint8         *data,
+                                  int             stride)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int width, height, y;
+  guint8 *pixels;
+
+  gthree_renderer_render (renderer, scene, camera, FALSE);
+
+  if (priv->render_target)
     {
-      if (update_buffers)
-        {
-          glBindBuffer (GL_ARRAY_BUFFER, buffer->vertex_buffer);
-          enable_attribute (renderer, position_location);
-          glVertexAttribPointer (position_location, 3, GL_FLOAT, FALSE, 0, NULL);
-        }
+      width = gthree_render_target_get_width (priv->render_target);
+      height = gthree_render_target_get_height (priv->render_target);
+      glBindFramebuffer (GL_READ_FRAMEBUFFER, gthree_render_target_get_framebuffer (priv->render_target));
     }
   else
     {
-      /*
-      if (object.morphTargetBase)
-        setupMorphTargets( material, geometryGroup, object );
-      */
+      width = priv->width;
+      height = priv->height;
     }
 
-  if (update_buffers)
-    {
-      // custom attributes
-      // Use the per-geometryGroup custom attribute arrays which are setup in initMeshBuffers
-#if TODO
-      if (geometryGroup.__webglCustomAttributesList )
-        {
-          for ( i = 0, il = geometryGroup.__webglCustomAttributesList.length; i < il; i ++ )
-            {
-              attribute = geometryGroup.__webglCustomAttributesList[ i ];
-              if ( attributes[ attribute.buffer.belongsToAttribute ] >= 0 )
-                {
-                  _gl.bindBuffer( _gl.ARRAY_BUFFER, attribute.buffer );
-                  enableAttribute( attributes[ attribute.buffer.belongsToAttribute ] );
-                  _gl.vertexAttribPointer( attributes[ attribute.buffer.belongsToAttribute ], attribute.size, _gl.FLOAT, false, 0, 0 );
-                }
-            }
-        }
-#endif
-
-      // colors
-      color_location = gthree_program_lookup_attribute_location (program, q_color);
-      if (color_location >= 0)
-        {
-          if (gthree_object_has_attribute_data (object, q_color))
-            {
-              glBindBuffer (GL_ARRAY_BUFFER, buffer->color_buffer);
-              enable_attribute (renderer, color_location);
-              glVertexAttribPointer (color_location, 3, GL_FLOAT, FALSE, 0, NULL);
-            }
-          else
-            gthree_material_load_default_attribute (material, color_location, q_color);
-        }
+  pixels = g_malloc (width * height * 4);
 
-      // uvs
-      uv_location = gthree_program_lookup_attribute_location (program, q_uv);
-      if (uv_location >= 0)
-        {
-          if (gthree_object_has_attribute_data (object, q_uv))
-            {
-              glBindBuffer (GL_ARRAY_BUFFER, buffer->uv_buffer);
-              enable_attribute (renderer, uv_location);
-              glVertexAttribPointer (uv_location, 2, GL_FLOAT, FALSE, 0, NULL);
-            }
-          else
-            gthree_material_load_default_attribute (material, uv_location, q_uv);
-        }
+  glPixelStorei (GL_PACK_ALIGNMENT, 1);
+  glReadPixels (0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 
-      uv2_location = gthree_program_lookup_attribute_location (program, q_uv2);
-      if (uv2_location >= 0)
-        {
-          if (gthree_object_has_attribute_data (object, q_uv2))
-            {
-              glBindBuffer (GL_ARRAY_BUFFER, buffer->uv2_buffer);
-              enable_attribute (renderer, uv2_location);
-              glVertexAttribPointer (uv2_location, 2, GL_FLOAT, FALSE, 0, NULL);
-            }
-          else
-            gthree_material_load_default_attribute (material, uv2_location, q_uv2);
-        }
+  /* GL has the bottom row first */
+  for (y = 0; y < height; y++)
+    memcpy (data + y * stride, pixels + (height - 1 - y) * width * 4, width * 4);
 
-      // normals
-      normal_location = gthree_program_lookup_attribute_location (program, q_normal);
-      if (normal_location >= 0 )
-        {
-          glBindBuffer (GL_ARRAY_BUFFER, buffer->normal_buffer);
-          enable_attribute (renderer, normal_location);
-          glVertexAttribPointer (normal_location, 3, GL_FLOAT, FALSE, 0, NULL);
-        }
+  g_free (pixels);
 
-#ifdef TODO
-      // skinning
+  if (priv->render_target)
+    gthree_render_target_bind (priv->render_target, renderer);
+}
 
-      // line distances
-#endif
+GdkPixbuf *
+gthree_renderer_render_to_pixbuf (GthreeRenderer *renderer,
+                                  GthreeScene    *scene,
+                                  GthreeCamera   *camera)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GdkPixbuf *pixbuf;
+  int width, height;
 
-      disable_unused_attributes (renderer);
+  if (priv->render_target)
+    {
+      width = gthree_render_target_get_width (priv->render_target);
+      height = gthree_render_target_get_height (priv->render_target);
     }
-
-  // render mesh
-  if (TRUE /* object instanceof THREE.Mesh */ )
+  else
     {
-      if (wireframe)
-        {
-          // wireframe
-          set_line_width (renderer, gthree_material_get_wireframe_line_width (material));
-          if (update_buffers)
-            glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, buffer->line_buffer);
-          glDrawElements (GL_LINES, buffer->line_count, GL_UNSIGNED_SHORT, 0 );
-        }
-      else
-        {
-          // triangles
-          if (update_buffers)
-            glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, buffer->face_buffer);
-          glDrawElements (GL_TRIANGLES, buffer->face_count, GL_UNSIGNED_SHORT, 0 );
-        }
+      width = priv->width;
+      height = priv->height;
     }
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+  gthree_renderer_render_to_buffer (renderer, scene, camera,
+                                    gdk_pixbuf_get_pixels (pixbuf),
+                                    gdk_pixbuf_get_rowstride (pixbuf));
+
+  return pixbuf;
 }
 
-static void
-render_objects (GthreeRenderer *renderer,
-                GPtrArray *render_list,
-                GthreeCamera *camera,
-                GList *lights,
-                gpointer fog,
-                gboolean use_blending,
-                GthreeMaterial *override_material)
+/* Later renders draw into target instead of the framebuffer that was
+ * bound when it was set, until this is called with NULL */
+void
+gthree_renderer_set_render_target (GthreeRenderer     *renderer,
+                                   GthreeRenderTarget *target)
 {
-  GthreeObjectBuffer *object_buffer;
-  GthreeMaterial *material;
-  int i;
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  for (i = 0; i < render_list->len; i++)
-    {
-      object_buffer = g_ptr_array_index (render_list, i);
+  if (priv->render_target == target)
+    return;
 
-      gthree_object_update_matrix_view (object_buffer->object, gthree_camera_get_world_inverse_matrix (camera));
+  if (priv->render_target == NULL)
+    glGetIntegerv (GL_DRAW_FRAMEBUFFER_BINDING, &priv->default_framebuffer);
 
-      if (override_material)
-        material = override_material;
-      else
-        material = gthree_object_buffer_resolve_material (object_buffer);
+  if (target)
+    g_object_ref (target);
+  g_clear_object (&priv->render_target);
+  priv->render_target = target;
 
-      if (material == NULL)
-        continue;
+  if (target)
+    {
+      gthree_render_target_bind (target, renderer);
+      glViewport (0, 0,
+                  gthree_render_target_get_width (target),
+                  gthree_render_target_get_height (target));
+    }
+  else
+    {
+      glBindFramebuffer (GL_FRAMEBUFFER, priv->default_framebuffer);
+      glViewport (priv->viewport_x, priv->viewport_y, priv->viewport_width, priv->viewport_height);
+    }
+}
 
-      if (use_blending)
-        {
-          guint equation, src_factor, dst_factor;
-          GthreeBlendMode mode = gthree_material_get_blend_mode (material, &equation, &src_factor, &dst_factor);
+GthreeRenderTarget *
+gthree_renderer_get_render_target (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-          set_blending (renderer, mode, equation, src_factor, dst_factor);
-        }
+  return priv->render_target;
+}
 
-      set_depth_test (renderer, gthree_material_get_depth_test (material));
-      set_depth_write (renderer, gthree_material_get_depth_write (material));
+/* Lights that cast shadows then render shadow maps of the objects set
+ * to cast shadows, which are applied to the objects set to receive
+ * them. The maps are kept, and only re-rendered when the light or a
+ * caster in view of it moved. */
+void
+gthree_renderer_set_shadow_map_enabled (GthreeRenderer *renderer,
+                                        gboolean        enabled)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-      {
-        gboolean polygon_offset;
-        float factor, units;
+  priv->shadow_map_enabled = !!enabled;
+}
 
-        polygon_offset = gthree_material_get_polygon_offset (material, &factor, &units);
-        set_polygon_offset (renderer, polygon_offset, factor, units);
-      }
-      set_material_faces (renderer, material);
+gboolean
+gthree_renderer_get_shadow_map_enabled (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-      render_buffer (renderer, camera, lights, fog, material, object_buffer);
-    }
+  return priv->shadow_map_enabled;
 }
 
-static void
-clear (gboolean color, gboolean depth, gboolean stencil)
+void
+gthree_renderer_set_shadow_map_type (GthreeRenderer      *renderer,
+                                     GthreeShadowMapType  type)
 {
-  guint bits = 0;
-  if (color)
-    bits |= GL_COLOR_BUFFER_BIT;
-  if (depth)
-    bits |= GL_DEPTH_BUFFER_BIT;
-  if (stencil)
-    bits |= GL_STENCIL_BUFFER_BIT;
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  glClear (bits);
+  priv->shadow_map_type = type;
 }
 
-void
-gthree_renderer_render (GthreeRenderer *renderer,
-                        GthreeScene    *scene,
-                        GthreeCamera   *camera,
-                        gboolean force_clear)
+GthreeShadowMapType
+gthree_renderer_get_shadow_map_type (GthreeRenderer *renderer)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  GthreeMaterial *override_material;
-  GList *lights;
-  gpointer fog;
 
-  lights = gthree_scene_get_lights (scene);
-  fog = NULL;
+  return priv->shadow_map_type;
+}
 
-  priv->current_material = NULL;
-  priv->current_camera = NULL;
-  priv->lights_need_update = TRUE;
-  priv->current_geometry_group_buffer = NULL;
-  priv->current_geometry_group_program = NULL;
-  priv->current_geometry_group_wireframe = FALSE;
+/* Draws all opaque objects whose materials allow it with a depth
+ * pre-pass, see gthree_material_set_depth_prepass(). Saves shading
+ * hidden fragments at the cost of drawing the geometry twice. */
+void
+gthree_renderer_set_depth_prepass (GthreeRenderer *renderer,
+                                   gboolean        depth_prepass)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  /* update scene graph */
+  priv->depth_prepass = !!depth_prepass;
+}
 
-  gthree_object_update_matrix_world (GTHREE_OBJECT (scene), FALSE);
+gboolean
+gthree_renderer_get_depth_prepass (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  /* update camera matrices and frustum */
+  return priv->depth_prepass;
+}
 
-  if (gthree_object_get_parent (GTHREE_OBJECT (camera)) == NULL)
-    gthree_object_update_matrix_world (GTHREE_OBJECT (camera), FALSE);
+/* Compiles new programs in the background where the driver supports
+ * GL_KHR_parallel_shader_compile. Until they are linked the objects
+ * using them are drawn in plain grey, counted in n_pending_programs
+ * of the render stats, so keep drawing frames while that is not 0. */
+void
+gthree_renderer_set_async_compile (GthreeRenderer *renderer,
+                                   gboolean        async_compile)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  gthree_camera_update_matrix (camera);
+  priv->async_compile = !!async_compile;
+}
 
-  gthree_camera_get_proj_screen_matrix (camera, &priv->proj_screen_matrix);
-  graphene_frustum_init_from_matrix (&priv->frustum, &priv->proj_screen_matrix);
+gboolean
+gthree_renderer_get_async_compile (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  gthree_scene_realize_objects (scene);
+  return priv->async_compile;
+}
 
-  g_ptr_array_set_size (priv->opaque_objects, 0);
-  g_ptr_array_set_size (priv->transparent_objects, 0);
+/* Scene traversal and culling are spread over n_threads threads, 0
+ * picks one per processor. The built-in objects bring their lazily
+ * computed bounds up to date on the main thread first, but custom
+ * in_frustum implementations must not write object state. With
+ * threads the world matrices are updated per subtree instead of from
+ * the batched transform store. */
+void
+gthree_renderer_set_traversal_threads (GthreeRenderer *renderer,
+                                       int             n_threads)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  project_object (renderer, scene, GTHREE_OBJECT (scene), camera);
+  if (n_threads <= 0)
+    n_threads = g_get_num_processors ();
 
-  if (priv->sort_objects)
+  priv->n_traversal_threads = n_threads;
+
+  if (n_threads == 1)
     {
-      g_ptr_array_sort (priv->opaque_objects, painter_sort_stable);
-      g_ptr_array_sort (priv->transparent_objects, reverse_painter_sort_stable);
+      if (priv->traversal_pool)
+        g_thread_pool_free (priv->traversal_pool, FALSE, TRUE);
+      priv->traversal_pool = NULL;
     }
+  else if (priv->traversal_pool)
+    g_thread_pool_set_max_threads (priv->traversal_pool, n_threads, NULL);
+  else
+    priv->traversal_pool = g_thread_pool_new (traversal_thread_func, renderer,
+                                              n_threads, FALSE, NULL);
+}
 
-  //this.setRenderTarget( renderTarget );
+int
+gthree_renderer_get_traversal_threads (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  if (priv->auto_clear || force_clear )
-    clear (priv->auto_clear_color, priv->auto_clear_depth, priv->auto_clear_stencil);
+  return priv->n_traversal_threads;
+}
 
-  /* set matrices for regular objects (frustum culled) */
+/* Objects whose bounding box was hidden by the opaque objects of a
+ * previous frame are skipped, so they may show up a frame late. With
+ * conditional set they are instead drawn depending on a test in the
+ * same frame. The GPU doesn't wait for it, objects whose test isn't
+ * done yet are just drawn. */
+void
+gthree_renderer_set_occlusion_culling (GthreeRenderer *renderer,
+                                       gboolean        occlusion_culling,
+                                       gboolean        conditional)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
+  priv->occlusion_culling = occlusion_culling;
+  priv->occlusion_conditional = conditional;
 
-  override_material = gthree_scene_get_override_material (scene);
-  if (override_material)
-    {
-      gboolean polygon_offset;
-      float factor, units;
-      guint equation, src_factor, dst_factor;
-      GthreeBlendMode mode = gthree_material_get_blend_mode (override_material, &equation, &src_factor, &dst_factor);
+  if (epoxy_gl_version () >= 33 || epoxy_has_gl_extension ("GL_ARB_occlusion_query2"))
+    priv->occlusion_target = GL_ANY_SAMPLES_PASSED;
+  else
+    priv->occlusion_target = GL_SAMPLES_PASSED;
 
-      set_blending (renderer, mode, equation, src_factor, dst_factor);
+  if (!occlusion_culling)
+    free_occlusion_queries (renderer, G_MAXUINT);
+}
+
+/* Tests the bounding volumes of objects against a small depth buffer
+ * that the meshes marked with gthree_object_set_is_occluder() are
+ * rasterized into on the CPU. Unlike the query based culling this has
+ * no latency, but only the occluders hide anything. */
+void
+gthree_renderer_set_software_occlusion_culling (GthreeRenderer *renderer,
+                                                gboolean        occlusion_culling)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-      set_depth_test (renderer, gthree_material_get_depth_test (override_material));
-      set_depth_write (renderer, gthree_material_get_depth_write (override_material));
-      polygon_offset = gthree_material_get_polygon_offset (override_material, &factor, &units);
-      set_polygon_offset (renderer, polygon_offset, factor, units);
+  priv->software_occlusion = occlusion_culling;
 
-      render_objects (renderer, priv->opaque_objects, camera, lights, fog, TRUE, override_material );
-      render_objects (renderer, priv->transparent_objects, camera, lights, fog, TRUE, override_material );
-    }
-  else
+  if (!occlusion_culling && priv->depth_raster)
     {
-      // opaque pass (front-to-back order)
+      gthree_depth_raster_free (priv->depth_raster);
+      priv->depth_raster = NULL;
+    }
+}
 
-      set_blending (renderer, GTHREE_BLEND_NO, 0, 0, 0);
-      render_objects (renderer, priv->opaque_objects, camera, lights, fog, FALSE, NULL);
+/* For the last render, n_culled counts the objects culled by either
+ * kind of occlusion culling */
+void
+gthree_renderer_get_occlusion_stats (GthreeRenderer *renderer,
+                                     int            *n_queries,
+                                     int            *n_culled)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-      // transparent pass (back-to-front order)
-      render_objects (renderer, priv->transparent_objects, camera, lights, fog, TRUE, NULL);
-    }
+  if (n_queries)
+    *n_queries = priv->n_occlusion_queries;
+  if (n_culled)
+    *n_culled = priv->n_occlusion_culled;
 }
 
 guint
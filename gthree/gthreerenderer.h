@@ -23,6 +23,50 @@ struct _GthreeRenderer {
   GObject parent;
 };
 
+/* Times are in milliseconds, and only recorded with timing enabled.
+ * The project phase includes uploading the buffers of the visible
+ * objects, the opaque phase the clear and shadow map updates. The
+ * counters are always kept, and include the shadow map draws.
+ * Drawn and culled objects are counted per object, an object is drawn
+ * if any of its buffers is, whatever culling left out the others.
+ * The depth pre-pass samples are the fragments that passed the depth
+ * test in the pre-pass, which the pre-passed objects would have shaded
+ * without it, and those they did shade. They are read back without
+ * waiting, so they are from the latest frame that has them.
+ * Pending programs are the objects drawn with a placeholder while
+ * their program compiles, see gthree_renderer_set_async_compile(). */
+typedef struct {
+  guint frame;
+  float cpu_time[GTHREE_N_RENDER_PHASES];
+  float gpu_time[GTHREE_N_RENDER_PHASES];
+  float cpu_total;
+  float gpu_total;
+  gboolean has_gpu_time;
+
+  int n_draw_calls;
+  int n_triangles;
+  int n_lines;
+  int n_program_switches;
+  int n_material_switches;
+  int n_buffer_binds; /* Including vertex array objects */
+  int n_texture_binds;
+  int n_uniform_uploads;
+  gsize uniform_upload_bytes;
+  gsize buffer_upload_bytes;
+  gsize texture_upload_bytes;
+  int n_objects_drawn;
+  int n_objects_culled;
+  int n_shadow_map_updates;
+  int n_depth_prepass_objects;
+  guint64 depth_prepass_samples;
+  guint64 depth_prepass_shaded_samples;
+  int n_pending_programs;
+} GthreeRenderStats;
+
+#define GTHREE_TYPE_RENDER_STATS (gthree_render_stats_get_type ())
+
+GType gthree_render_stats_get_type (void) G_GNUC_CONST;
+
 typedef struct {
   GObjectClass parent_class;
 
@@ -49,6 +93,44 @@ void gthree_renderer_render                (GthreeRenderer *renderer,
                                             GthreeScene    *scene,
                                             GthreeCamera   *camera,
                                             gboolean        force_clear);
+void gthree_renderer_set_traversal_threads (GthreeRenderer *renderer,
+                                            int             n_threads);
+int  gthree_renderer_get_traversal_threads (GthreeRenderer *renderer);
+void gthree_renderer_set_occlusion_culling (GthreeRenderer *renderer,
+                                            gboolean        occlusion_culling,
+                                            gboolean        conditional);
+void gthree_renderer_set_software_occlusion_culling (GthreeRenderer *renderer,
+                                                     gboolean        occlusion_culling);
+void gthree_renderer_get_occlusion_stats   (GthreeRenderer *renderer,
+                                            int            *n_queries,
+                                            int            *n_culled);
+void gthree_renderer_set_render_target     (GthreeRenderer     *renderer,
+                                            GthreeRenderTarget *target);
+GthreeRenderTarget *gthree_renderer_get_render_target (GthreeRenderer *renderer);
+void     gthree_renderer_set_shadow_map_enabled (GthreeRenderer      *renderer,
+                                                 gboolean             enabled);
+gboolean gthree_renderer_get_shadow_map_enabled (GthreeRenderer      *renderer);
+void     gthree_renderer_set_shadow_map_type    (GthreeRenderer      *renderer,
+                                                 GthreeShadowMapType  type);
+GthreeShadowMapType gthree_renderer_get_shadow_map_type (GthreeRenderer *renderer);
+void     gthree_renderer_set_depth_prepass     (GthreeRenderer *renderer,
+                                                gboolean        depth_prepass);
+gboolean gthree_renderer_get_depth_prepass     (GthreeRenderer *renderer);
+void     gthree_renderer_set_async_compile     (GthreeRenderer *renderer,
+                                                gboolean        async_compile);
+gboolean gthree_renderer_get_async_compile     (GthreeRenderer *renderer);
+void gthree_renderer_render_to_buffer      (GthreeRenderer *renderer,
+                                            GthreeScene    *scene,
+                                            GthreeCamera   *camera,
+                                            guint8         *data,
+                                            int             stride);
+GdkPixbuf *gthree_renderer_render_to_pixbuf (GthreeRenderer *renderer,
+                                             GthreeScene    *scene,
+                                             GthreeCamera   *camera);
+void     gthree_renderer_set_timing        (GthreeRenderer *renderer,
+                                            gboolean        timing);
+gboolean gthree_renderer_get_timing        (GthreeRenderer *renderer);
+const GthreeRenderStats *gthree_renderer_get_render_stats (GthreeRenderer *renderer);
 
 G_END_DECLS
 
@@ -0,0 +1,466 @@
+#include <epoxy/gl.h>
+
+#include "gthreerendertarget.h"
+#include "gthreetexture.h"
+#include "gthreeprivate.h"
+
+typedef struct {
+  int width;
+  int height;
+  int n_textures;
+  int samples;
+  gboolean depth_buffer;
+  gboolean stencil_buffer;
+
+  GPtrArray *textures;
+  GthreeTexture *depth_texture;
+
+  gboolean needs_realize;
+  guint framebuffer;
+  guint depth_renderbuffer;
+
+  /* With samples > 1 drawing goes here, and is resolved into framebuffer */
+  guint msaa_framebuffer;
+  guint *msaa_renderbuffers;
+  int n_msaa_renderbuffers;
+  guint msaa_depth_renderbuffer;
+} GthreeRenderTargetPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (GthreeRenderTarget, gthree_render_target, G_TYPE_OBJECT)
+
+GthreeRenderTarget *
+gthree_render_target_new (int width,
+                          int height)
+{
+  GthreeRenderTarget *target;
+
+  target = g_object_new (gthree_render_target_get_type (), NULL);
+  gthree_render_target_set_size (target, width, height);
+
+  return target;
+}
+
+static GthreeTexture *
+texture_new (void)
+{
+  GthreeTexture *texture = gthree_texture_new (NULL);
+
+  /* The storage is allocated and filled by us, not from a pixbuf */
+  gthree_texture_set_needs_update (texture, FALSE);
+
+  return texture;
+}
+
+static void
+gthree_render_target_init (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  priv->width = 1;
+  priv->height = 1;
+  priv->n_textures = 1;
+  priv->samples = 1;
+  priv->depth_buffer = TRUE;
+  priv->needs_realize = TRUE;
+
+  priv->textures = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (priv->textures, texture_new ());
+}
+
+/* Frees the GL objects, which are created again on the next bind. The
+ * context they were created in must be current. */
+void
+gthree_render_target_unrealize (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  if (priv->framebuffer)
+    glDeleteFramebuffers (1, &priv->framebuffer);
+  priv->framebuffer = 0;
+
+  if (priv->depth_renderbuffer)
+    glDeleteRenderbuffers (1, &priv->depth_renderbuffer);
+  priv->depth_renderbuffer = 0;
+
+  if (priv->msaa_framebuffer)
+    glDeleteFramebuffers (1, &priv->msaa_framebuffer);
+  priv->msaa_framebuffer = 0;
+
+  if (priv->msaa_renderbuffers)
+    {
+      glDeleteRenderbuffers (priv->n_msaa_renderbuffers, priv->msaa_renderbuffers);
+      g_clear_pointer (&priv->msaa_renderbuffers, g_free);
+    }
+  priv->n_msaa_renderbuffers = 0;
+
+  if (priv->msaa_depth_renderbuffer)
+    glDeleteRenderbuffers (1, &priv->msaa_depth_renderbuffer);
+  priv->msaa_depth_renderbuffer = 0;
+
+  priv->needs_realize = TRUE;
+}
+
+static void
+gthree_render_target_finalize (GObject *obj)
+{
+  GthreeRenderTarget *target = GTHREE_RENDER_TARGET (obj);
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  /* There is no telling which context is current here */
+  if (priv->framebuffer || priv->depth_renderbuffer || priv->msaa_framebuffer ||
+      priv->msaa_renderbuffers || priv->msaa_depth_renderbuffer)
+    g_warning ("GthreeRenderTarget finalized with live GL objects, "
+               "call gthree_render_target_unrealize() first");
+
+  g_ptr_array_free (priv->textures, TRUE);
+  g_clear_object (&priv->depth_texture);
+
+  G_OBJECT_CLASS (gthree_render_target_parent_class)->finalize (obj);
+}
+
+static void
+gthree_render_target_class_init (GthreeRenderTargetClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = gthree_render_target_finalize;
+}
+
+void
+gthree_render_target_set_size (GthreeRenderTarget *target,
+                               int                 width,
+                               int                 height)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  width = MAX (width, 1);
+  height = MAX (height, 1);
+
+  if (priv->width == width && priv->height == height)
+    return;
+
+  priv->width = width;
+  priv->height = height;
+  priv->needs_realize = TRUE;
+}
+
+int
+gthree_render_target_get_width (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  return priv->width;
+}
+
+int
+gthree_render_target_get_height (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  return priv->height;
+}
+
+/* More than one texture needs a shader that writes gl_FragData[] */
+void
+gthree_render_target_set_n_textures (GthreeRenderTarget *target,
+                                     int                 n_textures)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  n_textures = MAX (n_textures, 1);
+
+  if (priv->n_textures == n_textures)
+    return;
+
+  priv->n_textures = n_textures;
+  priv->needs_realize = TRUE;
+
+  if (priv->textures->len > n_textures)
+    g_ptr_array_set_size (priv->textures, n_textures);
+  while (priv->textures->len < n_textures)
+    g_ptr_array_add (priv->textures, texture_new ());
+}
+
+int
+gthree_render_target_get_n_textures (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  return priv->n_textures;
+}
+
+/* The texture stays the same over size changes, so it can be kept in
+ * a material */
+GthreeTexture *
+gthree_render_target_get_texture (GthreeRenderTarget *target,
+                                  int                 index)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  g_return_val_if_fail (index >= 0 && index < priv->n_textures, NULL);
+
+  return g_ptr_array_index (priv->textures, index);
+}
+
+/* Values above 1 draw multisampled, and resolve into the textures at
+ * the end of each render */
+void
+gthree_render_target_set_samples (GthreeRenderTarget *target,
+                                  int                 samples)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  samples = MAX (samples, 1);
+
+  if (priv->samples == samples)
+    return;
+
+  priv->samples = samples;
+  priv->needs_realize = TRUE;
+}
+
+int
+gthree_render_target_get_samples (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  return priv->samples;
+}
+
+void
+gthree_render_target_set_depth_buffer (GthreeRenderTarget *target,
+                                       gboolean            depth_buffer)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  priv->depth_buffer = !!depth_buffer;
+  priv->needs_realize = TRUE;
+}
+
+gboolean
+gthree_render_target_get_depth_buffer (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  return priv->depth_buffer;
+}
+
+void
+gthree_render_target_set_stencil_buffer (GthreeRenderTarget *target,
+                                         gboolean            stencil_buffer)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  priv->stencil_buffer = !!stencil_buffer;
+  priv->needs_realize = TRUE;
+}
+
+gboolean
+gthree_render_target_get_stencil_buffer (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  return priv->stencil_buffer;
+}
+
+/* Keeps depth in a texture rather than a renderbuffer, so it can be
+ * sampled, for instance as a shadow map */
+void
+gthree_render_target_set_depth_texture (GthreeRenderTarget *target,
+                                        gboolean            depth_texture)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  if (depth_texture == (priv->depth_texture != NULL))
+    return;
+
+  if (depth_texture)
+    priv->depth_texture = texture_new ();
+  else
+    g_clear_object (&priv->depth_texture);
+
+  priv->needs_realize = TRUE;
+}
+
+GthreeTexture *
+gthree_render_target_get_depth_texture (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  return priv->depth_texture;
+}
+
+static guint
+depth_format (GthreeRenderTargetPrivate *priv)
+{
+  return priv->stencil_buffer ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+}
+
+static guint
+depth_attachment (GthreeRenderTargetPrivate *priv)
+{
+  return priv->stencil_buffer ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+}
+
+static void
+set_draw_buffers (GthreeRenderTargetPrivate *priv)
+{
+  guint *buffers = g_newa (guint, priv->n_textures);
+  int i;
+
+  for (i = 0; i < priv->n_textures; i++)
+    buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+
+  glDrawBuffers (priv->n_textures, buffers);
+}
+
+static void
+check_status (const char *what)
+{
+  guint status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+    g_warning ("Incomplete %s framebuffer: 0x%x", what, status);
+}
+
+static void
+realize (GthreeRenderTarget *target,
+         GthreeRenderer     *renderer)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+  gboolean has_depth = priv->depth_buffer || priv->stencil_buffer || priv->depth_texture;
+  int i;
+
+  gthree_render_target_unrealize (target);
+  priv->needs_realize = FALSE;
+
+  glGenFramebuffers (1, &priv->framebuffer);
+  glBindFramebuffer (GL_FRAMEBUFFER, priv->framebuffer);
+
+  for (i = 0; i < priv->n_textures; i++)
+    {
+      GthreeTexture *texture = g_ptr_array_index (priv->textures, i);
+
+      gthree_texture_bind_for_renderer (texture, renderer, 0, GL_TEXTURE_2D);
+      gthree_texture_set_parameters (GL_TEXTURE_2D, texture, FALSE);
+      glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, priv->width, priv->height, 0,
+                    GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+      glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D,
+                              gthree_texture_get_gl_texture (texture), 0);
+    }
+
+  if (priv->depth_texture)
+    {
+      gthree_texture_bind_for_renderer (priv->depth_texture, renderer, 0, GL_TEXTURE_2D);
+      gthree_texture_set_parameters (GL_TEXTURE_2D, priv->depth_texture, FALSE);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      if (priv->stencil_buffer)
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, priv->width, priv->height, 0,
+                      GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+      else
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, priv->width, priv->height, 0,
+                      GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+      glFramebufferTexture2D (GL_FRAMEBUFFER, depth_attachment (priv), GL_TEXTURE_2D,
+                              gthree_texture_get_gl_texture (priv->depth_texture), 0);
+    }
+  else if (has_depth && priv->samples <= 1)
+    {
+      glGenRenderbuffers (1, &priv->depth_renderbuffer);
+      glBindRenderbuffer (GL_RENDERBUFFER, priv->depth_renderbuffer);
+      glRenderbufferStorage (GL_RENDERBUFFER, depth_format (priv), priv->width, priv->height);
+      glFramebufferRenderbuffer (GL_FRAMEBUFFER, depth_attachment (priv), GL_RENDERBUFFER,
+                                 priv->depth_renderbuffer);
+    }
+
+  set_draw_buffers (priv);
+  check_status ("render target");
+
+  if (priv->samples > 1)
+    {
+      int max_samples, samples;
+
+      glGetIntegerv (GL_MAX_SAMPLES, &max_samples);
+      samples = MIN (priv->samples, max_samples);
+
+      glGenFramebuffers (1, &priv->msaa_framebuffer);
+      glBindFramebuffer (GL_FRAMEBUFFER, priv->msaa_framebuffer);
+
+      priv->msaa_renderbuffers = g_new0 (guint, priv->n_textures);
+      priv->n_msaa_renderbuffers = priv->n_textures;
+      glGenRenderbuffers (priv->n_textures, priv->msaa_renderbuffers);
+      for (i = 0; i < priv->n_textures; i++)
+        {
+          glBindRenderbuffer (GL_RENDERBUFFER, priv->msaa_renderbuffers[i]);
+          glRenderbufferStorageMultisample (GL_RENDERBUFFER, samples, GL_RGBA8, priv->width, priv->height);
+          glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_RENDERBUFFER,
+                                     priv->msaa_renderbuffers[i]);
+        }
+
+      if (has_depth)
+        {
+          glGenRenderbuffers (1, &priv->msaa_depth_renderbuffer);
+          glBindRenderbuffer (GL_RENDERBUFFER, priv->msaa_depth_renderbuffer);
+          glRenderbufferStorageMultisample (GL_RENDERBUFFER, samples, depth_format (priv), priv->width, priv->height);
+          glFramebufferRenderbuffer (GL_FRAMEBUFFER, depth_attachment (priv), GL_RENDERBUFFER,
+                                     priv->msaa_depth_renderbuffer);
+        }
+
+      set_draw_buffers (priv);
+      check_status ("multisample render target");
+    }
+}
+
+/* Binds the framebuffer to draw into, (re)creating it if needed */
+void
+gthree_render_target_bind (GthreeRenderTarget *target,
+                           GthreeRenderer     *renderer)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  if (priv->needs_realize)
+    realize (target, renderer);
+
+  glBindFramebuffer (GL_FRAMEBUFFER, priv->msaa_framebuffer ? priv->msaa_framebuffer : priv->framebuffer);
+}
+
+/* The framebuffer with the textures attached, to read back from */
+guint
+gthree_render_target_get_framebuffer (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+
+  return priv->framebuffer;
+}
+
+/* Copies the multisampled drawing into the textures, and leaves the
+ * target bound */
+void
+gthree_render_target_resolve (GthreeRenderTarget *target)
+{
+  GthreeRenderTargetPrivate *priv = gthree_render_target_get_instance_private (target);
+  int i;
+
+  if (priv->msaa_framebuffer == 0)
+    return;
+
+  glBindFramebuffer (GL_READ_FRAMEBUFFER, priv->msaa_framebuffer);
+  glBindFramebuffer (GL_DRAW_FRAMEBUFFER, priv->framebuffer);
+
+  for (i = 0; i < priv->n_textures; i++)
+    {
+      glReadBuffer (GL_COLOR_ATTACHMENT0 + i);
+      glDrawBuffer (GL_COLOR_ATTACHMENT0 + i);
+      glBlitFramebuffer (0, 0, priv->width, priv->height,
+                         0, 0, priv->width, priv->height,
+                         GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+
+  if (priv->depth_texture)
+    glBlitFramebuffer (0, 0, priv->width, priv->height,
+                       0, 0, priv->width, priv->height,
+                       GL_DEPTH_BUFFER_BIT | (priv->stencil_buffer ? GL_STENCIL_BUFFER_BIT : 0),
+                       GL_NEAREST);
+
+  set_draw_buffers (priv);
+  glReadBuffer (GL_COLOR_ATTACHMENT0);
+  glBindFramebuffer (GL_FRAMEBUFFER, priv->msaa_framebuffer);
+}
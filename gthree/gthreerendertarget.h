@@ -0,0 +1,65 @@
+#ifndef __GTHREE_RENDER_TARGET_H__
+#define __GTHREE_RENDER_TARGET_H__
+
+#if !defined (__GTHREE_H_INSIDE__) && !defined (GTHREE_COMPILATION)
+#error "Only <gthree/gthree.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+#include <gthree/gthreetypes.h>
+
+G_BEGIN_DECLS
+
+#define GTHREE_TYPE_RENDER_TARGET      (gthree_render_target_get_type ())
+#define GTHREE_RENDER_TARGET(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), \
+                                                                    GTHREE_TYPE_RENDER_TARGET, \
+                                                                    GthreeRenderTarget))
+#define GTHREE_IS_RENDER_TARGET(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst),    \
+                                                                    GTHREE_TYPE_RENDER_TARGET))
+
+/* An offscreen framebuffer whose color attachments are textures that
+ * materials can sample. The GL objects are created lazily by the
+ * renderer, so the settings can be changed at any time. They must be
+ * freed with gthree_render_target_unrealize(), with the context they
+ * were used in current, before the last reference is dropped. */
+struct _GthreeRenderTarget {
+  GObject parent;
+};
+
+typedef struct {
+  GObjectClass parent_class;
+
+} GthreeRenderTargetClass;
+
+GType gthree_render_target_get_type (void) G_GNUC_CONST;
+
+GthreeRenderTarget *gthree_render_target_new (int width,
+                                              int height);
+
+void           gthree_render_target_set_size           (GthreeRenderTarget *target,
+                                                        int                 width,
+                                                        int                 height);
+int            gthree_render_target_get_width          (GthreeRenderTarget *target);
+int            gthree_render_target_get_height         (GthreeRenderTarget *target);
+void           gthree_render_target_set_n_textures     (GthreeRenderTarget *target,
+                                                        int                 n_textures);
+int            gthree_render_target_get_n_textures     (GthreeRenderTarget *target);
+GthreeTexture *gthree_render_target_get_texture        (GthreeRenderTarget *target,
+                                                        int                 index);
+void           gthree_render_target_set_samples        (GthreeRenderTarget *target,
+                                                        int                 samples);
+int            gthree_render_target_get_samples        (GthreeRenderTarget *target);
+void           gthree_render_target_set_depth_buffer   (GthreeRenderTarget *target,
+                                                        gboolean            depth_buffer);
+gboolean       gthree_render_target_get_depth_buffer   (GthreeRenderTarget *target);
+void           gthree_render_target_set_stencil_buffer (GthreeRenderTarget *target,
+                                                        gboolean            stencil_buffer);
+gboolean       gthree_render_target_get_stencil_buffer (GthreeRenderTarget *target);
+void           gthree_render_target_set_depth_texture  (GthreeRenderTarget *target,
+                                                        gboolean            depth_texture);
+GthreeTexture *gthree_render_target_get_depth_texture  (GthreeRenderTarget *target);
+void           gthree_render_target_unrealize          (GthreeRenderTarget *target);
+
+G_END_DECLS
+
+#endif /* __GTHREE_RENDER_TARGET_H__ */
@@ -3,8 +3,11 @@
 
 #include "gthreescene.h"
 #include "gthreelight.h"
+#include "gthreelod.h"
+#include "gthreeinstancedmesh.h"
 
 #include "gthreeobjectprivate.h"
+#include "gthreeprivate.h"
 
 typedef struct {
   GdkGLContext *context;
@@ -12,6 +15,9 @@ typedef struct {
   GList *added_objects;
   GList *removed_objects;
   GList *lights;
+  GList *lods;
+  GList *instanced_meshes;
+  GthreeOctree *octree;
 } GthreeScenePrivate;
 
 
@@ -45,6 +51,8 @@ gthree_scene_finalize (GObject *obj)
   g_assert (priv->added_objects == NULL);
 
   g_list_free_full (priv->removed_objects, g_object_unref);
+  if (priv->octree)
+    gthree_octree_free (priv->octree);
   G_OBJECT_CLASS (gthree_scene_parent_class)->finalize (obj);
 }
 
@@ -61,6 +69,12 @@ gthree_scene_added_child (GthreeObject *scene_obj,
   if (GTHREE_IS_LIGHT (child))
     priv->lights = g_list_prepend (priv->lights, child);
 
+  if (GTHREE_IS_LOD (child))
+    priv->lods = g_list_prepend (priv->lods, child);
+
+  if (GTHREE_IS_INSTANCED_MESH (child))
+    priv->instanced_meshes = g_list_prepend (priv->instanced_meshes, child);
+
   priv->added_objects = g_list_prepend (priv->added_objects, child);
 
   found = g_list_find (priv->removed_objects, child);
@@ -85,6 +99,15 @@ gthree_scene_removed_child (GthreeObject *scene_obj,
   if (GTHREE_IS_LIGHT (child))
     priv->lights = g_list_remove (priv->lights, child);
 
+  if (GTHREE_IS_LOD (child))
+    priv->lods = g_list_remove (priv->lods, child);
+
+  if (GTHREE_IS_INSTANCED_MESH (child))
+    priv->instanced_meshes = g_list_remove (priv->instanced_meshes, child);
+
+  if (priv->octree)
+    gthree_octree_remove (priv->octree, child);
+
   priv->removed_objects = g_list_prepend (priv->removed_objects, g_object_ref (child));
 
   found = g_list_find (priv->added_objects, child);
@@ -105,6 +128,15 @@ gthree_scene_realize_objects (GthreeScene *scene)
   for (l = priv->added_objects; l != NULL; l = l->next)
     gthree_object_realize (l->data);
 
+  /* Only after all are realized, as a realize can take buffers from
+     other objects (see GthreeStaticBatch) */
+  if (priv->octree)
+    for (l = priv->added_objects; l != NULL; l = l->next)
+      {
+        if (gthree_object_get_object_buffers (l->data) != NULL)
+          gthree_octree_insert (priv->octree, l->data);
+      }
+
   g_list_free (priv->added_objects);
   priv->added_objects = NULL;
 
@@ -168,6 +200,144 @@ gthree_scene_set_context (GthreeScene *scene,
     }
 }
 
+static void
+insert_realized_objects (GthreeOctree *octree,
+                         GthreeObject *object)
+{
+  GthreeObject *child;
+
+  if (gthree_object_get_object_buffers (object) != NULL)
+    gthree_octree_insert (octree, object);
+
+  for (child = gthree_object_get_first_child (object);
+       child != NULL;
+       child = gthree_object_get_next_sibling (child))
+    insert_realized_objects (octree, child);
+}
+
+/* With the octree the renderer culls whole regions at a time instead
+ * of each object, and the find functions become available. */
+void
+gthree_scene_set_use_octree (GthreeScene *scene,
+                             gboolean     use_octree)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  if (!!use_octree == (priv->octree != NULL))
+    return;
+
+  if (use_octree)
+    {
+      priv->octree = gthree_octree_new ();
+      insert_realized_objects (priv->octree, GTHREE_OBJECT (scene));
+    }
+  else
+    {
+      gthree_octree_free (priv->octree);
+      priv->octree = NULL;
+    }
+}
+
+gboolean
+gthree_scene_get_use_octree (GthreeScene *scene)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  return priv->octree != NULL;
+}
+
+GthreeOctree *
+gthree_scene_get_octree (GthreeScene *scene)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  return priv->octree;
+}
+
+static GList *
+ptr_array_to_list (GPtrArray *array)
+{
+  GList *list = NULL;
+  int i;
+
+  for (i = array->len - 1; i >= 0; i--)
+    list = g_list_prepend (list, g_ptr_array_index (array, i));
+
+  g_ptr_array_free (array, TRUE);
+
+  return list;
+}
+
+/* The find functions look at the world bounding spheres of the drawn
+ * objects as of the last render or query, and need the octree.
+ * Free the returned list with g_list_free(). */
+GList *
+gthree_scene_find_objects_in_box (GthreeScene          *scene,
+                                  const graphene_box_t *box)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+  GPtrArray *objects;
+
+  g_return_val_if_fail (priv->octree != NULL, NULL);
+
+  objects = g_ptr_array_new ();
+  gthree_octree_update (priv->octree);
+  gthree_octree_query_box (priv->octree, box, objects);
+
+  return ptr_array_to_list (objects);
+}
+
+GList *
+gthree_scene_find_objects_in_sphere (GthreeScene             *scene,
+                                     const graphene_sphere_t *sphere)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+  GPtrArray *objects;
+
+  g_return_val_if_fail (priv->octree != NULL, NULL);
+
+  objects = g_ptr_array_new ();
+  gthree_octree_update (priv->octree);
+  gthree_octree_query_sphere (priv->octree, sphere, objects);
+
+  return ptr_array_to_list (objects);
+}
+
+/* Closest first */
+GList *
+gthree_scene_find_nearest_objects (GthreeScene              *scene,
+                                   const graphene_point3d_t *point,
+                                   int                       max_objects)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+  GPtrArray *objects;
+
+  g_return_val_if_fail (priv->octree != NULL, NULL);
+
+  objects = g_ptr_array_new ();
+  gthree_octree_update (priv->octree);
+  gthree_octree_query_nearest (priv->octree, point, max_objects, objects);
+
+  return ptr_array_to_list (objects);
+}
+
+GList *
+gthree_scene_get_lods (GthreeScene *scene)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  return priv->lods;
+}
+
+/* Their bounds are computed lazily, see gthree_instanced_mesh_ensure_bounds() */
+GList *
+gthree_scene_get_instanced_meshes (GthreeScene *scene)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  return priv->instanced_meshes;
+}
+
 GList *
 gthree_scene_get_lights (GthreeScene *scene)
 {
@@ -38,6 +38,17 @@ GdkGLContext *gthree_scene_get_context (GthreeScene *scene);
 void gthree_scene_set_context (GthreeScene *scene,
                                GdkGLContext *context);
 
+void     gthree_scene_set_use_octree         (GthreeScene              *scene,
+                                              gboolean                  use_octree);
+gboolean gthree_scene_get_use_octree         (GthreeScene              *scene);
+GList *  gthree_scene_find_objects_in_box    (GthreeScene              *scene,
+                                              const graphene_box_t     *box);
+GList *  gthree_scene_find_objects_in_sphere (GthreeScene              *scene,
+                                              const graphene_sphere_t  *sphere);
+GList *  gthree_scene_find_nearest_objects   (GthreeScene              *scene,
+                                              const graphene_point3d_t *point,
+                                              int                       max_objects);
+
 G_END_DECLS
 
 #endif /* __GTHREE_SCENE_H__ */
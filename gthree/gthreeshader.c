@@ -3,6 +3,7 @@
 
 #include "gthreeshader.h"
 #include "gthreeprogram.h"
+#include "gthreeshaderlib.h"
 
 
 typedef struct {
@@ -11,6 +12,7 @@ typedef struct {
   char *vertex_shader_text;
   char *fragment_shader_text;
   GthreeShader *owner_of_shader_text;
+  gboolean static_text; /* library shaders */
   guint hash;
 } GthreeShaderPrivate;
 
@@ -72,7 +74,7 @@ gthree_shader_finalize (GObject *obj)
 
   if (priv->owner_of_shader_text)
     g_object_unref (priv->owner_of_shader_text);
-  else
+  else if (!priv->static_text)
     {
       g_clear_pointer (&priv->vertex_shader_text, g_free);
       g_clear_pointer (&priv->fragment_shader_text, g_free);
@@ -249,81 +251,14 @@ gthree_shader_clone (GthreeShader *orig)
   return clone;
 }
 
-static void
-parse_include (char *file,
-               GString *s)
-{
-  GBytes *bytes;
-  char *end;
-
-  while (*file != '"' && *file != 0)
-    file++;
-
-  if (*file == 0)
-    {
-      g_warning ("No initial \" in include");
-      return;
-    }
-
-  file++;
-
-  end = file;
-  while (*end != '"' && *end != 0)
-    end++;
-
-  if (*end == 0)
-    {
-      g_warning ("No final \" in include");
-      return;
-    }
-
-  *end = 0;
-  bytes = g_resources_lookup_data (file, 0, NULL);
-  if (bytes == NULL)
-    {
-      g_warning ("shader snipped %s not found", file);
-      return;
-    }
-
-  g_string_append_printf (s, "// Include: %s\n", file);
-  g_string_append_len (s,
-                        g_bytes_get_data (bytes, NULL),
-                        g_bytes_get_size (bytes));
-  g_string_append_c (s, '\n');
-  g_bytes_unref (bytes);
-}
-
-static char *
-parse_text_with_includes (const char *text)
-{
-  GString *s;
-  char **lines;
-  int i;
-
-  s = g_string_new ("");
-
-  lines = g_strsplit (text, "\n", -1);
-  for (i = 0; lines[i] != NULL; i++)
-    {
-      if (g_str_has_prefix (lines[i], "#include"))
-        parse_include (lines[i] + strlen ("#include"), s);
-      else
-        {
-          g_string_append (s, lines[i]);
-          g_string_append_c (s, '\n');
-        }
-    }
-
-  g_strfreev (lines);
-
-  return g_string_free (s, FALSE);
-}
-
-GthreeShader *
+/* The sources are the expanded ones from gthreeshaderlib.h, they and
+ * their hash are used as is */
+static GthreeShader *
 gthree_shader_new_from_definitions (const char **lib_uniforms,
                                     GthreeUniformsDefinition *uniform_defs, int defs_len,
                                     const char *vertex_shader,
-                                    const char *fragment_shader)
+                                    const char *fragment_shader,
+                                    guint hash)
 {
   GthreeShader *shader = g_object_new (gthree_shader_get_type (), NULL);
   GthreeShaderPrivate *priv = gthree_shader_get_instance_private (shader);
@@ -344,10 +279,10 @@ gthree_shader_new_from_definitions (const char **lib_uniforms,
       g_object_unref (uniforms);
     }
 
-  priv->vertex_shader_text = parse_text_with_includes (vertex_shader);
-  priv->fragment_shader_text = parse_text_with_includes (fragment_shader);
-
-  gthree_shader_init_hash (shader);
+  priv->vertex_shader_text = (char *)vertex_shader;
+  priv->fragment_shader_text = (char *)fragment_shader;
+  priv->static_text = TRUE;
+  priv->hash = hash;
 
   return shader;
 }
@@ -369,63 +304,7 @@ static float zerov2[2] = { 0, 0 };
 static float onev3[3] = { 1, 1, 1 };
 
 static const char *basic_uniform_libs[] = { "common", "fog", "shadowmap", NULL };
-static const char *basic_vertex_shader =
-  "#include \"/org/gnome/gthree/shader_chunks/map_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinning_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-  "void main() {\n"
-       "#include \"/org/gnome/gthree/shader_chunks/map_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/lightmap_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/color_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/skinbase_vertex.glsl\"\n"
-  "	#ifdef USE_ENVMAP\n"
-       "#include \"/org/gnome/gthree/shader_chunks/morphnormal_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/skinnormal_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/defaultnormal_vertex.glsl\"\n"
-  "	#endif\n"
-       "#include \"/org/gnome/gthree/shader_chunks/morphtarget_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/skinning_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/default_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-
-       "#include \"/org/gnome/gthree/shader_chunks/worldpos_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/envmap_vertex.glsl\"\n"
-       "#include \"/org/gnome/gthree/shader_chunks/shadowmap_vertex.glsl\"\n"
-  "}";
-
-static const char *basic_fragment_shader =
-  "uniform vec3 diffuse;\n"
-  "uniform float opacity;\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/map_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphamap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/specularmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-  "void main() {\n"
-  "	gl_FragColor = vec4( diffuse, opacity );\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/map_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphamap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphatest_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/specularmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/linear_to_gamma_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_fragment.glsl\"\n"
-  "}";
-
-static const char *lambert_uniform_libs[] = { "common", "fog", "lights", "shadowmap", NULL };
+static const char *lambert_uniform_libs[] = { "common", "fog", "shadowmap", NULL };
 
 static GthreeUniformsDefinition lambert_uniforms[] = {
   {"ambient", GTHREE_UNIFORM_TYPE_COLOR, &white },
@@ -434,86 +313,7 @@ static GthreeUniformsDefinition lambert_uniforms[] = {
 };
 
 
-static const char *lambert_vertex_shader =
-  "#define LAMBERT\n"
-  "varying vec3 vLightFront;\n"
-  "#ifdef DOUBLE_SIDED\n"
-  "	varying vec3 vLightBack;\n"
-  "#endif\n"
-  "#include \"/org/gnome/gthree/shader_chunks/map_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lights_lambert_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinning_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-  "void main() {\n"
-     "#include \"/org/gnome/gthree/shader_chunks/map_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/lightmap_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/color_vertex.glsl\"\n"
-
-     "#include \"/org/gnome/gthree/shader_chunks/morphnormal_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/skinbase_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/skinnormal_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/defaultnormal_vertex.glsl\"\n"
-
-     "#include \"/org/gnome/gthree/shader_chunks/morphtarget_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/skinning_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/default_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-
-     "#include \"/org/gnome/gthree/shader_chunks/worldpos_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/envmap_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/lights_lambert_vertex.glsl\"\n"
-     "#include \"/org/gnome/gthree/shader_chunks/shadowmap_vertex.glsl\"\n"
-  "}";
-
-static const char *lambert_fragment_shader =
-  "uniform float opacity;\n"
-  "varying vec3 vLightFront;\n"
-  "#ifdef DOUBLE_SIDED\n"
-  "	varying vec3 vLightBack;\n"
-  "#endif\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/map_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphamap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/specularmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-
-  "void main() {\n"
-  "	gl_FragColor = vec4( vec3( 1.0 ), opacity );\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/map_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphamap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphatest_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/specularmap_fragment.glsl\"\n"
-  "	#ifdef DOUBLE_SIDED\n"
-  //"float isFront = float( gl_FrontFacing );\n"
-  //"gl_FragColor.xyz *= isFront * vLightFront + ( 1.0 - isFront ) * vLightBack;\n"
-  "		if ( gl_FrontFacing )\n"
-  "			gl_FragColor.xyz *= vLightFront;\n"
-  "		else\n"
-  "			gl_FragColor.xyz *= vLightBack;\n"
-  "	#else\n"
-  "		gl_FragColor.xyz *= vLightFront;\n"
-  "	#endif\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_fragment.glsl\"\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/linear_to_gamma_fragment.glsl\"\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/fog_fragment.glsl\"\n"
-  "}";
-
-static const char *phong_uniform_libs[] = { "common", "bump", "normalmap", "fog", "lights", "shadowmap", NULL };
+static const char *phong_uniform_libs[] = { "common", "bump", "normalmap", "fog", "shadowmap", NULL };
 static GthreeUniformsDefinition phong_uniforms[] = {
   {"ambient", GTHREE_UNIFORM_TYPE_COLOR, &white },
   {"emissive", GTHREE_UNIFORM_TYPE_COLOR, &black },
@@ -522,142 +322,7 @@ static GthreeUniformsDefinition phong_uniforms[] = {
   {"wrapRGB", GTHREE_UNIFORM_TYPE_VECTOR3, &onev3}
 };
 
-static const char *phong_vertex_shader =
-  "#define PHONG\n"
-  "varying vec3 vViewPosition;\n"
-  "varying vec3 vNormal;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/map_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lights_phong_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinning_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-
-  "void main() {\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/map_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_vertex.glsl\"\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/morphnormal_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinbase_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinnormal_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/defaultnormal_vertex.glsl\"\n"
-
-  "	vNormal = normalize( transformedNormal );\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinning_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/default_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-
-  "	vViewPosition = -mvPosition.xyz;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/worldpos_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lights_phong_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_vertex.glsl\"\n"
-  "}";
-
-static const char *phong_fragment_shader =
-  "uniform vec3 diffuse;\n"
-  "uniform float opacity;\n"
-
-  "uniform vec3 ambient;\n"
-  "uniform vec3 emissive;\n"
-  "uniform vec3 specular;\n"
-  "uniform float shininess;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/map_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphamap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/lights_phong_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/bumpmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/normalmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/specularmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-
-  "void main() {\n"
-
-  "	gl_FragColor = vec4( vec3( 1.0 ), opacity );\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/map_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphamap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphatest_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/specularmap_fragment.glsl\"\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/lights_phong_fragment.glsl\"\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/lightmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/envmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_fragment.glsl\"\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/linear_to_gamma_fragment.glsl\"\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/fog_fragment.glsl\"\n"
-  "}";
-
 static const char *particle_basic_uniform_libs[] = { "particle", "shadowmap", NULL };
-static const char *particle_basic_vertex_shader =
-  "uniform float size;\n"
-  "uniform float scale;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-
-  "void main() {\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/color_vertex.glsl\"\n"
-
-  "	vec4 mvPosition = modelViewMatrix * vec4( position, 1.0 );\n"
-
-  "	#ifdef USE_SIZEATTENUATION\n"
-  "		gl_PointSize = size * ( scale / length( mvPosition.xyz ) );\n"
-  "	#else\n"
-  "		gl_PointSize = size;\n"
-  "	#endif\n"
-
-  "	gl_Position = projectionMatrix * mvPosition;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/worldpos_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_vertex.glsl\"\n"
-  "}";
-
-static const char *particle_basic_fragment_shader =
-  "uniform vec3 psColor;\n"
-  "uniform float opacity;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/map_particle_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-
-  "void main() {\n"
-
-  "	gl_FragColor = vec4( psColor, opacity );\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/map_particle_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/alphatest_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_fragment.glsl\"\n"
-
-  "}";
-
 static const char *dashed_uniform_libs[] = { "common", "fog", NULL };
 static GthreeUniformsDefinition dashed_uniforms[] = {
   {"scale", GTHREE_UNIFORM_TYPE_FLOAT, &f1 },
@@ -665,52 +330,6 @@ static GthreeUniformsDefinition dashed_uniforms[] = {
   {"totalSize", GTHREE_UNIFORM_TYPE_FLOAT, &f2 },
 };
 
-static const char *dashed_vertex_shader =
-  "uniform float scale;\n"
-  "attribute float lineDistance;\n"
-
-  "varying float vLineDistance;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-
-  "void main() {\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/color_vertex.glsl\"\n"
-
-  "	vLineDistance = scale * lineDistance;\n"
-
-  "	vec4 mvPosition = modelViewMatrix * vec4( position, 1.0 );\n"
-  "	gl_Position = projectionMatrix * mvPosition;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-
-  "}";
-
-static const char *dashed_fragment_shader =
-  "uniform vec3 diffuse;\n"
-  "uniform float opacity;\n"
-
-  "uniform float dashSize;\n"
-  "uniform float totalSize;\n"
-
-  "varying float vLineDistance;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/color_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-
-  "void main() {\n"
-  "	if ( mod( vLineDistance, totalSize ) > dashSize ) {\n"
-  "		discard;\n"
-  "	}\n"
-  "	gl_FragColor = vec4( diffuse, opacity );\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/color_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_fragment.glsl\"\n"
-  "}";
-
 static const char *depth_uniform_libs[] = { NULL };
 static GthreeUniformsDefinition depth_uniforms[] = {
   {"mNear", GTHREE_UNIFORM_TYPE_FLOAT, &f1 },
@@ -718,67 +337,11 @@ static GthreeUniformsDefinition depth_uniforms[] = {
   {"opacity", GTHREE_UNIFORM_TYPE_FLOAT, &f1 },
 };
 
-static const char *depth_vertex_shader =
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-
-  "void main() {\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/default_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-
-  "}";
-
-static const char *depth_fragment_shader =
-  "uniform float mNear;\n"
-  "uniform float mFar;\n"
-  "uniform float opacity;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-
-  "void main() {\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "	#ifdef USE_LOGDEPTHBUF_EXT\n"
-  "		float depth = gl_FragDepthEXT / gl_FragCoord.w;\n"
-  "	#else\n"
-  "		float depth = gl_FragCoord.z / gl_FragCoord.w;\n"
-  "	#endif\n"
-  "	float color = 1.0 - smoothstep( mNear, mFar, depth );\n"
-  "	gl_FragColor = vec4( vec3( color ), opacity );\n"
-  "}";
-
 static const char *normal_uniform_libs[] = { NULL };
 static GthreeUniformsDefinition normal_uniforms[] = {
   {"opacity", GTHREE_UNIFORM_TYPE_FLOAT, &f1 },
 };
 
-static const char *normal_vertex_shader =
-  "varying vec3 vNormal;\n"
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-
-  "void main() {\n"
-  "	vNormal = normalize( normalMatrix * normal );\n"
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/default_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-  "}";
-
-static const char *normal_fragment_shader =
-  "uniform float opacity;\n"
-  "varying vec3 vNormal;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-
-  "void main() {\n"
-  "	gl_FragColor = vec4( 0.5 * normalize( vNormal ) + 0.5, opacity );\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "}";
-
-
-
-
 /* -------------------------------------------------------------------------
 //	Normal map shader
 //		- Blinn-Phong
@@ -786,7 +349,7 @@ static const char *normal_fragment_shader =
 //		- point and directional lights (use with "lights: true" material option)
 ------------------------------------------------------------------------- */
 
-static const char *normalmap_uniform_libs[] = { "fog", "lights", "shadowmap", NULL };
+static const char *normalmap_uniform_libs[] = { "fog", "shadowmap", NULL };
 static GthreeUniformsDefinition normalmap_uniforms[] = {
   {"enableAO", GTHREE_UNIFORM_TYPE_INT, &i0},
   {"enableDiffuse", GTHREE_UNIFORM_TYPE_INT, &i0},
@@ -822,426 +385,6 @@ static GthreeUniformsDefinition normalmap_uniforms[] = {
   {"wrapRGB", GTHREE_UNIFORM_TYPE_VECTOR3, &onev3},
 };
 
-static const char *normalmap_fragment_shader =
-  "uniform vec3 ambient;\n"
-  "uniform vec3 diffuse;\n"
-  "uniform vec3 specular;\n"
-  "uniform float shininess;\n"
-  "uniform float opacity;\n"
-
-  "uniform bool enableDiffuse;\n"
-  "uniform bool enableSpecular;\n"
-  "uniform bool enableAO;\n"
-  "uniform bool enableReflection;\n"
-
-  "uniform sampler2D tDiffuse;\n"
-  "uniform sampler2D tNormal;\n"
-  "uniform sampler2D tSpecular;\n"
-  "uniform sampler2D tAO;\n"
-
-  "uniform samplerCube tCube;\n"
-
-  "uniform vec2 uNormalScale;\n"
-
-  "uniform bool useRefract;\n"
-  "uniform float refractionRatio;\n"
-  "uniform float reflectivity;\n"
-
-  "varying vec3 vTangent;\n"
-  "varying vec3 vBinormal;\n"
-  "varying vec3 vNormal;\n"
-  "varying vec2 vUv;\n"
-
-  "uniform vec3 ambientLightColor;\n"
-
-  "#if MAX_DIR_LIGHTS > 0\n"
-  "	uniform vec3 directionalLightColor[ MAX_DIR_LIGHTS ];\n"
-  "	uniform vec3 directionalLightDirection[ MAX_DIR_LIGHTS ];\n"
-  "#endif\n"
-
-  "#if MAX_HEMI_LIGHTS > 0\n"
-  "	uniform vec3 hemisphereLightSkyColor[ MAX_HEMI_LIGHTS ];\n"
-  "	uniform vec3 hemisphereLightGroundColor[ MAX_HEMI_LIGHTS ];\n"
-  "	uniform vec3 hemisphereLightDirection[ MAX_HEMI_LIGHTS ];\n"
-  "#endif\n"
-
-  "#if MAX_POINT_LIGHTS > 0\n"
-  "	uniform vec3 pointLightColor[ MAX_POINT_LIGHTS ];\n"
-  "	uniform vec3 pointLightPosition[ MAX_POINT_LIGHTS ];\n"
-  "	uniform float pointLightDistance[ MAX_POINT_LIGHTS ];\n"
-  "#endif\n"
-
-  "#if MAX_SPOT_LIGHTS > 0\n"
-  "	uniform vec3 spotLightColor[ MAX_SPOT_LIGHTS ];\n"
-  "	uniform vec3 spotLightPosition[ MAX_SPOT_LIGHTS ];\n"
-  "	uniform vec3 spotLightDirection[ MAX_SPOT_LIGHTS ];\n"
-  "	uniform float spotLightAngleCos[ MAX_SPOT_LIGHTS ];\n"
-  "	uniform float spotLightExponent[ MAX_SPOT_LIGHTS ];\n"
-  "	uniform float spotLightDistance[ MAX_SPOT_LIGHTS ];\n"
-  "#endif\n"
-
-  "#ifdef WRAP_AROUND\n"
-  "	uniform vec3 wrapRGB;\n"
-  "#endif\n"
-
-  "varying vec3 vWorldPosition;\n"
-  "varying vec3 vViewPosition;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_pars_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-
-  "void main() {\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "	gl_FragColor = vec4( vec3( 1.0 ), opacity );\n"
-  "	vec3 specularTex = vec3( 1.0 );\n"
-
-  "	vec3 normalTex = texture2D( tNormal, vUv ).xyz * 2.0 - 1.0;\n"
-  "	normalTex.xy *= uNormalScale;\n"
-  "	normalTex = normalize( normalTex );\n"
-
-  "	if( enableDiffuse ) {\n"
-  "		#ifdef GAMMA_INPUT\n"
-  "			vec4 texelColor = texture2D( tDiffuse, vUv );\n"
-  "			texelColor.xyz *= texelColor.xyz;\n"
-  "			gl_FragColor = gl_FragColor * texelColor;\n"
-  "		#else\n"
-  "			gl_FragColor = gl_FragColor * texture2D( tDiffuse, vUv );\n"
-  "		#endif\n"
-  "	}\n"
-
-  "	if( enableAO ) {\n"
-  "		#ifdef GAMMA_INPUT\n"
-  "			vec4 aoColor = texture2D( tAO, vUv );\n"
-  "			aoColor.xyz *= aoColor.xyz;\n"
-  "			gl_FragColor.xyz = gl_FragColor.xyz * aoColor.xyz;\n"
-  "		#else\n"
-  "			gl_FragColor.xyz = gl_FragColor.xyz * texture2D( tAO, vUv ).xyz;\n"
-  "		#endif\n"
-  "	}\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/alphatest_fragment.glsl\"\n"
-  "	if( enableSpecular )\n"
-  "		specularTex = texture2D( tSpecular, vUv ).xyz;\n"
-  "	mat3 tsb = mat3( normalize( vTangent ), normalize( vBinormal ), normalize( vNormal ) );\n"
-  "	vec3 finalNormal = tsb * normalTex;\n"
-
-  "	#ifdef FLIP_SIDED\n"
-  "		finalNormal = -finalNormal;\n"
-  "	#endif\n"
-
-  "	vec3 normal = normalize( finalNormal );\n"
-  "	vec3 viewPosition = normalize( vViewPosition );\n"
-
-  // point lights
-
-  "	#if MAX_POINT_LIGHTS > 0\n"
-  "		vec3 pointDiffuse = vec3( 0.0 );\n"
-  "		vec3 pointSpecular = vec3( 0.0 );\n"
-  "		for ( int i = 0; i < MAX_POINT_LIGHTS; i ++ ) {\n"
-  "			vec4 lPosition = viewMatrix * vec4( pointLightPosition[ i ], 1.0 );\n"
-  "			vec3 pointVector = lPosition.xyz + vViewPosition.xyz;\n"
-  "			float pointDistance = 1.0;\n"
-  "			if ( pointLightDistance[ i ] > 0.0 )\n"
-  "				pointDistance = 1.0 - min( ( length( pointVector ) / pointLightDistance[ i ] ), 1.0 );\n"
-  "			pointVector = normalize( pointVector );\n"
-
-  // diffuse
-
-  "			#ifdef WRAP_AROUND\n"
-  "				float pointDiffuseWeightFull = max( dot( normal, pointVector ), 0.0 );\n"
-  "				float pointDiffuseWeightHalf = max( 0.5 * dot( normal, pointVector ) + 0.5, 0.0 );\n"
-  "				vec3 pointDiffuseWeight = mix( vec3( pointDiffuseWeightFull ), vec3( pointDiffuseWeightHalf ), wrapRGB );\n"
-  "			#else\n"
-  "				float pointDiffuseWeight = max( dot( normal, pointVector ), 0.0 );\n"
-  "			#endif\n"
-
-  "			pointDiffuse += pointDistance * pointLightColor[ i ] * diffuse * pointDiffuseWeight;\n"
-
-  // specular
-
-  "			vec3 pointHalfVector = normalize( pointVector + viewPosition );\n"
-  "			float pointDotNormalHalf = max( dot( normal, pointHalfVector ), 0.0 );\n"
-  "			float pointSpecularWeight = specularTex.r * max( pow( pointDotNormalHalf, shininess ), 0.0 );\n"
-
-  "			float specularNormalization = ( shininess + 2.0 ) / 8.0;\n"
-
-  "			vec3 schlick = specular + vec3( 1.0 - specular ) * pow( max( 1.0 - dot( pointVector, pointHalfVector ), 0.0 ), 5.0 );\n"
-  "			pointSpecular += schlick * pointLightColor[ i ] * pointSpecularWeight * pointDiffuseWeight * pointDistance * specularNormalization;\n"
-  "		}\n"
-  "	#endif\n"
-
-  // spot lights
-
-  "	#if MAX_SPOT_LIGHTS > 0\n"
-  "		vec3 spotDiffuse = vec3( 0.0 );\n"
-  "		vec3 spotSpecular = vec3( 0.0 );\n"
-  "		for ( int i = 0; i < MAX_SPOT_LIGHTS; i ++ ) {\n"
-  "			vec4 lPosition = viewMatrix * vec4( spotLightPosition[ i ], 1.0 );\n"
-  "			vec3 spotVector = lPosition.xyz + vViewPosition.xyz;\n"
-  "			float spotDistance = 1.0;\n"
-  "			if ( spotLightDistance[ i ] > 0.0 )\n"
-  "				spotDistance = 1.0 - min( ( length( spotVector ) / spotLightDistance[ i ] ), 1.0 );\n"
-  "			spotVector = normalize( spotVector );\n"
-  "			float spotEffect = dot( spotLightDirection[ i ], normalize( spotLightPosition[ i ] - vWorldPosition ) );\n"
-  "			if ( spotEffect > spotLightAngleCos[ i ] ) {\n"
-  "				spotEffect = max( pow( max( spotEffect, 0.0 ), spotLightExponent[ i ] ), 0.0 );\n"
-  // diffuse
-  "				#ifdef WRAP_AROUND\n"
-  "					float spotDiffuseWeightFull = max( dot( normal, spotVector ), 0.0 );\n"
-  "					float spotDiffuseWeightHalf = max( 0.5 * dot( normal, spotVector ) + 0.5, 0.0 );\n"
-  "					vec3 spotDiffuseWeight = mix( vec3( spotDiffuseWeightFull ), vec3( spotDiffuseWeightHalf ), wrapRGB );\n"
-  "				#else\n"
-  "					float spotDiffuseWeight = max( dot( normal, spotVector ), 0.0 );\n"
-  "				#endif\n"
-
-  "				spotDiffuse += spotDistance * spotLightColor[ i ] * diffuse * spotDiffuseWeight * spotEffect;\n"
-
-  // specular
-
-  "				vec3 spotHalfVector = normalize( spotVector + viewPosition );\n"
-  "				float spotDotNormalHalf = max( dot( normal, spotHalfVector ), 0.0 );\n"
-  "				float spotSpecularWeight = specularTex.r * max( pow( spotDotNormalHalf, shininess ), 0.0 );\n"
-
-  "				float specularNormalization = ( shininess + 2.0 ) / 8.0;\n"
-
-  "				vec3 schlick = specular + vec3( 1.0 - specular ) * pow( max( 1.0 - dot( spotVector, spotHalfVector ), 0.0 ), 5.0 );\n"
-  "				spotSpecular += schlick * spotLightColor[ i ] * spotSpecularWeight * spotDiffuseWeight * spotDistance * specularNormalization * spotEffect;\n"
-  "			}\n"
-  "		}\n"
-  "	#endif\n"
-
-  // directional lights
-
-  "	#if MAX_DIR_LIGHTS > 0\n"
-  "		vec3 dirDiffuse = vec3( 0.0 );\n"
-  "		vec3 dirSpecular = vec3( 0.0 );\n"
-  "		for( int i = 0; i < MAX_DIR_LIGHTS; i++ ) {\n"
-  "			vec4 lDirection = viewMatrix * vec4( directionalLightDirection[ i ], 0.0 );\n"
-  "			vec3 dirVector = normalize( lDirection.xyz );\n"
-
-  // diffuse
-
-  "			#ifdef WRAP_AROUND\n"
-  "				float directionalLightWeightingFull = max( dot( normal, dirVector ), 0.0 );\n"
-  "				float directionalLightWeightingHalf = max( 0.5 * dot( normal, dirVector ) + 0.5, 0.0 );\n"
-  "				vec3 dirDiffuseWeight = mix( vec3( directionalLightWeightingFull ), vec3( directionalLightWeightingHalf ), wrapRGB );\n"
-  "			#else\n"
-  "				float dirDiffuseWeight = max( dot( normal, dirVector ), 0.0 );\n"
-  "			#endif\n"
-
-  "			dirDiffuse += directionalLightColor[ i ] * diffuse * dirDiffuseWeight;\n"
-
-  // specular
-
-  "			vec3 dirHalfVector = normalize( dirVector + viewPosition );\n"
-  "			float dirDotNormalHalf = max( dot( normal, dirHalfVector ), 0.0 );\n"
-  "			float dirSpecularWeight = specularTex.r * max( pow( dirDotNormalHalf, shininess ), 0.0 );\n"
-
-  "			float specularNormalization = ( shininess + 2.0 ) / 8.0;\n"
-
-  "			vec3 schlick = specular + vec3( 1.0 - specular ) * pow( max( 1.0 - dot( dirVector, dirHalfVector ), 0.0 ), 5.0 );\n"
-  "			dirSpecular += schlick * directionalLightColor[ i ] * dirSpecularWeight * dirDiffuseWeight * specularNormalization;\n"
-  "		}\n"
-
-  "	#endif\n"
-
-  // hemisphere lights
-  "	#if MAX_HEMI_LIGHTS > 0\n"
-  "		vec3 hemiDiffuse = vec3( 0.0 );\n"
-  "		vec3 hemiSpecular = vec3( 0.0 );\n" 
-  "		for( int i = 0; i < MAX_HEMI_LIGHTS; i ++ ) {\n"
-  "			vec4 lDirection = viewMatrix * vec4( hemisphereLightDirection[ i ], 0.0 );\n"
-  "			vec3 lVector = normalize( lDirection.xyz );\n"
-
-  // diffuse
-  "			float dotProduct = dot( normal, lVector );\n"
-  "			float hemiDiffuseWeight = 0.5 * dotProduct + 0.5;\n"
-
-  "			vec3 hemiColor = mix( hemisphereLightGroundColor[ i ], hemisphereLightSkyColor[ i ], hemiDiffuseWeight );\n"
-  "			hemiDiffuse += diffuse * hemiColor;\n"
-
-  // specular (sky light)
-  "			vec3 hemiHalfVectorSky = normalize( lVector + viewPosition );\n"
-  "			float hemiDotNormalHalfSky = 0.5 * dot( normal, hemiHalfVectorSky ) + 0.5;\n"
-  "			float hemiSpecularWeightSky = specularTex.r * max( pow( max( hemiDotNormalHalfSky, 0.0 ), shininess ), 0.0 );\n"
-
-  // specular (ground light)
-  "			vec3 lVectorGround = -lVector;\n"
-
-  "			vec3 hemiHalfVectorGround = normalize( lVectorGround + viewPosition );\n"
-  "			float hemiDotNormalHalfGround = 0.5 * dot( normal, hemiHalfVectorGround ) + 0.5;\n"
-  "			float hemiSpecularWeightGround = specularTex.r * max( pow( max( hemiDotNormalHalfGround, 0.0 ), shininess ), 0.0 );\n"
-
-  "			float dotProductGround = dot( normal, lVectorGround );\n"
-
-  "			float specularNormalization = ( shininess + 2.0 ) / 8.0;\n"
-
-  "			vec3 schlickSky = specular + vec3( 1.0 - specular ) * pow( max( 1.0 - dot( lVector, hemiHalfVectorSky ), 0.0 ), 5.0 );\n"
-  "			vec3 schlickGround = specular + vec3( 1.0 - specular ) * pow( max( 1.0 - dot( lVectorGround, hemiHalfVectorGround ), 0.0 ), 5.0 );\n"
-  "			hemiSpecular += hemiColor * specularNormalization * ( schlickSky * hemiSpecularWeightSky * max( dotProduct, 0.0 ) + schlickGround * hemiSpecularWeightGround * max( dotProductGround, 0.0 ) );\n"
-
-  "		}\n"
-  "	#endif\n"
-
-  // all lights contribution summation
-  "	vec3 totalDiffuse = vec3( 0.0 );\n"
-  "	vec3 totalSpecular = vec3( 0.0 );\n"
-
-  "	#if MAX_DIR_LIGHTS > 0\n"
-  "		totalDiffuse += dirDiffuse;\n"
-  "		totalSpecular += dirSpecular;\n"
-  "	#endif\n"
-
-  "	#if MAX_HEMI_LIGHTS > 0\n"
-  "		totalDiffuse += hemiDiffuse;\n"
-  "		totalSpecular += hemiSpecular;\n"
-  "	#endif\n"
-
-  "	#if MAX_POINT_LIGHTS > 0\n"
-  "		totalDiffuse += pointDiffuse;\n"
-  "		totalSpecular += pointSpecular;\n"
-  "	#endif\n"
-
-  "	#if MAX_SPOT_LIGHTS > 0\n"
-  "		totalDiffuse += spotDiffuse;\n"
-  "		totalSpecular += spotSpecular;\n"
-  "	#endif\n"
-
-  "	#ifdef METAL\n"
-  "		gl_FragColor.xyz = gl_FragColor.xyz * ( totalDiffuse + ambientLightColor * ambient + totalSpecular );\n"
-  "	#else\n"
-  "		gl_FragColor.xyz = gl_FragColor.xyz * ( totalDiffuse + ambientLightColor * ambient ) + totalSpecular;\n"
-  "	#endif\n"
-
-  "	if ( enableReflection ) {\n"
-  "		vec3 vReflect;\n"
-  "		vec3 cameraToVertex = normalize( vWorldPosition - cameraPosition );\n"
-
-  "		if ( useRefract ) {\n"
-  "			vReflect = refract( cameraToVertex, normal, refractionRatio );\n"
-  "		} else {\n"
-  "			vReflect = reflect( cameraToVertex, normal );\n"
-  "		}\n"
-
-  "		vec4 cubeColor = textureCube( tCube, vec3( -vReflect.x, vReflect.yz ) );\n"
-
-  "		#ifdef GAMMA_INPUT\n"
-  "			cubeColor.xyz *= cubeColor.xyz;\n"
-  "		#endif\n"
-
-  "		gl_FragColor.xyz = mix( gl_FragColor.xyz, cubeColor.xyz, specularTex.r * reflectivity );\n"
-  "	}\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/linear_to_gamma_fragment.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/fog_fragment.glsl\"\n"
-
-  "}";
-
-static const char *normalmap_vertex_shader =
-  "attribute vec4 tangent;\n"
-  "uniform vec2 uOffset;\n"
-  "uniform vec2 uRepeat;\n"
-  "uniform bool enableDisplacement;\n"
-
-  "#ifdef VERTEX_TEXTURES\n"
-  "	uniform sampler2D tDisplacement;\n"
-  "	uniform float uDisplacementScale;\n"
-  "	uniform float uDisplacementBias;\n"
-  "#endif\n"
-
-  "varying vec3 vTangent;\n"
-  "varying vec3 vBinormal;\n"
-  "varying vec3 vNormal;\n"
-  "varying vec2 vUv;\n"
-
-  "varying vec3 vWorldPosition;\n"
-  "varying vec3 vViewPosition;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/skinning_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/shadowmap_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-
-  "void main() {\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinbase_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinnormal_vertex.glsl\"\n"
-
-  // normal, tangent and binormal vectors
-  "	#ifdef USE_SKINNING\n"
-  "		vNormal = normalize( normalMatrix * skinnedNormal.xyz );\n"
-  "		vec4 skinnedTangent = skinMatrix * vec4( tangent.xyz, 0.0 );\n"
-  "		vTangent = normalize( normalMatrix * skinnedTangent.xyz );\n"
-  "	#else\n"
-  "		vNormal = normalize( normalMatrix * normal );\n"
-  "		vTangent = normalize( normalMatrix * tangent.xyz );\n"
-  "	#endif\n"
-
-  "	vBinormal = normalize( cross( vNormal, vTangent ) * tangent.w );\n"
-  "	vUv = uv * uRepeat + uOffset;\n"
-
-  // displacement mapping
-
-  "	vec3 displacedPosition;\n"
-
-  "	#ifdef VERTEX_TEXTURES\n"
-  "		if ( enableDisplacement ) {\n"
-  "			vec3 dv = texture2D( tDisplacement, uv ).xyz;\n"
-  "			float df = uDisplacementScale * dv.x + uDisplacementBias;\n"
-  "			displacedPosition = position + normalize( normal ) * df;\n"
-  "		} else {\n"
-  "			#ifdef USE_SKINNING\n"
-  "				vec4 skinVertex = bindMatrix * vec4( position, 1.0 );\n"
-
-  "				vec4 skinned = vec4( 0.0 );\n"
-  "				skinned += boneMatX * skinVertex * skinWeight.x;\n"
-  "				skinned += boneMatY * skinVertex * skinWeight.y;\n"
-  "				skinned += boneMatZ * skinVertex * skinWeight.z;\n"
-  "				skinned += boneMatW * skinVertex * skinWeight.w;\n"
-  "				skinned  = bindMatrixInverse * skinned;\n"
-
-  "				displacedPosition = skinned.xyz;\n"
-  "			#else\n"
-  "				displacedPosition = position;\n"
-  "			#endif\n"
-  "		}\n"
-  "	#else\n"
-  "		#ifdef USE_SKINNING\n"
-  "			vec4 skinVertex = bindMatrix * vec4( position, 1.0 );\n"
-
-  "			vec4 skinned = vec4( 0.0 );\n"
-  "			skinned += boneMatX * skinVertex * skinWeight.x;\n"
-  "			skinned += boneMatY * skinVertex * skinWeight.y;\n"
-  "			skinned += boneMatZ * skinVertex * skinWeight.z;\n"
-  "			skinned += boneMatW * skinVertex * skinWeight.w;\n"
-  "			skinned  = bindMatrixInverse * skinned;\n"
-
-  "			displacedPosition = skinned.xyz;\n"
-  "		#else\n"
-  "			displacedPosition = position;\n"
-  "		#endif\n"
-  "	#endif\n"
-
-  //
-  "	vec4 mvPosition = modelViewMatrix * vec4( displacedPosition, 1.0 );\n"
-  "	vec4 worldPosition = modelMatrix * vec4( displacedPosition, 1.0 );\n"
-
-  "	gl_Position = projectionMatrix * mvPosition;\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-
-  //
-  "	vWorldPosition = worldPosition.xyz;\n"
-  "	vViewPosition = -mvPosition.xyz;\n"
-
-  // shadows
-  "	#ifdef USE_SHADOWMAP\n"
-  "		for( int i = 0; i < MAX_SHADOWS; i ++ ) {\n"
-  "			vShadowCoord[ i ] = shadowMatrix[ i ] * worldPosition;\n"
-  "		}\n"
-  "	#endif\n"
-  "}";
-
-
 /* -------------------------------------------------------------------------
 //	Cube map shader
 ------------------------------------------------------------------------- */
@@ -1252,31 +395,6 @@ static GthreeUniformsDefinition cube_uniforms[] = {
   {"tFlip", GTHREE_UNIFORM_TYPE_FLOAT, &fm1},
 };
 
-static const char *cube_vertex_shader =
-  "varying vec3 vWorldPosition;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-
-  "void main() {\n"
-  "	vec4 worldPosition = modelMatrix * vec4( position, 1.0 );\n"
-  "	vWorldPosition = worldPosition.xyz;\n"
-  "	gl_Position = projectionMatrix * modelViewMatrix * vec4( position, 1.0 );\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-  "}";
-
-static const char *cube_fragment_shader =
-  "uniform samplerCube tCube;\n"
-  "uniform float tFlip;\n"
-
-  "varying vec3 vWorldPosition;\n"
-
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-
-  "void main() {\n"
-  "	gl_FragColor = textureCube( tCube, vec3( tFlip * vWorldPosition.x, vWorldPosition.yz ) );\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "}";
-
 /* Depth encoding into RGBA texture
  *
  * based on SpiderGL shadow map example
@@ -1292,45 +410,24 @@ static const char *cube_fragment_shader =
 static const char *depthRGBA_uniform_libs[] = { NULL };
 static GthreeUniformsDefinition depthRGBA_uniforms[] = {
 };
-static const char *depthRGBA_vertex_shader =
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinning_pars_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_vertex.glsl\"\n"
-
-  "void main() {\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinbase_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/morphtarget_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/skinning_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/default_vertex.glsl\"\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_vertex.glsl\"\n"
-  "}";
-
-static const char *depthRGBA_fragment_shader =
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_pars_fragment.glsl\"\n"
-
-  "vec4 pack_depth( const in float depth ) {\n"
-  "	const vec4 bit_shift = vec4( 256.0 * 256.0 * 256.0, 256.0 * 256.0, 256.0, 1.0 );\n"
-  "	const vec4 bit_mask = vec4( 0.0, 1.0 / 256.0, 1.0 / 256.0, 1.0 / 256.0 );\n"
-  "	vec4 res = mod( depth * bit_shift * vec4( 255 ), vec4( 256 ) ) / vec4( 255 );\n" // "	vec4 res = fract( depth * bit_shift );\n"
-  "	res -= res.xxyz * bit_mask;\n"
-  "	return res;\n"
-  "}\n"
-
-  "void main() {\n"
-  "#include \"/org/gnome/gthree/shader_chunks/logdepthbuf_fragment.glsl\"\n"
-  "	#ifdef USE_LOGDEPTHBUF_EXT\n"
-  "		gl_FragData[ 0 ] = pack_depth( gl_FragDepthEXT );\n"
-  "	#else\n"
-  "		gl_FragData[ 0 ] = pack_depth( gl_FragCoord.z );\n"
-  "	#endif\n"
-  //"gl_FragData[ 0 ] = pack_depth( gl_FragCoord.z / gl_FragCoord.w );\n"
-  //"float z = ( ( gl_FragCoord.z / gl_FragCoord.w ) - 3.0 ) / ( 4000.0 - 3.0 );\n"
-  //"gl_FragData[ 0 ] = pack_depth( z );\n"
-  //"gl_FragData[ 0 ] = vec4( z, z, z, 1.0 );\n"
-  "}";
+
+/* Only the depth, for the pre-pass. The position must be computed
+ * exactly like the other shaders do it. */
+
+static const char *depthPrepass_uniform_libs[] = { NULL };
+
+/* Drawn instead of materials whose program is still being compiled */
+
+static const char *placeholder_uniform_libs[] = { NULL };
+
+/* The bounding boxes of the hardware occlusion queries, the renderer
+ * sets the uniforms itself */
+
+static const char *occlusionBox_uniform_libs[] = { NULL };
 
 static GthreeShader *basic, *lambert, *phong, *particle_basic, *dashed;
-static GthreeShader *depth, *normal, *normalmap, *cube, *depthRGBA;
+static GthreeShader *depth, *normal, *normalmap, *cube, *depthRGBA, *depthPrepass;
+static GthreeShader *placeholder, *occlusionBox;
 
 static void
 gthree_shader_init_libs ()
@@ -1342,34 +439,43 @@ gthree_shader_init_libs ()
 
   basic = gthree_shader_new_from_definitions (basic_uniform_libs,
 					      NULL, 0,
-					      basic_vertex_shader, basic_fragment_shader);
+					      basic_vertex_shader, basic_fragment_shader, basic_shader_hash);
   lambert = gthree_shader_new_from_definitions (lambert_uniform_libs,
 						lambert_uniforms, G_N_ELEMENTS (lambert_uniforms),
-						lambert_vertex_shader, lambert_fragment_shader);
+						lambert_vertex_shader, lambert_fragment_shader, lambert_shader_hash);
   phong = gthree_shader_new_from_definitions (phong_uniform_libs,
 					      phong_uniforms, G_N_ELEMENTS (phong_uniforms),
-					      phong_vertex_shader, phong_fragment_shader);
+					      phong_vertex_shader, phong_fragment_shader, phong_shader_hash);
   particle_basic = gthree_shader_new_from_definitions (particle_basic_uniform_libs,
 						       NULL, 0,
-						       particle_basic_vertex_shader, particle_basic_fragment_shader);
+						       particle_basic_vertex_shader, particle_basic_fragment_shader, particle_basic_shader_hash);
   dashed = gthree_shader_new_from_definitions (dashed_uniform_libs,
 					       dashed_uniforms, G_N_ELEMENTS (dashed_uniforms),
-					       dashed_vertex_shader, dashed_fragment_shader);
+					       dashed_vertex_shader, dashed_fragment_shader, dashed_shader_hash);
   depth = gthree_shader_new_from_definitions (depth_uniform_libs,
 					      depth_uniforms, G_N_ELEMENTS (depth_uniforms),
-					      depth_vertex_shader, depth_fragment_shader);
+					      depth_vertex_shader, depth_fragment_shader, depth_shader_hash);
   normal = gthree_shader_new_from_definitions (normal_uniform_libs,
 					       normal_uniforms, G_N_ELEMENTS (normal_uniforms),
-					       normal_vertex_shader, normal_fragment_shader);
+					       normal_vertex_shader, normal_fragment_shader, normal_shader_hash);
   normalmap = gthree_shader_new_from_definitions (normalmap_uniform_libs,
                                                   normalmap_uniforms, G_N_ELEMENTS (normalmap_uniforms),
-                                                  normalmap_vertex_shader, normalmap_fragment_shader);
+                                                  normalmap_vertex_shader, normalmap_fragment_shader, normalmap_shader_hash);
   cube = gthree_shader_new_from_definitions (cube_uniform_libs,
 					     cube_uniforms, G_N_ELEMENTS (cube_uniforms),
-					     cube_vertex_shader, cube_fragment_shader);
+					     cube_vertex_shader, cube_fragment_shader, cube_shader_hash);
   depthRGBA = gthree_shader_new_from_definitions (depthRGBA_uniform_libs,
 						  depthRGBA_uniforms, G_N_ELEMENTS (depthRGBA_uniforms),
-						  depthRGBA_vertex_shader, depthRGBA_fragment_shader);
+						  depthRGBA_vertex_shader, depthRGBA_fragment_shader, depthRGBA_shader_hash);
+  depthPrepass = gthree_shader_new_from_definitions (depthPrepass_uniform_libs,
+						     NULL, 0,
+						     depthPrepass_vertex_shader, depthPrepass_fragment_shader, depthPrepass_shader_hash);
+  placeholder = gthree_shader_new_from_definitions (placeholder_uniform_libs,
+						    NULL, 0,
+						    placeholder_vertex_shader, placeholder_fragment_shader, placeholder_shader_hash);
+  occlusionBox = gthree_shader_new_from_definitions (occlusionBox_uniform_libs,
+						     NULL, 0,
+						     occlusionBox_vertex_shader, occlusionBox_fragment_shader, occlusionBox_shader_hash);
   
   initialized = TRUE;
 }
@@ -1408,6 +514,15 @@ gthree_get_shader_from_library (const char *name)
 
   if (strcmp (name, "depthRGBA") == 0)
     return depthRGBA;
+
+  if (strcmp (name, "depthPrepass") == 0)
+    return depthPrepass;
+
+  if (strcmp (name, "placeholder") == 0)
+    return placeholder;
+
+  if (strcmp (name, "occlusionBox") == 0)
+    return occlusionBox;
   
   g_warning ("can't find shader library %s\n", name);
   return NULL;
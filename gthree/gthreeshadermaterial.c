@@ -85,12 +85,6 @@ gthree_shader_material_real_set_uniforms (GthreeMaterial *material,
   GTHREE_MATERIAL_CLASS (gthree_shader_material_parent_class)->set_uniforms (material, uniforms, camera);
 }
 
-static gboolean
-gthree_shader_material_needs_view_matrix (GthreeMaterial *material)
-{
-  return TRUE;
-}
-
 static gboolean
 gthree_shader_material_needs_lights (GthreeMaterial *material)
 {
@@ -118,12 +112,6 @@ gthree_shader_material_needs_normals (GthreeMaterial *material)
   return GTHREE_SHADING_FLAT;
 }
 
-static gboolean
-gthree_shader_material_needs_camera_pos (GthreeMaterial *material)
-{
-  return TRUE;
-}
-
 static GthreeColorType
 gthree_shader_material_needs_colors  (GthreeMaterial *material)
 {
@@ -238,10 +226,8 @@ gthree_shader_material_class_init (GthreeShaderMaterialClass *klass)
   material_class->set_params = gthree_shader_material_real_set_params;
   material_class->set_uniforms = gthree_shader_material_real_set_uniforms;
   material_class->needs_lights = gthree_shader_material_needs_lights;
-  material_class->needs_view_matrix = gthree_shader_material_needs_view_matrix;
   material_class->needs_uv = gthree_shader_material_needs_uv;
   material_class->needs_normals = gthree_shader_material_needs_normals;
-  material_class->needs_camera_pos = gthree_shader_material_needs_camera_pos;
   material_class->needs_colors = gthree_shader_material_needs_colors;
 
   obj_props[PROP_SHADER] =
@@ -0,0 +1,586 @@
+#include <math.h>
+#include <epoxy/gl.h>
+
+#include "gthreestaticbatch.h"
+#include "gthreemesh.h"
+#include "gthreemultimaterial.h"
+#include "gthreeobjectprivate.h"
+#include "gthreeprivate.h"
+
+/* Indexes are 16bit, same as for geometry groups */
+#define MAX_VERTICES_IN_CHUNK 65535
+
+typedef struct {
+  graphene_sphere_t bounding_sphere;
+  int n_batched_meshes;
+  int n_draws;
+
+  guint has_colors : 1;
+  guint has_uvs : 1;
+  guint has_uv2s : 1;
+} GthreeStaticBatchPrivate;
+
+typedef struct {
+  GthreeMesh *mesh;
+  graphene_matrix_t matrix; /* mesh to batch space */
+  guint morton;
+} BatchItem;
+
+/* All chunks get the same set of attributes, as the renderer decides
+ * which ones to use per object rather than per buffer. */
+typedef struct {
+  GthreeMaterial *material;
+  gboolean smooth_normals;
+  GthreeColorType color_type;
+  gboolean has_colors;
+  gboolean has_uvs;
+  gboolean has_uv2s;
+
+  int n_vertices;
+  GArray *positions;
+  GArray *normals;
+  GArray *colors;
+  GArray *uvs;
+  GArray *uv2s;
+} ChunkBuilder;
+
+static const GdkRGBA white = { 1, 1, 1, 1 };
+
+static GQuark q_color;
+static GQuark q_uv;
+static GQuark q_uv2;
+
+G_DEFINE_TYPE_WITH_PRIVATE (GthreeStaticBatch, gthree_static_batch, GTHREE_TYPE_OBJECT)
+
+GthreeStaticBatch *
+gthree_static_batch_new (void)
+{
+  return g_object_new (gthree_static_batch_get_type (), NULL);
+}
+
+static void
+gthree_static_batch_init (GthreeStaticBatch *batch)
+{
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+
+  graphene_sphere_init (&priv->bounding_sphere, NULL, 0);
+}
+
+static gboolean
+mesh_is_batchable (GthreeObject *object)
+{
+  GthreeMesh *mesh;
+  GthreeMaterial *material;
+
+  /* Subclasses, like instanced meshes, draw in their own way */
+  if (G_OBJECT_TYPE (object) != GTHREE_TYPE_MESH)
+    return FALSE;
+
+  mesh = GTHREE_MESH (object);
+  material = gthree_mesh_get_material (mesh);
+
+  return
+    gthree_object_get_visible (object) &&
+    gthree_object_get_object_buffers (object) != NULL &&
+    gthree_mesh_get_geometry (mesh) != NULL &&
+    material != NULL &&
+    !GTHREE_IS_MULTI_MATERIAL (material);
+}
+
+static void
+collect_meshes (GthreeObject *object,
+                GHashTable   *by_material)
+{
+  GthreeObjectIter iter;
+  GthreeObject *child;
+
+  gthree_object_iter_init (&iter, object);
+  while (gthree_object_iter_next (&iter, &child))
+    {
+      if (mesh_is_batchable (child))
+        {
+          GthreeMaterial *material = gthree_mesh_get_material (GTHREE_MESH (child));
+          GArray *items = g_hash_table_lookup (by_material, material);
+
+          if (items == NULL)
+            {
+              items = g_array_new (FALSE, FALSE, sizeof (BatchItem));
+              g_hash_table_insert (by_material, material, items);
+            }
+
+          g_array_set_size (items, items->len + 1);
+          g_array_index (items, BatchItem, items->len - 1).mesh = GTHREE_MESH (child);
+        }
+
+      collect_meshes (child, by_material);
+    }
+}
+
+static guint
+spread_bits (guint v)
+{
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+static int
+item_compare (gconstpointer _a, gconstpointer _b)
+{
+  const BatchItem *a = _a;
+  const BatchItem *b = _b;
+
+  if (a->morton < b->morton)
+    return -1;
+  if (a->morton > b->morton)
+    return 1;
+  return 0;
+}
+
+/* Puts the items in z-order, so that every chunk covers a compact
+ * region and its bounding sphere stays useful for culling. */
+static void
+sort_items (GArray *items)
+{
+  graphene_point3d_t *centers, min, max;
+  int i;
+
+  centers = g_new (graphene_point3d_t, items->len);
+  min.x = min.y = min.z = G_MAXFLOAT;
+  max.x = max.y = max.z = -G_MAXFLOAT;
+
+  for (i = 0; i < items->len; i++)
+    {
+      BatchItem *item = &g_array_index (items, BatchItem, i);
+      GthreeGeometry *geometry = gthree_mesh_get_geometry (item->mesh);
+      graphene_sphere_t sphere;
+
+      graphene_matrix_transform_sphere (&item->matrix,
+                                        gthree_geometry_get_bounding_sphere (geometry),
+                                        &sphere);
+      graphene_sphere_get_center (&sphere, &centers[i]);
+
+      min.x = MIN (min.x, centers[i].x);
+      min.y = MIN (min.y, centers[i].y);
+      min.z = MIN (min.z, centers[i].z);
+      max.x = MAX (max.x, centers[i].x);
+      max.y = MAX (max.y, centers[i].y);
+      max.z = MAX (max.z, centers[i].z);
+    }
+
+  for (i = 0; i < items->len; i++)
+    {
+      BatchItem *item = &g_array_index (items, BatchItem, i);
+      guint x = max.x > min.x ? (centers[i].x - min.x) / (max.x - min.x) * 1023 : 0;
+      guint y = max.y > min.y ? (centers[i].y - min.y) / (max.y - min.y) * 1023 : 0;
+      guint z = max.z > min.z ? (centers[i].z - min.z) / (max.z - min.z) * 1023 : 0;
+
+      item->morton = spread_bits (x) | spread_bits (y) << 1 | spread_bits (z) << 2;
+    }
+
+  g_free (centers);
+
+  g_array_sort (items, item_compare);
+}
+
+static void
+chunk_builder_reset (ChunkBuilder *builder)
+{
+  builder->n_vertices = 0;
+  g_array_set_size (builder->positions, 0);
+  g_array_set_size (builder->normals, 0);
+  g_array_set_size (builder->colors, 0);
+  g_array_set_size (builder->uvs, 0);
+  g_array_set_size (builder->uv2s, 0);
+}
+
+static guint
+upload_array (guint target, GArray *array, gsize element_size)
+{
+  guint buffer;
+
+  glGenBuffers (1, &buffer);
+  glBindBuffer (target, buffer);
+  glBufferData (target, array->len * element_size, array->data, GL_STATIC_DRAW);
+  gthree_render_stats_add_buffer_upload (array->len * element_size);
+
+  return buffer;
+}
+
+static void
+chunk_builder_flush (GthreeStaticBatch *batch,
+                     ChunkBuilder      *builder)
+{
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+  GthreeBuffer *buffer;
+  GArray *faces, *lines;
+  graphene_point3d_t min, max;
+  graphene_box_t box;
+  int i;
+
+  if (builder->n_vertices == 0)
+    return;
+
+  buffer = gthree_buffer_new ();
+
+  buffer->vertex_buffer = upload_array (GL_ARRAY_BUFFER, builder->positions, sizeof (float));
+  if (builder->normals->len > 0)
+    buffer->normal_buffer = upload_array (GL_ARRAY_BUFFER, builder->normals, sizeof (float));
+  if (builder->colors->len > 0)
+    buffer->color_buffer = upload_array (GL_ARRAY_BUFFER, builder->colors, sizeof (float));
+  if (builder->uvs->len > 0)
+    buffer->uv_buffer = upload_array (GL_ARRAY_BUFFER, builder->uvs, sizeof (float));
+  if (builder->uv2s->len > 0)
+    buffer->uv2_buffer = upload_array (GL_ARRAY_BUFFER, builder->uv2s, sizeof (float));
+
+  faces = g_array_sized_new (FALSE, FALSE, sizeof (guint16), builder->n_vertices);
+  lines = g_array_sized_new (FALSE, FALSE, sizeof (guint16), builder->n_vertices * 2);
+  for (i = 0; i < builder->n_vertices; i += 3)
+    {
+      guint16 face[3] = { i, i + 1, i + 2 };
+      guint16 line[6] = { i, i + 1, i, i + 2, i + 1, i + 2 };
+
+      g_array_append_vals (faces, face, 3);
+      g_array_append_vals (lines, line, 6);
+    }
+
+  buffer->face_buffer = upload_array (GL_ELEMENT_ARRAY_BUFFER, faces, sizeof (guint16));
+  buffer->face_count = faces->len;
+  buffer->line_buffer = upload_array (GL_ELEMENT_ARRAY_BUFFER, lines, sizeof (guint16));
+  buffer->line_count = lines->len;
+
+  g_array_free (faces, TRUE);
+  g_array_free (lines, TRUE);
+
+  min.x = min.y = min.z = G_MAXFLOAT;
+  max.x = max.y = max.z = -G_MAXFLOAT;
+  for (i = 0; i < builder->n_vertices; i++)
+    {
+      float *p = &g_array_index (builder->positions, float, i * 3);
+
+      min.x = MIN (min.x, p[0]);
+      min.y = MIN (min.y, p[1]);
+      min.z = MIN (min.z, p[2]);
+      max.x = MAX (max.x, p[0]);
+      max.y = MAX (max.y, p[1]);
+      max.z = MAX (max.z, p[2]);
+    }
+  graphene_box_init (&box, &min, &max);
+  graphene_box_get_bounding_sphere (&box, &buffer->bounding_sphere);
+  buffer->has_bounding_sphere = TRUE;
+
+  gthree_object_add_buffer (GTHREE_OBJECT (batch), buffer, builder->material);
+  g_object_unref (buffer);
+
+  priv->n_draws++;
+
+  chunk_builder_reset (builder);
+}
+
+static void
+append_vec2 (GArray *array, const graphene_vec2_t *v)
+{
+  float f[2] = { 0, 0 };
+
+  if (v)
+    graphene_vec2_to_float (v, f);
+
+  g_array_append_vals (array, f, 2);
+}
+
+static void
+chunk_builder_add_mesh (GthreeStaticBatch *batch,
+                        ChunkBuilder      *builder,
+                        BatchItem         *item)
+{
+  GthreeGeometry *geometry = gthree_mesh_get_geometry (item->mesh);
+  const graphene_vec3_t *vertices = gthree_geometry_get_vertices (geometry);
+  const graphene_vec2_t *uvs = gthree_geometry_get_uvs (geometry);
+  const graphene_vec2_t *uv2s = gthree_geometry_get_uv2s (geometry);
+  int n_uv = gthree_geometry_get_n_uv (geometry);
+  int n_uv2 = gthree_geometry_get_n_uv2 (geometry);
+  int n_faces = gthree_geometry_get_n_faces (geometry);
+  graphene_matrix_t normal_matrix;
+  int i, j;
+
+  graphene_matrix_inverse (&item->matrix, &normal_matrix);
+  graphene_matrix_transpose (&normal_matrix, &normal_matrix);
+
+  for (i = 0; i < n_faces; i++)
+    {
+      int abc[3];
+      const graphene_vec3_t *vns[3];
+      const GdkRGBA *cs[3] = { &white, &white, &white };
+      gboolean smooth;
+
+      if (builder->n_vertices + 3 > MAX_VERTICES_IN_CHUNK)
+        chunk_builder_flush (batch, builder);
+
+      abc[0] = gthree_geometry_face_get_a (geometry, i);
+      abc[1] = gthree_geometry_face_get_b (geometry, i);
+      abc[2] = gthree_geometry_face_get_c (geometry, i);
+
+      smooth = builder->smooth_normals &&
+        gthree_geometry_face_get_vertex_normals (geometry, i, &vns[0], &vns[1], &vns[2]);
+
+      if (builder->has_colors &&
+          builder->color_type != GTHREE_COLOR_NONE &&
+          (builder->color_type != GTHREE_COLOR_VERTEX ||
+           !gthree_geometry_face_get_vertex_colors (geometry, i, &cs[0], &cs[1], &cs[2])))
+        cs[0] = cs[1] = cs[2] = gthree_geometry_face_get_color (geometry, i);
+
+      for (j = 0; j < 3; j++)
+        {
+          graphene_vec4_t v;
+          graphene_vec3_t n;
+          float f[4];
+
+          graphene_vec4_init_from_vec3 (&v, &vertices[abc[j]], 1);
+          graphene_matrix_transform_vec4 (&item->matrix, &v, &v);
+          graphene_vec4_to_float (&v, f);
+          g_array_append_vals (builder->positions, f, 3);
+
+          graphene_matrix_transform_vec3 (&normal_matrix,
+                                          smooth ? vns[j] : gthree_geometry_face_get_normal (geometry, i),
+                                          &n);
+          graphene_vec3_normalize (&n, &n);
+          graphene_vec3_to_float (&n, f);
+          g_array_append_vals (builder->normals, f, 3);
+
+          if (builder->has_colors)
+            {
+              f[0] = cs[j]->red;
+              f[1] = cs[j]->green;
+              f[2] = cs[j]->blue;
+              g_array_append_vals (builder->colors, f, 3);
+            }
+
+          /* Meshes without uvs get zeros, so the arrays stay aligned */
+          if (builder->has_uvs)
+            append_vec2 (builder->uvs, i * 3 + j < n_uv ? &uvs[i * 3 + j] : NULL);
+          if (builder->has_uv2s)
+            append_vec2 (builder->uv2s, i * 3 + j < n_uv2 ? &uv2s[i * 3 + j] : NULL);
+        }
+
+      builder->n_vertices += 3;
+    }
+}
+
+static void
+bake_material (GthreeStaticBatch *batch,
+               GthreeMaterial    *material,
+               GArray            *items)
+{
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+  ChunkBuilder builder = { NULL };
+  int i;
+
+  builder.material = material;
+  builder.smooth_normals = gthree_material_needs_normals (material) == GTHREE_SHADING_SMOOTH;
+  builder.color_type = gthree_material_needs_colors (material);
+  builder.has_colors = priv->has_colors;
+  builder.has_uvs = priv->has_uvs;
+  builder.has_uv2s = priv->has_uv2s;
+
+  builder.positions = g_array_new (FALSE, FALSE, sizeof (float));
+  builder.normals = g_array_new (FALSE, FALSE, sizeof (float));
+  builder.colors = g_array_new (FALSE, FALSE, sizeof (float));
+  builder.uvs = g_array_new (FALSE, FALSE, sizeof (float));
+  builder.uv2s = g_array_new (FALSE, FALSE, sizeof (float));
+
+  sort_items (items);
+
+  for (i = 0; i < items->len; i++)
+    chunk_builder_add_mesh (batch, &builder, &g_array_index (items, BatchItem, i));
+  chunk_builder_flush (batch, &builder);
+
+  g_array_free (builder.positions, TRUE);
+  g_array_free (builder.normals, TRUE);
+  g_array_free (builder.colors, TRUE);
+  g_array_free (builder.uvs, TRUE);
+  g_array_free (builder.uv2s, TRUE);
+}
+
+/* Children are realized before their parents, so by now all meshes
+ * below us have their own buffers, which we take over. */
+static void
+gthree_static_batch_realize (GthreeObject *object)
+{
+  GthreeStaticBatch *batch = GTHREE_STATIC_BATCH (object);
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+  graphene_matrix_t batch_inverse;
+  GHashTable *by_material;
+  GHashTableIter iter;
+  gpointer material, items;
+  graphene_point3d_t min, max;
+  graphene_box_t box;
+  GList *l;
+  int i;
+
+  priv->n_batched_meshes = 0;
+  priv->n_draws = 0;
+  priv->has_colors = priv->has_uvs = priv->has_uv2s = FALSE;
+
+  if (!graphene_matrix_inverse (gthree_object_get_world_matrix (object), &batch_inverse))
+    graphene_matrix_init_identity (&batch_inverse);
+
+  by_material = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                       (GDestroyNotify)g_array_unref);
+  collect_meshes (object, by_material);
+
+  g_hash_table_iter_init (&iter, by_material);
+  while (g_hash_table_iter_next (&iter, &material, &items))
+    {
+      GArray *array = items;
+      gboolean needs_uv = gthree_material_needs_uv (material);
+
+      if (gthree_material_needs_colors (material) != GTHREE_COLOR_NONE)
+        priv->has_colors = TRUE;
+
+      for (i = 0; i < array->len; i++)
+        {
+          BatchItem *item = &g_array_index (array, BatchItem, i);
+          GthreeGeometry *geometry = gthree_mesh_get_geometry (item->mesh);
+
+          if (needs_uv && gthree_geometry_get_n_uv (geometry) > 0)
+            priv->has_uvs = TRUE;
+          if (needs_uv && gthree_geometry_get_n_uv2 (geometry) > 0)
+            priv->has_uv2s = TRUE;
+
+          graphene_matrix_multiply (gthree_object_get_world_matrix (GTHREE_OBJECT (item->mesh)),
+                                    &batch_inverse, &item->matrix);
+          gthree_object_remove_buffers (GTHREE_OBJECT (item->mesh));
+        }
+
+      priv->n_batched_meshes += array->len;
+    }
+
+  g_hash_table_iter_init (&iter, by_material);
+  while (g_hash_table_iter_next (&iter, &material, &items))
+    bake_material (batch, material, items);
+
+  g_hash_table_destroy (by_material);
+
+  min.x = min.y = min.z = G_MAXFLOAT;
+  max.x = max.y = max.z = -G_MAXFLOAT;
+  for (l = gthree_object_get_object_buffers (object); l != NULL; l = l->next)
+    {
+      GthreeObjectBuffer *object_buffer = l->data;
+      const graphene_sphere_t *s = &object_buffer->buffer->bounding_sphere;
+      graphene_point3d_t center;
+      float radius = graphene_sphere_get_radius (s);
+
+      graphene_sphere_get_center (s, &center);
+      min.x = MIN (min.x, center.x - radius);
+      min.y = MIN (min.y, center.y - radius);
+      min.z = MIN (min.z, center.z - radius);
+      max.x = MAX (max.x, center.x + radius);
+      max.y = MAX (max.y, center.y + radius);
+      max.z = MAX (max.z, center.z + radius);
+    }
+
+  if (priv->n_draws > 0)
+    {
+      graphene_box_init (&box, &min, &max);
+      graphene_box_get_bounding_sphere (&box, &priv->bounding_sphere);
+    }
+  else
+    graphene_sphere_init (&priv->bounding_sphere, NULL, 0);
+}
+
+static void
+gthree_static_batch_unrealize (GthreeObject *object)
+{
+  GthreeStaticBatch *batch = GTHREE_STATIC_BATCH (object);
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+
+  /* The baked buffers went with the object buffers */
+  priv->n_batched_meshes = 0;
+  priv->n_draws = 0;
+}
+
+static gboolean
+gthree_static_batch_in_frustum (GthreeObject             *object,
+                                const graphene_frustum_t *frustum)
+{
+  GthreeStaticBatch *batch = GTHREE_STATIC_BATCH (object);
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+  graphene_sphere_t sphere;
+
+  if (priv->n_draws == 0)
+    return FALSE;
+
+  graphene_matrix_transform_sphere (gthree_object_get_world_matrix (object),
+                                    &priv->bounding_sphere,
+                                    &sphere);
+
+  return graphene_frustum_intersects_sphere (frustum, &sphere);
+}
+
+static gboolean
+gthree_static_batch_get_bounding_sphere (GthreeObject      *object,
+                                         graphene_sphere_t *sphere)
+{
+  GthreeStaticBatch *batch = GTHREE_STATIC_BATCH (object);
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+
+  if (priv->n_draws == 0)
+    return FALSE;
+
+  *sphere = priv->bounding_sphere;
+
+  return TRUE;
+}
+
+static gboolean
+gthree_static_batch_has_attribute_data (GthreeObject *object,
+                                        GQuark        attribute)
+{
+  GthreeStaticBatch *batch = GTHREE_STATIC_BATCH (object);
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+
+  if (attribute == q_color)
+    return priv->has_colors;
+  else if (attribute == q_uv)
+    return priv->has_uvs;
+  else if (attribute == q_uv2)
+    return priv->has_uv2s;
+
+  return FALSE;
+}
+
+static void
+gthree_static_batch_class_init (GthreeStaticBatchClass *klass)
+{
+  GthreeObjectClass *object_class = GTHREE_OBJECT_CLASS (klass);
+
+  object_class->realize = gthree_static_batch_realize;
+  object_class->unrealize = gthree_static_batch_unrealize;
+  object_class->in_frustum = gthree_static_batch_in_frustum;
+  object_class->get_bounding_sphere = gthree_static_batch_get_bounding_sphere;
+  object_class->has_attribute_data = gthree_static_batch_has_attribute_data;
+
+#define INIT_QUARK(name) q_##name = g_quark_from_static_string (#name)
+  INIT_QUARK(color);
+  INIT_QUARK(uv);
+  INIT_QUARK(uv2);
+}
+
+int
+gthree_static_batch_get_n_batched_meshes (GthreeStaticBatch *batch)
+{
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+
+  return priv->n_batched_meshes;
+}
+
+int
+gthree_static_batch_get_n_draws (GthreeStaticBatch *batch)
+{
+  GthreeStaticBatchPrivate *priv = gthree_static_batch_get_instance_private (batch);
+
+  return priv->n_draws;
+}
@@ -0,0 +1,40 @@
+#ifndef __GTHREE_STATIC_BATCH_H__
+#define __GTHREE_STATIC_BATCH_H__
+
+#if !defined (__GTHREE_H_INSIDE__) && !defined (GTHREE_COMPILATION)
+#error "Only <gthree/gthree.h> can be included directly."
+#endif
+
+#include <gthree/gthreeobject.h>
+
+G_BEGIN_DECLS
+
+#define GTHREE_TYPE_STATIC_BATCH      (gthree_static_batch_get_type ())
+#define GTHREE_STATIC_BATCH(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), \
+                                                                   GTHREE_TYPE_STATIC_BATCH, \
+                                                                   GthreeStaticBatch))
+#define GTHREE_IS_STATIC_BATCH(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst),    \
+                                                                   GTHREE_TYPE_STATIC_BATCH))
+
+/* Meshes added below a static batch before it is realized get their
+ * geometry baked into a few shared buffers per material, and are not
+ * drawn on their own after that. Moving or removing them later has
+ * no effect. */
+struct _GthreeStaticBatch {
+  GthreeObject parent;
+};
+
+typedef struct {
+  GthreeObjectClass parent_class;
+
+} GthreeStaticBatchClass;
+
+GthreeStaticBatch *gthree_static_batch_new (void);
+GType gthree_static_batch_get_type (void) G_GNUC_CONST;
+
+int      gthree_static_batch_get_n_batched_meshes (GthreeStaticBatch *batch);
+int      gthree_static_batch_get_n_draws          (GthreeStaticBatch *batch);
+
+G_END_DECLS
+
+#endif /* __GTHREE_STATIC_BATCH_H__ */
@@ -41,6 +41,9 @@ typedef struct {
   int unpack_alignment;
 
   guint gl_texture;
+
+  /* Set during gthree_texture_load(), for gthree_texture_bind() */
+  GthreeRenderer *load_renderer;
 } GthreeTexturePrivate;
 
 enum {
@@ -196,6 +199,40 @@ gthree_texture_get_mapping (GthreeTexture *texture)
   return priv->mapping;
 }
 
+void
+gthree_texture_set_mag_filter (GthreeTexture *texture,
+                               GthreeFilter   filter)
+{
+  GthreeTexturePrivate *priv = gthree_texture_get_instance_private (texture);
+
+  priv->mag_filter = filter;
+}
+
+GthreeFilter
+gthree_texture_get_mag_filter (GthreeTexture *texture)
+{
+  GthreeTexturePrivate *priv = gthree_texture_get_instance_private (texture);
+
+  return priv->mag_filter;
+}
+
+void
+gthree_texture_set_min_filter (GthreeTexture *texture,
+                               GthreeFilter   filter)
+{
+  GthreeTexturePrivate *priv = gthree_texture_get_instance_private (texture);
+
+  priv->min_filter = filter;
+}
+
+GthreeFilter
+gthree_texture_get_min_filter (GthreeTexture *texture)
+{
+  GthreeTexturePrivate *priv = gthree_texture_get_instance_private (texture);
+
+  return priv->min_filter;
+}
+
 gboolean
 gthree_texture_get_generate_mipmaps (GthreeTexture *texture)
 {
@@ -313,15 +350,38 @@ is_power_of_two (guint value)
 }
 
 void
-gthree_texture_bind (GthreeTexture *texture, int slot, int target)
+gthree_texture_bind_for_renderer (GthreeTexture *texture, GthreeRenderer *renderer, int slot, int target)
 {
   GthreeTexturePrivate *priv = gthree_texture_get_instance_private (texture);
 
   if (!priv->gl_texture)
     glGenTextures(1, &priv->gl_texture);
 
-  glActiveTexture (GL_TEXTURE0 + slot);
-  glBindTexture (target, priv->gl_texture);
+  if (renderer)
+    gthree_renderer_bind_texture (renderer, slot, target, priv->gl_texture);
+  else
+    {
+      glActiveTexture (GL_TEXTURE0 + slot);
+      glBindTexture (target, priv->gl_texture);
+    }
+}
+
+/* For the load vfuncs, goes through the binding cache of the renderer
+ * that is loading the texture */
+void
+gthree_texture_bind (GthreeTexture *texture, int slot, int target)
+{
+  GthreeTexturePrivate *priv = gthree_texture_get_instance_private (texture);
+
+  gthree_texture_bind_for_renderer (texture, priv->load_renderer, slot, target);
+}
+
+guint
+gthree_texture_get_gl_texture (GthreeTexture *texture)
+{
+  GthreeTexturePrivate *priv = gthree_texture_get_instance_private (texture);
+
+  return priv->gl_texture;
 }
 
 static void
@@ -412,6 +472,7 @@ gthree_texture_real_load (GthreeTexture *texture, int slot)
 
               glTexImage2D (GL_TEXTURE_2D, 0, gl_format, width, height, 0, gl_format, gl_type,
                             gdk_pixbuf_get_pixels (pixbuf));
+              gthree_render_stats_add_texture_upload (gdk_pixbuf_get_byte_length (pixbuf));
 	      g_object_unref (pixbuf);
             }
         }
@@ -424,9 +485,12 @@ gthree_texture_real_load (GthreeTexture *texture, int slot)
 }
 
 void
-gthree_texture_load (GthreeTexture *texture, int slot)
+gthree_texture_load (GthreeTexture *texture, GthreeRenderer *renderer, int slot)
 {
   GthreeTextureClass *class = GTHREE_TEXTURE_GET_CLASS(texture);
+  GthreeTexturePrivate *priv = gthree_texture_get_instance_private (texture);
 
+  priv->load_renderer = renderer;
   class->load (texture, slot);
+  priv->load_renderer = NULL;
 }
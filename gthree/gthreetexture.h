@@ -40,6 +40,12 @@ gboolean               gthree_texture_get_generate_mipmaps (GthreeTexture *textu
 void                   gthree_texture_set_mapping          (GthreeTexture *texture,
                                                             GthreeMapping  mapping);
 GthreeMapping          gthree_texture_get_mapping          (GthreeTexture *texture);
+void                   gthree_texture_set_mag_filter       (GthreeTexture *texture,
+                                                            GthreeFilter   filter);
+GthreeFilter           gthree_texture_get_mag_filter       (GthreeTexture *texture);
+void                   gthree_texture_set_min_filter       (GthreeTexture *texture,
+                                                            GthreeFilter   filter);
+GthreeFilter           gthree_texture_get_min_filter       (GthreeTexture *texture);
 
 G_END_DECLS
 
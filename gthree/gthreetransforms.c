@@ -0,0 +1,513 @@
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "gthreetransformsprivate.h"
+#include "gthreeobjectprivate.h"
+
+/* Slots are stored in blocks of four, each value of a block is four
+ * floats, one per slot. A matrix is 16 values, row major like
+ * graphene_matrix_to_float(). */
+#define BLOCK_SIZE 4
+#define TRS_VALUES 10 /* position, quaternion, scale */
+#define MATRIX_VALUES 16
+
+#define SLOT_INDEX(slot, n_values, value) \
+  ((((slot) / BLOCK_SIZE) * (n_values) + (value)) * BLOCK_SIZE + (slot) % BLOCK_SIZE)
+
+enum {
+  STATE_COMPOSE = 1 << 0, /* local matrix from position, rotation, scale */
+  STATE_CHANGED = 1 << 1, /* world matrix to compute */
+  STATE_VISIT_CHILDREN = 1 << 2,
+  STATE_WORLD_LOADED = 1 << 3, /* unchanged, but read by a child */
+};
+
+struct _GthreeTransforms {
+  GthreeObject *root;
+  guint graph_serial;
+
+  /* Depth order, each level starts at a new block so a block never
+     has to wait for another one of its own level. Padding slots have
+     no object. */
+  GPtrArray *objects; /* GthreeObject */
+  GArray *parents; /* int, the slot of the parent or -1 */
+  GArray *levels; /* int, the first slot of each level, then the end */
+
+  /* Only valid for the slots in use during an update */
+  int n_blocks;
+  guint8 *state;
+  float *trs;
+  float *local;
+  float *world;
+};
+
+#ifdef __SSE2__
+typedef __m128 Vec4;
+
+#define vec4_load(p) _mm_loadu_ps (p)
+#define vec4_store(p, v) _mm_storeu_ps ((p), (v))
+#define vec4_splat(f) _mm_set1_ps (f)
+#define vec4_add(a, b) _mm_add_ps ((a), (b))
+#define vec4_sub(a, b) _mm_sub_ps ((a), (b))
+#define vec4_mul(a, b) _mm_mul_ps ((a), (b))
+#else
+typedef struct {
+  float f[4];
+} Vec4;
+
+static inline Vec4
+vec4_load (const float *p)
+{
+  Vec4 v = { { p[0], p[1], p[2], p[3] } };
+  return v;
+}
+
+static inline void
+vec4_store (float *p, Vec4 v)
+{
+  memcpy (p, v.f, sizeof (v.f));
+}
+
+static inline Vec4
+vec4_splat (float f)
+{
+  Vec4 v = { { f, f, f, f } };
+  return v;
+}
+
+static inline Vec4
+vec4_add (Vec4 a, Vec4 b)
+{
+  Vec4 v = { { a.f[0] + b.f[0], a.f[1] + b.f[1], a.f[2] + b.f[2], a.f[3] + b.f[3] } };
+  return v;
+}
+
+static inline Vec4
+vec4_sub (Vec4 a, Vec4 b)
+{
+  Vec4 v = { { a.f[0] - b.f[0], a.f[1] - b.f[1], a.f[2] - b.f[2], a.f[3] - b.f[3] } };
+  return v;
+}
+
+static inline Vec4
+vec4_mul (Vec4 a, Vec4 b)
+{
+  Vec4 v = { { a.f[0] * b.f[0], a.f[1] * b.f[1], a.f[2] * b.f[2], a.f[3] * b.f[3] } };
+  return v;
+}
+#endif
+
+GthreeTransforms *
+gthree_transforms_new (void)
+{
+  GthreeTransforms *transforms = g_new0 (GthreeTransforms, 1);
+
+  transforms->objects = g_ptr_array_new ();
+  transforms->parents = g_array_new (FALSE, FALSE, sizeof (int));
+  transforms->levels = g_array_new (FALSE, FALSE, sizeof (int));
+
+  return transforms;
+}
+
+void
+gthree_transforms_free (GthreeTransforms *transforms)
+{
+  g_ptr_array_free (transforms->objects, TRUE);
+  g_array_free (transforms->parents, TRUE);
+  g_array_free (transforms->levels, TRUE);
+  g_free (transforms->state);
+  g_free (transforms->trs);
+  g_free (transforms->local);
+  g_free (transforms->world);
+  g_free (transforms);
+}
+
+static void
+add_slot (GthreeTransforms *transforms,
+          GthreeObject     *object,
+          int               parent)
+{
+  g_ptr_array_add (transforms->objects, object);
+  g_array_append_val (transforms->parents, parent);
+}
+
+static void
+end_level (GthreeTransforms *transforms)
+{
+  while (transforms->objects->len % BLOCK_SIZE != 0)
+    add_slot (transforms, NULL, -1);
+}
+
+static void
+rebuild (GthreeTransforms *transforms,
+         GthreeObject     *root)
+{
+  int level_start, level_end, slot, n_blocks;
+  GthreeObject *child;
+
+  g_ptr_array_set_size (transforms->objects, 0);
+  g_array_set_size (transforms->parents, 0);
+  g_array_set_size (transforms->levels, 0);
+
+  add_slot (transforms, root, -1);
+  end_level (transforms);
+
+  level_start = 0;
+  level_end = transforms->objects->len;
+  while (level_start < level_end)
+    {
+      g_array_append_val (transforms->levels, level_start);
+
+      for (slot = level_start; slot < level_end; slot++)
+        {
+          GthreeObject *object = g_ptr_array_index (transforms->objects, slot);
+
+          if (object == NULL)
+            continue;
+
+          for (child = gthree_object_get_first_child (object);
+               child != NULL;
+               child = gthree_object_get_next_sibling (child))
+            add_slot (transforms, child, slot);
+        }
+      end_level (transforms);
+
+      level_start = level_end;
+      level_end = transforms->objects->len;
+    }
+  g_array_append_val (transforms->levels, level_start);
+
+  n_blocks = transforms->objects->len / BLOCK_SIZE;
+  if (n_blocks > transforms->n_blocks)
+    {
+      g_free (transforms->state);
+      g_free (transforms->trs);
+      g_free (transforms->local);
+      g_free (transforms->world);
+
+      /* Unchanged slots of a block are computed too, keep them defined */
+      transforms->n_blocks = n_blocks;
+      transforms->state = g_new0 (guint8, n_blocks * BLOCK_SIZE);
+      transforms->trs = g_new0 (float, n_blocks * BLOCK_SIZE * TRS_VALUES);
+      transforms->local = g_new0 (float, n_blocks * BLOCK_SIZE * MATRIX_VALUES);
+      transforms->world = g_new0 (float, n_blocks * BLOCK_SIZE * MATRIX_VALUES);
+    }
+
+  transforms->root = root;
+  transforms->graph_serial = gthree_object_get_graph_serial ();
+}
+
+static void
+store_matrix (float       *values,
+              int          slot,
+              const float *matrix)
+{
+  int i;
+
+  for (i = 0; i < MATRIX_VALUES; i++)
+    values[SLOT_INDEX (slot, MATRIX_VALUES, i)] = matrix[i];
+}
+
+static void
+load_matrix (const float *values,
+             int          slot,
+             float       *matrix)
+{
+  int i;
+
+  for (i = 0; i < MATRIX_VALUES; i++)
+    matrix[i] = values[SLOT_INDEX (slot, MATRIX_VALUES, i)];
+}
+
+/* Marks what needs computing, walking only into subtrees with changes,
+ * and copies in the inputs */
+static void
+gather (GthreeTransforms *transforms)
+{
+  int n_slots = transforms->objects->len;
+  int slot, i;
+
+  for (slot = 0; slot < n_slots; slot++)
+    {
+      GthreeObject *object = g_ptr_array_index (transforms->objects, slot);
+      int parent = g_array_index (transforms->parents, int, slot);
+      GthreeTransformChanges changes;
+      guint8 state = 0;
+
+      transforms->state[slot] = 0;
+
+      if (object == NULL ||
+          (parent >= 0 && !(transforms->state[parent] & STATE_VISIT_CHILDREN)))
+        continue;
+
+      changes = gthree_object_get_transform_changes (object);
+
+      if (changes & GTHREE_TRANSFORM_LOCAL_CHANGED)
+        state |= STATE_COMPOSE | STATE_CHANGED;
+      if (changes & GTHREE_TRANSFORM_WORLD_CHANGED)
+        state |= STATE_CHANGED;
+      if (parent >= 0 && (transforms->state[parent] & STATE_CHANGED))
+        state |= STATE_CHANGED;
+      if ((state & STATE_CHANGED) || (changes & GTHREE_TRANSFORM_DESCENDANTS_CHANGED))
+        state |= STATE_VISIT_CHILDREN;
+
+      if (state & STATE_COMPOSE)
+        {
+          float trs[TRS_VALUES];
+
+          gthree_object_get_transform (object, &trs[0], &trs[3], &trs[7]);
+          for (i = 0; i < TRS_VALUES; i++)
+            transforms->trs[SLOT_INDEX (slot, TRS_VALUES, i)] = trs[i];
+        }
+      else if (state & STATE_CHANGED)
+        {
+          float matrix[MATRIX_VALUES];
+
+          gthree_object_get_matrix_floats (object, matrix);
+          store_matrix (transforms->local, slot, matrix);
+        }
+
+      if ((state & STATE_CHANGED) && parent >= 0 &&
+          !(transforms->state[parent] & (STATE_CHANGED | STATE_WORLD_LOADED)))
+        {
+          float matrix[MATRIX_VALUES];
+
+          gthree_object_get_world_matrix_floats (g_ptr_array_index (transforms->objects, parent), matrix);
+          store_matrix (transforms->world, parent, matrix);
+          transforms->state[parent] |= STATE_WORLD_LOADED;
+        }
+
+      transforms->state[slot] = state;
+    }
+}
+
+/* Same as gthree_object_update_matrix(): the rotation matrix of the
+ * quaternion, then scale, then translate, for row vectors */
+static void
+compose_block (const float *trs,
+               float       *matrix)
+{
+  Vec4 px = vec4_load (trs + 0 * BLOCK_SIZE);
+  Vec4 py = vec4_load (trs + 1 * BLOCK_SIZE);
+  Vec4 pz = vec4_load (trs + 2 * BLOCK_SIZE);
+  Vec4 qx = vec4_load (trs + 3 * BLOCK_SIZE);
+  Vec4 qy = vec4_load (trs + 4 * BLOCK_SIZE);
+  Vec4 qz = vec4_load (trs + 5 * BLOCK_SIZE);
+  Vec4 qw = vec4_load (trs + 6 * BLOCK_SIZE);
+  Vec4 sx = vec4_load (trs + 7 * BLOCK_SIZE);
+  Vec4 sy = vec4_load (trs + 8 * BLOCK_SIZE);
+  Vec4 sz = vec4_load (trs + 9 * BLOCK_SIZE);
+  Vec4 one = vec4_splat (1), two = vec4_splat (2), zero = vec4_splat (0);
+  Vec4 xx = vec4_mul (qx, qx), yy = vec4_mul (qy, qy), zz = vec4_mul (qz, qz);
+  Vec4 xy = vec4_mul (qx, qy), xz = vec4_mul (qx, qz), yz = vec4_mul (qy, qz);
+  Vec4 xw = vec4_mul (qx, qw), yw = vec4_mul (qy, qw), zw = vec4_mul (qz, qw);
+
+#define STORE(i, v) vec4_store (matrix + (i) * BLOCK_SIZE, (v))
+  STORE (0, vec4_mul (vec4_sub (one, vec4_mul (two, vec4_add (yy, zz))), sx));
+  STORE (1, vec4_mul (vec4_mul (two, vec4_add (xy, zw)), sy));
+  STORE (2, vec4_mul (vec4_mul (two, vec4_sub (xz, yw)), sz));
+  STORE (3, zero);
+  STORE (4, vec4_mul (vec4_mul (two, vec4_sub (xy, zw)), sx));
+  STORE (5, vec4_mul (vec4_sub (one, vec4_mul (two, vec4_add (xx, zz))), sy));
+  STORE (6, vec4_mul (vec4_mul (two, vec4_add (yz, xw)), sz));
+  STORE (7, zero);
+  STORE (8, vec4_mul (vec4_mul (two, vec4_add (xz, yw)), sx));
+  STORE (9, vec4_mul (vec4_mul (two, vec4_sub (yz, xw)), sy));
+  STORE (10, vec4_mul (vec4_sub (one, vec4_mul (two, vec4_add (xx, yy))), sz));
+  STORE (11, zero);
+  STORE (12, px);
+  STORE (13, py);
+  STORE (14, pz);
+  STORE (15, one);
+#undef STORE
+}
+
+/* result = a * b, like graphene_matrix_multiply() */
+static void
+multiply_block (const float *a,
+                const float *b,
+                float       *result)
+{
+  Vec4 bv[MATRIX_VALUES];
+  int row, col, i;
+
+  for (i = 0; i < MATRIX_VALUES; i++)
+    bv[i] = vec4_load (b + i * BLOCK_SIZE);
+
+  for (row = 0; row < 4; row++)
+    {
+      Vec4 a0 = vec4_load (a + (row * 4 + 0) * BLOCK_SIZE);
+      Vec4 a1 = vec4_load (a + (row * 4 + 1) * BLOCK_SIZE);
+      Vec4 a2 = vec4_load (a + (row * 4 + 2) * BLOCK_SIZE);
+      Vec4 a3 = vec4_load (a + (row * 4 + 3) * BLOCK_SIZE);
+
+      for (col = 0; col < 4; col++)
+        {
+          Vec4 sum = vec4_add (vec4_add (vec4_mul (a0, bv[0 * 4 + col]),
+                                         vec4_mul (a1, bv[1 * 4 + col])),
+                               vec4_add (vec4_mul (a2, bv[2 * 4 + col]),
+                                         vec4_mul (a3, bv[3 * 4 + col])));
+          vec4_store (result + (row * 4 + col) * BLOCK_SIZE, sum);
+        }
+    }
+}
+
+/* Copies the slots of the block in mask from src */
+static void
+merge_block (float       *dest,
+             const float *src,
+             guint        mask)
+{
+  int i, lane;
+
+  if (mask == (1 << BLOCK_SIZE) - 1)
+    {
+      memcpy (dest, src, MATRIX_VALUES * BLOCK_SIZE * sizeof (float));
+      return;
+    }
+
+  for (lane = 0; lane < BLOCK_SIZE; lane++)
+    {
+      if (mask & (1 << lane))
+        for (i = 0; i < MATRIX_VALUES; i++)
+          dest[i * BLOCK_SIZE + lane] = src[i * BLOCK_SIZE + lane];
+    }
+}
+
+static guint
+block_mask (GthreeTransforms *transforms,
+            int               block,
+            guint8            state)
+{
+  guint mask = 0;
+  int lane;
+
+  for (lane = 0; lane < BLOCK_SIZE; lane++)
+    {
+      if (transforms->state[block * BLOCK_SIZE + lane] & state)
+        mask |= 1 << lane;
+    }
+
+  return mask;
+}
+
+static void
+compose_local_matrices (GthreeTransforms *transforms)
+{
+  int n_blocks = transforms->objects->len / BLOCK_SIZE;
+  float matrices[MATRIX_VALUES * BLOCK_SIZE];
+  int block;
+
+  for (block = 0; block < n_blocks; block++)
+    {
+      guint mask = block_mask (transforms, block, STATE_COMPOSE);
+
+      if (mask == 0)
+        continue;
+
+      compose_block (transforms->trs + block * TRS_VALUES * BLOCK_SIZE, matrices);
+      merge_block (transforms->local + block * MATRIX_VALUES * BLOCK_SIZE, matrices, mask);
+    }
+}
+
+static void
+update_root (GthreeTransforms *transforms)
+{
+  GthreeObject *parent = gthree_object_get_parent (transforms->root);
+  float matrix[MATRIX_VALUES];
+
+  if (!(transforms->state[0] & STATE_CHANGED))
+    return;
+
+  load_matrix (transforms->local, 0, matrix);
+
+  if (parent != NULL)
+    {
+      graphene_matrix_t local, world;
+
+      graphene_matrix_init_from_float (&local, matrix);
+      graphene_matrix_multiply (&local, gthree_object_get_world_matrix (parent), &world);
+      graphene_matrix_to_float (&world, matrix);
+    }
+
+  store_matrix (transforms->world, 0, matrix);
+}
+
+/* Each level only reads the world matrices of the one above */
+static void
+update_world_matrices (GthreeTransforms *transforms)
+{
+  float parents[MATRIX_VALUES * BLOCK_SIZE];
+  float matrices[MATRIX_VALUES * BLOCK_SIZE];
+  int level, block, lane, i;
+
+  for (level = 1; level < transforms->levels->len - 1; level++)
+    {
+      int first = g_array_index (transforms->levels, int, level) / BLOCK_SIZE;
+      int last = g_array_index (transforms->levels, int, level + 1) / BLOCK_SIZE;
+
+      for (block = first; block < last; block++)
+        {
+          guint mask = block_mask (transforms, block, STATE_CHANGED);
+
+          if (mask == 0)
+            continue;
+
+          for (lane = 0; lane < BLOCK_SIZE; lane++)
+            {
+              int parent = g_array_index (transforms->parents, int, block * BLOCK_SIZE + lane);
+
+              for (i = 0; i < MATRIX_VALUES; i++)
+                parents[i * BLOCK_SIZE + lane] =
+                  parent >= 0 ? transforms->world[SLOT_INDEX (parent, MATRIX_VALUES, i)] : 0;
+            }
+
+          multiply_block (transforms->local + block * MATRIX_VALUES * BLOCK_SIZE, parents, matrices);
+          merge_block (transforms->world + block * MATRIX_VALUES * BLOCK_SIZE, matrices, mask);
+        }
+    }
+}
+
+static void
+scatter (GthreeTransforms *transforms)
+{
+  int n_slots = transforms->objects->len;
+  float matrix[MATRIX_VALUES], world[MATRIX_VALUES];
+  int slot;
+
+  for (slot = 0; slot < n_slots; slot++)
+    {
+      guint8 state = transforms->state[slot];
+
+      if (!(state & STATE_CHANGED))
+        continue;
+
+      if (state & STATE_COMPOSE)
+        load_matrix (transforms->local, slot, matrix);
+      load_matrix (transforms->world, slot, world);
+
+      gthree_object_set_computed_matrices (g_ptr_array_index (transforms->objects, slot),
+                                           (state & STATE_COMPOSE) ? matrix : NULL,
+                                           world);
+    }
+}
+
+void
+gthree_transforms_update (GthreeTransforms *transforms,
+                          GthreeObject     *root)
+{
+  if (root != transforms->root ||
+      transforms->graph_serial != gthree_object_get_graph_serial ())
+    rebuild (transforms, root);
+
+  /* Mostly static scenes end here */
+  if (!gthree_object_needs_matrix_world_update (root))
+    return;
+
+  gather (transforms);
+  compose_local_matrices (transforms);
+  update_root (transforms);
+  update_world_matrices (transforms);
+  scatter (transforms);
+}
@@ -0,0 +1,21 @@
+#ifndef __GTHREE_TRANSFORMS_PRIVATE_H__
+#define __GTHREE_TRANSFORMS_PRIVATE_H__
+
+#include <gthree/gthreeobject.h>
+
+G_BEGIN_DECLS
+
+/* Updates the world matrices of an object graph like
+ * gthree_object_update_matrix_world(), but from contiguous arrays in
+ * depth order, four objects at a time. The order is kept until the
+ * graph changes, the objects stay where the matrices live. */
+typedef struct _GthreeTransforms GthreeTransforms;
+
+GthreeTransforms *gthree_transforms_new    (void);
+void              gthree_transforms_free   (GthreeTransforms *transforms);
+void              gthree_transforms_update (GthreeTransforms *transforms,
+                                            GthreeObject     *root);
+
+G_END_DECLS
+
+#endif /* __GTHREE_TRANSFORMS_PRIVATE_H__ */
@@ -20,6 +20,11 @@ typedef struct _GthreeLightSetup GthreeLightSetup;
 typedef struct _GthreeTexture GthreeTexture;
 typedef struct _GthreeCubeTexture GthreeCubeTexture;
 typedef struct _GthreeGeometry GthreeGeometry;
+typedef struct _GthreeInstancedMesh GthreeInstancedMesh;
+typedef struct _GthreeStaticBatch GthreeStaticBatch;
+typedef struct _GthreeLOD GthreeLOD;
+typedef struct _GthreeRenderTarget GthreeRenderTarget;
+typedef struct _GthreeHeadlessContext GthreeHeadlessContext;
 
 
 #endif /* __GTHREE_TYPES_H__ */
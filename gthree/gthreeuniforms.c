@@ -19,7 +19,10 @@ struct _GthreeUniform {
   } value;
 };
 
+/* The uniforms are kept in the order they were added, so loading them
+ * walks a flat array. The hash maps names to indexes into it. */
 typedef struct {
+  GPtrArray *array;
   GHashTable *hash;
 } GthreeUniformsPrivate;
 
@@ -45,7 +48,8 @@ gthree_uniforms_init (GthreeUniforms *uniforms)
 {
   GthreeUniformsPrivate *priv = gthree_uniforms_get_instance_private (uniforms);
 
-  priv->hash = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)gthree_uniform_free);
+  priv->array = g_ptr_array_new_with_free_func ((GDestroyNotify)gthree_uniform_free);
+  priv->hash = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 static void
@@ -55,6 +59,7 @@ gthree_uniforms_finalize (GObject *obj)
   GthreeUniformsPrivate *priv = gthree_uniforms_get_instance_private (uniforms);
 
   g_hash_table_destroy (priv->hash);
+  g_ptr_array_free (priv->array, TRUE);
 
   G_OBJECT_CLASS (gthree_uniforms_parent_class)->finalize (obj);
 }
@@ -72,8 +77,24 @@ gthree_uniforms_add (GthreeUniforms *uniforms,
                      GthreeUniform  *uniform)
 {
   GthreeUniformsPrivate *priv = gthree_uniforms_get_instance_private (uniforms);
+  gpointer index;
 
-  g_hash_table_replace (priv->hash, GINT_TO_POINTER (uniform->name), uniform);
+  /* A replaced uniform keeps its place */
+  if (g_hash_table_lookup_extended (priv->hash, GINT_TO_POINTER (uniform->name), NULL, &index))
+    {
+      GthreeUniform *old = g_ptr_array_index (priv->array, GPOINTER_TO_INT (index));
+
+      if (old != uniform)
+        {
+          gthree_uniform_free (old);
+          g_ptr_array_index (priv->array, GPOINTER_TO_INT (index)) = uniform;
+        }
+    }
+  else
+    {
+      g_hash_table_insert (priv->hash, GINT_TO_POINTER (uniform->name), GINT_TO_POINTER (priv->array->len));
+      g_ptr_array_add (priv->array, uniform);
+    }
 }
 
 GthreeUniform *
@@ -81,8 +102,12 @@ gthree_uniforms_lookup (GthreeUniforms *uniforms,
                         GQuark name)
 {
   GthreeUniformsPrivate *priv = gthree_uniforms_get_instance_private (uniforms);
+  gpointer index;
 
-  return g_hash_table_lookup (priv->hash, GINT_TO_POINTER (name));
+  if (!g_hash_table_lookup_extended (priv->hash, GINT_TO_POINTER (name), NULL, &index))
+    return NULL;
+
+  return g_ptr_array_index (priv->array, GPOINTER_TO_INT (index));
 }
 
 GList  *
@@ -90,16 +115,11 @@ gthree_uniforms_get_all (GthreeUniforms *uniforms)
 {
   GthreeUniformsPrivate *priv = gthree_uniforms_get_instance_private (uniforms);
   GList *all;
-  GHashTableIter iter;
-  gpointer value;
+  int i;
 
   all = NULL;
-  g_hash_table_iter_init (&iter, priv->hash);
-  while (g_hash_table_iter_next (&iter, NULL, &value))
-    {
-      GthreeUniform *uniform = value;
-      all = g_list_prepend (all, uniform);
-    }
+  for (i = priv->array->len; i > 0; i--)
+    all = g_list_prepend (all, g_ptr_array_index (priv->array, i - 1));
 
   return all;
 }
@@ -126,14 +146,11 @@ void
 gthree_uniforms_merge (GthreeUniforms *uniforms,
                        GthreeUniforms *source)
 {
-  GthreeUniformsPrivate *priv = gthree_uniforms_get_instance_private (uniforms);
   GthreeUniformsPrivate *source_priv = gthree_uniforms_get_instance_private (source);
-  GHashTableIter iter;
-  GthreeUniform *uniform;
+  int i;
 
-  g_hash_table_iter_init (&iter, source_priv->hash);
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&uniform))
-    g_hash_table_replace (priv->hash, GINT_TO_POINTER (uniform->name), gthree_uniform_clone (uniform));
+  for (i = 0; i < source_priv->array->len; i++)
+    gthree_uniforms_add (uniforms, gthree_uniform_clone (g_ptr_array_index (source_priv->array, i)));
 }
 
 void
@@ -141,12 +158,11 @@ gthree_uniforms_load (GthreeUniforms *uniforms,
                      GthreeRenderer *renderer)
 {
   GthreeUniformsPrivate *priv = gthree_uniforms_get_instance_private (uniforms);
-  GHashTableIter iter;
-  GthreeUniform *uniform;
+  GthreeUniform **array = (GthreeUniform **)priv->array->pdata;
+  int i, len = priv->array->len;
 
-  g_hash_table_iter_init (&iter, priv->hash);
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&uniform))
-    gthree_uniform_load (uniform, renderer);
+  for (i = 0; i < len; i++)
+    gthree_uniform_load (array[i], renderer);
 }
 
 void
@@ -185,6 +201,30 @@ gthree_uniforms_set_float3_array (GthreeUniforms  *uniforms,
     gthree_uniform_set_float3_array (uni, array);
 }
 
+void
+gthree_uniforms_set_vec2_array (GthreeUniforms  *uniforms,
+                                const char      *name,
+                                GArray          *array)
+{
+  GthreeUniform *uni;
+
+  uni = gthree_uniforms_lookup_from_string (uniforms, name);
+  if (uni)
+    gthree_uniform_set_vec2_array (uni, array);
+}
+
+void
+gthree_uniforms_set_matrix4_array (GthreeUniforms  *uniforms,
+                                   const char      *name,
+                                   GArray          *array)
+{
+  GthreeUniform *uni;
+
+  uni = gthree_uniforms_lookup_from_string (uniforms, name);
+  if (uni)
+    gthree_uniform_set_matrix4_array (uni, array);
+}
+
 void
 gthree_uniforms_set_int (GthreeUniforms  *uniforms,
                          const char      *name,
@@ -221,6 +261,18 @@ gthree_uniforms_set_texture (GthreeUniforms  *uniforms,
     gthree_uniform_set_texture (uni, value);
 }
 
+void
+gthree_uniforms_set_texture_array (GthreeUniforms  *uniforms,
+                                   const char      *name,
+                                   GPtrArray       *array)
+{
+  GthreeUniform *uni;
+
+  uni = gthree_uniforms_lookup_from_string (uniforms, name);
+  if (uni)
+    gthree_uniform_set_texture_array (uni, array);
+}
+
 void
 gthree_uniforms_set_color (GthreeUniforms  *uniforms,
                            const char      *name,
@@ -362,14 +414,10 @@ gthree_uniform_clone (GthreeUniform *uniform)
         g_object_ref (clone->value.texture);
       break;
     case GTHREE_UNIFORM_TYPE_TEXTURE_ARRAY:
+      /* Shared, gthree_uniform_set_texture_array() replaces rather
+         than modifies it */
       if (uniform->value.ptr_array)
-        {
-          guint len = uniform->value.ptr_array->len;
-          clone->value.ptr_array = g_ptr_array_sized_new (len);
-          // TODO: ref? duplicate?
-          // TODO: Copy free func?
-          memcpy (clone->value.ptr_array->pdata, uniform->value.ptr_array->pdata, len * sizeof (gpointer));
-        }
+        g_ptr_array_ref (uniform->value.ptr_array);
       break;
     case GTHREE_UNIFORM_TYPE_MATRIX3:
       clone->value.more_floats = g_memdup (clone->value.more_floats, sizeof (float) * 9);
@@ -430,6 +478,26 @@ gthree_uniform_set_float3_array (GthreeUniform *uniform,
  set_array (uniform, array);
 }
 
+/* Two floats per element */
+void
+gthree_uniform_set_vec2_array (GthreeUniform *uniform,
+                               GArray *array)
+{
+ g_return_if_fail (uniform->type == GTHREE_UNIFORM_TYPE_VEC2_ARRAY);
+
+ set_array (uniform, array);
+}
+
+/* Sixteen floats per element */
+void
+gthree_uniform_set_matrix4_array (GthreeUniform *uniform,
+                                  GArray *array)
+{
+ g_return_if_fail (uniform->type == GTHREE_UNIFORM_TYPE_MATRIX4_ARRAY);
+
+ set_array (uniform, array);
+}
+
 void
 gthree_uniform_set_int (GthreeUniform *uniform,
                         int val)
@@ -473,10 +541,65 @@ gthree_uniform_set_texture (GthreeUniform *uniform,
   uniform->value.texture = value;
 }
 
+void
+gthree_uniform_set_texture_array (GthreeUniform *uniform,
+                                  GPtrArray *array)
+{
+  g_return_if_fail (uniform->type == GTHREE_UNIFORM_TYPE_TEXTURE_ARRAY);
+
+  if (array)
+    g_ptr_array_ref (array);
+  if (uniform->value.ptr_array)
+    g_ptr_array_unref (uniform->value.ptr_array);
+
+  uniform->value.ptr_array = array;
+}
+
+/* For the render stats, textures aren't uploaded by glUniform */
+static gsize
+uniform_upload_size (GthreeUniform *uniform)
+{
+  switch (uniform->type)
+    {
+    case GTHREE_UNIFORM_TYPE_INT:
+    case GTHREE_UNIFORM_TYPE_FLOAT:
+      return 4;
+    case GTHREE_UNIFORM_TYPE_FLOAT2:
+    case GTHREE_UNIFORM_TYPE_VECTOR2:
+      return 2 * 4;
+    case GTHREE_UNIFORM_TYPE_FLOAT3:
+    case GTHREE_UNIFORM_TYPE_VECTOR3:
+    case GTHREE_UNIFORM_TYPE_COLOR:
+      return 3 * 4;
+    case GTHREE_UNIFORM_TYPE_FLOAT4:
+    case GTHREE_UNIFORM_TYPE_VECTOR4:
+      return 4 * 4;
+    case GTHREE_UNIFORM_TYPE_MATRIX3:
+      return 9 * 4;
+    case GTHREE_UNIFORM_TYPE_MATRIX4:
+      return 16 * 4;
+    case GTHREE_UNIFORM_TYPE_INT_ARRAY:
+    case GTHREE_UNIFORM_TYPE_INT3_ARRAY:
+    case GTHREE_UNIFORM_TYPE_FLOAT_ARRAY:
+    case GTHREE_UNIFORM_TYPE_FLOAT2_ARRAY:
+    case GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY:
+    case GTHREE_UNIFORM_TYPE_FLOAT4_ARRAY:
+    case GTHREE_UNIFORM_TYPE_VEC2_ARRAY:
+    case GTHREE_UNIFORM_TYPE_MATRIX4_ARRAY:
+      if (uniform->value.array)
+        return uniform->value.array->len * g_array_get_element_size (uniform->value.array);
+      return 0;
+    default:
+      return 0;
+    }
+}
+
 void
 gthree_uniform_load (GthreeUniform *uniform,
                      GthreeRenderer *renderer)
 {
+  gsize size;
+
   if (uniform->location == -1)
     return;
 
@@ -536,16 +659,45 @@ gthree_uniform_load (GthreeUniform *uniform,
       break;
     case GTHREE_UNIFORM_TYPE_TEXTURE:
       if (uniform->value.texture)
-        gthree_texture_load (uniform->value.texture, gthree_renderer_allocate_texture_unit (renderer));
+        {
+          int unit = gthree_renderer_allocate_texture_unit (renderer);
+
+          gthree_texture_load (uniform->value.texture, renderer, unit);
+          glUniform1i (uniform->location, unit);
+        }
+      break;
+    case GTHREE_UNIFORM_TYPE_TEXTURE_ARRAY:
+      if (uniform->value.ptr_array)
+        {
+          GPtrArray *textures = uniform->value.ptr_array;
+          int *units = g_newa (int, MAX (textures->len, 1));
+          int i;
+
+          for (i = 0; i < textures->len; i++)
+            {
+              units[i] = gthree_renderer_allocate_texture_unit (renderer);
+              gthree_texture_load (g_ptr_array_index (textures, i), renderer, units[i]);
+            }
+          glUniform1iv (uniform->location, textures->len, units);
+        }
       break;
     case GTHREE_UNIFORM_TYPE_VEC2_ARRAY:
+      if (uniform->value.array)
+	glUniform2fv (uniform->location, uniform->value.array->len / 2, &g_array_index (uniform->value.array, float, 0));
+      break;
+    case GTHREE_UNIFORM_TYPE_MATRIX4_ARRAY:
+      if (uniform->value.array)
+	glUniformMatrix4fv (uniform->location, uniform->value.array->len / 16, FALSE, &g_array_index (uniform->value.array, float, 0));
+      break;
     case GTHREE_UNIFORM_TYPE_VEC3_ARRAY:
     case GTHREE_UNIFORM_TYPE_VEC4_ARRAY:
     case GTHREE_UNIFORM_TYPE_MATRIX3_ARRAY:
-    case GTHREE_UNIFORM_TYPE_MATRIX4_ARRAY:
-    case GTHREE_UNIFORM_TYPE_TEXTURE_ARRAY:
       g_warning ("gthree_uniform_load() - unsupported uniform type %d\n", uniform->type);
     }
+
+  size = uniform_upload_size (uniform);
+  if (size > 0)
+    gthree_render_stats_add_uniform_upload (size);
 }
 
 static int i0 = 0;
@@ -601,29 +753,6 @@ static GthreeUniformsDefinition fog_lib[] = {
   {"fogColor", GTHREE_UNIFORM_TYPE_COLOR, &white }
 };
 
-static GthreeUniforms *lights;
-static GthreeUniformsDefinition lights_lib[] = {
-  {"ambientLightColor", GTHREE_UNIFORM_TYPE_COLOR, NULL},
-
-  {"directionalLightDirection", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-  {"directionalLightColor", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-
-  {"hemisphereLightDirection", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-  {"hemisphereLightSkyColor", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-  {"hemisphereLightGroundColor", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-
-  {"pointLightColor", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-  {"pointLightPosition", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-  {"pointLightDistance", GTHREE_UNIFORM_TYPE_FLOAT_ARRAY, NULL},
-
-  {"spotLightColor", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-  {"spotLightPosition", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-  {"spotLightDirection", GTHREE_UNIFORM_TYPE_FLOAT3_ARRAY, NULL},
-  {"spotLightDistance", GTHREE_UNIFORM_TYPE_FLOAT_ARRAY, NULL},
-  {"spotLightAngleCos", GTHREE_UNIFORM_TYPE_FLOAT_ARRAY, NULL},
-  {"spotLightExponent", GTHREE_UNIFORM_TYPE_FLOAT_ARRAY, NULL}
-};
-
 static GthreeUniforms *particle;
 static GthreeUniformsDefinition particle_lib[] = {
   {"psColor", GTHREE_UNIFORM_TYPE_COLOR, &grey },
@@ -717,7 +846,6 @@ gthree_uniforms_init_libs ()
   bump = gthree_uniforms_new_from_definitions (bump_lib, G_N_ELEMENTS (bump_lib));
   normalmap = gthree_uniforms_new_from_definitions (normalmap_lib, G_N_ELEMENTS (normalmap_lib));
   fog = gthree_uniforms_new_from_definitions (fog_lib, G_N_ELEMENTS (fog_lib));
-  lights = gthree_uniforms_new_from_definitions (lights_lib, G_N_ELEMENTS (lights_lib));
   particle = gthree_uniforms_new_from_definitions (particle_lib, G_N_ELEMENTS (particle_lib));
   shadowmap = gthree_uniforms_new_from_definitions (shadowmap_lib, G_N_ELEMENTS (shadowmap_lib));
 
@@ -737,8 +865,6 @@ gthree_get_uniforms_from_library (const char *name)
     return normalmap;
   if (strcmp (name, "fog") == 0)
     return fog;
-  if (strcmp (name, "lights") == 0)
-    return lights;
   if (strcmp (name, "particle") == 0)
     return particle;
   if (strcmp (name, "shadowmap") == 0)
@@ -89,6 +89,12 @@ void            gthree_uniforms_set_float_array    (GthreeUniforms  *uniforms,
 void            gthree_uniforms_set_float3_array   (GthreeUniforms  *uniforms,
                                                     const char      *name,
                                                     GArray          *array);
+void            gthree_uniforms_set_vec2_array     (GthreeUniforms  *uniforms,
+                                                    const char      *name,
+                                                    GArray          *array);
+void            gthree_uniforms_set_matrix4_array  (GthreeUniforms  *uniforms,
+                                                    const char      *name,
+                                                    GArray          *array);
 void            gthree_uniforms_set_int            (GthreeUniforms  *uniforms,
                                                     const char      *name,
                                                     int              value);
@@ -98,6 +104,9 @@ void            gthree_uniforms_set_vec4           (GthreeUniforms  *uniforms,
 void            gthree_uniforms_set_texture        (GthreeUniforms  *uniforms,
                                                     const char      *name,
                                                     GthreeTexture   *value);
+void            gthree_uniforms_set_texture_array  (GthreeUniforms  *uniforms,
+                                                    const char      *name,
+                                                    GPtrArray       *array);
 void            gthree_uniforms_set_color          (GthreeUniforms  *uniforms,
                                                     const char      *name,
                                                     GdkRGBA         *color);
@@ -114,12 +123,18 @@ void gthree_uniform_set_float_array (GthreeUniform *uniform,
 				     GArray *array);
 void gthree_uniform_set_float3_array (GthreeUniform *uniform,
 				      GArray *array);
+void gthree_uniform_set_vec2_array (GthreeUniform *uniform,
+                                    GArray *array);
+void gthree_uniform_set_matrix4_array (GthreeUniform *uniform,
+                                       GArray *array);
 void gthree_uniform_set_int (GthreeUniform *uniform,
                              int value);
 void gthree_uniform_set_vec4 (GthreeUniform *uniform,
                               graphene_vec4_t *value);
 void gthree_uniform_set_texture (GthreeUniform *uniform,
                                  GthreeTexture *value);
+void gthree_uniform_set_texture_array (GthreeUniform *uniform,
+                                       GPtrArray *array);
 void gthree_uniform_set_color (GthreeUniform *uniform,
                                GdkRGBA *color);
 
@@ -1,5 +1,5 @@
-#ifdef USE_COLOR
+#if defined( USE_COLOR ) || defined( USE_INSTANCING_COLOR )
 
 	varying vec3 vColor;
 
-#endif
\ No newline at end of file
+#endif
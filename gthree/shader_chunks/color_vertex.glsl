@@ -1,13 +1,25 @@
+#if defined( USE_COLOR ) || defined( USE_INSTANCING_COLOR )
+
+	vColor = vec3( 1.0 );
+
+#endif
+
 #ifdef USE_COLOR
 
 	#ifdef GAMMA_INPUT
 
-		vColor = color * color;
+		vColor *= color * color;
 
 	#else
 
-		vColor = color;
+		vColor *= color;
 
 	#endif
 
-#endif
\ No newline at end of file
+#endif
+
+#ifdef USE_INSTANCING_COLOR
+
+	vColor *= instanceColor;
+
+#endif
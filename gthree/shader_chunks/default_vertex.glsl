@@ -1,20 +1,30 @@
 vec4 mvPosition;
 
+#ifdef USE_INSTANCING
+
+	mat4 objectModelViewMatrix = modelViewMatrix * instanceMatrix;
+
+#else
+
+	mat4 objectModelViewMatrix = modelViewMatrix;
+
+#endif
+
 #ifdef USE_SKINNING
 
-	mvPosition = modelViewMatrix * skinned;
+	mvPosition = objectModelViewMatrix * skinned;
 
 #endif
 
 #if !defined( USE_SKINNING ) && defined( USE_MORPHTARGETS )
 
-	mvPosition = modelViewMatrix * vec4( morphed, 1.0 );
+	mvPosition = objectModelViewMatrix * vec4( morphed, 1.0 );
 
 #endif
 
 #if !defined( USE_SKINNING ) && ! defined( USE_MORPHTARGETS )
 
-	mvPosition = modelViewMatrix * vec4( position, 1.0 );
+	mvPosition = objectModelViewMatrix * vec4( position, 1.0 );
 
 #endif
 
@@ -18,6 +18,21 @@ vec3 objectNormal;
 
 #endif
 
+#ifdef USE_INSTANCING
+
+	// The cofactor matrix is the inverse transpose times the determinant,
+	// so it keeps normals right under non-uniform scale. The sign of the
+	// determinant is put back for mirroring matrices, the length doesn't
+	// matter as normals are normalized later.
+	mat3 instanceMatrix3 = mat3( instanceMatrix );
+	mat3 instanceNormalMatrix = mat3( cross( instanceMatrix3[ 1 ], instanceMatrix3[ 2 ] ),
+	                                  cross( instanceMatrix3[ 2 ], instanceMatrix3[ 0 ] ),
+	                                  cross( instanceMatrix3[ 0 ], instanceMatrix3[ 1 ] ) );
+
+	objectNormal = instanceNormalMatrix * objectNormal * sign( dot( instanceMatrix3[ 0 ], instanceNormalMatrix[ 0 ] ) );
+
+#endif
+
 #ifdef FLIP_SIDED
 
 	objectNormal = -objectNormal;
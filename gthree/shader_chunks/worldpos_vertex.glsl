@@ -1,20 +1,30 @@
 #if defined( USE_ENVMAP ) || defined( PHONG ) || defined( LAMBERT ) || defined ( USE_SHADOWMAP )
 
+	#ifdef USE_INSTANCING
+
+		mat4 objectModelMatrix = modelMatrix * instanceMatrix;
+
+	#else
+
+		mat4 objectModelMatrix = modelMatrix;
+
+	#endif
+
 	#ifdef USE_SKINNING
 
-		vec4 worldPosition = modelMatrix * skinned;
+		vec4 worldPosition = objectModelMatrix * skinned;
 
 	#endif
 
 	#if defined( USE_MORPHTARGETS ) && ! defined( USE_SKINNING )
 
-		vec4 worldPosition = modelMatrix * vec4( morphed, 1.0 );
+		vec4 worldPosition = objectModelMatrix * vec4( morphed, 1.0 );
 
 	#endif
 
 	#if ! defined( USE_MORPHTARGETS ) && ! defined( USE_SKINNING )
 
-		vec4 worldPosition = modelMatrix * vec4( position, 1.0 );
+		vec4 worldPosition = objectModelMatrix * vec4( position, 1.0 );
 
 	#endif
 
@@ -0,0 +1,25 @@
+uniform vec3 diffuse;
+uniform float opacity;
+#include "color_pars_fragment.glsl"
+#include "map_pars_fragment.glsl"
+#include "alphamap_pars_fragment.glsl"
+#include "lightmap_pars_fragment.glsl"
+#include "envmap_pars_fragment.glsl"
+#include "fog_pars_fragment.glsl"
+#include "shadowmap_pars_fragment.glsl"
+#include "specularmap_pars_fragment.glsl"
+#include "logdepthbuf_pars_fragment.glsl"
+void main() {
+	gl_FragColor = vec4( diffuse, opacity );
+#include "logdepthbuf_fragment.glsl"
+#include "map_fragment.glsl"
+#include "alphamap_fragment.glsl"
+#include "alphatest_fragment.glsl"
+#include "specularmap_fragment.glsl"
+#include "lightmap_fragment.glsl"
+#include "color_fragment.glsl"
+#include "envmap_fragment.glsl"
+#include "shadowmap_fragment.glsl"
+#include "linear_to_gamma_fragment.glsl"
+#include "fog_fragment.glsl"
+}
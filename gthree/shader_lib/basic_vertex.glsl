@@ -0,0 +1,26 @@
+#include "map_pars_vertex.glsl"
+#include "lightmap_pars_vertex.glsl"
+#include "envmap_pars_vertex.glsl"
+#include "color_pars_vertex.glsl"
+#include "morphtarget_pars_vertex.glsl"
+#include "skinning_pars_vertex.glsl"
+#include "shadowmap_pars_vertex.glsl"
+#include "logdepthbuf_pars_vertex.glsl"
+void main() {
+#include "map_vertex.glsl"
+#include "lightmap_vertex.glsl"
+#include "color_vertex.glsl"
+#include "skinbase_vertex.glsl"
+	#ifdef USE_ENVMAP
+#include "morphnormal_vertex.glsl"
+#include "skinnormal_vertex.glsl"
+#include "defaultnormal_vertex.glsl"
+	#endif
+#include "morphtarget_vertex.glsl"
+#include "skinning_vertex.glsl"
+#include "default_vertex.glsl"
+#include "logdepthbuf_vertex.glsl"
+#include "worldpos_vertex.glsl"
+#include "envmap_vertex.glsl"
+#include "shadowmap_vertex.glsl"
+}
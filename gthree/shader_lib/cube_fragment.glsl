@@ -0,0 +1,8 @@
+uniform samplerCube tCube;
+uniform float tFlip;
+varying vec3 vWorldPosition;
+#include "logdepthbuf_pars_fragment.glsl"
+void main() {
+	gl_FragColor = textureCube( tCube, vec3( tFlip * vWorldPosition.x, vWorldPosition.yz ) );
+#include "logdepthbuf_fragment.glsl"
+}
@@ -0,0 +1,8 @@
+varying vec3 vWorldPosition;
+#include "logdepthbuf_pars_vertex.glsl"
+void main() {
+	vec4 worldPosition = modelMatrix * vec4( position, 1.0 );
+	vWorldPosition = worldPosition.xyz;
+	gl_Position = projectionMatrix * modelViewMatrix * vec4( position, 1.0 );
+#include "logdepthbuf_vertex.glsl"
+}
@@ -0,0 +1,17 @@
+uniform vec3 diffuse;
+uniform float opacity;
+uniform float dashSize;
+uniform float totalSize;
+varying float vLineDistance;
+#include "color_pars_fragment.glsl"
+#include "fog_pars_fragment.glsl"
+#include "logdepthbuf_pars_fragment.glsl"
+void main() {
+	if ( mod( vLineDistance, totalSize ) > dashSize ) {
+		discard;
+	}
+	gl_FragColor = vec4( diffuse, opacity );
+#include "logdepthbuf_fragment.glsl"
+#include "color_fragment.glsl"
+#include "fog_fragment.glsl"
+}
@@ -0,0 +1,12 @@
+uniform float scale;
+attribute float lineDistance;
+varying float vLineDistance;
+#include "color_pars_vertex.glsl"
+#include "logdepthbuf_pars_vertex.glsl"
+void main() {
+#include "color_vertex.glsl"
+	vLineDistance = scale * lineDistance;
+	vec4 mvPosition = modelViewMatrix * vec4( position, 1.0 );
+	gl_Position = projectionMatrix * mvPosition;
+#include "logdepthbuf_vertex.glsl"
+}
@@ -0,0 +1,10 @@
+#include "morphtarget_pars_vertex.glsl"
+#include "skinning_pars_vertex.glsl"
+#include "logdepthbuf_pars_vertex.glsl"
+void main() {
+#include "skinbase_vertex.glsl"
+#include "morphtarget_vertex.glsl"
+#include "skinning_vertex.glsl"
+#include "default_vertex.glsl"
+#include "logdepthbuf_vertex.glsl"
+}
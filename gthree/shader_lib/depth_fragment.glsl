@@ -0,0 +1,14 @@
+uniform float mNear;
+uniform float mFar;
+uniform float opacity;
+#include "logdepthbuf_pars_fragment.glsl"
+void main() {
+#include "logdepthbuf_fragment.glsl"
+	#ifdef USE_LOGDEPTHBUF_EXT
+		float depth = gl_FragDepthEXT / gl_FragCoord.w;
+	#else
+		float depth = gl_FragCoord.z / gl_FragCoord.w;
+	#endif
+	float color = 1.0 - smoothstep( mNear, mFar, depth );
+	gl_FragColor = vec4( vec3( color ), opacity );
+}
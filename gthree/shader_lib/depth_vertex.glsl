@@ -0,0 +1,7 @@
+#include "morphtarget_pars_vertex.glsl"
+#include "logdepthbuf_pars_vertex.glsl"
+void main() {
+#include "morphtarget_vertex.glsl"
+#include "default_vertex.glsl"
+#include "logdepthbuf_vertex.glsl"
+}
@@ -0,0 +1,36 @@
+uniform float opacity;
+varying vec3 vLightFront;
+#ifdef DOUBLE_SIDED
+	varying vec3 vLightBack;
+#endif
+#include "color_pars_fragment.glsl"
+#include "map_pars_fragment.glsl"
+#include "alphamap_pars_fragment.glsl"
+#include "lightmap_pars_fragment.glsl"
+#include "envmap_pars_fragment.glsl"
+#include "fog_pars_fragment.glsl"
+#include "shadowmap_pars_fragment.glsl"
+#include "specularmap_pars_fragment.glsl"
+#include "logdepthbuf_pars_fragment.glsl"
+void main() {
+	gl_FragColor = vec4( vec3( 1.0 ), opacity );
+#include "logdepthbuf_fragment.glsl"
+#include "map_fragment.glsl"
+#include "alphamap_fragment.glsl"
+#include "alphatest_fragment.glsl"
+#include "specularmap_fragment.glsl"
+	#ifdef DOUBLE_SIDED
+		if ( gl_FrontFacing )
+			gl_FragColor.xyz *= vLightFront;
+		else
+			gl_FragColor.xyz *= vLightBack;
+	#else
+		gl_FragColor.xyz *= vLightFront;
+	#endif
+#include "lightmap_fragment.glsl"
+#include "color_fragment.glsl"
+#include "envmap_fragment.glsl"
+#include "shadowmap_fragment.glsl"
+#include "linear_to_gamma_fragment.glsl"
+#include "fog_fragment.glsl"
+}
@@ -0,0 +1,7 @@
+uniform float opacity;
+varying vec3 vNormal;
+#include "logdepthbuf_pars_fragment.glsl"
+void main() {
+	gl_FragColor = vec4( 0.5 * normalize( vNormal ) + 0.5, opacity );
+#include "logdepthbuf_fragment.glsl"
+}
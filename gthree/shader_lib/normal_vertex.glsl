@@ -0,0 +1,10 @@
+varying vec3 vNormal;
+#include "morphtarget_pars_vertex.glsl"
+#include "logdepthbuf_pars_vertex.glsl"
+void main() {
+#include "defaultnormal_vertex.glsl"
+	vNormal = normalize( transformedNormal );
+#include "morphtarget_vertex.glsl"
+#include "default_vertex.glsl"
+#include "logdepthbuf_vertex.glsl"
+}
@@ -0,0 +1,7 @@
+uniform mat4 projScreenMatrix;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+void main() {
+	gl_Position = projScreenMatrix * vec4( mix( boxMin, boxMax, position ), 1.0 );
+}
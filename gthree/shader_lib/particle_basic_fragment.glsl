@@ -0,0 +1,16 @@
+uniform vec3 psColor;
+uniform float opacity;
+#include "color_pars_fragment.glsl"
+#include "map_particle_pars_fragment.glsl"
+#include "fog_pars_fragment.glsl"
+#include "shadowmap_pars_fragment.glsl"
+#include "logdepthbuf_pars_fragment.glsl"
+void main() {
+	gl_FragColor = vec4( psColor, opacity );
+#include "logdepthbuf_fragment.glsl"
+#include "map_particle_fragment.glsl"
+#include "alphatest_fragment.glsl"
+#include "color_fragment.glsl"
+#include "shadowmap_fragment.glsl"
+#include "fog_fragment.glsl"
+}
@@ -0,0 +1,18 @@
+uniform float size;
+uniform float scale;
+#include "color_pars_vertex.glsl"
+#include "shadowmap_pars_vertex.glsl"
+#include "logdepthbuf_pars_vertex.glsl"
+void main() {
+#include "color_vertex.glsl"
+	vec4 mvPosition = modelViewMatrix * vec4( position, 1.0 );
+	#ifdef USE_SIZEATTENUATION
+		gl_PointSize = size * ( scale / length( mvPosition.xyz ) );
+	#else
+		gl_PointSize = size;
+	#endif
+	gl_Position = projectionMatrix * mvPosition;
+#include "logdepthbuf_vertex.glsl"
+#include "worldpos_vertex.glsl"
+#include "shadowmap_vertex.glsl"
+}
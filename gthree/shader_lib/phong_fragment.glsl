@@ -0,0 +1,33 @@
+uniform vec3 diffuse;
+uniform float opacity;
+uniform vec3 ambient;
+uniform vec3 emissive;
+uniform vec3 specular;
+uniform float shininess;
+#include "color_pars_fragment.glsl"
+#include "map_pars_fragment.glsl"
+#include "alphamap_pars_fragment.glsl"
+#include "lightmap_pars_fragment.glsl"
+#include "envmap_pars_fragment.glsl"
+#include "fog_pars_fragment.glsl"
+#include "lights_phong_pars_fragment.glsl"
+#include "shadowmap_pars_fragment.glsl"
+#include "bumpmap_pars_fragment.glsl"
+#include "normalmap_pars_fragment.glsl"
+#include "specularmap_pars_fragment.glsl"
+#include "logdepthbuf_pars_fragment.glsl"
+void main() {
+	gl_FragColor = vec4( vec3( 1.0 ), opacity );
+#include "logdepthbuf_fragment.glsl"
+#include "map_fragment.glsl"
+#include "alphamap_fragment.glsl"
+#include "alphatest_fragment.glsl"
+#include "specularmap_fragment.glsl"
+#include "lights_phong_fragment.glsl"
+#include "lightmap_fragment.glsl"
+#include "color_fragment.glsl"
+#include "envmap_fragment.glsl"
+#include "shadowmap_fragment.glsl"
+#include "linear_to_gamma_fragment.glsl"
+#include "fog_fragment.glsl"
+}
@@ -0,0 +1,31 @@
+#define PHONG
+varying vec3 vViewPosition;
+varying vec3 vNormal;
+#include "map_pars_vertex.glsl"
+#include "lightmap_pars_vertex.glsl"
+#include "envmap_pars_vertex.glsl"
+#include "lights_phong_pars_vertex.glsl"
+#include "color_pars_vertex.glsl"
+#include "morphtarget_pars_vertex.glsl"
+#include "skinning_pars_vertex.glsl"
+#include "shadowmap_pars_vertex.glsl"
+#include "logdepthbuf_pars_vertex.glsl"
+void main() {
+#include "map_vertex.glsl"
+#include "lightmap_vertex.glsl"
+#include "color_vertex.glsl"
+#include "morphnormal_vertex.glsl"
+#include "skinbase_vertex.glsl"
+#include "skinnormal_vertex.glsl"
+#include "defaultnormal_vertex.glsl"
+	vNormal = normalize( transformedNormal );
+#include "morphtarget_vertex.glsl"
+#include "skinning_vertex.glsl"
+#include "default_vertex.glsl"
+#include "logdepthbuf_vertex.glsl"
+	vViewPosition = -mvPosition.xyz;
+#include "worldpos_vertex.glsl"
+#include "envmap_vertex.glsl"
+#include "lights_phong_vertex.glsl"
+#include "shadowmap_vertex.glsl"
+}
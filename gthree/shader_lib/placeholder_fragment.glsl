@@ -0,0 +1,3 @@
+void main() {
+	gl_FragColor = vec4( 0.5, 0.5, 0.5, 1.0 );
+}
@@ -0,0 +1,3 @@
+void main() {
+#include "default_vertex.glsl"
+}